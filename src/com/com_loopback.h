@@ -26,17 +26,27 @@
 // \brief Loopback interface
 // This class implements a loopback interface on the lowest layer
 // Two stacks may be connected together for testing purpose
-// Incoming messages are 
+// Incoming messages are handed to the worker thread by a lock-free ring, the
+// worker delivers all pending messages to the counter loopback per wakeup.
+// If the loopback is constructed within a util::reactor::scope, messages are
+// delivered by the reactor thread instead of an own worker thread. Both
+// loopbacks of a pair should be bound to the same reactor then.
 //
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifndef _DECOM_COM_LOOPBACK_H_
 #define _DECOM_COM_LOOPBACK_H_
 
-#include <queue>
 #include <thread>
+#include <memory>
+#include <atomic>
 
 #include "../com.h"
+#include "../util/mpsc_ring.h"
+
+#if defined(DECOM_REACTOR)
+#include "../util/reactor.h"
+#endif
 
 /////////////////////////////////////////////////////////////////////
 
@@ -46,6 +56,9 @@ namespace com {
 
 class loopback : public communicator
 {
+  // defines the number of messages which can be queued for the counter loopback
+  static const std::size_t LOOPBACK_RING_SIZE = 256U;
+
 public:
 
   /**
@@ -57,6 +70,13 @@ public:
     , is_open_(false)
     , worker_end_(false)
   {
+#if defined(DECOM_REACTOR)
+    if (util::reactor::current()) {
+      // the reactor thread delivers the messages, the timer is bound to the reactor
+      deliver_timer_.reset(new util::timer());
+      return;
+    }
+#endif
     // create worker thread
     std::thread t(&worker, this);
     thread_.swap(t);
@@ -70,29 +90,35 @@ public:
   {
     is_open_    = false;
     worker_end_ = true;
-    data_ind_.notify_all();
-    thread_.join();
+    data_ev_.set();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
   }
 
 
   static void worker(void* arg)
   {
     loopback* l = static_cast<loopback*>(arg);
-    std::mutex m;
-
-    do {
-      std::unique_lock<std::mutex> lk(m);
-      l->data_ind_.wait(lk);
-
-      // send data
-      if (l->is_open_ && !l->send_queue_.empty()) {
-        l->mutex_.lock();
-        txdata_type data = l->send_queue_.front();
-        l->send_queue_.pop();
-        l->mutex_.unlock();
+
+    while (!l->worker_end_) {
+      l->data_ev_.wait();
+      // reset before draining, a message which is pushed meanwhile sets the event again
+      l->data_ev_.reset();
+      deliver(l);
+    }
+  }
+
+
+  // deliver all queued messages, worker or reactor thread
+  static void deliver(void* arg)
+  {
+    loopback* l = static_cast<loopback*>(arg);
+    l->send_ring_.drain([l](txdata_type& data) {
+      if (l->is_open_) {
         l->counter_loopback_->receive(data.data, data.id, data.more);
       }
-    } while (!l->worker_end_);
+    });
   }
 
 
@@ -137,13 +163,29 @@ public:
    */
   virtual bool send(msg& data, eid const& id = eid_any, bool more = false)
   {
-    communicator::indication(tx_done, id);
     // pass the data to the other stack / counter loopback part
     if (is_open_ && counter_loopback_) {
-      mutex_.lock();
-      send_queue_.push({ data, id, more });
-      mutex_.unlock();
-      data_ind_.notify_all();
+      // make a real copy, tx_done allows the sender to reuse data and the counter loopback may modify it
+      msg copy = data;
+      if (copy.size() != data.size()) {
+        // no free page, the sender retries
+        return false;
+      }
+      if (!send_ring_.push(copy, id, more)) {
+        // ring is full, the counter loopback doesn't keep up
+        return false;
+      }
+      communicator::indication(tx_done, id);
+#if defined(DECOM_REACTOR)
+      if (deliver_timer_) {
+        // deliver in the next reactor loop
+        if (!deliver_timer_->is_running()) {
+          deliver_timer_->start(std::chrono::microseconds(0), false, &loopback::deliver, this);
+        }
+        return true;
+      }
+#endif
+      data_ev_.set();
       return true;
     }
     return false;
@@ -162,20 +204,27 @@ public:
 
 private:
   bool is_open_;                      // true if open
-  std::condition_variable data_ind_;  // data indication
+  util::event data_ev_;               // data indication
   std::thread thread_;                // worker thread
-  volatile bool worker_end_;          // terminate thread
-  std::mutex mutex_;                  // queue lock
+  std::atomic<bool> worker_end_;     // terminate thread
 
   typedef struct struct_txdata_type {
+    struct_txdata_type(const msg& m, eid const& i, bool mo)
+      : id(i)
+      , more(mo)
+    { data.ref_copy(m); }   // takes the pages of the copy made by send()
     msg  data;
     eid  id;
     bool more;
   } txdata_type;
 
-  std::queue<txdata_type> send_queue_;  // send queue
+  util::mpsc_ring<txdata_type, LOOPBACK_RING_SIZE> send_ring_;  // send queue
 
   loopback* counter_loopback_;          // pointer to the counter loopback part
+
+#if defined(DECOM_REACTOR)
+  std::unique_ptr<util::timer> deliver_timer_;  // reactor mode: delivers the queued messages
+#endif
 };
 
 } // namespace com
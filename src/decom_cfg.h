@@ -100,11 +100,36 @@
 // depends on the used protocols, a good start is a quarter of the page
 #define DECOM_MSG_POOL_PAGE_BEGIN   (DECOM_MSG_POOL_PAGE_SIZE / 4U)
 
+// defines the number of free pages each thread keeps in its own page cache (magazine)
+// pages are fetched from and returned to the pool in batches of half the magazine size
+// cached pages are not available for other threads, so keep this small against POOL_PAGES
+// 0 disables the thread cache
+#define DECOM_MSG_POOL_MAGAZINE_SIZE  16U
+
+// optional page classes beside the default page class above
+// a msg picks its class by the size given to its ctor or by a pool hint, see msg::get_msg_pool()
+// each class has its own page limit and statistics, 0 pages disables the class
+// small pages, e.g. for CAN frames
+#define DECOM_MSG_POOL_SMALL_PAGE_SIZE  64U
+#define DECOM_MSG_POOL_SMALL_PAGES      128U
+// large pages, e.g. for TCP segments
+#define DECOM_MSG_POOL_LARGE_PAGE_SIZE  4096U
+#define DECOM_MSG_POOL_LARGE_PAGES      16U
+
+
+//////////////////////////////////////////////////////////////////////////
+// R E A C T O R
+
+// define this to enable the reactor runtime (util/reactor.h, currently linux only)
+// layers and timers which are constructed within a util::reactor::scope are driven
+// by the reactor thread instead of own threads, see util/reactor.h
+// #define DECOM_REACTOR
+
 
 //////////////////////////////////////////////////////////////////////////
 // S T A T I S T I C S
 
-// define this to turn on layer statistics (mostly for debugging purpose)
+// define this to turn on layer and msg pool statistics (mostly for debugging purpose)
 #define DECOM_STATS
 
 // disable for MS release
@@ -28,6 +28,8 @@
 // This class is used to send and receive files to and from the stack
 // If the file is too big to be send in one message (which is mostly the case)
 // segmentation can be used
+// If the device is constructed within a util::reactor::scope, the next segment
+// is sent by the reactor thread instead of an own worker thread.
 //
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -41,6 +43,11 @@
 
 #include "../dev.h"
 
+#if defined(DECOM_REACTOR)
+#include <memory>
+#include "../util/reactor.h"
+#endif
+
 /////////////////////////////////////////////////////////////////////
 
 namespace decom {
@@ -65,6 +72,12 @@ public:
     tx_err_      = false;
     rx_ignore_more_ = false;
     worker_end_  = false;
+#if defined(DECOM_REACTOR)
+    if (util::reactor::current()) {
+      // the reactor thread sends the segments, the timer is bound to the reactor
+      segment_timer_.reset(new util::timer());
+    }
+#endif
   }
 
 
@@ -90,6 +103,12 @@ public:
     bool result = device::open(address, id);
     tx_eid_ = id;
 
+#if defined(DECOM_REACTOR)
+    if (segment_timer_) {
+      // no worker thread in reactor mode
+      return result;
+    }
+#endif
     // start write worker thread
     worker_end_ = false;
     std::thread t(worker, this);
@@ -115,7 +134,14 @@ public:
     // stop worker thread
     worker_end_ = true;
     tx_ev_.set();
-    thread_.join();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+#if defined(DECOM_REACTOR)
+    if (segment_timer_) {
+      segment_timer_->stop();
+    }
+#endif
 
     // Close the lower layer after closing THIS layer - closing is done TOP-DOWN
     // in layer stack
@@ -152,6 +178,13 @@ public:
   {
     if (tx_file_.is_open() && code == tx_done) {
       // message sent, process next segment
+#if defined(DECOM_REACTOR)
+      if (segment_timer_) {
+        // send it in the next reactor loop, not within the indication
+        segment_timer_->start(std::chrono::microseconds(0), false, &file::next_segment, this);
+        return;
+      }
+#endif
       tx_ev_.set();
     }
     else {
@@ -177,6 +210,18 @@ public:
   }
 
 
+#if defined(DECOM_REACTOR)
+  // reactor mode: send the next segment
+  static void next_segment(void* arg)
+  {
+    file* f = static_cast<file*>(arg);
+    if (f->tx_file_.is_open()) {
+      f->send_segment();
+    }
+  }
+#endif
+
+
   ////////////////////////////////////////////////////////////////////////
   // D E V I C E   A P I
 
@@ -318,6 +363,9 @@ private:
   std::streamoff  tx_filesent_;     // size of transmit file sent
   bool            tx_lineend_;      // use line ending to segment messages
   bool            tx_err_;          // transmission error on lower layer
+#if defined(DECOM_REACTOR)
+  std::unique_ptr<util::timer> segment_timer_;  // reactor mode: sends the next segment
+#endif
 };
 
 } // namespace dev
@@ -30,6 +30,15 @@
 // Basically it receives messages and stores them in a receive buffer which
 // can be read via read() function with timeout param.
 // Bytes and strings can be send as messages via the write() function.
+// write() blocks until the lower layer indicated the transmission by default.
+// For high latency links set_tx_window() allows several outstanding messages,
+// which are sent by write_async(). Each message gets a completion token and an
+// optional callback, flush() waits until all outstanding messages are done.
+// The tx indications of the lower layer are assigned to the outstanding messages
+// in send order. The lower layer is called without holding the window lock, with
+// several writer threads the send order is the order of the token reservation.
+// On close() or a disconnected indication the outstanding messages are completed
+// with tx_error, so no callback or flush() waits for an indication which won't come.
 //
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -49,8 +58,15 @@ namespace dev {
 
 class generic : public device
 {
+  // defines the maximum number of outstanding messages, see set_tx_window()
+  static const std::size_t GENERIC_TX_WINDOW_MAX = 32U;
+
   bool receive_last_more_;
 
+public:
+  // completion callback of write_async(), status is tx_done or an error code
+  typedef void (*tx_callback_type)(void* arg, std::uint64_t token, status_type status);
+
 protected:
   bool          is_open_;       // true if device is open
   bool          is_connected_;  // true if device is connected
@@ -61,10 +77,23 @@ protected:
   bool          rx_more_;       // last more flag
   std::mutex    rx_mutex_;      // receive buffer mutex
   util::event   rx_ev_;         // receive event
-  util::event   tx_ev_;         // transmit event
+  util::event   tx_ev_;         // transmit event, set if no message is outstanding
   util::event   con_ev_;        // connection event
   status_type   tx_status_;     // actual tx status
 
+  typedef struct tag_tx_pending_type {
+    tx_callback_type  callback;
+    void*             arg;
+    bool              rejected;   // the lower layer didn't accept the msg, no indication follows
+  } tx_pending_type;
+
+  tx_pending_type       tx_pending_[GENERIC_TX_WINDOW_MAX];   // outstanding messages, indexed by token
+  std::size_t           tx_window_;     // maximum number of outstanding messages
+  std::uint64_t         tx_sent_;       // token of the last sent message
+  std::uint64_t         tx_done_;       // token of the last completed message
+  bool                  tx_failed_;     // a message failed since the last flush()
+  std::mutex            tx_mutex_;      // guards the window, not held while the lower layer is called
+
   void (*callback_)(void* arg, msg& data, eid const& id);   // receive callback function
   void*         callback_arg_;  // callback arg
 
@@ -76,6 +105,10 @@ public:
     , is_open_(false)
     , is_connected_(false)
     , tx_status_(disconnected)
+    , tx_window_(1U)
+    , tx_sent_(0U)
+    , tx_done_(0U)
+    , tx_failed_(false)
     , callback_(nullptr)
     , callback_arg_(nullptr)
     , receive_last_more_(false)
@@ -120,6 +153,9 @@ public:
   {
     is_open_ = false;
     device::close(id);
+
+    // the lower layer may have indicated the outstanding messages while closing, abort the rest
+    tx_abort();
   }
 
 
@@ -162,6 +198,44 @@ public:
   }
 
 
+  /**
+   * Receive function for a batch of complete messages from lower layer
+   * The callback is called for every message, the receive buffer holds the last one.
+   * Without a callback the messages are received one by one, like unbatched messages.
+   * \param data Array of messages to receive
+   * \param count Number of messages
+   * \param id The endpoint identifier
+   */
+  virtual void receive_batch(msg* data, std::size_t count, eid const& id = eid_any)
+  {
+    if (!is_open_ || !count) {
+      // layer is closed
+      return;
+    }
+
+    if (id != eid_ && !id.is_any()) {
+      // msg not for us, ignore it
+      return;
+    }
+
+    if (receive_last_more_ || !callback_) {
+      // a fragmented msg is pending or the messages are only read(), receive them one by one
+      device::receive_batch(data, count, id);
+      return;
+    }
+
+    // the buffer lock isn't held by the callback, so it may call read()
+    for (std::size_t i = 0U; i < count; ++i) {
+      callback_(callback_arg_, data[i], id);
+    }
+
+    // acquire buffer lock once for the whole batch
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+    rx_msg_.ref_copy(data[count - 1U]);
+    rx_ev_.set();   // trigger receive event
+  }
+
+
   /**
    * Status/Error indication from lower layer
    * \param code The status code which occurred on lower layer
@@ -182,13 +256,13 @@ public:
     case disconnected:
       is_connected_ = false;
       con_ev_.reset();
+      tx_abort();
       break;
     case tx_done:
     case tx_error:
     case tx_timeout:
     case tx_overrun:
-      tx_status_ = code;
-      tx_ev_.set();
+      tx_complete(code);
       break;
     default:
       break;
@@ -213,44 +287,119 @@ public:
   { return is_open_; }
 
 
+  /**
+   * Set the number of messages which may be outstanding (sent but not indicated by the lower layer)
+   * Default is 1, so a write fails while the previous message is in progress.
+   * \param window Number of outstanding messages, 1 to GENERIC_TX_WINDOW_MAX
+   */
+  void set_tx_window(std::size_t window)
+  {
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    tx_window_ = window < 1U ? 1U : (window > GENERIC_TX_WINDOW_MAX ? static_cast<std::size_t>(GENERIC_TX_WINDOW_MAX) : window);
+  }
+
+
   /**
    * Zero copy write (msg buffer is passed by reference)
    * \param data Data written to device
    * \param id The endpoint identifier
-   * \param blocking if true write() blocks until data is send or an error/timeout happened
+   * \param blocking if true write() blocks until data and all outstanding messages are sent or an error/timeout happened
    * \return true if write was successful
    */
   bool write(msg& data, eid const& id = eid_any, bool more = false, bool blocking = true)
+  {
+    if (!write_async(data, nullptr, nullptr, id, more)) {
+      return false;
+    }
+    // return without waiting for tx done, or when the tx indication(s) are received
+    return !blocking || flush();
+  }
+
+
+  /**
+   * Non blocking zero copy write, the message is sent if the tx window isn't full
+   * \param data Data written to device
+   * \param callback Optional callback, called with the token and tx status when the lower layer indicated the transmission
+   * \param arg Callback argument
+   * \param id The endpoint identifier
+   * \param more true if message is a fragment which is followed by another msg
+   * \return Completion token of the message, 0 if the message was not sent
+   */
+  std::uint64_t write_async(msg& data, tx_callback_type callback = nullptr, void* arg = nullptr, eid const& id = eid_any, bool more = false)
   {
     // checks
     if (!is_open_) {
       DECOM_LOG_ERROR("Device is not opened, sending not possible");
-      return false;
+      return 0U;
     }
     if (!is_connected_) {
       DECOM_LOG_ERROR("Device is not connected, sending not possible");
-      return false;
+      return 0U;
     }
 
-    if (!tx_ev_.get()) {
-      // sending is still in progress
-      DECOM_LOG_ERROR("Transmission in progress, sending not possible");
-      return false;
+    std::unique_lock<std::mutex> lock(tx_mutex_);
+    if (tx_sent_ - tx_done_ >= tx_window_) {
+      // window is full, the caller retries after a completion
+      DECOM_LOG_DEBUG("Tx window full, sending not possible");
+      return 0U;
     }
 
-    tx_ev_.reset();                         // clear indication
-    if (!blocking) {
-      // return without waiting for tx done
-      return device::send(data, id, more);  // send data to lower layer
-    }
-    else {
-      if (device::send(data, id, more)) {   // send data to lower layer
-        tx_ev_.wait();                      // wait for notification
-        // return when tx indication received
-        return tx_status_ == tx_done;
+    // reserve the token before sending, the lower layer may indicate within send()
+    const std::uint64_t token = ++tx_sent_;
+    tx_pending_[token % GENERIC_TX_WINDOW_MAX].callback = callback;
+    tx_pending_[token % GENERIC_TX_WINDOW_MAX].arg      = arg;
+    tx_pending_[token % GENERIC_TX_WINDOW_MAX].rejected = false;
+    tx_ev_.reset();
+    lock.unlock();    // a lower layer may indicate out of another thread while it holds its own lock
+
+    if (!device::send(data, id, more)) {    // send data to lower layer
+      lock.lock();
+      if (tx_done_ < token) {
+        // nothing is indicated for a rejected msg, release the token
+        tx_pending_[token % GENERIC_TX_WINDOW_MAX].rejected = true;
+        while ((tx_sent_ > tx_done_) && tx_pending_[tx_sent_ % GENERIC_TX_WINDOW_MAX].rejected) {
+          --tx_sent_;
+        }
+        tx_skip_rejected();
       }
+      return 0U;
+    }
+    return token;
+  }
+
+
+  /**
+   * Wait until all outstanding messages are indicated by the lower layer
+   * \return true if all messages since the last flush() were sent successfully
+   */
+  bool flush()
+  {
+    tx_ev_.wait();    // spins shortly before the thread is parked
+    return tx_result();
+  }
+
+
+  /**
+   * Wait until all outstanding messages are indicated by the lower layer
+   * \param timeout Time to wait
+   * \return true if all messages since the last flush() were sent successfully, false in case of error or timeout
+   */
+  bool flush(std::chrono::milliseconds timeout)
+  {
+    if (tx_ev_.wait_for(timeout) == std::cv_status::timeout) {
       return false;
     }
+    return tx_result();
+  }
+
+
+  /**
+   * Returns the number of outstanding messages
+   */
+  std::size_t tx_pending()
+  {
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    return static_cast<std::size_t>(tx_sent_ - tx_done_);
   }
 
 
@@ -363,6 +512,80 @@ public:
     callback_     = callback;
     callback_arg_ = arg;
   }
+
+
+private:
+
+  // complete the oldest outstanding message
+  void tx_complete(status_type code)
+  {
+    std::unique_lock<std::mutex> lock(tx_mutex_);
+    tx_status_ = code;
+    if (tx_done_ == tx_sent_) {
+      // no message outstanding
+      DECOM_LOG_DEBUG("Unexpected tx indication");
+      return;
+    }
+    const std::uint64_t token = ++tx_done_;
+    const tx_pending_type pending = tx_pending_[token % GENERIC_TX_WINDOW_MAX];
+    tx_failed_ = tx_failed_ || (code != tx_done);
+    tx_skip_rejected();
+    lock.unlock();
+
+    if (pending.callback) {
+      pending.callback(pending.arg, token, code);
+    }
+  }
+
+
+  // complete all outstanding messages with tx_error, the lower layer doesn't indicate them anymore
+  void tx_abort()
+  {
+    tx_pending_type pending[GENERIC_TX_WINDOW_MAX];
+    std::uint64_t   first;
+    std::size_t     count = 0U;
+    {
+      std::lock_guard<std::mutex> lock(tx_mutex_);
+      first = tx_done_ + 1U;
+      for (; tx_done_ < tx_sent_; ++count) {
+        pending[count] = tx_pending_[++tx_done_ % GENERIC_TX_WINDOW_MAX];
+      }
+      if (count) {
+        tx_status_ = tx_error;
+        tx_failed_ = true;
+      }
+      tx_ev_.set();
+    }
+
+    // rejected messages got no token, so they have no callback
+    for (std::size_t n = 0U; n < count; ++n) {
+      if (pending[n].callback && !pending[n].rejected) {
+        pending[n].callback(pending[n].arg, first + n, tx_error);
+      }
+    }
+  }
+
+
+  // complete the rejected messages at the front of the window, tx_mutex_ must be held
+  void tx_skip_rejected()
+  {
+    while ((tx_done_ < tx_sent_) && tx_pending_[(tx_done_ + 1U) % GENERIC_TX_WINDOW_MAX].rejected) {
+      ++tx_done_;
+    }
+    if (tx_done_ == tx_sent_) {
+      tx_ev_.set();
+    }
+  }
+
+
+  // result of the messages since the last call
+  bool tx_result()
+  {
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    const bool result = !tx_failed_;
+    tx_failed_ = false;
+    return result;
+  }
 };
 
 } // namespace dev
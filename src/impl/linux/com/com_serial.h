@@ -0,0 +1,690 @@
+///////////////////////////////////////////////////////////////////////////////
+// \author (c) Marco Paland (info@paland.com)
+//             2011-2021, PALANDesign Hannover, Germany
+//
+// \license The MIT License (MIT)
+//
+// This file is part of the decom library.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// \brief Serial port communication class
+//
+// This class abstracts a Linux tty serial port.
+// All kind of serial ports (RS232, USB, virtual etc.) are supported.
+// termios2 is used, so any baudrate the driver supports can be set.
+// A receive thread waits for data via epoll, the bytes are read directly
+// into msg pages. A transmit thread writes the msg pages and indicates
+// tx_done when the data is physically sent (tcdrain).
+//
+// The VMIN/VTIME settings of the tty define how received bytes are batched:
+// VMIN > 0, VTIME = 0: data is passed up when at least VMIN bytes arrived
+// VMIN > 0, VTIME > 0: data is passed up when VMIN bytes arrived or the line
+//                      is idle for VTIME * 100 ms after a byte
+// VMIN = 0:            data is passed up as soon as it's available (default)
+// The port is used non-blocking, so the threads never block in read/write and
+// can always be terminated. The tty poll honors VMIN, the VTIME idle timeout
+// is done by the receive thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _DECOM_COM_SERIAL_H_
+#define _DECOM_COM_SERIAL_H_
+
+// termios2 - don't include <termios.h>, it conflicts with the kernel definitions
+#include <asm/termbits.h>
+#include <asm/ioctls.h>
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#include "../../../com.h"
+
+/////////////////////////////////////////////////////////////////////
+
+// defines the maximum number of bytes which are read at once
+#ifndef DECOM_COM_SERIAL_RX_BUFSIZE
+#define DECOM_COM_SERIAL_RX_BUFSIZE   32768U
+#endif
+
+/////////////////////////////////////////////////////////////////////
+
+
+namespace decom {
+namespace com {
+
+
+class serial : public communicator
+{
+  // defines the number of msg segments which are read/written per readv()/writev() call
+  static const std::size_t COM_SERIAL_IOV_MAX = 64U;
+
+  // defines the time the receive thread waits for free msg pages before it checks for termination
+  static const std::size_t COM_SERIAL_POOL_WAIT_MS = 100U;
+
+public:
+  // params
+  typedef enum tag_stopbit_type {
+    stopbit_0 = 0,              // 0   stopbits (uncommon)
+    stopbit_05,                 // 0.5 stopbits
+    stopbit_1,                  // 1   stopbit
+    stopbit_15,                 // 1.5 stopbits
+    stopbit_2                   // 2   stopbits
+  } stopbit_type;
+
+  typedef enum tag_parity_type {
+    parity_none = 0,            // no parity
+    parity_odd,                 // odd parity bit
+    parity_even,                // even parity bit
+    parity_mark,                // mark parity bit
+    parity_space                // space parity bit
+  } parity_type;
+
+  typedef enum tag_flowctrl_type {
+    flowctrl_none = 0,          // no flow control
+    flowctrl_rts_cts,           // RTS/CTS flow control
+    flowctrl_dtr_dsr,           // DTR/DSR flow control
+    flowctrl_xon_xoff           // XON/XOFF flow control
+  } flowctrl_type;
+
+
+public:
+  /**
+   * Param ctor, sets the default port parameters
+   * \param baudrate The baudrate given in [baud]
+   * \param databits Number of databits, normally and default is 8
+   * \param parity Parity, see defines
+   * \param stopbits Number of stopbits, see defines
+   * \param handshake Handshake options, see defines
+   * \param name Layer name
+   */
+  serial(std::uint32_t baudrate,
+         std::uint8_t  databits  = 8U,
+         parity_type   parity    = parity_none,
+         stopbit_type  stopbits  = stopbit_1,
+         flowctrl_type handshake = flowctrl_none,
+         const char* name        = "com_serial"
+        )
+    : communicator(name)   // it's VERY IMPORTANT to call the base class ctor HERE!!!
+    , baudrate_(baudrate)
+    , databits_(databits)
+    , parity_(parity)
+    , stopbits_(stopbits)
+    , handshake_(handshake)
+    , vmin_(0U)
+    , vtime_(0U)
+    , low_latency_(true)
+    , fd_(-1)
+    , epoll_(-1)
+    , terminate_event_(-1)
+    , rx_thread_(nullptr)
+    , tx_thread_(nullptr)
+    , running_(false)
+    , tx_busy_(false)
+  { }
+
+
+  /**
+   * default dtor
+   */
+  ~serial()
+  {
+    close();
+  }
+
+
+  /**
+   * Called by upper layer to open this layer
+   * \param address The port to open, like '/dev/ttyUSB0' or 'ttyS0'
+   * \param id Unused
+   * \return true if open is successful
+   */
+  virtual bool open(const char* address = "", eid const& id = eid_any)
+  {
+    (void)id;   // unused
+
+    // check that upper protocol/device exists
+    if (!upper_) {
+      return false;
+    }
+
+    // assemble port address
+    if (!address || !(*address)) {
+      // invalid address
+      return false;
+    }
+    std::string port(address);
+    if (port.find('/') == std::string::npos) {
+      port.insert(0U, "/dev/");     // extend to complete port address (like '/dev/ttyS0')
+    }
+
+    close();                        // just in case layer was already open
+
+    // open the port non-blocking, so that close() never hangs in a pending read/write
+    fd_ = ::open(port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) {
+      DECOM_LOG_ERROR("Error opening port " << port.c_str() << ", error " << errno);
+      return false;
+    }
+
+    // exclusive access
+    if (::ioctl(fd_, TIOCEXCL)) {
+      DECOM_LOG_WARN("Port can't be set to exclusive mode");
+    }
+
+    DECOM_LOG_INFO("Opened serial port ") << port.c_str();
+
+    // set params
+    if (!set_param(baudrate_, databits_, parity_, stopbits_, handshake_)) {
+      // error in set params
+      DECOM_LOG_ERROR("Error setting params");
+      close();
+      return false;
+    }
+
+    // low latency mode, not supported by all drivers (e.g. pseudo terminals)
+    if (!set_low_latency(low_latency_)) {
+      DECOM_LOG_INFO("Low latency mode not supported by the port");
+    }
+
+    (void)purge();
+
+    ///////////////////// create receive/transmit thread ////////////////////////////
+
+    epoll_           = ::epoll_create1(EPOLL_CLOEXEC);
+    terminate_event_ = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = { };
+    ev.events  = EPOLLIN;
+    ev.data.fd = terminate_event_;
+    bool res = (epoll_ >= 0) && (terminate_event_ >= 0) && !::epoll_ctl(epoll_, EPOLL_CTL_ADD, terminate_event_, &ev);
+    ev.data.fd = fd_;
+    res = res && !::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd_, &ev);
+    if (!res) {
+      // error to create events - close all
+      DECOM_LOG_ERROR("Error creating events");
+      close();
+      return false;
+    }
+
+    running_   = true;
+    tx_busy_   = false;
+    rx_thread_ = new std::thread(&serial::rx_thread, this);
+    tx_thread_ = new std::thread(&serial::tx_thread, this);
+
+    // send port open indication
+    communicator::indication(connected);
+
+    return true;
+  }
+
+
+  /**
+   * Called by upper layer to close this layer
+   * \param id Unused
+   */
+  virtual void close(eid const& id = eid_any)
+  {
+    (void)id;   // unused
+
+    // stop the receive and transmit thread
+    if (rx_thread_) {
+      {
+        std::lock_guard<std::mutex> lock(tx_mutex_);
+        running_ = false;
+      }
+      tx_cv_.notify_one();
+      const std::uint64_t one = 1U;
+      if (::write(terminate_event_, &one, sizeof(one)) != sizeof(one)) {
+        DECOM_LOG_ERROR("Triggering terminate event failed");
+      }
+      // discard pending output, so that a blocked transmission returns
+      (void)::ioctl(fd_, TCFLSH, TCOFLUSH);
+      rx_thread_->join();
+      tx_thread_->join();
+      delete rx_thread_;
+      delete tx_thread_;
+      rx_thread_ = nullptr;
+      tx_thread_ = nullptr;
+      tx_msg_.clear();
+    }
+    if (terminate_event_ >= 0) {
+      (void)::close(terminate_event_);
+      terminate_event_ = -1;
+    }
+    if (epoll_ >= 0) {
+      (void)::close(epoll_);
+      epoll_ = -1;
+    }
+
+    // close the port
+    if (is_open()) {
+      (void)purge();
+      // final close
+      (void)::close(fd_);
+      fd_ = -1;
+
+      DECOM_LOG_INFO("Closed serial port");
+
+      // port closed indication
+      communicator::indication(disconnected);
+    }
+  }
+
+
+  /**
+   * Called by upper layer to send data to the port
+   * \param data The message to send
+   * \param id The endpoint identifier, unused here
+   * \param more unused
+   * \return true if Send is successful
+   */
+  virtual bool send(msg& data, eid const& id = eid_any, bool more = false)
+  {
+    (void)id; (void)more;   // unused
+
+    // validate port
+    if (!is_open()) {
+      DECOM_LOG_ERROR("Sending failed: port is not open");
+      return false;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(tx_mutex_);
+
+      // return false if a transfer is in progress, means no new data can be accepted
+      // this is mostly the case when the upper layer didn't wait for tx_done indication
+      if (tx_busy_) {
+        DECOM_LOG_WARN("Transmission already in progress, data not accepted");
+        return false;
+      }
+
+      // the pages are written directly, no linear copy is needed
+      tx_msg_.ref_copy(data);
+      tx_busy_ = true;
+    }
+    tx_cv_.notify_one();
+
+    // sending in progress now, indication is handled in transmit thread
+    return true;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////
+  // L A Y E R   A P I
+
+public:
+
+  /**
+   * Set communication parameter
+   * \param baudrate The baudrate given in [baud], any rate the driver supports
+   * \param databits Number of databits, normally 8
+   * \param parity Parity, see defines
+   * \param stopbits Number of stopbits, see defines, 1.5 stopbits are only available with 5 databits
+   * \param handshake Handshake protocol, see defines, DTR/DSR isn't supported by Linux
+   * \return true if successful
+   */
+  bool set_param(std::uint32_t baudrate,
+                 std::uint8_t  databits  = 8U,
+                 parity_type   parity    = parity_none,
+                 stopbit_type  stopbits  = stopbit_1,
+                 flowctrl_type handshake = flowctrl_none)
+  {
+    baudrate_  = baudrate;
+    databits_  = databits;
+    parity_    = parity;
+    stopbits_  = stopbits;
+    handshake_ = handshake;
+
+    // validate port
+    if (!is_open()) {
+      return false;
+    }
+
+    struct termios2 tio;
+    if (::ioctl(fd_, TCGETS2, &tio)) {
+      return false;
+    }
+
+    // raw mode
+    tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY | INPCK);
+    tio.c_oflag &= ~OPOST;
+    tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tio.c_cflag &= ~(CBAUD | CSIZE | CSTOPB | PARENB | PARODD | CMSPAR | CRTSCTS);
+    tio.c_cflag |= CREAD | CLOCAL;
+
+    // baudrate
+    tio.c_cflag  |= BOTHER;
+    tio.c_ispeed  = baudrate;
+    tio.c_ospeed  = baudrate;
+
+    // databits
+    switch (databits) {
+      case 5U : tio.c_cflag |= CS5; break;
+      case 6U : tio.c_cflag |= CS6; break;
+      case 7U : tio.c_cflag |= CS7; break;
+      case 8U : tio.c_cflag |= CS8; break;
+      default :
+        DECOM_LOG_ERROR("Unsupported number of databits");
+        return false;
+    }
+
+    // parity
+    switch (parity) {
+      case parity_none  : break;
+      case parity_odd   : tio.c_cflag |= PARENB | PARODD; break;
+      case parity_even  : tio.c_cflag |= PARENB; break;
+      case parity_mark  : tio.c_cflag |= PARENB | CMSPAR | PARODD; break;
+      case parity_space : tio.c_cflag |= PARENB | CMSPAR; break;
+    }
+    if (parity != parity_none) {
+      tio.c_iflag |= INPCK;
+    }
+
+    // stopbits, CSTOPB is 1.5 stopbits with 5 databits
+    switch (stopbits) {
+      case stopbit_1  : break;
+      case stopbit_15 :
+        if (databits != 5U) {
+          DECOM_LOG_ERROR("1.5 stopbits need 5 databits");
+          return false;
+        }
+        tio.c_cflag |= CSTOPB;
+        break;
+      case stopbit_2  : tio.c_cflag |= CSTOPB; break;
+      default :
+        DECOM_LOG_ERROR("Unsupported number of stopbits");
+        return false;
+    }
+
+    // handshake
+    switch (handshake) {
+      case flowctrl_none     : break;
+      case flowctrl_rts_cts  : tio.c_cflag |= CRTSCTS; break;
+      case flowctrl_xon_xoff : tio.c_iflag |= IXON | IXOFF; break;
+      default :
+        DECOM_LOG_ERROR("Unsupported handshake");
+        return false;
+    }
+
+    // receive batching
+    tio.c_cc[VMIN]  = vmin_;
+    tio.c_cc[VTIME] = vtime_;
+
+    // apply settings
+    return ::ioctl(fd_, TCSETS2, &tio) == 0;
+  }
+
+
+  /**
+   * Set the receive batching, see VMIN/VTIME description above
+   * \param vmin Minimum number of bytes which are passed up at once
+   * \param vtime Inter byte timeout in [100 ms], 0 to wait for vmin bytes
+   * \return true if successful or if the port is not open yet (applied on open)
+   */
+  bool set_rx_batching(std::uint8_t vmin, std::uint8_t vtime)
+  {
+    vmin_  = vmin;
+    vtime_ = vtime;
+    return !is_open() || set_param(baudrate_, databits_, parity_, stopbits_, handshake_);
+  }
+
+
+  /**
+   * Set the low latency mode of the driver (ASYNC_LOW_LATENCY), default is on
+   * The driver passes received data immediately then, instead of buffering it for some ms
+   * \param enable true to enable the low latency mode
+   * \return true if successful or if the port is not open yet (applied on open)
+   */
+  bool set_low_latency(bool enable)
+  {
+    low_latency_ = enable;
+
+    // validate port
+    if (!is_open()) {
+      return true;
+    }
+
+    struct serial_struct ser;
+    if (::ioctl(fd_, TIOCGSERIAL, &ser)) {
+      return false;
+    }
+    ser.flags = enable ? (ser.flags | ASYNC_LOW_LATENCY) : (ser.flags & ~ASYNC_LOW_LATENCY);
+    return ::ioctl(fd_, TIOCSSERIAL, &ser) == 0;
+  }
+
+
+  /**
+   * Flush all buffers, means all data in buffers is send to hardware
+   * \return true if successful
+   */
+  bool flush(void)
+  {
+    // validate port
+    if (!is_open()) {
+      return false;
+    }
+
+    DECOM_LOG_INFO("Flushing COM port");
+
+    return ::ioctl(fd_, TCSBRK, 1) == 0;   // tcdrain()
+  }
+
+
+  /**
+   * Purge all buffers
+   * \param rx Clears the receive buffer (if the device has one)
+   * \param tx Clears the transmit buffer (if the device has one)
+   * \return true if successful
+   */
+  bool purge(bool rx = true, bool tx = true)
+  {
+    // validate port
+    if (!is_open() || (!rx && !tx)) {
+      return false;
+    }
+
+    DECOM_LOG_INFO("Purging COM port");
+
+    return ::ioctl(fd_, TCFLSH, rx ? (tx ? TCIOFLUSH : TCIFLUSH) : TCOFLUSH) == 0;
+  }
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+private:
+  /**
+   * Check if the port is open
+   * \return true if the COM port is open
+   */
+  inline bool is_open() const
+  { return fd_ >= 0; }
+
+
+  /**
+   * Get the number of received bytes in the tty buffer
+   * \return Number of available bytes, 0 if none or on error
+   */
+  inline std::size_t rx_available() const
+  {
+    int available = 0;
+    return (::ioctl(fd_, FIONREAD, &available) || (available <= 0)) ? 0U : static_cast<std::size_t>(available);
+  }
+
+
+  // receive thread
+  static void rx_thread(void* arg)
+  {
+    serial* s = static_cast<serial*>(arg);
+    msg_pool& pool = msg::get_msg_pool();
+    const std::chrono::milliseconds timeout(static_cast<std::chrono::milliseconds::rep>(COM_SERIAL_POOL_WAIT_MS));
+
+    // validate port - MUST be open and active
+    DECOM_LOG_VERIFY(s->is_open());
+
+    while (s->running_) {
+      struct epoll_event ev;
+      const int count = ::epoll_wait(s->epoll_, &ev, 1, -1);
+      if ((count <= 0) || (ev.data.fd != s->fd_)) {
+        // interrupted or terminate event
+        continue;
+      }
+      if (ev.events & (EPOLLHUP | EPOLLERR)) {
+        // port gone, e.g. USB adapter unplugged
+        DECOM_LOG_ERROR2("Port error, receiving stopped", s->name_);
+        s->communicator::indication(rx_error);
+        break;
+      }
+
+      // get the number of available bytes, only these are read
+      std::size_t size = s->rx_available();
+      if (s->vtime_ && (size < s->vmin_)) {
+        // VMIN > 0, VTIME > 0: collect bytes until VMIN is reached or the line is idle for VTIME
+        for (std::size_t last = 0U; s->running_ && (size < s->vmin_) && (size != last); size = s->rx_available()) {
+          last = size;
+          struct pollfd pfd = { s->terminate_event_, POLLIN, 0 };
+          (void)::poll(&pfd, 1U, static_cast<int>(s->vtime_) * 100);
+        }
+        if (!s->running_) {
+          break;
+        }
+      }
+      size = size ? size : 1U;
+      size = size > DECOM_COM_SERIAL_RX_BUFSIZE ? DECOM_COM_SERIAL_RX_BUFSIZE : size;
+
+      // back-pressure: don't read before the pool can take the data, the tty buffers it meanwhile
+      const std::size_t pages = size / pool.page_size() + 2U;
+      while (s->running_ && !pool.wait_free(pages < pool.max_size() ? pages : pool.max_size(), timeout));
+      if (!s->running_) {
+        break;
+      }
+
+      // read directly into the pages of the msg
+      msg data;
+      if (!data.resize(size, false)) {
+        s->communicator::indication(rx_overrun);
+        continue;
+      }
+      struct iovec iov[COM_SERIAL_IOV_MAX];
+      const ssize_t bytes_read = ::readv(s->fd_, iov, static_cast<int>(data.get_segments(iov, COM_SERIAL_IOV_MAX)));
+      if (bytes_read > 0) {
+        // bytes received, pass data to upper layer
+        (void)data.resize(static_cast<std::size_t>(bytes_read));
+        s->communicator::receive(data);
+      }
+      else if ((bytes_read < 0) && (errno != EINTR) && (errno != EAGAIN)) {
+        // com error, port closed etc.
+        s->communicator::indication(rx_error);
+      }
+    }
+
+    DECOM_LOG_DEBUG2("Terminating receive thread", s->name_);
+  }
+
+
+  // transmit thread
+  static void tx_thread(void* arg)
+  {
+    serial* s = static_cast<serial*>(arg);
+
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(s->tx_mutex_);
+        s->tx_cv_.wait(lock, [s] { return !s->running_ || (s->tx_busy_ && !s->tx_msg_.empty()); });
+        if (!s->running_) {
+          break;
+        }
+      }
+
+      // write all data, tx_msg_ is not changed while tx_busy_ is set
+      bool res = true;
+      for (std::size_t offset = 0U; res && (offset < s->tx_msg_.size()); ) {
+        struct iovec iov[COM_SERIAL_IOV_MAX];
+        const ssize_t bytes_written = ::writev(s->fd_, iov, static_cast<int>(s->tx_msg_.get_segments(iov, COM_SERIAL_IOV_MAX, offset)));
+        if (bytes_written > 0) {
+          offset += static_cast<std::size_t>(bytes_written);
+        }
+        else if ((bytes_written < 0) && (errno == EINTR)) {
+          continue;
+        }
+        else if ((bytes_written < 0) && (errno == EAGAIN)) {
+          // tty buffer full, wait until it can take data or termination is requested
+          struct pollfd pfd[2] = { { s->fd_, POLLOUT, 0 }, { s->terminate_event_, POLLIN, 0 } };
+          res = (::poll(pfd, 2U, -1) >= 0 || errno == EINTR) && !(pfd[1].revents & POLLIN);
+        }
+        else {
+          res = false;
+        }
+      }
+
+      // wait until all data is physically sent - tcdrain()
+      res = res && (::ioctl(s->fd_, TCSBRK, 1) == 0);
+
+      {
+        std::lock_guard<std::mutex> lock(s->tx_mutex_);
+        s->tx_msg_.clear();
+        s->tx_busy_ = false;
+        if (!s->running_) {
+          break;
+        }
+      }
+      s->communicator::indication(res ? tx_done : tx_error);    // inform upper layer
+    }
+
+    DECOM_LOG_DEBUG2("Terminating transmit thread", s->name_);
+  }
+
+
+  // COM parameters
+  std::uint32_t   baudrate_;
+  std::uint8_t    databits_;
+  parity_type     parity_;
+  stopbit_type    stopbits_;
+  flowctrl_type   handshake_;
+  std::uint8_t    vmin_;                // VMIN receive batching
+  std::uint8_t    vtime_;               // VTIME receive batching
+  bool            low_latency_;         // ASYNC_LOW_LATENCY mode
+
+  int             fd_;                  // port file descriptor
+  int             epoll_;               // epoll instance of the receive thread
+  int             terminate_event_;     // eventfd to trigger the receive thread out of waiting
+  std::thread*    rx_thread_;           // receive thread
+  std::thread*    tx_thread_;           // transmit thread
+  std::atomic<bool> running_;           // threads are running
+
+  std::mutex              tx_mutex_;    // guards the tx state
+  std::condition_variable tx_cv_;       // signals a new transmission or termination
+  msg             tx_msg_;              // data in transmission (ref copy)
+  bool            tx_busy_;             // tx transfer running
+};
+
+} // namespace com
+} // namespace decom
+
+#endif // _DECOM_COM_SERIAL_H_
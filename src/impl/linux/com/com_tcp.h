@@ -0,0 +1,967 @@
+///////////////////////////////////////////////////////////////////////////////
+// \author (c) Marco Paland (info@paland.com)
+//             2013-2021, PALANDesign Hannover, Germany
+//
+// \license The MIT License (MIT)
+//
+// This file is part of the decom library.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// \brief Linux TCP communication class
+//
+// This class is used for client or server TCP connections over IP
+// Non-blocking sockets and an edge triggered epoll instance are used, the
+// epoll instance is served by a pool of worker threads.
+// If the communicator is constructed within a util::reactor::scope, the epoll
+// instance is served by the reactor thread instead and no threads are created.
+//
+// TCP server (multi connections):
+// com_tcp (true)
+// open("'localhost' or local ip : listen_port", eid_any)  --> indication: eid is (client addr/port)
+// receive(data, eid (client addr/port))
+// send(data, eid (client addr/port))
+//
+// TCP client (one connection):
+// open("host:port", eid_any)                              --> indication: eid is eid_any
+// receive(data, eid_any)
+// send(data, eid_any)
+//
+// eid IP addr is stored in network format
+// eid IP port is stored in host format
+//
+// Sending is zero copy: the msg pages are passed to sendmsg() as iovec segments.
+// Data is received with readv() directly into the pages of a msg.
+// If the msg pool runs out of pages, reading pauses until pages are freed, so
+// the TCP flow control throttles the peer instead of losing data.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _DECOM_COM_TCP_H_
+#define _DECOM_COM_TCP_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+
+#include "../../../com.h"
+
+#if defined(DECOM_REACTOR)
+#include "../util/reactor.h"
+#endif
+
+
+/////////////////////////////////////////////////////////////////////
+
+namespace decom {
+namespace com {
+
+
+class tcp : public communicator
+{
+  // defines the maximum size of a received msg, it's read with one readv() call into the msg pages
+  static const std::size_t COM_TCP_BUFFER_SIZE = 8192U;
+
+  // defines the number of threads per processor in server mode, 2 is a good default
+  static const std::size_t COM_TCP_THREADS_PER_PROCESSOR = 2U;
+
+  // defines the number of events a worker thread fetches per epoll_wait() call
+  static const std::size_t COM_TCP_EPOLL_EVENTS = 16U;
+
+  // defines the number of msg segments which are sent per sendmsg() or received per readv() call
+  static const std::size_t COM_TCP_IOV_MAX = 16U;
+
+  // defines the time a worker thread waits for free msg pages before it checks for shutdown
+  static const std::size_t COM_TCP_POOL_WAIT_MS = 100U;
+
+  std::vector<std::thread*> worker_threads_;    // pool of worker threads
+
+  bool        server_;                          // server or client
+  bool        use_ipv6_;                        // use IPv4 or IPv6
+  int         socket_;                          // socket
+  int         epoll_;                           // epoll instance
+  int         shutdown_event_;                  // eventfd to trigger the worker threads out of waiting
+  std::string source_addr_;                     // source addr
+  std::atomic<bool> running_;                   // worker threads are running
+
+  typedef struct tag_client_context_type {
+    int          socket;      // associated accept socket
+    eid          id;          // eid of the socket, here: address = IP, port = port
+    std::atomic<unsigned> rx_requests;  // read requests, only the worker which raised it from 0 reads the socket
+    bool         rx_stalled;  // reactor mode: reading paused for free msg pages
+    std::mutex   tx_mutex;    // guards the tx state
+    msg          tx_msg;      // data in transmission (ref copy)
+    std::size_t  tx_offset;   // number of bytes of tx_msg which are sent
+    bool         tx_pending;  // transmission in progress
+
+    // the socket is closed when the last worker thread releases the context, so
+    // a socket number can't be reused while a worker thread is still reading it
+    ~tag_client_context_type()
+    { (void)::close(socket); }
+  } client_context_type;
+
+  typedef std::shared_ptr<client_context_type> client_context_ptr;
+
+  std::map<eid, client_context_ptr> client_contexts_;   // contexts by eid
+  std::map<int, client_context_ptr> client_sockets_;    // contexts by socket, for the epoll events
+  std::mutex                        client_contexts_mutex_;
+
+#if defined(DECOM_REACTOR)
+  util::reactor*                    reactor_;           // reactor which serves the epoll instance, nullptr for worker threads
+  int                               rx_free_event_;     // reactor mode: eventfd which is written by the pool when pages are free again
+  bool                              rx_free_pending_;   // reactor mode: free pages notification is requested
+#endif
+
+
+public:
+  /**
+   * Normal ctor
+   * \param server TCP: true for listening server, false for connecting client
+   * \param ipv6 true for IPv6 protocol, false for IPv4, default is IPv4
+   * \param server_threads Number of data handling server threads (estimated clients), 0 for default
+   * \param name Layer name
+   */
+  tcp(bool server = false, bool ipv6 = false, std::size_t server_threads = 0U, const char* name = "com_tcp")
+    : communicator(name)   // it's VERY IMPORTANT to call the base class ctor HERE!!!
+    , server_(server)
+    , use_ipv6_(ipv6)
+    , socket_(-1)
+    , epoll_(-1)
+    , shutdown_event_(-1)
+    , running_(true)
+#if defined(DECOM_REACTOR)
+    , reactor_(util::reactor::current())
+    , rx_free_event_(-1)
+    , rx_free_pending_(false)
+#endif
+  {
+    // set MTU to the buffer size
+    mtu() = COM_TCP_BUFFER_SIZE;
+
+    // create the epoll instance
+    epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_ < 0) {
+      DECOM_LOG_EMERG("Creating epoll instance failed");
+      return;
+    }
+
+    // the shutdown event is level triggered, so it wakes up all worker threads
+    shutdown_event_ = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = { };
+    ev.events  = EPOLLIN;
+    ev.data.fd = shutdown_event_;
+    if ((shutdown_event_ < 0) || ::epoll_ctl(epoll_, EPOLL_CTL_ADD, shutdown_event_, &ev)) {
+      DECOM_LOG_EMERG("Creating shutdown event failed");
+      return;
+    }
+
+#if defined(DECOM_REACTOR)
+    if (reactor_) {
+      // the free pages event resumes the receivers which were stalled for free msg pages
+      rx_free_event_ = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+      ev.data.fd = rx_free_event_;
+      if ((rx_free_event_ < 0) || ::epoll_ctl(epoll_, EPOLL_CTL_ADD, rx_free_event_, &ev)) {
+        DECOM_LOG_EMERG("Creating free pages event failed");
+      }
+      // the reactor thread serves the epoll instance
+      if (!reactor_->add(epoll_, EPOLLIN, &tcp::reactor_handler, this)) {
+        DECOM_LOG_EMERG("Registering epoll instance at the reactor failed");
+      }
+      return;
+    }
+#endif
+
+    if (server_) {
+      // create server data threads
+      if (!server_threads) {
+        const std::size_t cores = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1U;
+        server_threads = cores * COM_TCP_THREADS_PER_PROCESSOR;
+        DECOM_LOG_INFO("Detected " << cores << " cores, creating " << server_threads << " worker threads");
+      }
+      for (std::size_t i = 0U; i < server_threads; i++) {
+        worker_threads_.push_back(new std::thread(&tcp::data_thread, this));
+      }
+    }
+    else {
+      // create one client data thread
+      worker_threads_.push_back(new std::thread(&tcp::data_thread, this));
+    }
+  }
+
+
+  /**
+   * dtor
+   */
+  virtual ~tcp()
+  {
+    close();
+
+    // trigger all worker threads out of waiting
+    running_ = false;
+    const std::uint64_t one = 1U;
+    if (::write(shutdown_event_, &one, sizeof(one)) != sizeof(one)) {
+      DECOM_LOG_ERROR("Triggering shutdown event failed");
+    }
+    // AFTER that, terminate all worker threads
+    for (const auto& it : worker_threads_) {
+      it->join();
+      delete it;
+    }
+#if defined(DECOM_REACTOR)
+    if (reactor_) {
+      // no notification is running after cancelling, so the event can be closed
+      msg::get_msg_pool(COM_TCP_BUFFER_SIZE).cancel_free_notify(this);
+      reactor_->remove(epoll_);
+      (void)::close(rx_free_event_);
+    }
+#endif
+
+    // close epoll instance and event
+    (void)::close(shutdown_event_);
+    (void)::close(epoll_);
+  }
+
+
+  /**
+   * Called by upper layer to open this layer
+   * \param address The address to open in the form of "host:port", "IP:port" (IPv4) or "[IP]:port" (IPv6)
+   *                Server mode: Defines the local interface and listen port
+   *                Client mode: Defines the client host and port, the local interface may be set via set_source_address
+   * \param id Unused
+   * \return true if open is successful
+   */
+  virtual bool open(const char* address = "", eid const& id = eid_any)
+  {
+    (void)id;
+
+    // for security: check that upper protocol/device exists
+    if (!upper_) {
+      return false;
+    }
+
+    // already open?
+    if (socket_ >= 0) {
+      DECOM_LOG_WARN("Socket already open");
+      return false;
+    }
+
+    // resolve address
+    struct addrinfo* result = resolve_address(address);
+    if (!result) {
+      return false;
+    }
+
+    // create the socket
+    socket_ = ::socket(use_ipv6_ ? AF_INET6 : AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (socket_ < 0) {
+      // error
+      DECOM_LOG_CRIT("Socket creation error " << errno);
+      ::freeaddrinfo(result);
+      return false;
+    }
+
+    if (server_) {
+      // S E R V E R
+
+      const int enable = 1;
+      if (::setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable))) {
+        DECOM_LOG_WARN("Socket option SO_REUSEADDR error " << errno);
+      }
+
+      // bind socket
+      if (::bind(socket_, result->ai_addr, result->ai_addrlen)) {
+        DECOM_LOG_CRIT("Socket bind() failed with error " << errno);
+        close_socket();
+        ::freeaddrinfo(result);
+        return false;
+      }
+
+      // set listen socket
+      if (::listen(socket_, SOMAXCONN)) {
+        DECOM_LOG_CRIT("Socket listen() failed with error " << errno);
+        close_socket();
+        ::freeaddrinfo(result);
+        return false;
+      }
+
+      // accepting is done by the worker threads
+      if (!set_nonblocking(socket_) || !add_socket(socket_, EPOLLIN | EPOLLET)) {
+        DECOM_LOG_CRIT("Registering listen socket failed with error " << errno);
+        close_socket();
+        ::freeaddrinfo(result);
+        return false;
+      }
+
+      DECOM_LOG_INFO("Server listening on ") << address_to_string(reinterpret_cast<struct sockaddr_storage*>(result->ai_addr)).str().c_str();
+    }
+    else {
+      // C L I E N T
+
+      // bind non default source address/port if given
+      if (!source_addr_.empty()) {
+        // source address is given, resolve it
+        struct addrinfo* addr_src = resolve_address(source_addr_.c_str());
+        if (addr_src) {
+          // bind socket
+          if (::bind(socket_, addr_src->ai_addr, addr_src->ai_addrlen)) {
+            DECOM_LOG_WARN("Source bind() failed with error " << errno);
+          }
+          ::freeaddrinfo(addr_src);
+        }
+      }
+
+      // connect socket
+      if (::connect(socket_, result->ai_addr, result->ai_addrlen)) {
+        DECOM_LOG_WARN("Socket connect() failed with error " << errno);
+        close_socket();
+        ::freeaddrinfo(result);
+        return false;
+      }
+
+      // register client context, the context owns the socket now
+      if (!add_client(socket_, eid_any)) {
+        DECOM_LOG_ERROR("Registering socket failed with error " << errno);
+        socket_ = -1;
+        ::freeaddrinfo(result);
+        return false;
+      }
+    }
+
+    // free result
+    ::freeaddrinfo(result);
+
+    return true;
+  }
+
+
+  /**
+   * Called by upper layer to close this layer
+   * \param id Unused (all open eids are closed)
+   */
+  virtual void close(eid const& id = eid_any)
+  {
+    (void)id;   // unused
+
+    if (socket_ < 0) {
+      // not open / already closed
+      return;
+    }
+
+    // delete all client sockets and contexts
+    DECOM_LOG_DEBUG("Shudown and closing client socket(s)");
+    std::vector<eid> ids;
+    {
+      std::lock_guard<std::mutex> lock(client_contexts_mutex_);
+      for (const auto& it : client_contexts_) {
+        ::shutdown(it.second->socket, SHUT_RDWR);
+        (void)::epoll_ctl(epoll_, EPOLL_CTL_DEL, it.second->socket, nullptr);
+        ids.push_back(it.first);
+      }
+      client_contexts_.clear();
+      client_sockets_.clear();
+    }
+    for (const auto& it : ids) {
+      communicator::indication(disconnected, it);
+    }
+
+    // shutdown and close the main socket
+    DECOM_LOG_DEBUG("Shudown and closing main socket");
+    if (server_) {
+      (void)::epoll_ctl(epoll_, EPOLL_CTL_DEL, socket_, nullptr);
+      ::shutdown(socket_, SHUT_RDWR);
+      (void)::close(socket_);
+    }
+    socket_ = -1;   // client socket is closed with its context
+  }
+
+
+  /**
+   * Called by upper layer to transmit data to the internet
+   * \param data The message to send
+   * \param id The endpoint identifier, ignored in client mode
+   * \param more true if message is a fragment - unused here
+   * \return true if Send is successful
+   */
+  virtual bool send(msg& data, eid const& id = eid_any, bool more = false)
+  {
+    (void)more;   // unused
+
+    if (socket_ < 0) {
+      // not open / already closed
+      DECOM_LOG_ERROR("Sending failed: socket is not open");
+      return false;
+    }
+
+    // find according client context if TCP server
+    client_context_ptr context;
+    {
+      std::lock_guard<std::mutex> lock(client_contexts_mutex_);
+      std::map<eid, client_context_ptr>::iterator it = client_contexts_.find(server_ ? id : eid_any);
+      if (it != client_contexts_.end()) {
+        context = it->second;
+      }
+    }
+    if (!context) {
+      // channel not found
+      DECOM_LOG_WARN("Sending eid ") << format_eid(id).str().c_str() << " not found";
+      return false;
+    }
+
+    int result;
+    {
+      std::lock_guard<std::mutex> lock(context->tx_mutex);
+
+      // return false if a transfer is in progress, means new data can't be accepted
+      // this is mostly the case when the upper layer didn't wait for the tx_done indication
+      if (context->tx_pending) {
+        DECOM_LOG_WARN("Transmission already in progress");
+        return false;
+      }
+
+      // send the pages of the msg directly, the rest is sent when the socket is writable again
+      context->tx_msg.ref_copy(data);
+      context->tx_offset  = 0U;
+      context->tx_pending = true;
+      result = tx_continue(context.get());
+    }
+    if (result < 0) {
+      DECOM_LOG_ERROR("Sending failure, eid ") << format_eid(id).str().c_str() << ", error " << errno;
+      // tx error indication
+      communicator::indication(tx_error, context->id);
+      return false;
+    }
+    if (result > 0) {
+      // tx done indication
+      communicator::indication(tx_done, context->id);
+    }
+    return true;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////
+  // C O M M U N I C A T O R   A P I
+
+  /**
+   * TCP CLIENT mode: Set the client (source) address/port in and define other address/port than default.
+   * Set this BEFORE calling open()!
+   * \param address The source address in the form of "host:port", "IP:port" (IPv4) or "[IP]:port" (IPv6)
+   */
+  void set_source_address(const std::string& address)
+  {
+    // already open?
+    if (socket_ >= 0) {
+      DECOM_LOG_ERROR("Socket already open, source address can't be changed anymore");
+    }
+
+    source_addr_ = address;
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+
+
+  static void data_thread(void* arg)
+  {
+    tcp* i = static_cast<tcp*>(arg);
+    std::stringstream thread_id;
+    thread_id << std::this_thread::get_id();
+
+    struct epoll_event events[COM_TCP_EPOLL_EVENTS];
+    while (i->running_) {
+      const int count = ::epoll_wait(i->epoll_, events, static_cast<int>(COM_TCP_EPOLL_EVENTS), -1);
+      if (count < 0) {
+        if (errno != EINTR) {
+          DECOM_LOG_ERROR2("epoll_wait() failed with error " << errno, i->name_);
+        }
+        continue;
+      }
+      DECOM_LOG_DEBUG2("Using data thread " << thread_id.str().c_str(), i->name_);
+      i->dispatch(events, count);
+    }
+
+    DECOM_LOG_DEBUG2("Terminating data thread " << thread_id.str().c_str(), i->name_);
+  }
+
+
+#if defined(DECOM_REACTOR)
+  // reactor mode: the epoll instance is readable
+  static void reactor_handler(void* arg, std::uint32_t)
+  {
+    tcp* i = static_cast<tcp*>(arg);
+    struct epoll_event events[COM_TCP_EPOLL_EVENTS];
+    const int count = ::epoll_wait(i->epoll_, events, static_cast<int>(COM_TCP_EPOLL_EVENTS), 0);
+    if (count > 0) {
+      i->dispatch(events, count);
+    }
+  }
+
+
+  // reactor mode: the pool has free pages again, called by the thread which frees the page
+  static void rx_free(void* arg)
+  {
+    const std::uint64_t one = 1U;
+    if (::write(static_cast<tcp*>(arg)->rx_free_event_, &one, sizeof(one)) != sizeof(one)) {
+      DECOM_LOG_ERROR2("Triggering free pages event failed", static_cast<tcp*>(arg)->name_);
+    }
+  }
+
+
+  // reactor mode: read the sockets which were stalled for free msg pages
+  static void rx_resume(void* arg)
+  {
+    tcp* i = static_cast<tcp*>(arg);
+    std::uint64_t count;
+    (void)!::read(i->rx_free_event_, &count, sizeof(count));
+    i->rx_free_pending_ = false;
+    std::vector<client_context_ptr> stalled;
+    {
+      std::lock_guard<std::mutex> lock(i->client_contexts_mutex_);
+      for (const auto& it : i->client_sockets_) {
+        if (it.second->rx_stalled) {
+          it.second->rx_stalled = false;
+          stalled.push_back(it.second);
+        }
+      }
+    }
+    for (const auto& context : stalled) {
+      if (!i->rx_drain(context)) {
+        DECOM_LOG_INFO2("Socket has been closed by peer", i->name_);
+        i->remove_client(context);
+      }
+    }
+  }
+#endif
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// H E L P E R
+private:
+
+  // handle the events of the epoll instance
+  void dispatch(const struct epoll_event* events, int count)
+  {
+    for (int n = 0; (n < count) && running_; n++) {
+      const int fd = events[n].data.fd;
+      if (fd == shutdown_event_) {
+        // shutdown
+        DECOM_LOG_DEBUG("Shutdown data thread");
+        break;
+      }
+#if defined(DECOM_REACTOR)
+      if (fd == rx_free_event_) {
+        // free msg pages
+        rx_resume(this);
+        continue;
+      }
+#endif
+      if (server_ && (fd == socket_)) {
+        // new connections
+        accept_clients();
+        continue;
+      }
+
+      // find the client context
+      client_context_ptr context;
+      {
+        std::lock_guard<std::mutex> lock(client_contexts_mutex_);
+        std::map<int, client_context_ptr>::iterator it = client_sockets_.find(fd);
+        if (it != client_sockets_.end()) {
+          context = it->second;
+        }
+      }
+      if (!context) {
+        // socket closed meanwhile
+        continue;
+      }
+
+      if (events[n].events & EPOLLOUT) {
+        // socket is writable again - continue sending
+        int result = 0;
+        {
+          std::lock_guard<std::mutex> lock(context->tx_mutex);
+          if (context->tx_pending) {
+            result = tx_continue(context.get());
+          }
+        }
+        if (result < 0) {
+          DECOM_LOG_ERROR("Sending failure");
+          // tx error indication
+          communicator::indication(tx_error, context->id);
+        }
+        else if (result > 0) {
+          // tx done indication
+          communicator::indication(tx_done, context->id);
+        }
+      }
+      if ((events[n].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !rx_drain(context)) {
+        // socket has been closed
+        DECOM_LOG_INFO("Socket has been closed by peer");
+        remove_client(context);
+      }
+    }
+  }
+
+
+  // accept all pending connections of the listen socket
+  void accept_clients()
+  {
+    for (;;) {
+      struct sockaddr_storage client_addr = { };
+      socklen_t client_addr_len = sizeof(client_addr);
+      const int accept_socket = ::accept4(socket_, reinterpret_cast<struct sockaddr*>(&client_addr), &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (accept_socket < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+          // failure
+          DECOM_LOG_ERROR("Accepting socket failed with error " << errno);
+        }
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+
+      // report client
+      DECOM_LOG_INFO("ACCEPT from " << address_to_string(&client_addr).str().c_str());
+
+      // set client context eid
+      eid id;
+      id.port() = ntohs(client_addr.ss_family == AF_INET ? reinterpret_cast<struct sockaddr_in*>(&client_addr)->sin_port : reinterpret_cast<struct sockaddr_in6*>(&client_addr)->sin6_port);
+      memcpy(static_cast<void*>(id.addr().addr),
+             (client_addr.ss_family == AF_INET) ? static_cast<void*>(&reinterpret_cast<struct sockaddr_in*>(&client_addr)->sin_addr) : static_cast<void*>(&reinterpret_cast<struct sockaddr_in6*>(&client_addr)->sin6_addr),
+             (client_addr.ss_family == AF_INET) ? 4U : 16U);
+
+      // register new client context
+      if (!add_client(accept_socket, id)) {
+        DECOM_LOG_ERROR("Registering client socket failed with error " << errno);
+      }
+    }
+  }
+
+
+  // create the client context of the given socket and add it to the epoll instance
+  // the socket is owned by the context afterwards, it's closed in case of an error
+  bool add_client(int socket, eid const& id)
+  {
+    const int enable = 1;
+    (void)::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    if (!set_nonblocking(socket)) {
+      (void)::close(socket);
+      return false;
+    }
+
+    client_context_ptr client_context(new client_context_type);
+    client_context->socket     = socket;
+    client_context->id         = id;
+    client_context->tx_offset  = 0U;
+    client_context->tx_pending = false;
+    client_context->rx_requests = 0U;
+    client_context->rx_stalled  = false;
+    {
+      std::lock_guard<std::mutex> lock(client_contexts_mutex_);
+      client_contexts_[id]     = client_context;
+      client_sockets_[socket]  = client_context;
+    }
+
+    // notify upper layer before the first data can be received
+    communicator::indication(connected, id);
+
+    if (!add_socket(socket, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)) {
+      std::lock_guard<std::mutex> lock(client_contexts_mutex_);
+      client_contexts_.erase(id);
+      client_sockets_.erase(socket);
+      return false;
+    }
+    return true;
+  }
+
+
+  // remove and close the client context, the upper layer gets a disconnected indication
+  void remove_client(const client_context_ptr& context)
+  {
+    {
+      std::lock_guard<std::mutex> lock(client_contexts_mutex_);
+      std::map<int, client_context_ptr>::iterator it = client_sockets_.find(context->socket);
+      if ((it == client_sockets_.end()) || (it->second != context)) {
+        // already removed
+        return;
+      }
+      client_sockets_.erase(it);
+      client_contexts_.erase(context->id);
+      (void)::epoll_ctl(epoll_, EPOLL_CTL_DEL, context->socket, nullptr);
+    }
+    // closed indication
+    communicator::indication(disconnected, context->id);
+  }
+
+
+  // read all available data of the socket, returns false if the socket is closed
+  // an edge may be reported to more than one worker, so the reading is passed to the worker which
+  // is already reading, that way no worker is blocked and free to handle the tx events meanwhile
+  bool rx_drain(const client_context_ptr& context)
+  {
+    if (context->rx_requests.fetch_add(1U)) {
+      // another worker is reading and reads again
+      return true;
+    }
+    for (;;) {
+      if (!rx_read(context.get())) {
+        return false;
+      }
+      unsigned requests = 1U;
+      if (context->rx_requests.compare_exchange_strong(requests, 0U)) {
+        return true;
+      }
+      // more edges reported meanwhile, read again
+      context->rx_requests = 1U;
+    }
+  }
+
+
+  // read the socket until it would block, returns false if the socket is closed
+  bool rx_read(client_context_type* context)
+  {
+    msg_pool& pool = msg::get_msg_pool(COM_TCP_BUFFER_SIZE);
+    const std::size_t pages = std::min<std::size_t>(COM_TCP_BUFFER_SIZE / pool.page_size() + 2U, pool.max_size());   // +1 rest, +1 page begin offset
+    const std::chrono::milliseconds timeout(static_cast<std::chrono::milliseconds::rep>(COM_TCP_POOL_WAIT_MS));
+    for (;;) {
+      // back-pressure: don't read before the pool can take the data, the peer is throttled by the TCP flow control
+#if defined(DECOM_REACTOR)
+      if (reactor_ && !pool.has_free(pages)) {
+        // the reactor thread must not block, the socket is read again when the pool has free pages
+        rx_stall(context, pool, pages);
+        return true;
+      }
+#endif
+      while (!pool.wait_free(pages, timeout)) {
+        if (!running_) {
+          return true;
+        }
+      }
+
+      // read directly into the pages of the msg
+      msg data(pool);
+      if (!data.resize(COM_TCP_BUFFER_SIZE, false)) {
+        // pool was emptied meanwhile or the free pages are cached by other threads
+#if defined(DECOM_REACTOR)
+        if (reactor_) {
+          rx_stall(context, pool, pages);
+          return true;
+        }
+#endif
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+      struct iovec iov[COM_TCP_IOV_MAX];
+      const ssize_t bytes_transferred = ::readv(context->socket, iov, static_cast<int>(data.get_segments(iov, COM_TCP_IOV_MAX)));
+      if (bytes_transferred > 0) {
+        // bytes received, pass data to upper layer
+        (void)data.resize(static_cast<std::size_t>(bytes_transferred));
+        communicator::receive(data, context->id);
+        continue;
+      }
+      if (bytes_transferred == 0) {
+        // orderly shutdown by peer
+        return false;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      // EAGAIN: all data read, wait for the next edge
+      return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+    }
+  }
+
+
+#if defined(DECOM_REACTOR)
+  // reactor mode: stall reading the socket until the pool notifies that the given number of pages is free
+  void rx_stall(client_context_type* context, msg_pool& pool, std::size_t pages)
+  {
+    context->rx_stalled = true;
+    if (!rx_free_pending_) {
+      rx_free_pending_ = true;
+      if (!pool.notify_free(pages, &tcp::rx_free, this)) {
+        // freed meanwhile
+        rx_free(this);
+      }
+    }
+  }
+#endif
+
+
+  // send the pending tx data, the tx mutex must be locked
+  // returns 1 if all data is sent, 0 if the socket buffer is full and -1 on error
+  int tx_continue(client_context_type* context)
+  {
+    while (context->tx_offset < context->tx_msg.size()) {
+      struct iovec iov[COM_TCP_IOV_MAX];
+      struct msghdr hdr = { };
+      hdr.msg_iov    = iov;
+      hdr.msg_iovlen = context->tx_msg.get_segments(iov, COM_TCP_IOV_MAX, context->tx_offset);
+      const ssize_t bytes_transferred = ::sendmsg(context->socket, &hdr, MSG_NOSIGNAL);
+      if (bytes_transferred < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+          // socket buffer full, continue on EPOLLOUT
+          return 0;
+        }
+        context->tx_pending = false;
+        context->tx_msg.clear();
+        return -1;
+      }
+      context->tx_offset += static_cast<std::size_t>(bytes_transferred);
+    }
+    // release the pages
+    context->tx_pending = false;
+    context->tx_msg.clear();
+    return 1;
+  }
+
+
+  // add the socket to the epoll instance
+  bool add_socket(int socket, std::uint32_t events)
+  {
+    struct epoll_event ev = { };
+    ev.events  = events;
+    ev.data.fd = socket;
+    return ::epoll_ctl(epoll_, EPOLL_CTL_ADD, socket, &ev) == 0;
+  }
+
+
+  static bool set_nonblocking(int socket)
+  {
+    const int flags = ::fcntl(socket, F_GETFL, 0);
+    return (flags >= 0) && (::fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0);
+  }
+
+
+  void close_socket()
+  {
+    (void)::close(socket_);
+    socket_ = -1;
+  }
+
+
+  std::stringstream format_eid(eid const& id) const
+  {
+    std::stringstream eid_str;
+    if (id.is_any()) {
+      eid_str << "ANY";
+    }
+    else {
+      eid_str << std::hex << id.addr().addr32[0] << "."
+              << std::hex << id.addr().addr32[1] << "."
+              << std::hex << id.addr().addr32[2] << "."
+              << std::hex << id.addr().addr32[3] << ":"
+              << std::dec << id.port();
+    }
+    return eid_str;
+  }
+
+
+  std::stringstream address_to_string(struct sockaddr_storage* addr) const
+  {
+    char ip[INET6_ADDRSTRLEN] = { };
+    std::stringstream str;
+    if (addr->ss_family == AF_INET6) {
+      (void)::inet_ntop(AF_INET6, &reinterpret_cast<struct sockaddr_in6*>(addr)->sin6_addr, ip, sizeof(ip));
+      str << "[" << ip << "]:" << ntohs(reinterpret_cast<struct sockaddr_in6*>(addr)->sin6_port);
+    }
+    else {
+      (void)::inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in*>(addr)->sin_addr, ip, sizeof(ip));
+      str << ip << ":" << ntohs(reinterpret_cast<struct sockaddr_in*>(addr)->sin_port);
+    }
+    return str;
+  }
+
+
+  // CAUTION: The returned addrinfo MUST BE FREED with freeaddrinfo();
+  struct addrinfo* resolve_address(const char* address) const
+  {
+    // extract host and port from address
+    std::string host(address);
+    std::string port(address);
+
+    // IPv6 IP address given?
+    std::string::size_type c = host.rfind("]:");
+    if (c != std::string::npos) {
+      // yes cut off port
+      host.erase(c, host.length() - c);
+      // remove start bracket
+      if (host.find("[") != std::string::npos) {
+        host.erase(host.begin() + host.find("["));
+      }
+      // cut off address
+      port.erase(0, c + 2U);
+    }
+    else {
+      c = host.rfind(":");
+      if (c != std::string::npos) {
+        // cut off port
+        host.erase(c, host.length() - c);
+        // cut off address
+        port.erase(0, c + 1U);
+      }
+      else {
+        port.clear();
+      }
+    }
+
+    // resolve address
+    struct addrinfo* result = nullptr;
+    struct addrinfo hints = { };
+    hints.ai_family   = use_ipv6_ ? AF_INET6 : AF_INET;     // use IPv4 or IPv6
+    hints.ai_socktype = SOCK_STREAM;                        // TCP
+    hints.ai_protocol = IPPROTO_TCP;                        // TCP
+    hints.ai_flags    = server_ ? AI_PASSIVE : 0;           // wildcard address for an empty server host
+    const int err = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+    if (err) {
+      DECOM_LOG_ERROR("Address " << address << " can't be resolved, getaddrinfo() failed with error " << ::gai_strerror(err));
+      return nullptr;
+    }
+    DECOM_LOG_DEBUG("'" << address << "' resolved to ") << address_to_string(reinterpret_cast<struct sockaddr_storage*>(result->ai_addr)).str().c_str();
+
+    return result;
+  }
+};
+
+} // namespace com
+} // namespace decom
+
+#endif  // _DECOM_COM_TCP_H_
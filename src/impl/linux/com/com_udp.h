@@ -0,0 +1,874 @@
+///////////////////////////////////////////////////////////////////////////////
+// \author (c) Marco Paland (info@paland.com)
+//             2013-2021, PALANDesign Hannover, Germany
+//
+// \license The MIT License (MIT)
+//
+// This file is part of the decom library.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// \brief Linux UDP communication class
+//
+// This class is used for UDP datagram communication over IP
+// Datagrams are received with recvmmsg() directly into msg pages and sent
+// with sendmmsg() in batches.
+//
+// UDP server (multi peers):
+// com_udp (true)
+// open("'localhost' or local ip : local_port", eid_any)
+// receive(data, eid (source addr/port))
+// send(data, eid (destination addr/port))
+//
+// UDP client (one peer):
+// open("host:port", eid_any)
+// receive(data, eid_any)
+// send(data, eid_any)
+//
+// eid IP addr is stored in network format
+// eid IP port is stored in host format
+//
+// Sending with the 'more' flag set queues the datagram, the queue is sent
+// with one sendmmsg() call when a datagram without 'more' flag is sent, the
+// queue is full or COM_UDP_FLUSH_TIME_US elapsed. tx_done is indicated for
+// each datagram after it is sent. If the socket buffer is full, the rest of
+// the queue is sent when the socket is writable again, send() doesn't block.
+// If the communicator is constructed within a util::reactor::scope, datagrams
+// are received by the reactor thread and no receive thread is created.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _DECOM_COM_UDP_H_
+#define _DECOM_COM_UDP_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#include "../../../com.h"
+#include "../util/timer.h"
+
+#if defined(DECOM_REACTOR)
+#include "../util/reactor.h"
+#endif
+
+
+/////////////////////////////////////////////////////////////////////
+
+namespace decom {
+namespace com {
+
+
+class udp : public communicator
+{
+  // defines the maximum size of a datagram
+  static const std::size_t COM_UDP_DATAGRAM_SIZE = 2048U;
+
+  // defines the number of datagrams which are received/sent per recvmmsg()/sendmmsg() call
+  static const std::size_t COM_UDP_BATCH_SIZE = 16U;
+
+  // defines the number of msg segments of a datagram
+  static const std::size_t COM_UDP_IOV_MAX = 32U;
+
+  // defines the time the receive thread waits for free msg pages before it checks for shutdown
+  static const std::size_t COM_UDP_POOL_WAIT_MS = 100U;
+
+  // defines the time queued datagrams wait for more datagrams before they are sent
+  static const std::size_t COM_UDP_FLUSH_TIME_US = 1000U;
+
+  std::thread*      receive_thread_;      // receive thread
+  bool              server_;              // server or client
+  bool              use_ipv6_;            // use IPv4 or IPv6
+  int               socket_;              // socket
+  int               epoll_;               // epoll instance
+  int               shutdown_event_;      // eventfd to trigger the receive thread out of waiting
+  std::string       source_addr_;         // source addr
+  std::atomic<bool> running_;             // receive thread is running
+  std::mutex        events_mutex_;        // guards rx_paused_, tx_blocked_ and the epoll events of the socket
+  bool              rx_paused_;           // receiving is paused for free msg pages
+
+  // receive batch
+  std::vector<msg>         rx_msg_;                                     // msgs the datagrams are received in, only alive during receiving
+  struct mmsghdr           rx_hdr_[COM_UDP_BATCH_SIZE];
+  struct iovec             rx_iov_[COM_UDP_BATCH_SIZE][COM_UDP_IOV_MAX];
+  struct sockaddr_storage  rx_addr_[COM_UDP_BATCH_SIZE];
+
+  // transmit batch
+  std::mutex               tx_mutex_;                                   // guards the transmit batch
+  std::vector<msg>         tx_msg_;                                     // queued datagrams (ref copies), only alive while queued
+  std::vector<eid>         tx_id_;                                      // eids of the queued datagrams
+  struct mmsghdr           tx_hdr_[COM_UDP_BATCH_SIZE];
+  struct iovec             tx_iov_[COM_UDP_BATCH_SIZE][COM_UDP_IOV_MAX];
+  struct sockaddr_storage  tx_addr_[COM_UDP_BATCH_SIZE];
+  std::size_t              tx_head_;                                    // index of the first unsent datagram
+  std::size_t              tx_count_;                                   // number of queued datagrams
+  bool                     tx_blocked_;                                 // socket buffer full, waiting for EPOLLOUT, set under both mutexes
+
+  // tx indication of a datagram, given after the tx mutex is released
+  typedef struct tag_tx_indication_type {
+    eid          id;
+    status_type  code;
+  } tx_indication_type;
+
+#if defined(DECOM_REACTOR)
+  util::reactor*                reactor_;           // reactor which receives the datagrams, nullptr for the receive thread
+  int                           rx_free_event_;     // reactor mode: eventfd which is written by the pool when pages are free again
+#endif
+
+  util::timer              tx_timer_;     // sends the queued datagrams - destroyed first
+
+
+public:
+  /**
+   * Normal ctor
+   * \param server UDP: true for server, receiving from and sending to any peer, false for client with one peer
+   * \param ipv6 true for IPv6 protocol, false for IPv4, default is IPv4
+   * \param name Layer name
+   */
+  udp(bool server = false, bool ipv6 = false, const char* name = "com_udp")
+    : communicator(name)   // it's VERY IMPORTANT to call the base class ctor HERE!!!
+    , receive_thread_(nullptr)
+    , server_(server)
+    , use_ipv6_(ipv6)
+    , socket_(-1)
+    , epoll_(-1)
+    , shutdown_event_(-1)
+    , running_(true)
+    , rx_paused_(false)
+    , tx_head_(0U)
+    , tx_count_(0U)
+    , tx_blocked_(false)
+#if defined(DECOM_REACTOR)
+    , reactor_(util::reactor::current())
+    , rx_free_event_(-1)
+#endif
+  {
+    // set MTU to the datagram size
+    mtu() = COM_UDP_DATAGRAM_SIZE;
+
+    // msgs are created on demand, so no pages are bound by an idle communicator
+    rx_msg_.reserve(COM_UDP_BATCH_SIZE);
+    tx_msg_.reserve(COM_UDP_BATCH_SIZE);
+    tx_id_.resize(COM_UDP_BATCH_SIZE);
+
+    // create the epoll instance
+    epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_ < 0) {
+      DECOM_LOG_EMERG("Creating epoll instance failed");
+      return;
+    }
+
+    // the shutdown event wakes up the receive thread
+    shutdown_event_ = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = { };
+    ev.events  = EPOLLIN;
+    ev.data.fd = shutdown_event_;
+    if ((shutdown_event_ < 0) || ::epoll_ctl(epoll_, EPOLL_CTL_ADD, shutdown_event_, &ev)) {
+      DECOM_LOG_EMERG("Creating shutdown event failed");
+      return;
+    }
+
+#if defined(DECOM_REACTOR)
+    if (reactor_) {
+      // the free pages event resumes the receiver which was paused for free msg pages
+      rx_free_event_ = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+      ev.data.fd = rx_free_event_;
+      if ((rx_free_event_ < 0) || ::epoll_ctl(epoll_, EPOLL_CTL_ADD, rx_free_event_, &ev)) {
+        DECOM_LOG_EMERG("Creating free pages event failed");
+      }
+      // the reactor thread serves the epoll instance
+      if (!reactor_->add(epoll_, EPOLLIN, &udp::reactor_handler, this)) {
+        DECOM_LOG_EMERG("Registering epoll instance at the reactor failed");
+      }
+      return;
+    }
+#endif
+
+    // create the receive thread
+    receive_thread_ = new std::thread(&udp::receive_thread, this);
+  }
+
+
+  /**
+   * dtor
+   */
+  virtual ~udp()
+  {
+    close();
+
+    // trigger the receive thread out of waiting
+    running_ = false;
+    const std::uint64_t one = 1U;
+    if (::write(shutdown_event_, &one, sizeof(one)) != sizeof(one)) {
+      DECOM_LOG_ERROR("Triggering shutdown event failed");
+    }
+    // AFTER that, terminate the receive thread
+    if (receive_thread_) {
+      receive_thread_->join();
+      delete receive_thread_;
+    }
+#if defined(DECOM_REACTOR)
+    if (reactor_) {
+      // no notification is running after cancelling, so the event can be closed
+      msg::get_msg_pool(COM_UDP_DATAGRAM_SIZE).cancel_free_notify(this);
+      reactor_->remove(epoll_);
+      (void)::close(rx_free_event_);
+    }
+#endif
+
+    // close epoll instance and event
+    (void)::close(shutdown_event_);
+    (void)::close(epoll_);
+  }
+
+
+  /**
+   * Called by upper layer to open this layer
+   * \param address The address to open in the form of "host:port", "IP:port" (IPv4) or "[IP]:port" (IPv6)
+   *                Server mode: Defines the local interface and port
+   *                Client mode: Defines the peer host and port, the local interface may be set via set_source_address
+   * \param id Unused
+   * \return true if open is successful
+   */
+  virtual bool open(const char* address = "", eid const& id = eid_any)
+  {
+    (void)id;
+
+    // for security: check that upper protocol/device exists
+    if (!upper_) {
+      return false;
+    }
+
+    // already open?
+    if (socket_ >= 0) {
+      DECOM_LOG_WARN("Socket already open");
+      return false;
+    }
+
+    // resolve address
+    struct addrinfo* result = resolve_address(address);
+    if (!result) {
+      return false;
+    }
+
+    // create the socket
+    socket_ = ::socket(use_ipv6_ ? AF_INET6 : AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (socket_ < 0) {
+      // error
+      DECOM_LOG_CRIT("Socket creation error " << errno);
+      ::freeaddrinfo(result);
+      return false;
+    }
+
+    if (server_) {
+      // S E R V E R
+
+      // bind socket
+      if (::bind(socket_, result->ai_addr, result->ai_addrlen)) {
+        DECOM_LOG_CRIT("Socket bind() failed with error " << errno);
+        close_socket();
+        ::freeaddrinfo(result);
+        return false;
+      }
+      DECOM_LOG_INFO("Server bound to ") << address_to_string(reinterpret_cast<struct sockaddr_storage*>(result->ai_addr)).str().c_str();
+    }
+    else {
+      // C L I E N T
+
+      // bind non default source address/port if given
+      if (!source_addr_.empty()) {
+        // source address is given, resolve it
+        struct addrinfo* addr_src = resolve_address(source_addr_.c_str());
+        if (addr_src) {
+          // bind socket
+          if (::bind(socket_, addr_src->ai_addr, addr_src->ai_addrlen)) {
+            DECOM_LOG_WARN("Source bind() failed with error " << errno);
+          }
+          ::freeaddrinfo(addr_src);
+        }
+      }
+
+      // connect socket, this sets the default destination and filters the received datagrams
+      if (::connect(socket_, result->ai_addr, result->ai_addrlen)) {
+        DECOM_LOG_WARN("Socket connect() failed with error " << errno);
+        close_socket();
+        ::freeaddrinfo(result);
+        return false;
+      }
+    }
+
+    // free result
+    ::freeaddrinfo(result);
+
+    // receiving is done by the receive thread
+    {
+      std::lock_guard<std::mutex> lock(events_mutex_);
+      rx_paused_  = false;
+      tx_blocked_ = false;
+    }
+    struct epoll_event ev = { };
+    ev.events  = EPOLLIN;
+    ev.data.fd = socket_;
+    if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, socket_, &ev)) {
+      DECOM_LOG_CRIT("Registering socket failed with error " << errno);
+      close_socket();
+      return false;
+    }
+
+    // there's no connection, the socket can be used now
+    communicator::indication(connected, eid_any);
+
+    return true;
+  }
+
+
+  /**
+   * Called by upper layer to close this layer
+   * \param id Unused
+   */
+  virtual void close(eid const& id = eid_any)
+  {
+    (void)id;   // unused
+
+    if (socket_ < 0) {
+      // not open / already closed
+      return;
+    }
+
+    // send the queued datagrams, the ones which don't fit into the socket buffer anymore are dropped
+    tx_send(true);
+
+    DECOM_LOG_DEBUG("Closing socket");
+    (void)::epoll_ctl(epoll_, EPOLL_CTL_DEL, socket_, nullptr);
+    {
+      // the tx timer may send meanwhile
+      std::lock_guard<std::mutex> lock(tx_mutex_);
+      close_socket();
+    }
+
+    communicator::indication(disconnected, eid_any);
+  }
+
+
+  /**
+   * Called by upper layer to transmit a datagram
+   * \param data The datagram to send
+   * \param id The endpoint identifier (destination addr/port), ignored in client mode
+   * \param more true if more datagrams follow, the datagram is queued then and sent with the last one
+   * \return true if Send is successful
+   */
+  virtual bool send(msg& data, eid const& id = eid_any, bool more = false)
+  {
+    if (socket_ < 0) {
+      // not open / already closed
+      DECOM_LOG_ERROR("Sending failed: socket is not open");
+      return false;
+    }
+
+    if (data.size() > COM_UDP_DATAGRAM_SIZE) {
+      DECOM_LOG_ERROR("Sending failed: datagram exceeds the mtu");
+      return false;
+    }
+
+    if (server_ && id.is_any()) {
+      DECOM_LOG_ERROR("Sending failed: no destination eid given");
+      return false;
+    }
+
+    tx_indication_type ind[COM_UDP_BATCH_SIZE];
+    std::size_t ind_count = 0U;
+    {
+      std::lock_guard<std::mutex> lock(tx_mutex_);
+
+      // queue the datagram
+      if (data.segment_count() > COM_UDP_IOV_MAX) {
+        DECOM_LOG_ERROR("Sending failed: datagram has too many segments");
+        return false;
+      }
+      if (tx_count_ == COM_UDP_BATCH_SIZE) {
+        // the socket buffer is full, the upper layer sends again after a tx_done indication
+        DECOM_LOG_WARN("Sending failed: transmit queue is full");
+        return false;
+      }
+      const std::size_t n = tx_count_;
+      tx_msg_.emplace_back(data, msg::ref_type());   // cheap copy, no page is allocated
+      tx_id_[n] = id;
+      std::memset(&tx_hdr_[n], 0, sizeof(struct mmsghdr));
+      tx_hdr_[n].msg_hdr.msg_iov    = tx_iov_[n];
+      tx_hdr_[n].msg_hdr.msg_iovlen = tx_msg_[n].get_segments(tx_iov_[n], COM_UDP_IOV_MAX);
+      if (server_) {
+        tx_hdr_[n].msg_hdr.msg_name    = &tx_addr_[n];
+        tx_hdr_[n].msg_hdr.msg_namelen = eid_to_address(id, &tx_addr_[n]);
+      }
+      tx_count_++;
+
+      // send the queue if no more datagrams follow or if it's full, a blocked queue is sent on EPOLLOUT
+      if (!tx_blocked_ && (!more || (tx_count_ == COM_UDP_BATCH_SIZE))) {
+        tx_flush(ind, ind_count);
+      }
+      else if (!tx_blocked_ && !tx_timer_.is_running()) {
+        // send the queue if no further datagram comes in time
+        tx_timer_.start(std::chrono::microseconds(static_cast<std::chrono::microseconds::rep>(COM_UDP_FLUSH_TIME_US)), false, &udp::tx_timeout, this);
+      }
+    }
+
+    // the datagram is queued, tx_done is indicated when it's sent
+    tx_indicate(ind, ind_count);
+    return true;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////
+  // C O M M U N I C A T O R   A P I
+
+  /**
+   * UDP CLIENT mode: Set the client (source) address/port in and define other address/port than default.
+   * Set this BEFORE calling open()!
+   * \param address The source address in the form of "host:port", "IP:port" (IPv4) or "[IP]:port" (IPv6)
+   */
+  void set_source_address(const std::string& address)
+  {
+    // already open?
+    if (socket_ >= 0) {
+      DECOM_LOG_ERROR("Socket already open, source address can't be changed anymore");
+    }
+
+    source_addr_ = address;
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+
+
+  static void receive_thread(void* arg)
+  {
+    udp* i = static_cast<udp*>(arg);
+
+    struct epoll_event events[2];
+    while (i->running_) {
+      const int count = ::epoll_wait(i->epoll_, events, 2, -1);
+      if (count < 0) {
+        if (errno != EINTR) {
+          DECOM_LOG_ERROR2("epoll_wait() failed with error " << errno, i->name_);
+        }
+        continue;
+      }
+      for (int n = 0; (n < count) && i->running_; n++) {
+        if (events[n].data.fd == i->socket_) {
+          i->socket_event(events[n].events);
+        }
+      }
+    }
+
+    DECOM_LOG_DEBUG2("Terminating receive thread", i->name_);
+  }
+
+
+  // the queued datagrams weren't sent in time or the socket buffer was full
+  static void tx_timeout(void* arg)
+  {
+    static_cast<udp*>(arg)->tx_send(false);
+  }
+
+
+#if defined(DECOM_REACTOR)
+  // reactor mode: the epoll instance is readable
+  static void reactor_handler(void* arg, std::uint32_t)
+  {
+    udp* i = static_cast<udp*>(arg);
+    struct epoll_event events[2];
+    const int count = ::epoll_wait(i->epoll_, events, 2, 0);
+    for (int n = 0; n < count; n++) {
+      if (events[n].data.fd == i->socket_) {
+        i->socket_event(events[n].events);
+      }
+      else if (events[n].data.fd == i->rx_free_event_) {
+        i->rx_resume();
+      }
+    }
+  }
+
+
+  // reactor mode: the pool has free pages again, called by the thread which frees the page
+  static void rx_free(void* arg)
+  {
+    const std::uint64_t one = 1U;
+    if (::write(static_cast<udp*>(arg)->rx_free_event_, &one, sizeof(one)) != sizeof(one)) {
+      DECOM_LOG_ERROR2("Triggering free pages event failed", static_cast<udp*>(arg)->name_);
+    }
+  }
+#endif
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// H E L P E R
+private:
+
+  // event of the socket, receive thread or reactor thread
+  void socket_event(std::uint32_t events)
+  {
+    if (events & EPOLLOUT) {
+      // the socket buffer takes the blocked datagrams now
+      tx_send(false);
+    }
+    if (events & (EPOLLIN | EPOLLERR)) {
+      rx_drain();
+    }
+  }
+
+
+  // receive all available datagrams
+  void rx_drain()
+  {
+    msg_pool& pool = msg::get_msg_pool(COM_UDP_DATAGRAM_SIZE);
+    const std::size_t pages = COM_UDP_DATAGRAM_SIZE / pool.page_size() + 2U;   // +1 rest, +1 page begin offset
+    const std::chrono::milliseconds timeout(static_cast<std::chrono::milliseconds::rep>(COM_UDP_POOL_WAIT_MS));
+
+    for (;;) {
+#if defined(DECOM_REACTOR)
+      if (reactor_ && !pool.has_free(pages)) {
+        // the reactor thread must not block, pause the level triggered socket until the pool has free pages again
+        rx_pause(pool, pages);
+        return;
+      }
+#endif
+      // back-pressure: don't read before the pool can take a datagram, datagrams are queued in the socket meanwhile
+      while (!pool.wait_free(pages, timeout)) {
+        if (!running_) {
+          return;
+        }
+      }
+
+      // provide datagram buffers for up to half of the free pages, the rest is left to the upper layers
+      // and to the pages which are cached by other threads
+      const std::size_t budget = (pool.max_size() - pool.used_pages()) / 2U / pages;
+      const std::size_t limit  = budget < 1U ? 1U : (budget > COM_UDP_BATCH_SIZE ? COM_UDP_BATCH_SIZE : budget);
+      std::size_t batch = 0U;
+      for (; batch < limit; batch++) {
+        // the msg isn't shared, so the datagram can be received in place
+        rx_msg_.emplace_back(pool);
+        if (!rx_msg_[batch].resize(COM_UDP_DATAGRAM_SIZE, false)) {
+          rx_msg_.pop_back();
+          break;
+        }
+        std::memset(&rx_hdr_[batch], 0, sizeof(struct mmsghdr));
+        rx_hdr_[batch].msg_hdr.msg_iov     = rx_iov_[batch];
+        rx_hdr_[batch].msg_hdr.msg_iovlen  = rx_msg_[batch].get_segments(rx_iov_[batch], COM_UDP_IOV_MAX);
+        rx_hdr_[batch].msg_hdr.msg_name    = &rx_addr_[batch];
+        rx_hdr_[batch].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+      }
+      if (!batch) {
+        // pool was emptied meanwhile or the free pages are cached by other threads
+#if defined(DECOM_REACTOR)
+        if (reactor_) {
+          rx_pause(pool, pages);
+          return;
+        }
+#endif
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+
+      const int count = ::recvmmsg(socket_, rx_hdr_, static_cast<unsigned int>(batch), MSG_DONTWAIT, nullptr);
+      for (int n = 0; n < count; n++) {
+        if (rx_hdr_[n].msg_hdr.msg_flags & MSG_TRUNC) {
+          DECOM_LOG_WARN("Datagram exceeds the mtu, dropped");
+          communicator::indication(rx_overrun, server_ ? address_to_eid(&rx_addr_[n]) : eid_any);
+          continue;
+        }
+        (void)rx_msg_[n].resize(rx_hdr_[n].msg_len);
+        communicator::receive(rx_msg_[n], server_ ? address_to_eid(&rx_addr_[n]) : eid_any);
+      }
+      // release the pages of the batch
+      rx_msg_.clear();
+
+      if (count < static_cast<int>(batch)) {
+        if ((count < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+          DECOM_LOG_ERROR("recvmmsg() failed with error " << errno);
+          communicator::indication(rx_error, eid_any);
+        }
+        // all datagrams read
+        return;
+      }
+    }
+  }
+
+
+#if defined(DECOM_REACTOR)
+  // reactor mode: pause receiving until the pool notifies that the given number of pages is free
+  void rx_pause(msg_pool& pool, std::size_t pages)
+  {
+    (void)update_events(rx_paused_, true);
+    if (!pool.notify_free(pages, &udp::rx_free, this)) {
+      // freed meanwhile
+      rx_free(this);
+    }
+  }
+
+
+  // reactor mode: resume the paused receiver, the level triggered socket reports the queued datagrams
+  void rx_resume()
+  {
+    std::uint64_t count;
+    (void)!::read(rx_free_event_, &count, sizeof(count));
+    if (socket_ >= 0) {
+      (void)update_events(rx_paused_, false);
+    }
+  }
+#endif
+
+
+  // set the given state flag (rx_paused_ or tx_blocked_) and the epoll events of the socket accordingly
+  // EPOLLOUT is only used while datagrams are blocked, the events of rx and tx are set under one lock
+  bool update_events(bool& flag, bool value)
+  {
+    std::lock_guard<std::mutex> lock(events_mutex_);
+    flag = value;
+    struct epoll_event ev = { };
+    ev.events  = (rx_paused_ ? 0U : static_cast<std::uint32_t>(EPOLLIN)) | (tx_blocked_ ? static_cast<std::uint32_t>(EPOLLOUT) : 0U);
+    ev.data.fd = socket_;
+    return ::epoll_ctl(epoll_, EPOLL_CTL_MOD, socket_, &ev) == 0;
+  }
+
+
+  /**
+   * Send the queued datagrams and indicate them
+   * \param drop true to drop the datagrams which can't be sent now, e.g. on close
+   */
+  void tx_send(bool drop)
+  {
+    tx_indication_type ind[COM_UDP_BATCH_SIZE];
+    std::size_t ind_count = 0U;
+    {
+      std::lock_guard<std::mutex> lock(tx_mutex_);
+      if (socket_ >= 0) {
+        tx_flush(ind, ind_count);
+      }
+      if (drop || (socket_ < 0)) {
+        for (std::size_t n = tx_head_; n < tx_count_; n++) {
+          ind[ind_count].id   = tx_id_[n];
+          ind[ind_count].code = tx_error;
+          ind_count++;
+        }
+        tx_msg_.clear();
+        tx_head_    = 0U;
+        tx_count_   = 0U;
+        (void)update_events(tx_blocked_, false);
+      }
+    }
+    tx_indicate(ind, ind_count);
+  }
+
+
+  /**
+   * Send the queued datagrams, the tx mutex must be locked
+   * If the socket buffer is full, the rest stays queued and is sent on EPOLLOUT
+   * \param ind Indications of the sent datagrams, indicated by tx_indicate() after the tx mutex is released
+   * \param ind_count Number of indications
+   */
+  void tx_flush(tx_indication_type* ind, std::size_t& ind_count)
+  {
+    while (tx_head_ < tx_count_) {
+      const int count = ::sendmmsg(socket_, &tx_hdr_[tx_head_], static_cast<unsigned int>(tx_count_ - tx_head_), 0);
+      if (count < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+          // socket buffer full, don't block - send the rest when the socket is writable again
+          (void)update_events(tx_blocked_, true);
+          return;
+        }
+        DECOM_LOG_ERROR("sendmmsg() failed with error " << errno << ", eid ") << format_eid(tx_id_[tx_head_]).str().c_str();
+        // skip the failed datagram
+        ind[ind_count].id   = tx_id_[tx_head_];
+        ind[ind_count].code = tx_error;
+        ind_count++;
+        tx_head_++;
+        continue;
+      }
+      for (int n = 0; n < count; n++) {
+        ind[ind_count].id   = tx_id_[tx_head_];
+        ind[ind_count].code = tx_done;
+        ind_count++;
+        tx_head_++;
+      }
+    }
+
+    // queue is empty, release the pages
+    tx_msg_.clear();
+    tx_head_  = 0U;
+    tx_count_ = 0U;
+    if (tx_blocked_) {
+      (void)update_events(tx_blocked_, false);
+    }
+  }
+
+
+  // indicate the sent datagrams, the tx mutex must not be locked
+  void tx_indicate(const tx_indication_type* ind, std::size_t ind_count)
+  {
+    for (std::size_t n = 0U; n < ind_count; n++) {
+      communicator::indication(ind[n].code, ind[n].id);
+    }
+  }
+
+
+  eid address_to_eid(struct sockaddr_storage* addr) const
+  {
+    eid id;
+    if (addr->ss_family == AF_INET6) {
+      id.port() = ntohs(reinterpret_cast<struct sockaddr_in6*>(addr)->sin6_port);
+      memcpy(static_cast<void*>(id.addr().addr), &reinterpret_cast<struct sockaddr_in6*>(addr)->sin6_addr, 16U);
+    }
+    else {
+      id.port() = ntohs(reinterpret_cast<struct sockaddr_in*>(addr)->sin_port);
+      memcpy(static_cast<void*>(id.addr().addr), &reinterpret_cast<struct sockaddr_in*>(addr)->sin_addr, 4U);
+    }
+    return id;
+  }
+
+
+  socklen_t eid_to_address(eid const& id, struct sockaddr_storage* addr) const
+  {
+    std::memset(addr, 0, sizeof(struct sockaddr_storage));
+    if (use_ipv6_) {
+      struct sockaddr_in6* addr6 = reinterpret_cast<struct sockaddr_in6*>(addr);
+      addr6->sin6_family = AF_INET6;
+      addr6->sin6_port   = htons(static_cast<std::uint16_t>(id.port()));
+      memcpy(&addr6->sin6_addr, static_cast<const void*>(id.addr().addr), 16U);
+      return sizeof(struct sockaddr_in6);
+    }
+    struct sockaddr_in* addr4 = reinterpret_cast<struct sockaddr_in*>(addr);
+    addr4->sin_family = AF_INET;
+    addr4->sin_port   = htons(static_cast<std::uint16_t>(id.port()));
+    memcpy(&addr4->sin_addr, static_cast<const void*>(id.addr().addr), 4U);
+    return sizeof(struct sockaddr_in);
+  }
+
+
+  void close_socket()
+  {
+    (void)::close(socket_);
+    socket_ = -1;
+  }
+
+
+  std::stringstream format_eid(eid const& id) const
+  {
+    std::stringstream eid_str;
+    if (id.is_any()) {
+      eid_str << "ANY";
+    }
+    else {
+      eid_str << std::hex << id.addr().addr32[0] << "."
+              << std::hex << id.addr().addr32[1] << "."
+              << std::hex << id.addr().addr32[2] << "."
+              << std::hex << id.addr().addr32[3] << ":"
+              << std::dec << id.port();
+    }
+    return eid_str;
+  }
+
+
+  std::stringstream address_to_string(struct sockaddr_storage* addr) const
+  {
+    char ip[INET6_ADDRSTRLEN] = { };
+    std::stringstream str;
+    if (addr->ss_family == AF_INET6) {
+      (void)::inet_ntop(AF_INET6, &reinterpret_cast<struct sockaddr_in6*>(addr)->sin6_addr, ip, sizeof(ip));
+      str << "[" << ip << "]:" << ntohs(reinterpret_cast<struct sockaddr_in6*>(addr)->sin6_port);
+    }
+    else {
+      (void)::inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in*>(addr)->sin_addr, ip, sizeof(ip));
+      str << ip << ":" << ntohs(reinterpret_cast<struct sockaddr_in*>(addr)->sin_port);
+    }
+    return str;
+  }
+
+
+  // CAUTION: The returned addrinfo MUST BE FREED with freeaddrinfo();
+  struct addrinfo* resolve_address(const char* address) const
+  {
+    // extract host and port from address
+    std::string host(address);
+    std::string port(address);
+
+    // IPv6 IP address given?
+    std::string::size_type c = host.rfind("]:");
+    if (c != std::string::npos) {
+      // yes cut off port
+      host.erase(c, host.length() - c);
+      // remove start bracket
+      if (host.find("[") != std::string::npos) {
+        host.erase(host.begin() + host.find("["));
+      }
+      // cut off address
+      port.erase(0, c + 2U);
+    }
+    else {
+      c = host.rfind(":");
+      if (c != std::string::npos) {
+        // cut off port
+        host.erase(c, host.length() - c);
+        // cut off address
+        port.erase(0, c + 1U);
+      }
+      else {
+        port.clear();
+      }
+    }
+
+    // resolve address
+    struct addrinfo* result = nullptr;
+    struct addrinfo hints = { };
+    hints.ai_family   = use_ipv6_ ? AF_INET6 : AF_INET;     // use IPv4 or IPv6
+    hints.ai_socktype = SOCK_DGRAM;                         // UDP
+    hints.ai_protocol = IPPROTO_UDP;                        // UDP
+    hints.ai_flags    = server_ ? AI_PASSIVE : 0;           // wildcard address for an empty server host
+    const int err = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+    if (err) {
+      DECOM_LOG_ERROR("Address " << address << " can't be resolved, getaddrinfo() failed with error " << ::gai_strerror(err));
+      return nullptr;
+    }
+    DECOM_LOG_DEBUG("'" << address << "' resolved to ") << address_to_string(reinterpret_cast<struct sockaddr_storage*>(result->ai_addr)).str().c_str();
+
+    return result;
+  }
+};
+
+} // namespace com
+} // namespace decom
+
+#endif  // _DECOM_COM_UDP_H_
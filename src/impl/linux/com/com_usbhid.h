@@ -0,0 +1,657 @@
+///////////////////////////////////////////////////////////////////////////////
+// \author (c) Marco Paland (info@paland.com)
+//             2014-2021, PALANDesign Hannover, Germany
+//
+// \license The MIT License (MIT)
+//
+// This file is part of the decom library.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// \brief Linux USB HID device communication class
+//
+// This class is used to communicate with USB HID devices via hidraw
+//
+// Example usage:
+// decom::com::usbhid usb;
+// decom::dev::generic gen(&usb);
+// std::vector<decom::com::usbhid::hid_device_info_type> dev_info = usb.enumerate();  // enum all devices
+// gen.open(dev_info[0].path, 0);  // open first device (for demo)
+// gen.write(std::string("12345678901234567890"));
+// gen.close();
+//
+// The device is opened by its path (like '/dev/hidraw0') or by its VID/PID
+// given in hex, optionally followed by the serial number:
+// 'VID:PID' or 'VID:PID:serial', like '046d:c52b' or '046d:c52b:0123456'
+//
+// Received input reports are passed with the report ID as eid port.
+// send() uses the eid port as report ID of the output reports.
+// The read/write access to the hidraw device node is needed, the class can be
+// tested with a virtual device of the uhid driver.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _DECOM_COM_USBHID_H_
+#define _DECOM_COM_USBHID_H_
+
+#include <linux/hidraw.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdlib>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#include "../../../com.h"
+
+
+/////////////////////////////////////////////////////////////////////
+
+namespace decom {
+namespace com {
+
+
+class usbhid : public communicator
+{
+  // defines the time the receive thread waits for free msg pages before it checks for termination
+  static const std::size_t COM_USBHID_POOL_WAIT_MS = 100U;
+
+public:
+  /**
+   * Normal com ctor
+   * \param name Layer name
+   */
+  usbhid(const char* name = "com_usbhid")
+    : communicator(name)   // it's VERY IMPORTANT to call the base class ctor HERE!!!
+    , device_fd_(-1)
+    , epoll_(-1)
+    , terminate_event_(-1)
+    , rx_thread_(nullptr)
+    , tx_thread_(nullptr)
+    , running_(false)
+    , tx_busy_(false)
+  { }
+
+
+  /**
+   * dtor
+   */
+  ~usbhid()
+  {
+    // close device
+    close();
+  }
+
+
+  /**
+   * Called by upper layer to open this layer
+   * \param address Path of the HID device to open (given in hid_device_info structure of enumerate())
+   *                or 'VID:PID' / 'VID:PID:serial' in hex
+   * \param id Unused
+   * \return true if open is successful
+   */
+  bool open(const char* address = "", eid const& id = eid_any)
+  {
+    (void)id;
+
+    // for security: check that upper protocol/device exists
+    if (!upper_) {
+      return false;
+    }
+
+    if (!address || !(*address)) {
+      // invalid address
+      return false;
+    }
+
+    close();    // just in case layer was already open
+
+    // open device
+    std::string path(address);
+    if (path.find('/') == std::string::npos) {
+      // VID:PID[:serial] given
+      char* end;
+      const std::uint16_t vendor_id  = static_cast<std::uint16_t>(std::strtoul(address, &end, 16));
+      const std::uint16_t product_id = static_cast<std::uint16_t>(*end == ':' ? std::strtoul(end + 1, &end, 16) : 0U);
+      const char* serial_number = (*end == ':') ? end + 1 : nullptr;
+      device_fd_ = open_device(vendor_id, product_id, serial_number, path);
+    }
+    else {
+      device_fd_ = open_device(path.c_str());
+    }
+    if (device_fd_ < 0) {
+      // error opening device
+      DECOM_LOG_ERROR("Error opening device ") << address;
+      return false;
+    }
+
+    // setup device info
+    device_info_ = get_device_info(path);
+
+    ///////////////////// create receive/transmit thread ////////////////////////////
+
+    epoll_           = ::epoll_create1(EPOLL_CLOEXEC);
+    terminate_event_ = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = { };
+    ev.events  = EPOLLIN;
+    ev.data.fd = terminate_event_;
+    bool res = (epoll_ >= 0) && (terminate_event_ >= 0) && !::epoll_ctl(epoll_, EPOLL_CTL_ADD, terminate_event_, &ev);
+    ev.data.fd = device_fd_;
+    res = res && !::epoll_ctl(epoll_, EPOLL_CTL_ADD, device_fd_, &ev);
+    if (!res) {
+      // error to create events - close all
+      DECOM_LOG_ERROR("Error creating events");
+      close();
+      return false;
+    }
+
+    running_   = true;
+    tx_busy_   = false;
+    rx_thread_ = new std::thread(&usbhid::rx_thread, this);
+    tx_thread_ = new std::thread(&usbhid::tx_thread, this);
+
+    // send port open indication
+    communicator::indication(connected);
+
+    return true;
+  }
+
+
+  /**
+   * Called by upper layer to close this layer
+   * \param id Unused
+   */
+  void close(eid const& id = eid_any)
+  {
+    (void)id;
+
+    // stop the receive and transmit thread
+    if (rx_thread_) {
+      {
+        std::lock_guard<std::mutex> lock(tx_mutex_);
+        running_ = false;
+      }
+      tx_cv_.notify_one();
+      const std::uint64_t one = 1U;
+      if (::write(terminate_event_, &one, sizeof(one)) != sizeof(one)) {
+        DECOM_LOG_ERROR("Triggering terminate event failed");
+      }
+      rx_thread_->join();
+      tx_thread_->join();
+      delete rx_thread_;
+      delete tx_thread_;
+      rx_thread_ = nullptr;
+      tx_thread_ = nullptr;
+      tx_msg_.clear();
+    }
+    if (terminate_event_ >= 0) {
+      (void)::close(terminate_event_);
+      terminate_event_ = -1;
+    }
+    if (epoll_ >= 0) {
+      (void)::close(epoll_);
+      epoll_ = -1;
+    }
+
+    // close device
+    if (is_open()) {
+      (void)::close(device_fd_);
+      device_fd_ = -1;
+
+      // port closed indication
+      communicator::indication(disconnected);
+    }
+  }
+
+
+  /**
+   * Called by upper layer to transmit data to this communication endpoint / physical layer
+   * \param data Data to send
+   * \param id eid.port is used as report ID (default is 0)
+   * \param more unused
+   * \return true if Send is successful
+   */
+  bool send(msg& data, eid const& id = eid_any, bool more = false)
+  {
+    (void)more;
+
+    // validate device
+    if (!is_open()) {
+      DECOM_LOG_ERROR("Sending failed: device is not open");
+      return false;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(tx_mutex_);
+
+      // if a transfer is in progress, no new data can be accepted
+      if (tx_busy_) {
+        // abort - did you wait for tx_done indication?
+        DECOM_LOG_WARN("Transmission already in progress, data not accepted");
+        return false;
+      }
+
+      tx_busy_ = true;
+      tx_msg_.ref_copy(data);   // store a cheap copy
+      tx_eid_  = id;            // store the id
+    }
+    tx_cv_.notify_one();
+
+    // sending in progress now, indication is handled in transmit thread
+    return true;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////
+  // L A Y E R   A P I
+
+public:
+  /**
+   * HID device info structure
+   */
+  typedef struct tag_hid_device_info_type {
+    std::string   path;                 // platform specific device path - used for open()
+    std::uint16_t vendor_id;            // vendor ID
+    std::uint16_t product_id;           // product ID
+    std::string   serial_number;        // serial number
+    std::uint16_t release_number;       // release (version) number in BCD
+    std::string   manufacturer_string;  // Manufacturer String
+    std::string   product_string;       // Product string
+    std::uint16_t usage_page;           // Usage Page for this Device/Interface
+    std::uint16_t usage;                // Usage for this Device/Interface
+    std::uint16_t output_report_length; // OutputReportByteLength, including the report ID byte
+    std::uint16_t input_report_length;  // InputReportByteLength, including the report ID byte
+    std::int32_t  interface_number;     // USB interface which represents this logical device
+    bool          report_ids;           // true if the device uses numbered reports
+  } hid_device_info_type;
+
+
+  /**
+   * Enumerate USB HID devices.
+   * This function returns a list of all the HID devices attached to the system
+   * which match the vendor_id and product_id.
+   * If vendor_id and product_id are both set to 0, then all HID devices are returned.
+   * \param vendor_id The Vendor ID (VID) of the device to match
+   * \param product_id The Product ID (PID) of the device to match
+   * \return Returns a vector of available/matching devices
+   */
+  std::vector<hid_device_info_type> enumerate(std::uint16_t vendor_id = 0U, std::uint16_t product_id = 0U)
+  {
+    std::vector<hid_device_info_type> result;
+
+    DIR* dir = ::opendir("/sys/class/hidraw");
+    if (!dir) {
+      // no hidraw support
+      return result;  // return empty vector
+    }
+
+    for (struct dirent* entry = ::readdir(dir); entry; entry = ::readdir(dir)) {
+      if (std::string(entry->d_name).compare(0U, 6U, "hidraw")) {
+        // skip '.' and '..'
+        continue;
+      }
+      const hid_device_info_type device_info = get_device_info(std::string("/dev/") + entry->d_name);
+
+      // check the VID/PID to see if we should add this device to the enumeration list
+      if ((vendor_id == 0U && product_id == 0U) ||
+          (device_info.vendor_id == vendor_id && device_info.product_id == product_id))
+      {
+        // VID/PID match - create entry
+        result.push_back(device_info);
+      }
+    }
+    (void)::closedir(dir);
+
+    return result;
+  }
+
+
+  /**
+   * Send a feature report to the device
+   * \param report_id Report ID
+   * \param data Report data
+   * \return true if successful
+   */
+  bool send_feature_report(std::uint8_t report_id, msg const& data)
+  {
+    tmp_buf_.resize(data.size() + 1U);
+    tmp_buf_[0] = report_id;
+    (void)data.get(&tmp_buf_[1], data.size());
+    return ::ioctl(device_fd_, HIDIOCSFEATURE(tmp_buf_.size()), &tmp_buf_[0]) == static_cast<int>(tmp_buf_.size());
+  }
+
+
+  /**
+   * Get a feature report from the device
+   * \param report_id Report ID
+   * \param data Report data
+   * \return true if successful
+   */
+  bool get_feature_report(std::uint8_t report_id, msg& data)
+  {
+    tmp_buf_.resize(HID_MAX_DESCRIPTOR_SIZE);
+    tmp_buf_[0] = report_id;
+    const int bytes_returned = ::ioctl(device_fd_, HIDIOCGFEATURE(tmp_buf_.size()), &tmp_buf_[0]);
+    if (bytes_returned < 1) {
+      return false;
+    }
+    // the first byte contains the report ID
+    data.clear();
+    return data.append(&tmp_buf_[1], static_cast<std::size_t>(bytes_returned) - 1U);
+  }
+
+
+  int open_device(const char* path)
+  {
+    return ::open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  }
+
+
+  int open_device(std::uint16_t vendor_id, std::uint16_t product_id, const char* serial_number, std::string& path)
+  {
+    std::vector<hid_device_info_type> devs = enumerate(vendor_id, product_id);
+    for (std::vector<hid_device_info_type>::const_iterator it = devs.begin(); it != devs.end(); ++it) {
+      if (!serial_number || (serial_number == it->serial_number)) {
+        path = it->path;
+        return open_device(it->path.c_str());
+      }
+    }
+    // no device found
+    return -1;
+  }
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+private:
+  /**
+   * Check if the device is open
+   * \return true if the device is open
+   */
+  inline bool is_open() const
+  { return device_fd_ >= 0; }
+
+
+  // receive thread
+  static void rx_thread(void* arg)
+  {
+    usbhid* u = static_cast<usbhid*>(arg);
+    const std::size_t length = u->device_info_.input_report_length ? u->device_info_.input_report_length : HID_MAX_DESCRIPTOR_SIZE;
+    msg_pool& pool = msg::get_msg_pool(length);
+    const std::size_t pages = length / pool.page_size() + 2U;
+    const std::chrono::milliseconds timeout(static_cast<std::chrono::milliseconds::rep>(COM_USBHID_POOL_WAIT_MS));
+
+    // validate port - MUST be open and active
+    DECOM_LOG_VERIFY(u->is_open());
+
+    while (u->running_) {
+      struct epoll_event ev;
+      const int count = ::epoll_wait(u->epoll_, &ev, 1, -1);
+      if ((count <= 0) || (ev.data.fd != u->device_fd_)) {
+        // interrupted or terminate event
+        continue;
+      }
+      if (ev.events & (EPOLLHUP | EPOLLERR)) {
+        // device gone
+        DECOM_LOG_ERROR2("Device error, receiving stopped", u->name_);
+        u->communicator::indication(rx_error);
+        break;
+      }
+
+      // read all pending reports, each read returns one report
+      for (;;) {
+        // back-pressure: don't read before the pool can take the report, the driver buffers it meanwhile
+        while (u->running_ && !pool.wait_free(pages < pool.max_size() ? pages : pool.max_size(), timeout));
+        if (!u->running_) {
+          break;
+        }
+
+        // read directly into the pages of the msg
+        msg data(pool);
+        if (!data.resize(length, false)) {
+          u->communicator::indication(rx_overrun);
+          break;
+        }
+        struct iovec iov[8];
+        const ssize_t bytes_read = ::readv(u->device_fd_, iov, static_cast<int>(data.get_segments(iov, 8U)));
+        if (bytes_read <= 0) {
+          if ((bytes_read < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+            // device error, removed etc.
+            u->communicator::indication(rx_error);
+          }
+          break;
+        }
+        (void)data.resize(static_cast<std::size_t>(bytes_read));
+
+        // numbered reports start with the report ID, use it as channel
+        std::uint32_t report_id = 0U;
+        if (u->device_info_.report_ids) {
+          report_id = data.front();
+          data.pop_front();
+        }
+        u->communicator::receive(data, eid(report_id));
+      }
+    }
+
+    DECOM_LOG_DEBUG2("Terminating receive thread", u->name_);
+  }
+
+
+  // transmit thread
+  static void tx_thread(void* arg)
+  {
+    usbhid* u = static_cast<usbhid*>(arg);
+
+    // output report: report ID (0 for unnumbered reports) followed by the report data
+    const std::size_t length = u->device_info_.output_report_length > 1U ? u->device_info_.output_report_length - 1U : 0U;
+
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(u->tx_mutex_);
+        u->tx_cv_.wait(lock, [u] { return !u->running_ || u->tx_busy_; });
+        if (!u->running_) {
+          break;
+        }
+      }
+
+      // send the msg in segments of the output report size, tx_msg_ is not changed while tx_busy_ is set
+      // a report needs one write() call, so the report is assembled in a linear buffer
+      bool res = true;
+      const std::size_t segment = length ? length : u->tx_msg_.size();
+      for (std::size_t offset = 0U; res && (offset < u->tx_msg_.size()); offset += segment) {
+        u->tx_buf_.assign(segment + 1U, 0U);
+        u->tx_buf_[0] = static_cast<std::uint8_t>(u->tx_eid_.port());   // byte 0 is the report id
+        (void)u->tx_msg_.get(&u->tx_buf_[1], segment, offset);
+        ssize_t bytes_written;
+        do {
+          bytes_written = ::write(u->device_fd_, &u->tx_buf_[0], u->tx_buf_.size());
+        } while ((bytes_written < 0) && (errno == EINTR));
+        res = bytes_written == static_cast<ssize_t>(u->tx_buf_.size());
+      }
+
+      decom::eid id;
+      {
+        std::lock_guard<std::mutex> lock(u->tx_mutex_);
+        u->tx_msg_.clear();
+        u->tx_busy_ = false;
+        id = u->tx_eid_;
+        if (!u->running_) {
+          break;
+        }
+      }
+      u->communicator::indication(res ? tx_done : tx_error, id);    // inform upper layer
+    }
+
+    DECOM_LOG_DEBUG2("Terminating transmit thread", u->name_);
+  }
+
+
+  // returns information about the device, out of sysfs and the report descriptor
+  hid_device_info_type get_device_info(const std::string& path)
+  {
+    hid_device_info_type device_info;
+    device_info.path                 = path;
+    device_info.vendor_id            = 0U;
+    device_info.product_id           = 0U;
+    device_info.release_number       = 0U;
+    device_info.usage_page           = 0U;
+    device_info.usage                = 0U;
+    device_info.output_report_length = 0U;
+    device_info.input_report_length  = 0U;
+    device_info.interface_number     = -1;
+    device_info.report_ids           = false;
+
+    // sysfs device directory of the hidraw node
+    const std::string sys = "/sys/class/hidraw/" + path.substr(path.rfind('/') + 1U) + "/device/";
+
+    // VID/PID, serial number and name out of 'HID_ID=0003:0000046D:0000C52B', 'HID_UNIQ=...', 'HID_NAME=...'
+    std::ifstream uevent((sys + "uevent").c_str());
+    for (std::string line; std::getline(uevent, line); ) {
+      if (!line.compare(0U, 7U, "HID_ID=")) {
+        char* end;
+        (void)std::strtoul(line.c_str() + 7U, &end, 16);    // bus type
+        device_info.vendor_id  = static_cast<std::uint16_t>(std::strtoul(end + 1, &end, 16));
+        device_info.product_id = static_cast<std::uint16_t>(std::strtoul(end + 1, &end, 16));
+      }
+      else if (!line.compare(0U, 9U, "HID_UNIQ=")) {
+        device_info.serial_number = line.substr(9U);
+      }
+      else if (!line.compare(0U, 9U, "HID_NAME=")) {
+        device_info.product_string = line.substr(9U);
+      }
+    }
+
+    // USB interface and device attributes
+    const std::string interface_number = read_file(sys + "../bInterfaceNumber");
+    if (!interface_number.empty()) {
+      device_info.interface_number = util::hex2int<std::int32_t>(interface_number.c_str());
+    }
+    const std::string release_number = read_file(sys + "../../bcdDevice");
+    if (!release_number.empty()) {
+      device_info.release_number = util::hex2int<std::uint16_t>(release_number.c_str());
+    }
+    const std::string manufacturer = read_file(sys + "../../manufacturer");
+    if (!manufacturer.empty()) {
+      device_info.manufacturer_string = manufacturer;
+    }
+    const std::string product = read_file(sys + "../../product");
+    if (!product.empty()) {
+      device_info.product_string = product;
+    }
+
+    // get the usage page, usage and the report lengths out of the report descriptor
+    std::ifstream descriptor((sys + "report_descriptor").c_str(), std::ios::binary);
+    const std::vector<std::uint8_t> desc((std::istreambuf_iterator<char>(descriptor)), std::istreambuf_iterator<char>());
+    parse_report_descriptor(desc, device_info);
+
+    return device_info;
+  }
+
+
+  // parse the report descriptor for the usage page/usage of the first collection and the maximum report lengths
+  static void parse_report_descriptor(const std::vector<std::uint8_t>& desc, hid_device_info_type& device_info)
+  {
+    std::uint32_t usage_page = 0U, report_size = 0U, report_count = 0U;
+    std::uint32_t input_bits[256] = { 0U }, output_bits[256] = { 0U };
+    std::uint8_t  report_id = 0U;
+    bool usage_found = false;
+
+    for (std::size_t i = 0U; i < desc.size(); ) {
+      const std::uint8_t prefix = desc[i];
+      if (prefix == 0xFEU) {
+        // long item - skip it
+        i += 3U + (i + 1U < desc.size() ? desc[i + 1U] : 0U);
+        continue;
+      }
+      const std::size_t size = (prefix & 0x03U) == 3U ? 4U : (prefix & 0x03U);
+      std::uint32_t value = 0U;
+      for (std::size_t n = 0U; (n < size) && (i + 1U + n < desc.size()); n++) {
+        value |= static_cast<std::uint32_t>(desc[i + 1U + n]) << (8U * n);
+      }
+      switch (prefix & 0xFCU) {
+        case 0x04U : usage_page   = value; break;                                  // global: usage page
+        case 0x74U : report_size  = value; break;                                  // global: report size
+        case 0x94U : report_count = value; break;                                  // global: report count
+        case 0x84U : report_id    = static_cast<std::uint8_t>(value); device_info.report_ids = true; break;   // global: report ID
+        case 0x08U :                                                               // local: usage
+          if (!usage_found) {
+            device_info.usage_page = static_cast<std::uint16_t>(size == 4U ? value >> 16U : usage_page);
+            device_info.usage      = static_cast<std::uint16_t>(value);
+            usage_found = true;
+          }
+          break;
+        case 0x80U : input_bits[report_id]  += report_size * report_count; break;  // main: input
+        case 0x90U : output_bits[report_id] += report_size * report_count; break;  // main: output
+        default : break;
+      }
+      i += 1U + size;
+    }
+
+    // lengths include the report ID byte, like on other platforms
+    for (std::size_t n = 0U; n < 256U; n++) {
+      const std::uint16_t input  = static_cast<std::uint16_t>((input_bits[n] + 7U) / 8U + 1U);
+      const std::uint16_t output = static_cast<std::uint16_t>((output_bits[n] + 7U) / 8U + 1U);
+      device_info.input_report_length  = input_bits[n]  && (input  > device_info.input_report_length)  ? input  : device_info.input_report_length;
+      device_info.output_report_length = output_bits[n] && (output > device_info.output_report_length) ? output : device_info.output_report_length;
+    }
+  }
+
+
+  // read the first line of a (sysfs) file, empty if not existing
+  static std::string read_file(const std::string& path)
+  {
+    std::ifstream file(path.c_str());
+    std::string line;
+    (void)std::getline(file, line);
+    return line;
+  }
+
+
+  hid_device_info_type    device_info_;       // info of opened device
+  int                     device_fd_;         // file descriptor of the opened device
+  int                     epoll_;             // epoll instance of the receive thread
+  int                     terminate_event_;   // eventfd to trigger the receive thread out of waiting
+  std::thread*            rx_thread_;         // receive thread
+  std::thread*            tx_thread_;         // transmit thread
+  std::atomic<bool>       running_;           // threads are running
+
+  std::mutex              tx_mutex_;          // guards the tx state
+  std::condition_variable tx_cv_;             // signals a new transmission or termination
+  decom::msg              tx_msg_;            // tx msg
+  decom::eid              tx_eid_;            // tx eid (report id)
+  bool                    tx_busy_;           // tx transfer running
+  std::vector<std::uint8_t> tmp_buf_;         // static temp buffer
+  std::vector<std::uint8_t> tx_buf_;          // static linear tx buffer
+};
+
+} // namespace com
+} // namespace decom
+
+#endif    // _DECOM_COM_USBHID_H_
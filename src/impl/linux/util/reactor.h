@@ -0,0 +1,463 @@
+///////////////////////////////////////////////////////////////////////////////
+// \author (c) Marco Paland (info@paland.com)
+//             2011-2021, PALANDesign Hannover, Germany
+//
+// \license The MIT License (MIT)
+//
+// This file is part of the decom library.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// \brief Reactor implementation for Linux
+//
+// The reactor is a single threaded event loop based on epoll. File descriptor
+// readiness, timers and posted functions are dispatched by the thread which
+// calls run(), so a stack which is driven by one reactor needs no threads of
+// its own and its layers are never called concurrently.
+// All layers and timers which are constructed within a reactor::scope (or in
+// the reactor thread) are bound to the reactor:
+//
+//   decom::util::reactor r;
+//   decom::util::reactor::scope s(r);
+//   decom::com::tcp     com;            // no worker threads
+//   decom::prot::...    prot(&com);     // util::timer callbacks in the reactor thread
+//   decom::dev::generic dev(&prot);     // use non blocking writes and the receive callback
+//   r.run();
+//
+// Many reactors, each in its own thread, can be used to shard stacks across
+// the cores.
+// Communicators without reactor support keep their own threads.
+//
+// The loop itself dispatches without locks, but the layers keep their mutexes,
+// like the tx/rx mutexes of dev::generic and the session mutex of
+// prot::iso15765. Driven by one reactor they are uncontended, each costs an
+// atomic operation per call.
+//
+// A file descriptor can be removed by any thread. remove() called by another
+// thread waits until a running handler of the fd returned, so the handler
+// argument can be destroyed afterwards. That thread must not hold a lock which
+// the handler takes then.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _DECOM_UTIL_REACTOR_H_
+#define _DECOM_UTIL_REACTOR_H_
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include "../../../decom_cfg.h"
+#include "../../../log.h"
+#include "timer.h"
+
+#if !defined(DECOM_REACTOR)
+#error DECOM_REACTOR must be defined in decom_cfg.h to use the reactor
+#endif
+
+/////////////////////////////////////////////////////////////////////
+
+namespace decom {
+namespace util {
+
+
+class reactor
+{
+  // defines the number of events which are fetched per epoll_wait() call
+  static const std::size_t REACTOR_EPOLL_EVENTS = 64U;
+
+public:
+  // file descriptor handler, events are the EPOLL* flags
+  typedef void (*handler_type)(void* arg, std::uint32_t events);
+
+  // posted function
+  typedef void (*function_type)(void* arg);
+
+
+  /**
+   * Binds the construction of layers and timers in the calling thread to the reactor
+   */
+  class scope
+  {
+  public:
+    explicit scope(reactor& r)
+      : reactor_(reactor::current())
+      , service_(timer_service::bound())
+    {
+      reactor::current()     = &r;
+      timer_service::bound() = &r.timers_;
+    }
+
+    ~scope()
+    {
+      reactor::current()     = reactor_;
+      timer_service::bound() = service_;
+    }
+
+  private:
+    reactor*       reactor_;    // previous reactor
+    timer_service* service_;    // previous timer service
+
+    scope(const scope&);              // no copy
+    scope& operator=(const scope&);   // no assignment
+  };
+
+
+  /**
+   * ctor
+   */
+  reactor()
+    : running_(false)
+    , posted_(false)
+    , removed_(false)
+    , dispatching_(nullptr)
+    , events_(nullptr)
+    , event_count_(0)
+    , event_index_(0)
+  {
+    epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    post_event_ = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((epoll_ < 0) || (post_event_ < 0)) {
+      DECOM_LOG_EMERG2("Creating epoll instance failed", "reactor");
+      return;
+    }
+    (void)add(post_event_, EPOLLIN, &reactor::post_handler, this);
+    (void)add(timers_.fd(), EPOLLIN, &reactor::timer_handler, this);
+  }
+
+
+  /**
+   * dtor
+   * The reactor must not run anymore
+   */
+  ~reactor()
+  {
+    remove(timers_.fd());
+    remove(post_event_);
+    collect();
+    (void)::close(post_event_);
+    (void)::close(epoll_);
+  }
+
+
+  /**
+   * Returns the reactor which the calling thread is bound to
+   * \return Reference to the reactor pointer of the calling thread, nullptr if not bound
+   */
+  static reactor*& current()
+  {
+    static thread_local reactor* r = nullptr;
+    return r;
+  }
+
+
+  /**
+   * Run the event loop in the calling thread until stop() is called
+   * The calling thread is bound to the reactor while running
+   */
+  void run()
+  {
+    scope s(*this);
+    running_ = true;
+    while (running_) {
+      (void)run_once(std::chrono::milliseconds(-1));
+    }
+  }
+
+
+  /**
+   * Wait for events and dispatch them once
+   * Use this instead of run() to integrate the reactor in another loop
+   * \param timeout Time to wait for events, -1 to wait forever
+   * \return Number of dispatched events
+   */
+  int run_once(std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
+  {
+    if (loop_thread_.load() != std::this_thread::get_id()) {
+      loop_thread_ = std::this_thread::get_id();
+    }
+
+    struct epoll_event events[REACTOR_EPOLL_EVENTS];
+    const int count = ::epoll_wait(epoll_, events, static_cast<int>(REACTOR_EPOLL_EVENTS), static_cast<int>(timeout.count()));
+    if (count < 0) {
+      if (errno != EINTR) {
+        DECOM_LOG_ERROR2("epoll_wait() failed with error " << errno, "reactor");
+      }
+      return 0;
+    }
+
+    events_      = events;
+    event_count_ = count;
+    for (event_index_ = 0; event_index_ < event_count_; ++event_index_) {
+      source* s = static_cast<source*>(events[event_index_].data.ptr);
+      if (!s) {
+        // removed in this dispatch
+        continue;
+      }
+      // announce the dispatch before the fd is checked, remove() of another thread sets the fd
+      // before it checks the dispatch, so either the removed source is skipped or remove() waits
+      dispatching_ = s;
+      if (s->fd >= 0) {
+        s->handler(s->arg, events[event_index_].events);
+      }
+      dispatching_ = nullptr;
+    }
+    events_      = nullptr;
+    event_count_ = 0;
+
+    if (removed_) {
+      collect();
+    }
+    return count;
+  }
+
+
+  /**
+   * Stop the event loop, can be called by any thread
+   */
+  void stop()
+  {
+    running_ = false;
+    wakeup();
+  }
+
+
+  /**
+   * Post a function which is executed by the reactor thread, can be called by any thread
+   * Posted functions are executed in order
+   * \param func Function
+   * \param arg Argument which is passed to the function
+   */
+  void post(function_type func, void* arg)
+  {
+    {
+      std::lock_guard<std::mutex> lock(post_mutex_);
+      posts_.push_back(std::make_pair(func, arg));
+    }
+    if (!posted_.exchange(true)) {
+      wakeup();
+    }
+  }
+
+
+  /**
+   * Add a file descriptor to the reactor
+   * \param fd File descriptor
+   * \param events EPOLL* flags to wait for
+   * \param handler Handler which is called in the reactor thread
+   * \param arg Argument which is passed to the handler
+   * \return true if successful
+   */
+  bool add(int fd, std::uint32_t events, handler_type handler, void* arg)
+  {
+    source* s = new source;
+    s->fd      = fd;
+    s->handler = handler;
+    s->arg     = arg;
+    struct epoll_event ev = { };
+    ev.events   = events;
+    ev.data.ptr = s;
+    if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev)) {
+      DECOM_LOG_ERROR2("Adding fd " << fd << " failed with error " << errno, "reactor");
+      delete s;
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(source_mutex_);
+    sources_.push_back(s);
+    return true;
+  }
+
+
+  /**
+   * Change the events of a file descriptor
+   * \param fd File descriptor
+   * \param events EPOLL* flags to wait for
+   * \return true if successful
+   */
+  bool modify(int fd, std::uint32_t events)
+  {
+    source* s = find(fd);
+    if (!s) {
+      return false;
+    }
+    struct epoll_event ev = { };
+    ev.events   = events;
+    ev.data.ptr = s;
+    return ::epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &ev) == 0;
+  }
+
+
+  /**
+   * Remove a file descriptor from the reactor, must be called before the fd is closed
+   * If called by another thread, this waits until a running handler of the fd returned
+   * \param fd File descriptor
+   */
+  void remove(int fd)
+  {
+    source* s = find(fd);
+    if (!s) {
+      return;
+    }
+    (void)::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+
+    // skip pending events of the fd in the current dispatch and free it afterwards
+    if (in_loop()) {
+      for (int n = event_index_ + 1; n < event_count_; ++n) {
+        if (events_[n].data.ptr == s) {
+          events_[n].data.ptr = nullptr;
+        }
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(source_mutex_);
+      s->fd = -1;
+    }
+    removed_ = true;
+    if (!in_loop()) {
+      // the handler isn't called anymore, wait for the one which is running
+      while (dispatching_ == s) {
+        std::this_thread::yield();
+      }
+      // make sure that the sources are collected
+      wakeup();
+    }
+  }
+
+
+  /**
+   * Returns true if called by the reactor thread
+   */
+  inline bool in_loop() const
+  { return loop_thread_ == std::this_thread::get_id(); }
+
+
+  /**
+   * Timer service of the reactor
+   */
+  inline timer_service& timers()
+  { return timers_; }
+
+
+  /////////////////////////////////////////////////////////////////////////////
+  // P R I V A T E
+private:
+  typedef struct tag_source_type {
+    std::atomic<int> fd;        // file descriptor, -1 if removed, checked by the loop without lock
+    handler_type     handler;   // handler
+    void*            arg;       // handler argument
+  } source;
+
+
+  // find the source of the fd
+  source* find(int fd)
+  {
+    std::lock_guard<std::mutex> lock(source_mutex_);
+    for (std::vector<source*>::iterator it = sources_.begin(); it != sources_.end(); ++it) {
+      if ((*it)->fd == fd) {
+        return *it;
+      }
+    }
+    return nullptr;
+  }
+
+
+  // free the removed sources
+  void collect()
+  {
+    removed_ = false;
+    std::lock_guard<std::mutex> lock(source_mutex_);
+    for (std::vector<source*>::iterator it = sources_.begin(); it != sources_.end(); ) {
+      if ((*it)->fd < 0) {
+        delete *it;
+        it = sources_.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+
+
+  // wake up the reactor thread
+  inline void wakeup()
+  {
+    const std::uint64_t one = 1U;
+    (void)!::write(post_event_, &one, sizeof(one));
+  }
+
+
+  // execute the posted functions
+  static void post_handler(void* arg, std::uint32_t)
+  {
+    reactor* r = static_cast<reactor*>(arg);
+    std::uint64_t count;
+    (void)!::read(r->post_event_, &count, sizeof(count));
+
+    r->posted_ = false;
+    std::vector<std::pair<function_type, void*> > posts;
+    {
+      std::lock_guard<std::mutex> lock(r->post_mutex_);
+      posts.swap(r->posts_);
+    }
+    for (std::vector<std::pair<function_type, void*> >::const_iterator it = posts.begin(); it != posts.end(); ++it) {
+      it->first(it->second);
+    }
+  }
+
+
+  // execute the expired timers
+  static void timer_handler(void* arg, std::uint32_t)
+  {
+    static_cast<reactor*>(arg)->timers_.dispatch();
+  }
+
+
+  int                   epoll_;           // epoll instance
+  int                   post_event_;      // eventfd to wake up the reactor thread
+  std::atomic<bool>     running_;         // event loop is running
+  std::atomic<bool>     posted_;          // posts are pending, post_event_ is written
+  std::atomic<bool>     removed_;         // removed sources need to be collected
+  std::atomic<source*>  dispatching_;     // source whose handler is running, nullptr if none
+  std::atomic<std::thread::id> loop_thread_;  // thread which runs the loop
+  timer_service         timers_;          // timers of the reactor (externally driven)
+
+  std::mutex            source_mutex_;    // guards the source list
+  std::vector<source*>  sources_;         // registered file descriptors
+
+  std::mutex            post_mutex_;      // guards the post queue
+  std::vector<std::pair<function_type, void*> > posts_;   // posted functions
+
+  struct epoll_event*   events_;          // events of the current dispatch
+  int                   event_count_;     // number of events of the current dispatch
+  int                   event_index_;     // event in dispatch
+
+  reactor(const reactor&);              // no copy
+  reactor& operator=(const reactor&);   // no assignment
+};
+
+} // namespace util
+} // namespace decom
+
+#endif // _DECOM_UTIL_REACTOR_H_
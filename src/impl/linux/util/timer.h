@@ -0,0 +1,601 @@
+///////////////////////////////////////////////////////////////////////////////
+// \author (c) Marco Paland (info@paland.com)
+//             2011-2021, PALANDesign Hannover, Germany
+//
+// \license The MIT License (MIT)
+//
+// This file is part of the decom library.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// \brief Timer implementation for Linux
+//
+// This class implements a high precision timer on the Linux platform.
+// A timer is a lightweight handle on a timer service. All timers of the same
+// priority share one service, which is one thread driving a hierarchical timing
+// wheel (see util/timer_wheel.h) with a tick of 1 us. Start, stop and restart
+// are O(1) and don't create any threads, so thousands of timers (e.g. many
+// iso15765 channels) only need one thread per used priority.
+// The service thread sleeps on a CLOCK_MONOTONIC timerfd until the next
+// expiration, there is no active polling and no periodic tick. The expiration
+// times of a periodic timer are calculated from the start time, so the timer
+// doesn't drift.
+// All callbacks of a service are executed in its thread, so a callback must not
+// block for a longer time.
+// A service may also be driven by an external thread, e.g. by a util::reactor.
+// Timers which are constructed while a service is bound to the constructing
+// thread (see timer_service::bound()) use that service instead.
+// The service thread runs with SCHED_FIFO for high priorities, this needs the
+// CAP_SYS_NICE capability or an according RLIMIT_RTPRIO, otherwise the thread
+// runs with normal priority.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _DECOM_UTIL_TIMER_H_
+#define _DECOM_UTIL_TIMER_H_
+
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <ctime>
+#include <cerrno>
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <limits>
+
+#include "../../../decom_cfg.h"
+#include "../../../log.h"
+#include "../../../util/timer_wheel.h"
+
+/////////////////////////////////////////////////////////////////////
+
+namespace decom {
+namespace util {
+
+
+/**
+ * Timer service
+ * One thread drives the timing wheel of all timers with the same priority
+ */
+class timer_service
+{
+public:
+  /**
+   * Timer entry, this is the state of a timer within the service
+   */
+  class entry : public timer_wheel::node
+  {
+  public:
+    entry()
+      : running_(false)
+      , periodic_(false)
+      , arg_(nullptr)
+      , callback_(nullptr)
+    { }
+
+    inline bool is_running() const
+    { return running_; }
+
+  private:
+    std::chrono::nanoseconds period_;     // timer period
+    std::chrono::nanoseconds deadline_;   // next expiration (CLOCK_MONOTONIC)
+    std::atomic<bool> running_;           // timer status
+    bool periodic_;                       // true if periodic timer
+    void* arg_;                           // argument for callback function
+    void (*callback_)(void* arg);         // callback function
+
+    friend class timer_service;
+  };
+
+
+  /**
+   * ctor
+   * \param policy Scheduling policy of the service thread
+   * \param priority Scheduling priority of the service thread, 0 for non real time policies
+   */
+  timer_service(int policy, int priority)
+    : wheel_(to_tick(clock()))
+    , armed_(std::numeric_limits<std::uint64_t>::max())
+    , firing_(nullptr)
+    , busy_(false)
+    , end_(false)
+    , external_(false)
+  {
+    timer_fd_   = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    trigger_fd_ = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (timer_fd_ < 0 || trigger_fd_ < 0) {
+      DECOM_LOG_ERROR2("Timer service can't create timerfd/eventfd, error " << errno, "timer");
+    }
+
+    // create service thread
+    thread_ = std::thread(&timer_service::worker, this);
+    driver_ = thread_.get_id();
+
+    // set prio
+    struct sched_param param;
+    param.sched_priority = priority;
+    if (::pthread_setschedparam(thread_.native_handle(), policy, &param)) {
+      // no permission for real time scheduling, stay with normal priority
+      DECOM_LOG_WARN2("Timer thread priority can't be set, running with normal priority", "timer");
+    }
+  }
+
+
+  /**
+   * External ctor
+   * The service has no thread, the owner waits for fd() to get readable and calls dispatch() then
+   */
+  timer_service()
+    : wheel_(to_tick(clock()))
+    , armed_(std::numeric_limits<std::uint64_t>::max())
+    , firing_(nullptr)
+    , busy_(false)
+    , end_(false)
+    , external_(true)
+    , trigger_fd_(-1)
+  {
+    timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+      DECOM_LOG_ERROR2("Timer service can't create timerfd, error " << errno, "timer");
+    }
+  }
+
+
+  /**
+   * dtor
+   */
+  ~timer_service()
+  {
+    if (!external_) {
+      // gracefully stop and kill the service thread
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        end_ = true;
+      }
+      trigger();                // trigger thread
+      thread_.join();           // join thread
+      (void)::close(trigger_fd_);
+    }
+    (void)::close(timer_fd_);
+  }
+
+
+  /**
+   * Service of the calling thread
+   * Timers use the bound service instead of the service of their priority, see util::reactor
+   * \return Reference to the service pointer of the calling thread, nullptr if no service is bound
+   */
+  static timer_service*& bound()
+  {
+    static thread_local timer_service* service = nullptr;
+    return service;
+  }
+
+
+  /**
+   * Returns true if the service is driven by an external thread
+   */
+  inline bool is_external() const
+  { return external_; }
+
+
+  /**
+   * The timerfd of an external service, it gets readable when dispatch() needs to be called
+   */
+  inline int fd() const
+  { return timer_fd_; }
+
+
+  /**
+   * Execute the expired timers of an external service
+   * Must be called by the driving thread when fd() is readable
+   */
+  void dispatch()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    driver_ = std::this_thread::get_id();
+    busy_   = true;
+    process(lock);
+    arm();
+    busy_   = false;
+  }
+
+
+  /**
+   * Start/restart a timer, O(1)
+   * \param e Timer entry
+   * \param period Cycle time of the timer
+   * \param periodic true for a periodic timer, false for a singleshot timer
+   * \param func Callback function which is called when timer fires
+   * \param arg Argument which is passed to the callback function
+   * \return true if timer started successfully
+   */
+  bool start(entry& e, std::chrono::microseconds period, bool periodic, void(*func)(void* arg), void* arg)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const std::chrono::nanoseconds now = clock();
+    e.period_   = period.count() > 0 ? std::chrono::nanoseconds(period) : std::chrono::nanoseconds(std::chrono::microseconds(1));
+    e.deadline_ = now + e.period_;
+    e.periodic_ = periodic;
+    e.arg_      = arg;
+    e.callback_ = func;
+    e.running_  = true;
+
+    const std::uint64_t tick = to_tick_ceil(e.deadline_);
+    wheel_.reset(to_tick(now));
+    wheel_.add(e, tick);
+
+    // wake up the service thread if the timer expires before the armed time
+    // this is not necessary if the service thread is processing, it arms the timerfd afterwards
+    if (!busy_ && tick < armed_) {
+      if (external_) {
+        arm();
+      }
+      else {
+        trigger();
+      }
+    }
+    return true;
+  }
+
+
+  /**
+   * Stop a timer, O(1)
+   * \param e Timer entry
+   */
+  void stop(entry& e)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wheel_.remove(e);
+      e.running_ = false;
+    }
+    cv_.notify_all();
+  }
+
+
+  /**
+   * Stop a timer and wait until its callback isn't executed anymore
+   * Must be called before the entry is destroyed
+   * \param e Timer entry
+   */
+  void release(entry& e)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    wheel_.remove(e);
+    e.running_ = false;
+    if (std::this_thread::get_id() != driver_) {
+      cv_.wait(lock, [this, &e] { return firing_ != &e; });
+    }
+  }
+
+
+  /**
+   * Block until the (singleshot) timer is expired or stopped
+   * \param e Timer entry
+   */
+  void wait(entry& e)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&e] { return !e.running_; });
+  }
+
+
+  /**
+   * Returns the time since the last trigger of the timer
+   * \param e Timer entry
+   * \return The time since the last (re)start or trigger of the timer, -1 if timer is not running
+   */
+  std::chrono::microseconds get_elapsed(const entry& e) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!e.running_) {
+      return std::chrono::microseconds(-1);
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(clock() - (e.deadline_ - e.period_));
+  }
+
+
+  /////////////////////////////////////////////////////////////////////////////
+  // P R I V A T E
+private:
+  /**
+   * Service thread
+   */
+  void worker()
+  {
+    struct pollfd fds[2] = { { timer_fd_, POLLIN, 0 }, { trigger_fd_, POLLIN, 0 } };
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!end_) {
+      arm();
+      busy_ = false;
+      lock.unlock();
+      const int rc = ::poll(fds, 2U, -1);
+      lock.lock();
+      busy_ = true;
+      if (rc <= 0) {
+        // interrupted
+        continue;
+      }
+
+      if (fds[1].revents & POLLIN) {
+        // triggered by start/dtor
+        std::uint64_t count;
+        (void)!::read(trigger_fd_, &count, sizeof(count));
+      }
+      process(lock);
+    }
+  }
+
+
+  // execute the expired timers, mutex must be held by the given lock
+  void process(std::unique_lock<std::mutex>& lock)
+  {
+    std::uint64_t count;
+    (void)!::read(timer_fd_, &count, sizeof(count));
+
+    const std::uint64_t tick = to_tick(clock());
+    for (timer_wheel::node* n = wheel_.expire(tick); n; n = wheel_.expire(tick)) {
+      entry& e = static_cast<entry&>(*n);
+      if (e.periodic_) {
+        // next expiration is calculated from the last one, a delayed timer catches up in this loop
+        e.deadline_ += e.period_;
+        wheel_.add(e, to_tick_ceil(e.deadline_));
+      }
+      else {
+        // execute only once, disable before callback execution
+        e.running_ = false;
+        cv_.notify_all();
+      }
+
+      void (*callback)(void* arg) = e.callback_;
+      void* arg = e.arg_;
+      if (callback) {
+        // execute callback here - CAUTION: timer may be restarted, stopped or destroyed in callback!
+        firing_ = &e;
+        lock.unlock();
+        callback(arg);
+        lock.lock();
+        firing_ = nullptr;
+        cv_.notify_all();
+      }
+    }
+  }
+
+
+  // arm the timerfd for the next tick of the wheel, mutex must be held
+  void arm()
+  {
+    const std::uint64_t next = wheel_.next_tick();
+    if (next == armed_) {
+      return;
+    }
+    armed_ = next;
+
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+    if (next != std::numeric_limits<std::uint64_t>::max()) {
+      its.it_value.tv_sec  = static_cast<time_t>(next / 1000000U);
+      its.it_value.tv_nsec = static_cast<long>((next % 1000000U) * 1000U);
+      if (!its.it_value.tv_sec && !its.it_value.tv_nsec) {
+        its.it_value.tv_nsec = 1;   // zero would disarm the timer
+      }
+    }
+    (void)::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr);
+  }
+
+
+  // wake up the service thread
+  inline void trigger()
+  {
+    const std::uint64_t one = 1U;
+    (void)!::write(trigger_fd_, &one, sizeof(one));
+  }
+
+
+  // CLOCK_MONOTONIC time
+  static inline std::chrono::nanoseconds clock()
+  {
+    struct timespec now;
+    (void)::clock_gettime(CLOCK_MONOTONIC, &now);
+    return std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec);
+  }
+
+
+  // tick is 1 us
+  static inline std::uint64_t to_tick(std::chrono::nanoseconds t)
+  { return static_cast<std::uint64_t>(t.count()) / 1000U; }
+
+  static inline std::uint64_t to_tick_ceil(std::chrono::nanoseconds t)
+  { return (static_cast<std::uint64_t>(t.count()) + 999U) / 1000U; }
+
+
+  timer_wheel wheel_;                   // timers
+  std::uint64_t armed_;                 // tick the timerfd is armed for
+  entry* firing_;                       // timer which callback is executed
+  bool busy_;                           // service thread is processing
+  bool end_;                            // end service thread
+  bool external_;                       // service is driven by an external thread
+  int timer_fd_;                        // timerfd of CLOCK_MONOTONIC
+  int trigger_fd_;                      // eventfd to wake up the service thread
+  std::thread thread_;                  // service thread
+  std::thread::id driver_;              // thread which executes the callbacks
+  mutable std::mutex mutex_;            // guards the wheel and the timer entries
+  std::condition_variable cv_;          // signaled when a timer stopped or a callback returned
+
+  timer_service(const timer_service&);              // no copy
+  timer_service& operator=(const timer_service&);   // no assignment
+};
+
+
+/////////////////////////////////////////////////////////////////////
+
+class timer
+{
+public:
+  typedef enum tag_priority_type {
+    //                        linux mappings: SCHED_FIFO priority, <= 0 for no real time scheduling
+    priority_idle           = -2,   // SCHED_IDLE
+    priority_low            = -1,   // SCHED_BATCH
+    priority_normal         = 0,    // SCHED_OTHER, use this if every timer resolution is > 100ms
+    priority_high           = 50,   // SCHED_FIFO, default, sufficient for most scenarios
+    priority_time_critical  = 90    // SCHED_FIFO, use this if high precision is necessary, e.g. for LIN/CAN scheduling etc.
+  } priority_type;
+
+  /**
+   * param ctor
+   * \param prio Defines the timer thread priority - ignored if platform doesn't support thread priority
+   *        or if a service is bound to the calling thread
+   */
+  timer(priority_type prio = priority_high)
+    : service_(timer_service::bound() ? *timer_service::bound() : service(prio))
+  { }
+
+
+  /**
+   * dtor
+   */
+  ~timer()
+  {
+    // stop the timer and wait for a running callback
+    service_.release(entry_);
+  }
+
+
+  /**
+   * Set process to idle for the given time of milliseconds
+   * Standard implementation is an OS wrapper in most cases
+   * \param milliseconds The time to sleep in [ms] or other units (converted by chrono)
+   */
+  static inline void sleep(std::chrono::milliseconds milliseconds)
+  {
+    struct timespec ts;
+    ts.tv_sec  = static_cast<time_t>(milliseconds.count() / 1000);
+    ts.tv_nsec = static_cast<long>((milliseconds.count() % 1000) * 1000000L);
+    while (::clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR);
+  }
+
+
+  /**
+   * Wait (block) for the given time, the timer is used for it
+   * \param microseconds The time to wait in [us] or other units (converted by chrono)
+   */
+  inline void wait(std::chrono::microseconds microseconds)
+  {
+    if (service_.is_external()) {
+      // the driving thread may wait itself, so just sleep
+      struct timespec ts;
+      ts.tv_sec  = static_cast<time_t>(microseconds.count() / 1000000);
+      ts.tv_nsec = static_cast<long>((microseconds.count() % 1000000) * 1000L);
+      while (::clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR);
+      return;
+    }
+    start(microseconds, false, nullptr, nullptr);
+    service_.wait(entry_);
+  }
+
+
+  /**
+   * Start/restart the periodic timer. If the timer is running it is restarted.
+   * \param microseconds Cycle time of the timer in [us] or other chrono units (converted by chrono)
+   * \param periodic true for a periodic timer, false for a singleshot timer
+   * \param func Callback function which is called when timer fires
+   * \param arg Argument which is passed to the callback function
+   * \return true if timer started successfully
+   */
+  inline bool start(std::chrono::microseconds period, bool periodic, void(*func)(void* arg), void* arg)
+  { return service_.start(entry_, period, periodic, func, arg); }
+
+
+  /**
+   * Stop the timer
+   * \return true if stopped successfully
+   */
+  inline bool stop()
+  {
+    service_.stop(entry_);
+    return true;
+  }
+
+
+  /**
+   * Returns the time since the last (re)start of the timer
+   * \return The time since the last (re)start of the timer, -1 if timer is not running
+   */
+  inline std::chrono::microseconds get_elapsed() const
+  { return service_.get_elapsed(entry_); }
+
+
+  /**
+   * Status of the timer
+   * \return true if timer is running
+   */
+  inline bool is_running() const
+  { return entry_.is_running(); }
+
+
+  /////////////////////////////////////////////////////////////////////////////
+  // P R I V A T E
+private:
+  // returns the service of the given priority, services are created on first use
+  static timer_service& service(priority_type prio)
+  {
+    switch (prio) {
+      case priority_idle : {
+        static timer_service service_idle(SCHED_IDLE, 0);
+        return service_idle;
+      }
+      case priority_low : {
+        static timer_service service_low(SCHED_BATCH, 0);
+        return service_low;
+      }
+      case priority_normal : {
+        static timer_service service_normal(SCHED_OTHER, 0);
+        return service_normal;
+      }
+      case priority_time_critical : {
+        static timer_service service_time_critical(SCHED_FIFO, priority_time_critical);
+        return service_time_critical;
+      }
+      default : {
+        static timer_service service_high(SCHED_FIFO, priority_high);
+        return service_high;
+      }
+    }
+  }
+
+
+  timer_service&        service_;     // service of the timer priority
+  timer_service::entry  entry_;       // timer state
+
+  timer(const timer&);              // no copy
+  timer& operator=(const timer&);   // no assignment
+};
+
+} // namespace util
+} // namespace decom
+
+#endif // _DECOM_UTIL_TIMER_H_
@@ -326,6 +326,23 @@ public:
   }
 
 
+  /**
+   * Receive function for a batch of complete messages from lower layer, e.g. all packets of one read
+   * The default implementation passes the messages one by one to receive(), override this
+   * if the layer can process a batch at once.
+   * ATTENTION: call by ref - so data may be modified on upper layer!
+   * \param data Array of messages to receive
+   * \param count Number of messages
+   * \param id The endpoint identifier
+   */
+  virtual void receive_batch(msg* data, std::size_t count, eid const& id = eid_any)
+  {
+    for (std::size_t i = 0U; i < count; ++i) {
+      receive(data[i], id, false);
+    }
+  }
+
+
   /**
    * Status/Error indication from lower layer
    * \param code The status code which occurred on lower layer
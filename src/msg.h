@@ -39,7 +39,10 @@
 // A page is a unit of a msg and has a head and a tail pointer. If head == tail the page is empty.
 // The next pointer points to the next page in the chain or is nullptr on last page.
 // ref is a counter of how many references a page/msg has. If a page has more than one reference it
-// is read only, all operations which change the msg content are prohibited then.
+// is read only. Operations which change the msg copy the affected page (copy on write) and, because
+// the next pointers are shared too, the shared pages in front of it.
+// ref is atomic, so messages may share pages across threads: references are taken relaxed and
+// released with release semantics, the final release acquires before the page is reused.
 //
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -47,8 +50,13 @@
 #define _DECOM_MSG_H_
 
 #include <cstdint>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <iterator>
+#include <vector>
+#include <algorithm>
 #include <cstring>    // for memcpy
 
 #include "decom_cfg.h"
@@ -76,24 +84,59 @@
 #define DECOM_MSG_POOL_PAGE_BEGIN   (DECOM_MSG_POOL_PAGE_SIZE / 4U)
 #endif
 
+// defines the number of free pages each thread keeps in its own page cache (magazine)
+// pages are fetched from and returned to the pool in batches of half the magazine size
+// a magazine holds a quarter of the pool at most, so small pools don't run dry by idle caches
+// 0 disables the thread cache
+#ifndef DECOM_MSG_POOL_MAGAZINE_SIZE
+#define DECOM_MSG_POOL_MAGAZINE_SIZE  16U
+#endif
+
+// defines the page size and the number of pages of the optional small page class
+// 0 pages disables the class
+#ifndef DECOM_MSG_POOL_SMALL_PAGE_SIZE
+#define DECOM_MSG_POOL_SMALL_PAGE_SIZE  64U
+#endif
+#ifndef DECOM_MSG_POOL_SMALL_PAGES
+#define DECOM_MSG_POOL_SMALL_PAGES      0U
+#endif
+
+// defines the page size and the number of pages of the optional large page class
+// 0 pages disables the class
+#ifndef DECOM_MSG_POOL_LARGE_PAGE_SIZE
+#define DECOM_MSG_POOL_LARGE_PAGE_SIZE  4096U
+#endif
+#ifndef DECOM_MSG_POOL_LARGE_PAGES
+#define DECOM_MSG_POOL_LARGE_PAGES      0U
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 
 namespace decom {
 
+class msg_pool;
+
 typedef struct tag_pool_page_type
 {
-  std::uint8_t data[DECOM_MSG_POOL_PAGE_SIZE];  // data buffer
-  std::size_t  head;                            // head (begin) position
-  std::size_t  tail;                            // tail (end) position (tail == MSG_POOL_PAGE_SIZE: page is full)
-  std::size_t  ref;                             // reference counter, 0 = unused page
-  bool         read_only;                       // read only flag, if set the content of the page is fixed
-  struct tag_pool_page_type* next;              // pointer to the next page
+  std::uint8_t* data;                             // data buffer
+  std::size_t   size;                             // size of the data buffer, given by the page class of the pool
+  std::size_t   head;                             // head (begin) position
+  std::size_t   tail;                             // tail (end) position (tail == size: page is full)
+  std::atomic<std::size_t>    ref;                // reference counter, 0 = unused page
+  bool          read_only;                        // read only flag, if set the content of the page is fixed
+  struct tag_pool_page_type*  next;               // pointer to the next page
+  std::atomic<std::uint32_t>  free_next;          // index of the next free page, only valid while the page is in the free list
+  msg_pool*     pool;                             // owning pool, the page is returned to it
 } pool_page_type;
 
 
 
 /**
  * message pool class
+ * Free pages are kept in an intrusive lock-free LIFO list. The list head is a
+ * 64 bit word of the page index (low word) and an ABA tag (high word) which is
+ * incremented on every list change, so alloc and free are O(1) without a mutex.
+ * A pool provides pages of one size class, the storage is provided by msg_pool_storage.
  */
 class msg_pool
 {
@@ -106,34 +149,64 @@ public:
   typedef const value_type&   const_reference;
   typedef std::size_t         size_type;
 
+  // page size classes
+  typedef enum tag_class_type {
+    class_small = 0,          // small pages, e.g. for CAN frames
+    class_default,            // default pages of DECOM_MSG_POOL_PAGE_SIZE
+    class_large,              // large pages, e.g. for TCP segments
+    class_count
+  } class_type;
+
 
   // ctor
-  msg_pool()
-    : name_("msg_pool")
+  msg_pool(const char* name, class_type page_class)
+    : name_(name)
+    , class_(page_class)
+    , instance_(nullptr)
+    , page_size_(0U)
+    , pages_(0U)
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+    , magazine_size_(0U)
+#endif
+    , free_gen_(0U)
   {
-    // init all pages
-    for (size_type i = 0U; i < DECOM_MSG_POOL_PAGES; i++) {
-      instance_[i].ref = 0U;
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+    // register the pool, the id identifies it in the thread caches
+    {
+      registry_type& reg = registry();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      id_ = ++reg.last_id;
+      reg.ids.push_back(id_);
     }
+#endif
+    free_head_.store(FREE_NIL, std::memory_order_relaxed);
+    free_pages_.store(0U, std::memory_order_relaxed);
+
     // init used page counters
-    used_pages_     = 0U;   // currently used pages
-    used_pages_max_ = 0U;
+    used_pages_.store(0U, std::memory_order_relaxed);   // currently used pages
+    used_pages_max_.store(0U, std::memory_order_relaxed);
+    waiters_.store(0U, std::memory_order_relaxed);
+#ifdef DECOM_STATS
+    alloc_failures_.store(0U, std::memory_order_relaxed);
+#endif
   }
 
 
   // dtor
   ~msg_pool()
   {
-    if (used_pages_) {
+    if (used_pages_.load()) {
       DECOM_LOG_ERROR("Allocated pages left back in pool");
     }
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+    // unregister the pool, thread caches which are still bound to it drop their pages on next use
+    registry_type& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.ids.erase(std::find(reg.ids.begin(), reg.ids.end(), id_));
+#endif
   }
 
 
-  // instance
-  pool_page_type instance_[DECOM_MSG_POOL_PAGES];
-
-
   // page access
   inline reference operator[](const size_type i)             { return instance_[i]; }
   inline const_reference operator[](const size_type i) const { return instance_[i]; }
@@ -144,100 +217,549 @@ public:
   // alloc new page
   pointer page_alloc()
   {
-    // lock access
-    std::lock_guard<std::mutex> lock(m_);
-
-    // find free page
-    for (size_type i = 0U; i < DECOM_MSG_POOL_PAGES; i++) {
-      if (!instance_[i].ref) {
-        // found it - init page
-        instance_[i].ref  = 1U;
-        instance_[i].head = 0U;
-        instance_[i].tail = 0U;
-        instance_[i].next = nullptr;
-        if (++used_pages_ > used_pages_max_) {
-          used_pages_max_++;
-        }
-        DECOM_LOG_DEBUG("Page alloc: ") << i << " (" << used_pages_ << "/" << DECOM_MSG_POOL_PAGES << ")";
-        return &instance_[i];
+    pointer page = alloc();
+    if (!page) {
+      // no free page found
+#ifdef DECOM_STATS
+      (void)alloc_failures_.fetch_add(1U, std::memory_order_relaxed);
+#endif
+      DECOM_LOG_CRIT("Page allocation failed");
+    }
+    return page;
+  }
+
+
+  /**
+   * Alloc new page, wait for a free page if the pool is exhausted
+   * \param timeout Maximum time to wait for a free page
+   * \return The page or nullptr if no page was freed within the timeout
+   */
+  pointer try_alloc(std::chrono::milliseconds timeout)
+  {
+    pointer page = alloc();
+    if (page) {
+      return page;
+    }
+
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    (void)waiters_.fetch_add(1U);   // freed pages bypass the thread caches now
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    bool timed_out = false;
+    while (!page && !timed_out) {
+      // retry until a page is freed while the allocation is attempted or the timeout elapses
+      const std::uint32_t gen = free_gen_;
+      lock.unlock();
+      page = alloc();
+      lock.lock();
+      while (!page && (gen == free_gen_) && !timed_out) {
+        timed_out = wait_cv_.wait_until(lock, deadline) == std::cv_status::timeout;
       }
     }
-    // no free page found
-    DECOM_LOG_CRIT("Page allocation failed");
-    return nullptr;
+    lock.unlock();
+    (void)waiters_.fetch_sub(1U);
+
+    if (!page) {
+#ifdef DECOM_STATS
+      (void)alloc_failures_.fetch_add(1U, std::memory_order_relaxed);
+#endif
+      DECOM_LOG_CRIT("Page allocation timeout");
+    }
+    return page;
   }
 
 
-  // free page
-  inline void page_free(pointer page)
+  /**
+   * Wait until the pool has the given number of free pages, e.g. before reading the next frame
+   * \param pages Number of required free pages
+   * \param timeout Maximum time to wait
+   * \return true if the pages are free, false on timeout
+   */
+  bool wait_free(size_type pages, std::chrono::milliseconds timeout)
+  {
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    (void)waiters_.fetch_add(1U);
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    bool timed_out = false;
+    while ((free_pages() < pages) && !timed_out) {
+      timed_out = wait_cv_.wait_until(lock, deadline) == std::cv_status::timeout;
+    }
+    const bool free = free_pages() >= pages;
+    lock.unlock();
+    (void)waiters_.fetch_sub(1U);
+    return free;
+  }
+
+
+  /**
+   * Request a notification when the pool has the given number of free pages again
+   * Use it to resume reading from a device which was paused due to pool exhaustion, e.g. by a reactor
+   * thread which must not block. The notification is one-shot, it's removed when the callback is called.
+   * The callback is called by the thread which frees the page while the pool lock is held,
+   * so keep it short and don't use the pool in it, e.g. write an eventfd.
+   * \param pages Number of free pages which triggers the callback
+   * \param callback Callback function
+   * \param arg Argument which is passed to the callback, identifies the notification for cancel_free_notify()
+   * eturn true if the notification is pending, false if the pages are free already, the callback isn't called then
+   */
+  bool notify_free(size_type pages, void(*callback)(void* arg), void* arg)
   {
-    // lock access
-    std::lock_guard<std::mutex> lock(m_);
+    (void)waiters_.fetch_add(1U);   // freed pages bypass the thread caches now
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    if (free_pages() >= pages) {
+      (void)waiters_.fetch_sub(1U);
+      return false;
+    }
+    free_notify_type n = { callback, arg, pages };
+    free_notify_.push_back(n);
+    return true;
+  }
+
 
-    if (!--page->ref) {
-      used_pages_--;
-      DECOM_LOG_DEBUG("Page freed: " << page - instance_ << " (" << used_pages_ << "/" << DECOM_MSG_POOL_PAGES << ")");
+  /**
+   * Cancel the pending notifications of the given argument
+   * When this returns, no callback of the argument is running anymore, so it can be destroyed
+   * \param arg Argument of notify_free()
+   */
+  void cancel_free_notify(void* arg)
+  {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    for (std::vector<free_notify_type>::iterator it = free_notify_.begin(); it != free_notify_.end(); ) {
+      if (it->arg == arg) {
+        it = free_notify_.erase(it);
+        (void)waiters_.fetch_sub(1U);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+
+
+  /**
+   * Number of pages the calling thread can allocate, these are the pages of the free list and of its thread cache
+   * Pages in the caches of other threads are not counted, they are given back while a thread waits for free pages
+   * \return Number of free pages
+   */
+  inline size_type free_pages() const
+  {
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+    const magazine_type* mag = bound_magazine();
+    return free_pages_.load(std::memory_order_relaxed) + (mag ? mag->count : 0U);
+#else
+    return free_pages_.load(std::memory_order_relaxed);
+#endif
+  }
+
+
+  // true if the calling thread can allocate at least the given number of pages
+  inline bool has_free(size_type pages) const
+  { return free_pages() >= pages; }
+
+
+  // add a reference to a page, the caller must hold a reference already
+  static inline void page_ref(pointer page)
+  {
+    (void)page->ref.fetch_add(1U, std::memory_order_relaxed);
+  }
+
+
+  // free page or release a reference
+  inline void page_free(pointer page)
+  {
+    if (page->ref.fetch_sub(1U, std::memory_order_release) == 1U) {
+      // last reference gone - synchronize with all other releases before the page is reused
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      // return page to the thread cache or to the pool
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+      magazine_type& mag = magazine();
+      if (waiters_.load(std::memory_order_relaxed) || !magazine_size_) {
+        // a thread waits for free pages or the pool is too small for caching - give all cached pages to the pool
+        free_push(mag.page, mag.count);
+        mag.count = 0U;
+        free_push(&page, 1U);
+      }
+      else if (mag.count >= magazine_size_) {
+        // thread cache is full - drain the older half to the pool
+        const size_type half = (magazine_size_ + 1U) / 2U;
+        free_push(mag.page, half);
+        for (size_type i = half; i < mag.count; i++) {
+          mag.page[i - half] = mag.page[i];
+        }
+        mag.count -= half;
+        mag.page[mag.count++] = page;
+      }
+      else {
+        mag.page[mag.count++] = page;
+      }
+#else
+      free_push(&page, 1U);
+#endif
+      const size_type used = used_pages_.fetch_sub(1U) - 1U;
+      DECOM_LOG_DEBUG("Page freed: " << static_cast<size_type>(page - instance_) << " (" << used << "/" << pages_ << ")");
+      (void)used;
+
+      // back-pressure: wake up waiting threads and call the notifications whose pages are free
+      if (waiters_.load()) {
+        {
+          std::lock_guard<std::mutex> lock(wait_mutex_);
+          free_gen_++;
+          notify();
+        }
+        wait_cv_.notify_all();
+      }
     }
   }
 
 
   // capacity
-  inline size_type used_pages() const     { return used_pages_; }
-  inline size_type used_pages_max() const { return used_pages_max_; }
-  inline size_type max_size() const       { return DECOM_MSG_POOL_PAGES; }
-  inline void clear_used_pages_max()      { used_pages_max_ = 0U; }
+  inline size_type used_pages() const     { return used_pages_.load(std::memory_order_relaxed); }
+  inline size_type used_pages_max() const { return used_pages_max_.load(std::memory_order_relaxed); }
+  inline size_type max_size() const       { return pages_; }
+  inline size_type page_size() const      { return page_size_; }
+  inline class_type page_class() const    { return class_; }
+  inline void clear_used_pages_max()      { used_pages_max_.store(0U, std::memory_order_relaxed); }
+
+#ifdef DECOM_STATS
+  // number of failed page allocations
+  inline std::uint32_t alloc_failures() const { return alloc_failures_.load(std::memory_order_relaxed); }
+#endif
+
+
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+  // thread cache statistics of the calling thread, 0 if its cache is bound to another pool
+  // the statistics are reset when the cache is bound to another pool
+  inline std::uint32_t magazine_hits() const    { const magazine_type* mag = bound_magazine(); return mag ? mag->hits : 0U; }
+  inline std::uint32_t magazine_misses() const  { const magazine_type* mag = bound_magazine(); return mag ? mag->misses : 0U; }
+  inline size_type magazine_pages() const       { const magazine_type* mag = bound_magazine(); return mag ? mag->count : 0U; }
+#endif
 
 
   // name
   const char* name_;            // debugging/log name
 
+protected:
+  // init all pages and chain them into the free list, called by the storage ctor
+  void init(pointer pages, std::uint8_t* storage, size_type page_size, size_type page_count)
+  {
+    instance_  = pages;
+    page_size_ = page_size;
+    pages_     = page_count;
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+    magazine_size_ = page_count / 4U < DECOM_MSG_POOL_MAGAZINE_SIZE ? page_count / 4U : DECOM_MSG_POOL_MAGAZINE_SIZE;
+#endif
+    for (size_type i = 0U; i < page_count; i++) {
+      instance_[i].data = storage + i * page_size;
+      instance_[i].size = page_size;
+      instance_[i].pool = this;
+      instance_[i].ref.store(0U, std::memory_order_relaxed);
+      instance_[i].free_next.store(i + 1U < page_count ? static_cast<std::uint32_t>(i + 1U) : FREE_NIL, std::memory_order_relaxed);
+    }
+    free_pages_.store(page_count, std::memory_order_relaxed);
+    free_head_.store(page_count ? 0U : FREE_NIL, std::memory_order_release);   // tag 0, first page 0
+  }
+
+  // free list end marker
+  static const std::uint32_t FREE_NIL = 0xFFFFFFFFUL;
+
 private:
-  size_type used_pages_;        // actual (currently) pages in use
-  size_type used_pages_max_;    // maximum of pages used
-  std::mutex m_;                // mutex for page pool access
+  // return the incremented ABA tag of the given list head, positioned in the high word
+  static inline std::uint64_t free_tag(std::uint64_t head)
+  { return ((head >> 32U) + 1U) << 32U; }
+
+
+  // take a free page and init it, nullptr if the pool is exhausted
+  pointer alloc()
+  {
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+    // take the page out of the thread cache, refill it out of the pool if empty
+    magazine_type& mag = magazine();
+    if (mag.count) {
+      mag.hits++;
+    }
+    else {
+      mag.misses++;
+      while ((mag.count < magazine_size_ / 2U + 1U) && ((mag.page[mag.count] = free_pop()) != nullptr)) {
+        mag.count++;
+      }
+    }
+    pointer page = mag.count ? mag.page[--mag.count] : nullptr;
+#else
+    pointer page = free_pop();
+#endif
+
+    if (!page) {
+      // no free page found
+      return nullptr;
+    }
+
+    // found it - init page
+    page->ref.store(1U, std::memory_order_relaxed);
+    page->head = 0U;
+    page->tail = 0U;
+    page->next = nullptr;
+    const size_type used = used_pages_.fetch_add(1U, std::memory_order_relaxed) + 1U;
+    size_type used_max = used_pages_max_.load(std::memory_order_relaxed);
+    while ((used > used_max) && !used_pages_max_.compare_exchange_weak(used_max, used, std::memory_order_relaxed));
+    DECOM_LOG_DEBUG("Page alloc: ") << static_cast<size_type>(page - instance_) << " (" << used << "/" << pages_ << ")";
+    return page;
+  }
+
+
+  // pop the first page of the free list, nullptr if the list is empty
+  pointer free_pop()
+  {
+    std::uint64_t head = free_head_.load(std::memory_order_acquire);
+    for (;;) {
+      const std::uint32_t i = static_cast<std::uint32_t>(head);
+      if (i == FREE_NIL) {
+        return nullptr;
+      }
+      // next is possibly stale if the page was taken meanwhile, the tag makes the CAS fail then
+      const std::uint64_t next = free_tag(head) | instance_[i].free_next.load(std::memory_order_relaxed);
+      if (free_head_.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) {
+        (void)free_pages_.fetch_sub(1U, std::memory_order_relaxed);
+        return &instance_[i];
+      }
+    }
+  }
+
+
+  // push the given pages on the free list, the pages are chained first and spliced in with a single CAS
+  void free_push(pointer const* page, size_type count)
+  {
+    if (!count) {
+      return;
+    }
+    for (size_type n = 0U; n + 1U < count; n++) {
+      page[n]->free_next.store(static_cast<std::uint32_t>(page[n + 1U] - instance_), std::memory_order_relaxed);
+    }
+    const std::uint32_t first = static_cast<std::uint32_t>(page[0] - instance_);
+    (void)free_pages_.fetch_add(count, std::memory_order_relaxed);   // counted before the pages can be taken
+    std::uint64_t head = free_head_.load(std::memory_order_relaxed);
+    do {
+      page[count - 1U]->free_next.store(static_cast<std::uint32_t>(head), std::memory_order_relaxed);
+    } while (!free_head_.compare_exchange_weak(head, free_tag(head) | first, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+  // ids of the alive pools, a pool may be destroyed while other threads still cache its pages
+  typedef struct tag_registry_type
+  {
+    tag_registry_type()
+      : last_id(0U)
+    { }
+
+    std::mutex                 mutex;     // guards the ids, held while cached pages are given back to a pool
+    std::vector<std::uint64_t> ids;       // ids of the alive pools
+    std::uint64_t              last_id;   // last given id, ids are not reused
+  } registry_type;
+
+
+  static registry_type& registry()
+  {
+    static registry_type _registry;
+    return _registry;
+  }
+
+
+  // per thread page cache, pages are fetched from and drained to the pool in batches
+  typedef struct tag_magazine_type
+  {
+    tag_magazine_type()
+      : pool(nullptr)
+      , pool_id(0U)
+      , count(0U)
+      , hits(0U)
+      , misses(0U)
+    { }
+
+    // thread ends - give all cached pages back to the pool
+    ~tag_magazine_type()
+    { release(); }
+
+    // give the cached pages back to the pool, they are dropped if the pool doesn't exist anymore
+    void release()
+    {
+      if (pool && count) {
+        registry_type& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        if (std::find(reg.ids.begin(), reg.ids.end(), pool_id) != reg.ids.end()) {
+          pool->free_push(page, count);
+        }
+      }
+      count = 0U;
+    }
+
+    msg_pool*     pool;                                 // owning pool
+    std::uint64_t pool_id;                              // id of the owning pool, a new pool may reuse the address
+    pointer       page[DECOM_MSG_POOL_MAGAZINE_SIZE];   // cached free pages
+    size_type     count;                                // number of cached pages
+    std::uint32_t hits;                                 // allocations served by the cache
+    std::uint32_t misses;                               // allocations which needed a refill
+  } magazine_type;
+
+
+  // return the thread caches of the calling thread, one magazine per page class
+  static inline magazine_type* magazines()
+  {
+    static thread_local magazine_type _magazine[class_count];
+    return _magazine;
+  }
+
+
+  // return the thread cache of the calling thread and bind it to this pool
+  // the magazine serves one pool at a time, the cached pages of another pool of the class are given back to it first
+  inline magazine_type& magazine()
+  {
+    magazine_type& mag = magazines()[class_];
+    if ((mag.pool != this) || (mag.pool_id != id_)) {
+      mag.release();
+      mag.pool    = this;
+      mag.pool_id = id_;
+      mag.hits    = 0U;
+      mag.misses  = 0U;
+    }
+    return mag;
+  }
+
+
+  // return the thread cache of the calling thread if it's bound to this pool, nullptr otherwise
+  inline const magazine_type* bound_magazine() const
+  {
+    const magazine_type& mag = magazines()[class_];
+    return (mag.pool == this) && (mag.pool_id == id_) ? &mag : nullptr;
+  }
+#endif
+
+
+  const class_type           class_;           // page class of this pool
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+  std::uint64_t              id_;              // unique pool id
+#endif
+  pointer                    instance_;        // page instances
+  size_type                  page_size_;       // page size
+  size_type                  pages_;           // number of pages
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+  size_type                  magazine_size_;   // number of pages a thread cache holds at most
+#endif
+  std::atomic<std::uint64_t> free_head_;       // free list head: ABA tag (high word) | page index (low word)
+  std::atomic<size_type>     free_pages_;      // number of pages in the free list
+  std::atomic<size_type>     used_pages_;      // actual (currently) pages in use
+  std::atomic<size_type>     used_pages_max_;  // maximum of pages used
+#ifdef DECOM_STATS
+  std::atomic<std::uint32_t> alloc_failures_;  // failed page allocations
+#endif
+
+  // call and remove the notifications whose number of free pages is reached, wait_mutex_ must be locked
+  // only pages of the free list are counted, the thread caches are given back while notifications are pending
+  void notify()
+  {
+    for (std::vector<free_notify_type>::iterator it = free_notify_.begin(); it != free_notify_.end(); ) {
+      if (free_pages_.load(std::memory_order_relaxed) >= it->pages) {
+        it->callback(it->arg);
+        it = free_notify_.erase(it);
+        (void)waiters_.fetch_sub(1U);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+
+
+  // free pages notification
+  typedef struct tag_free_notify_type {
+    void        (*callback)(void* arg);  // callback function
+    void*         arg;                   // callback argument
+    size_type     pages;                 // number of free pages which triggers the callback
+  } free_notify_type;
+
+
+  // back-pressure
+  std::atomic<size_type>     waiters_;         // number of threads waiting for free pages and of pending notifications
+  std::mutex                 wait_mutex_;      // guards free_gen_ and free_notify_
+  std::condition_variable    wait_cv_;         // signaled on page free while threads are waiting
+  std::uint32_t              free_gen_;        // incremented on every page free while threads are waiting
+  std::vector<free_notify_type> free_notify_;  // pending free pages notifications
+};
+
+
+
+/**
+ * message pool storage class
+ * Provides the static page memory of a pool of PAGES pages with PAGE_SIZE bytes each
+ */
+template<std::size_t PAGE_SIZE, std::size_t PAGES>
+class msg_pool_storage : public msg_pool
+{
+public:
+  // ctor
+  msg_pool_storage(const char* name, class_type page_class)
+    : msg_pool(name, page_class)
+  {
+    static_assert(PAGES > 0U, "pool needs at least one page");
+    static_assert(PAGES < FREE_NIL, "page count exceeds the free list index range");
+    init(page_, &data_[0][0], PAGE_SIZE, PAGES);
+  }
+
+private:
+  pool_page_type page_[PAGES];              // page instances
+  std::uint8_t   data_[PAGES][PAGE_SIZE];   // page data
 };
 
 
 
+class msg;
+
 /**
  * message iterator class
+ * The iterators of a non const msg unshare a shared page before it's accessed (copy on write),
+ * so writes through them don't change other messages. Element access never changes the
+ * position of an iterator, iterators of pages which are copied meanwhile find their page again.
  */
-class msg_iterator : public std::iterator<std::forward_iterator_tag, std::uint8_t>
+class msg_iterator : public std::iterator<std::random_access_iterator_tag, std::uint8_t>
 {
 public:
   typedef std::uint8_t        value_type;
   typedef value_type*         pointer;
   typedef const value_type*   const_pointer;
   typedef value_type&         reference;
-  typedef const reference     const_reference;
+  typedef const value_type&   const_reference;
   typedef std::size_t         size_type;
 
 
 public:
-  msg_iterator(msg_pool::pointer page, bool begin)
-   : first_(page)
-   , page_ (begin ? page       : nullptr)
-   , idx_  (begin ? page->head : 0)
-  { }
+  // the iterator is placed at the given page index, pos is the logical position of it in the msg
+  // a writable iterator unshares the pages it accesses
+  inline msg_iterator(const msg* m, msg_pool::pointer page, size_type idx, size_type pos, bool writable);
 
 
   msg_iterator(const msg_iterator& it)
-   : first_(it.first_)
-   , page_ (it.page_)
-   , idx_  (it.idx_)
+   : msg_     (it.msg_)
+   , page_    (it.page_)
+   , idx_     (it.idx_)
+   , pos_     (it.pos_)
+   , gen_     (it.gen_)
+   , writable_(it.writable_)
   { }
 
 
-  inline reference operator*() const
-  { return page_->data[idx_]; }
+  inline reference operator*() const;
+
+
+  inline reference operator[](difference_type n) const
+  { return *(*this + n); }
 
 
   const msg_iterator& operator++()
   {
     DECOM_LOG_ASSERT(page_);
+    sync();
+    pos_++;
     if (++idx_ >= page_->tail) {
-      page_ = page_->next;
-      idx_  = page_ ? page_->head : 0U;
+      next_page();
     }
     return *this;
   }
@@ -245,39 +767,66 @@ public:
 
   const msg_iterator& operator--()
   {
-    // end?
-    if (!page_) {
-      for (page_ = first_; page_->next; page_ = page_->next);
-      idx_ = page_->tail;
-    }
-
-    if (idx_ > page_->head) {
-      idx_--;
-    }
-    else {
-      // find previous page
-      if (page_ != first_) {
-        msg_pool::pointer p = first_;
-        for (; p->next != page_; p = p->next);
-        page_ = p;
-        idx_  = p->tail;
+    DECOM_LOG_ASSERT(page_);
+    sync();
+    if (idx_ == page_->head) {
+      // find previous not empty page, the msg has no back links
+      for (msg_pool::pointer p = first_page(); p != page_; p = p->next) {
+        if (p->head != p->tail) {
+          idx_ = p->tail;
+          page_ = p;
+        }
       }
     }
+    pos_--;
+    idx_--;
     return *this;
   }
 
 
+  inline msg_iterator operator++(int)
+  {
+    msg_iterator tmp = *this;
+    ++*this;
+    return tmp;
+  }
+
+
+  inline msg_iterator operator--(int)
+  {
+    msg_iterator tmp = *this;
+    --*this;
+    return tmp;
+  }
+
+
+  // move within the actual page in O(1), across pages forward from the actual page
+  // and backward from the first page of the msg
   msg_iterator& operator+=(difference_type n)
   {
+    if (!page_ || !n) {
+      return *this;
+    }
+    sync();
     if (n > 0) {
-      for (; n > 0; n--) {
-        ++*this;
+      pos_ += static_cast<size_type>(n);
+      while (static_cast<size_type>(n) >= page_->tail - idx_) {
+        n -= static_cast<difference_type>(page_->tail - idx_);
+        idx_ = page_->tail;
+        if (!next_page()) {
+          pos_ -= static_cast<size_type>(n);  // end of msg reached
+          return *this;
+        }
       }
+      idx_ += static_cast<size_type>(n);
+    }
+    else if (static_cast<size_type>(-n) <= idx_ - page_->head) {
+      // same page
+      pos_ -= static_cast<size_type>(-n);
+      idx_ -= static_cast<size_type>(-n);
     }
     else {
-      for (; n < 0; n++) {
-        --*this;
-      }
+      seek(pos_ - static_cast<size_type>(-n));
     }
     return *this;
   }
@@ -301,18 +850,80 @@ public:
   }
 
 
-  inline bool operator==(const msg_iterator& other) const
-  { return (this->idx_ == other.idx_) && (this->page_ == other.page_); }
+  inline difference_type operator-(const msg_iterator& other) const
+  { return static_cast<difference_type>(pos_) - static_cast<difference_type>(other.pos_); }
 
 
+  // comparison of iterators of the same msg
+  inline bool operator==(const msg_iterator& other) const
+  { return (this->pos_ == other.pos_) && (this->msg_ == other.msg_); }
+
   inline bool operator!=(const msg_iterator& other) const
   { return !(*this == other); }
 
+  inline bool operator<(const msg_iterator& other) const
+  { return this->pos_ < other.pos_; }
+
+  inline bool operator>(const msg_iterator& other) const
+  { return this->pos_ > other.pos_; }
+
+  inline bool operator<=(const msg_iterator& other) const
+  { return this->pos_ <= other.pos_; }
+
+  inline bool operator>=(const msg_iterator& other) const
+  { return this->pos_ >= other.pos_; }
+
 
 private:
-  msg_pool::pointer first_;   // page_ pointer to first page of msg
-  msg_pool::pointer page_;    // the actual iterator page of msg
-  std::size_t       idx_;     // the actual iterator index in the page
+  // advance to the head of the next not empty page
+  // returns false if there is none, the iterator stays at the tail of the actual page (end)
+  bool next_page() const
+  {
+    for (msg_pool::pointer p = page_->next; p; p = p->next) {
+      if (p->head != p->tail) {
+        page_ = p;
+        idx_  = p->head;
+        return true;
+      }
+    }
+    return false;
+  }
+
+
+  // place the iterator at the given logical position, starting at the first page
+  void seek(size_type pos) const
+  {
+    pos_  = pos;
+    page_ = first_page();
+    idx_  = page_ ? page_->head : 0U;
+    for (msg_pool::pointer p = page_; p; p = p->next) {
+      const size_type len = p->tail - p->head;
+      if (len) {
+        page_ = p;
+        if (pos < len) {
+          idx_ = p->head + pos;
+          return;
+        }
+        pos -= len;
+        idx_ = p->tail;
+      }
+    }
+  }
+
+
+  // find the page again if pages of the msg were copied since the iterator was placed
+  inline void sync() const;
+
+  // first page of the msg
+  inline msg_pool::pointer first_page() const;
+
+
+  const msg*                msg_;       // msg of the iterator
+  mutable msg_pool::pointer page_;      // the actual iterator page of msg
+  mutable std::size_t       idx_;       // the actual iterator index in the page
+  mutable std::size_t       pos_;       // the logical iterator position in the msg
+  mutable std::uint32_t     gen_;       // copy generation of the msg the page is valid for
+  bool                      writable_;  // iterator of a non const msg, accessed pages are unshared
 };
 
 
@@ -327,33 +938,52 @@ public:
   typedef value_type*         pointer;
   typedef const value_type*   const_pointer;
   typedef value_type&         reference;
-  typedef const reference     const_reference;
+  typedef const value_type&   const_reference;
   typedef msg_iterator        iterator;
   typedef msg_iterator        const_iterator;
   typedef std::size_t         size_type;
 
+  // tag of the ref copy ctor
+  typedef struct tag_ref_type { } ref_type;
+
+  // read only span of msg data, one per page
+  typedef struct tag_segment_type
+  {
+    const std::uint8_t* data;     // start of the data in the page
+    size_type           size;     // data length
+  } segment_type;
+
 
   // ctor
   explicit msg(size_type offset = DECOM_MSG_POOL_PAGE_BEGIN)
     : illegal_ref_(0xCCU)                   // init illegal ref
     , name_("msg")
+    , pool_(&get_msg_pool())
+    , cow_gen_(0U)
   {
-    page_ = get_msg_pool().page_alloc();    // allocate new initial page out of pool
-    if (page_) {
-      page_->head = page_->tail = offset;   // init pointers
-    }
+    init_page(offset);                      // allocate new initial page out of pool
+  }
+
+
+  // ctor with page class hint, the pages of this msg are allocated out of the given pool
+  explicit msg(msg_pool& pool, size_type offset = DECOM_MSG_POOL_PAGE_BEGIN)
+    : illegal_ref_(0xCCU)                   // init illegal ref
+    , name_("msg")
+    , pool_(&pool)
+    , cow_gen_(0U)
+  {
+    init_page(offset);                      // allocate new initial page out of pool
   }
 
 
-  // ctor with element init
+  // ctor with element init, the page class is chosen by the element count
   explicit msg(size_type n, const value_type& value = value_type(), size_type offset = DECOM_MSG_POOL_PAGE_BEGIN)
     : illegal_ref_(0xCCU)                   // init illegal ref
     , name_("msg")
+    , pool_(&get_msg_pool(n))
+    , cow_gen_(0U)
   {
-    page_ = get_msg_pool().page_alloc();    // allocate new initial page out of pool
-    if (page_) {
-      page_->head = page_->tail = offset;   // init pointers
-    }
+    init_page(offset);                      // allocate new initial page out of pool
     while (n--) {
       push_back(value);
     }
@@ -365,11 +995,10 @@ public:
   msg(InputIterator first, InputIterator last, size_type offset = DECOM_MSG_POOL_PAGE_BEGIN)
    : illegal_ref_(0xCCU)                  // init illegal ref
    , name_("msg")
+   , pool_(&get_msg_pool())
+   , cow_gen_(0U)
   {
-    page_ = get_msg_pool().page_alloc();  // allocate new initial page out of pool
-    if (page_) {
-      page_->head = page_->tail = offset; // init pointers
-    }
+    init_page(offset);                    // allocate new initial page out of pool
     for (InputIterator it = first; it != last; ++it) {
       push_back(static_cast<value_type>(*it));
     }
@@ -381,22 +1010,32 @@ public:
   msg(const msg& m)
     : illegal_ref_(0xCCU)                 // init illegal ref
     , name_("msg")
+    , pool_(m.pool_)
+    , cow_gen_(0U)
   {
-    page_ = get_msg_pool().page_alloc();  // allocate new initial page out of pool
-    for (msg_pool::pointer p = m.page_; p; p = p->next) {
-      page_->head = m.page_->head;
-      page_->tail = m.page_->tail;
-      (void)memcpy(page_->data + page_->head, m.page_->data + page_->head, page_->tail - page_->head);
-      if (p->next) {
-        page_->next = get_msg_pool().page_alloc();
-        if (page_->next) {
-          // success
-          page_ = page_->next;
-        }
-        else {
-          // page allocation error
-        }
-      }
+    init_page(m.page_ ? m.page_->head : DECOM_MSG_POOL_PAGE_BEGIN);   // allocate new initial page, keep the head room
+    if (page_ && !copy_pages(m)) {
+      // page allocation error
+      DECOM_LOG_WARN("copy error, no free page");
+    }
+  }
+
+
+  // ref copy ctor - This ctor generates a cheap copy (ref copy) of the given msg like ref_copy(),
+  // but without allocating an initial page first, e.g. for queues of msgs in transmission
+  msg(const msg& m, ref_type)
+    : illegal_ref_(0xCCU)                 // init illegal ref
+    , name_("msg")
+    , page_(m.page_)
+    , last_(m.last_)
+    , size_(m.size_)
+    , cursor_page_(nullptr)
+    , pool_(m.pool_)
+    , cow_gen_(0U)
+  {
+    // inc refs of the pages
+    for (msg_pool::pointer p = page_; p; p = p->next) {
+      msg_pool::page_ref(p);
     }
   }
 
@@ -405,52 +1044,47 @@ public:
   ~msg()
   {
     // message goes out of scope, free all associated pages
-    for (msg_pool::pointer p = page_; p; p = p->next) {
-      get_msg_pool().page_free(p);
-    }
+    free_pages(page_);
   }
 
 
   // assignment operator, make a real copy (physical)
   msg& operator=(const msg& m)
   {
+    if (&m == this) {
+      return *this;
+    }
+
     clear();    // free old pages
-    for (msg_pool::pointer p = m.page_; p; p = p->next) {
-      page_->head = m.page_->head;
-      page_->tail = m.page_->tail;
-      (void)memcpy(page_->data + page_->head, m.page_->data + page_->head, page_->tail - page_->head);
-      if (p->next) {
-        page_->next = get_msg_pool().page_alloc();
-        if (page_->next) {
-          // success
-          page_ = page_->next;
-        }
-        else {
-          // page allocation error
-          DECOM_LOG_WARN("assignment error, no free page");
-        }
-      }
+    if (page_ && !copy_pages(m)) {
+      // page allocation error
+      DECOM_LOG_WARN("assignment error, no free page");
     }
     return *this;
   }
 
 
   // Generates a cheap copy (ref copy), not a physical second msg.
-  // The ref counters of all pages are incremented. Both messages
-  // (original and copy) are read only then!
+  // The ref counters of all pages are incremented. The modifiers and the non const element
+  // access of both messages copy a shared page when it's accessed first (copy on write).
   msg& ref_copy(const msg& m)
   {
-    // free old pages
-    for (msg_pool::pointer p = page_; p; p = p->next) {
-      get_msg_pool().page_free(p);
+    if (&m == this) {
+      return *this;
     }
 
+    // free old pages
+    free_pages(page_);
+
     // attach the pages to be copied
     page_ = m.page_;
+    last_ = m.last_;
+    size_ = m.size_;
+    cursor_page_ = nullptr;
 
     // inc refs of new pages
     for (msg_pool::pointer p = page_; p; p = p->next) {
-      p->ref++;
+      msg_pool::page_ref(p);
     }
     return *this;
   }
@@ -479,52 +1113,93 @@ public:
 
 
   // element access
-  reference at(size_type pos)
+  // The page of the last access is cached, so ascending indexed loops over the msg
+  // are linear. Like the iterators, this is not safe for concurrent access of the same msg object.
+  // A shared page is copied before the reference is returned, so writes don't change other messages.
+  reference at(size_type pos)
+  {
+    // security check
+    if (!page_) return illegal_ref_;
+
+    if (pos >= size_) {
+      // i is out of range
+      DECOM_LOG_WARN("at() position " << pos << " is out of range");
+      return illegal_ref_;
+    }
+
+    // find the according page, start at the last page, the cursor or the first page
+    msg_pool::pointer p = page_;
+    size_type _size = 0U;
+    if (pos >= size_ - (last_->tail - last_->head)) {
+      p     = last_;
+      _size = size_ - (last_->tail - last_->head);
+    }
+    else if (cursor_page_ && (pos >= cursor_pos_)) {
+      p     = cursor_page_;
+      _size = cursor_pos_;
+    }
+    p = find_page(p, _size, pos);
+    // page found, copy it if it's shared
+    p = unshare(p);
+    if (!p) {
+      DECOM_LOG_WARN("at() - no free page");
+      return illegal_ref_;
+    }
+    cursor_page_ = p;
+    cursor_pos_  = _size;
+    return p->data[p->head + pos - _size];
+  }
+
+
+  // element access
+  // The cursor is neither used nor changed, so concurrent const access of the same msg object is safe.
+  const_reference at(size_type pos) const
   {
     // security check
     if (!page_) return illegal_ref_;
 
-    // find the according page
+    if (pos >= size_) {
+      // i is out of range
+      DECOM_LOG_WARN("at() position " << pos << " is out of range");
+      return illegal_ref_;
+    }
+
+    // find the according page, start at the last page or the first page
+    msg_pool::pointer p = page_;
     size_type _size = 0U;
-    for (msg_pool::pointer p = page_; p; p = p->next) {
-      if (pos < _size + (p->tail - p->head)) {
-        // page found
-        return p->data[p->head + pos - _size];
-      }
-      _size += p->tail - p->head;
+    if (pos >= size_ - (last_->tail - last_->head)) {
+      p     = last_;
+      _size = size_ - (last_->tail - last_->head);
     }
-    // page not found (i is out of range)
-    DECOM_LOG_WARN("at() position " << pos << " is out of range");
-    return illegal_ref_;
+    p = find_page(p, _size, pos);
+    return p->data[p->head + pos - _size];
   }
 
 
   // element access
-  inline const_reference at(size_type n) const { return at(n); }
   inline reference operator[](size_type n) { return at(n); }
   inline const_reference operator[](size_type n) const { return at(n); }
   inline reference front() { return *begin(); }
   inline const_reference front() const { return *begin(); }
-  inline reference back() { return at(size() - 1U); }
-  inline const_reference back() const { return at(size() - 1U); }
+  inline reference back() { return size_ && unshare(last_) ? last_->data[last_->tail - 1U] : illegal_ref_; }
+  inline const_reference back() const { return size_ ? last_->data[last_->tail - 1U] : illegal_ref_; }
 
 
   // modifier
   bool push_back(value_type x)
   {
     // security check
-    if (!page_ || page_->ref > 1U) {
-      DECOM_LOG_WARN("push_back() - " << (!page_ ? "page invalid" : "pageref > 1"));
+    if (!page_ || !unshare(last_)) {
+      DECOM_LOG_WARN("push_back() - " << (!page_ ? "page invalid" : "no free page"));
       return false;
     }
     // store data
-    msg_pool::pointer page = last_page();
-    if (page->tail == DECOM_MSG_POOL_PAGE_SIZE) {
+    if (last_->tail == last_->size) {
       // last page is full - allocate a new one
-      page->next = get_msg_pool().page_alloc();
-      if (page->next) {
+      last_->next = pool_->page_alloc();
+      if (last_->next) {
         // success
-        page = page->next;
+        last_ = last_->next;
       }
       else {
         // page allocation error
@@ -532,7 +1207,8 @@ public:
       }
     }
     // store data
-    page->data[page->tail++] = x;
+    last_->data[last_->tail++] = x;
+    size_++;
     return true;
   }
 
@@ -541,18 +1217,19 @@ public:
   void pop_back()
   {
     // security check
-    if (!page_ || page_->ref > 1U) {
-      DECOM_LOG_WARN("pop_back() - " << (!page_ ? "page invalid" : "pageref > 1"));
+    if (!page_ || !size_ || !unshare(last_)) {
+      DECOM_LOG_WARN("pop_back() - " << (!page_ ? "page invalid" : (!size_ ? "msg empty" : "no free page")));
       return;
     }
     // decrement size
-    msg_pool::pointer _last_page = last_page();
-    if ((--_last_page->tail == 0U) && (page_->next)) {
+    while (last_->tail == last_->head) {
+      // skip empty last pages
+      drop_last_page();
+    }
+    size_--;
+    if ((--last_->tail == last_->head) && (last_ != page_)) {
       // remove page if it's not the only one of this msg
-      get_msg_pool().page_free(_last_page);
-      msg_pool::pointer p = page_;
-      for (; p && p->next && p->next != _last_page; p = p->next);
-      p->next = nullptr;
+      drop_last_page();
     }
   }
 
@@ -561,18 +1238,18 @@ public:
   bool push_front(value_type x)
   {
     // security check
-    if (!page_ || page_->ref > 1) {
-      DECOM_LOG_WARN("push_front() - " << (!page_ ? "page invalid" : "pageref > 1"));
+    if (!page_) {
+      DECOM_LOG_WARN("push_front() - page invalid");
       return false;
     }
     // store data
-    if (page_->head == 0U) {
-      // front page is full - allocate a new one
-      msg_pool::pointer p = get_msg_pool().page_alloc();
+    if ((page_->head == 0U) || is_shared(page_)) {
+      // front page is full or shared - allocate a new one, a shared page is not copied
+      msg_pool::pointer p = pool_->page_alloc();
       if (p) {
         // success
-        p->head = DECOM_MSG_POOL_PAGE_SIZE;
-        p->tail = DECOM_MSG_POOL_PAGE_SIZE;
+        p->head = p->size;
+        p->tail = p->size;
         p->next = page_;
         page_   = p;
       }
@@ -583,6 +1260,8 @@ public:
     }
     // store data
     page_->data[--page_->head] = x;
+    size_++;
+    cursor_page_ = nullptr;
     return true;
   }
 
@@ -591,16 +1270,24 @@ public:
   void pop_front()
   {
     // security checks
-    if (!page_ || page_->ref > 1U || page_->head == page_->tail) {
-      DECOM_LOG_WARN("pop_front() - " << (!page_ ? "page invalid" : "pageref > 1"));
+    if (!page_ || !size_) {
+      DECOM_LOG_WARN("pop_front() - " << (!page_ ? "page invalid" : "msg empty"));
+      return;
+    }
+    while (page_->head == page_->tail) {
+      // skip empty first pages, releasing a shared page doesn't change it
+      drop_first_page();
+    }
+    if (!unshare(page_)) {
+      DECOM_LOG_WARN("pop_front() - no free page");
       return;
     }
     // increment start position
-    if ((++page_->head == DECOM_MSG_POOL_PAGE_SIZE) && (page_->next)) {
+    size_--;
+    cursor_page_ = nullptr;
+    if ((++page_->head == page_->tail) && (page_->next)) {
       // remove page if it's not the last one
-      msg_pool::pointer p = page_;
-      page_ = page_->next;
-      get_msg_pool().page_free(p);
+      drop_first_page();
     }
   }
 
@@ -610,32 +1297,24 @@ public:
   {
     if (!page_) { return; };
 
-    for (msg_pool::pointer p = page_; p; p = p->next) {
-      get_msg_pool().page_free(p);                            // free page or decrement reference
-    }
-    page_ = get_msg_pool().page_alloc();                      // allocate new page out of pool
-    if (page_) {
-      page_->head = page_->tail = DECOM_MSG_POOL_PAGE_BEGIN;  // init pointers
-    }
+    free_pages(page_);                      // free pages or decrement references
+    init_page(DECOM_MSG_POOL_PAGE_BEGIN);   // allocate new page out of pool
   }
 
 
   // insert
   iterator insert(iterator position, const value_type& x)
   {
-    if (!page_ || page_->ref > 1U) {
-      DECOM_LOG_WARN("insert() - " << (!page_ ? "page invalid" : "pageref > 1"));
+    const size_type pos = static_cast<size_type>(position - begin());
+    if (!page_ || !unshare(last_)) {
+      DECOM_LOG_WARN("insert() - " << (!page_ ? "page invalid" : "no free page"));
       return end();
     }
 
     push_back(size() ? back() : 0U);  // add new last element
-    if (position == end()) {
-      position = end() - 1U;
-    }
-    else {
-      for (iterator it = end() - 1U; it != position; --it) {
-        *it = *(it - 1U);
-      }
+    position = begin() + pos;         // pages may be copied or added
+    for (iterator it = end() - 1U; it != position; --it) {
+      *it = *(it - 1U);
     }
     *position = x;
 
@@ -662,13 +1341,22 @@ public:
   }
 
 
+  // insert, byte buffer ranges are copied in page sized chunks
+  inline void insert(iterator position, const std::uint8_t* first, const std::uint8_t* last)
+  {
+    (void)insert_range(position, first, static_cast<size_type>(last - first));
+  }
+
+
   // erase
   iterator erase(iterator position)
   {
-    if (!page_ || page_->ref > 1U) {
-      DECOM_LOG_WARN("erase() - " << (!page_ ? "page invalid" : "pageref > 1"));
+    const size_type pos = static_cast<size_type>(position - begin());
+    if (!page_ || !unshare(last_)) {
+      DECOM_LOG_WARN("erase() - " << (!page_ ? "page invalid" : "no free page"));
       return end();
     }
+    position = begin() + pos;   // pages may be copied
 
     if (position == end()) { return end(); }
 
@@ -694,22 +1382,19 @@ public:
 
 
   // iterators
-        iterator begin()       { return iterator(page_, true ); }
-  const_iterator begin() const { return iterator(page_, true ); }
-        iterator end()         { return iterator(page_, false); }
-  const_iterator end() const   { return iterator(page_, false); }
+        iterator begin()       { return iterator(this, page_, page_ ? page_->head : 0U, 0U, true); }
+  const_iterator begin() const { return iterator(this, page_, page_ ? page_->head : 0U, 0U, false); }
+        iterator end()         { return iterator(this, last_, last_ ? last_->tail : 0U, size_, true); }
+  const_iterator end() const   { return iterator(this, last_, last_ ? last_->tail : 0U, size_, false); }
+  // read only iterators of a non const msg, shared pages are not copied
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const   { return end(); }
 
 
   // capacity - size
   // actual size of this message
   inline size_type size() const
-  {
-    size_type _size = 0U;
-    for (msg_pool::pointer p = page_; p; p = p->next) {
-      _size += p->tail - p->head;
-    }
-    return _size;
-  }
+  { return size_; }
 
 
   // capacity - maximum size
@@ -717,9 +1402,9 @@ public:
   size_type max_size()
   {
     // return the addition of:
-    return size() +                                                                           // actual msg size
-      DECOM_MSG_POOL_PAGE_SIZE - last_page()->tail +                                          // rest amount of last page
-      (get_msg_pool().max_size() - get_msg_pool().used_pages()) * DECOM_MSG_POOL_PAGE_SIZE;   // size of all free pages in the pool
+    return size_ +                                                              // actual msg size
+      (last_ ? last_->size - last_->tail : 0U) +                                // rest amount of last page
+      (pool_->max_size() - pool_->used_pages()) * pool_->page_size();           // size of all free pages in the pool
   }
 
 
@@ -735,55 +1420,65 @@ public:
   // capacity
   // true if msg is empty (size == 0)
   inline bool empty() const
-  { return size() == 0U; }
+  { return size_ == 0U; }
 
 
-  // resize msg to given size
-  bool resize(size_type sz)
+  // resize msg to given size, grown elements are zero initialized
+  // with init == false they are left uninitialized, e.g. to receive data into the pages in place
+  bool resize(size_type sz, bool init = true)
   {
     // security check
-    if (!page_ || page_->ref > 1U) {
-      DECOM_LOG_WARN("resize() - " << (!page_ ? "page invalid" : "pageref > 1"));
+    if (!page_) {
+      DECOM_LOG_WARN("resize() - page invalid");
       return false;
     }
 
-    size_type msg_size = size();
-    if (sz == msg_size) {
-      // nothing to do
-      return true;
-    }
-
-    if (sz > msg_size) {
+    if (sz > size_) {
       // grow
-      msg_pool::pointer page = last_page();
-      for (size_type i = 0U; i < sz - msg_size; i++) {
-        if (page->tail == DECOM_MSG_POOL_PAGE_SIZE) {
+      if (!unshare(last_)) {
+        DECOM_LOG_WARN("resize() - no free page");
+        return false;
+      }
+      while (size_ < sz) {
+        if (last_->tail == last_->size) {
           // last page is full - allocate a new one
-          page->next = get_msg_pool().page_alloc();
-          if (page->next) {
+          last_->next = pool_->page_alloc();
+          if (last_->next) {
             // success
-            page = page->next;
+            last_ = last_->next;
           }
           else {
             // page allocation error
             return false;
           }
         }
-        page->data[page->tail++] = 0U;  // init data
+        // init data
+        const size_type chunk = sz - size_ < last_->size - last_->tail ? sz - size_ : last_->size - last_->tail;
+        if (init) {
+          (void)memset(last_->data + last_->tail, 0, chunk);
+        }
+        last_->tail += chunk;
+        size_       += chunk;
       }
     }
-    else {
-      // shrink
-      for (size_type i = 0U; i < msg_size - sz; i++) {
-        msg_pool::pointer _last_page = last_page();
-        if ((--_last_page->tail == 0U) && (page_->next)) {
-          // remove page if it's not the only one of this msg
-          get_msg_pool().page_free(_last_page);
-          msg_pool::pointer p = page_;
-          for (; p && p->next && p->next != _last_page; p = p->next);
-          p->next = nullptr;
-        }
+    else if (sz < size_) {
+      // shrink - find the page of the new end and release all pages behind
+      msg_pool::pointer p = page_;
+      size_type _size = 0U;
+      for (; _size + (p->tail - p->head) < sz; p = p->next) {
+        _size += p->tail - p->head;
+      }
+      p = unshare(p);
+      if (!p) {
+        DECOM_LOG_WARN("resize() - no free page");
+        return false;
       }
+      p->tail = p->head + (sz - _size);
+      free_pages(p->next);
+      p->next = nullptr;
+      last_   = p;
+      size_   = sz;
+      cursor_page_ = nullptr;
     }
     return true;
   }
@@ -804,29 +1499,29 @@ public:
     }
 
     // copy in page sizes
-    size_type offset_page = 0U;   // offset of all previous pages
     size_type offset_dest = 0U;   // offset in destination buffer (copied bytes)
     for (msg_pool::pointer p = page_; p; p = p->next) {
       size_type page_start = p->head;
       size_type page_size = p->tail - p->head;
 
       // start within this page?
-      if ((offset > offset_page) && (offset < offset_page + page_size)) {
-        // yes - adjust start position and page_size
-        page_start += offset - offset_page;
-        page_size -= offset - offset_page;
+      if (offset >= page_size) {
+        // no - skip the page
+        offset -= page_size;
+        continue;
       }
-
-      if (offset < offset_page + page_size) {
-        // check maxsize adjust page_size
-        if (offset_dest + page_size > maxlength) {
-          page_size = maxlength - offset_dest;
-        }
-        // copy to dest buffer
-        (void)memcpy(dest + offset_dest, &p->data[page_start], page_size);
-        offset_dest += page_size;
+      // yes - adjust start position and page_size
+      page_start += offset;
+      page_size  -= offset;
+      offset      = 0U;
+
+      // check maxsize adjust page_size
+      if (offset_dest + page_size > maxlength) {
+        page_size = maxlength - offset_dest;
       }
-      offset_page += page_size;
+      // copy to dest buffer
+      (void)memcpy(dest + offset_dest, &p->data[page_start], page_size);
+      offset_dest += page_size;
 
       // stop if maxsize is reached
       if (offset_dest >= maxlength) {
@@ -837,6 +1532,47 @@ public:
   }
 
 
+  /**
+   * Number of segments (not empty pages) of the msg data
+   * \return Number of segments which get_segments() can return at most
+   */
+  size_type segment_count() const
+  {
+    size_type count = 0U;
+    for (msg_pool::pointer p = page_; p; p = p->next) {
+      count += p->tail != p->head ? 1U : 0U;
+    }
+    return count;
+  }
+
+
+  /**
+   * Read only scatter/gather view of the msg data without copying it
+   * The segments point into the pool pages and are valid as long as this msg isn't changed.
+   * \param seg Segment array to fill, segment_type or any struct with iov_base and iov_len fields,
+   *            like struct iovec for writev()/sendmsg()
+   * \param count Number of elements of the segment array
+   * \param offset Start offset in msg, e.g. the amount of data which was already written
+   * \return Number of filled segments
+   */
+  template<typename Segment>
+  size_type get_segments(Segment* seg, size_type count, size_type offset = 0U) const
+  {
+    size_type n = 0U;
+    for (msg_pool::pointer p = page_; p && (n < count); p = p->next) {
+      const size_type len = p->tail - p->head;
+      if (offset >= len) {
+        // skip empty pages and pages before the offset
+        offset -= len;
+        continue;
+      }
+      set_segment(seg[n++], p->data + p->head + offset, len - offset);
+      offset = 0U;
+    }
+    return n;
+  }
+
+
   /**
    * Copy a linear byte buffer to msg
    * \param source Source buffer
@@ -853,27 +1589,170 @@ public:
     // remove old msg data
     clear();
 
-    msg_pool::pointer page = page_;
-    size_type offset = 0U;
     // copy data in page sized chunks
-    do {
-      page->tail = page->tail + count > DECOM_MSG_POOL_PAGE_SIZE ? DECOM_MSG_POOL_PAGE_SIZE : page->tail + count;
-      (void)memcpy(page->data + page->head, source + offset, page->tail - page->head);
-      count -= page->tail - page->head;
-      offset += page->tail - page->head;
-      if (count) {
-        page->next = get_msg_pool().page_alloc();
-        if (page->next) {
-          // success
-          page = page->next;
-        }
-        else {
-          // page allocation error - clean up whole msg
-          clear();
-          return false;
+    if (!page_ || !write_back(source, count)) {
+      // page allocation error - clean up whole msg
+      clear();
+      return false;
+    }
+    return true;
+  }
+
+
+  /**
+   * Append a linear byte buffer to the end of msg
+   * \param source Source buffer
+   * \param count Number of bytes
+   * \return true if successful, the msg is unchanged on page allocation error
+   */
+  bool append(const std::uint8_t* source, size_type count)
+  {
+    // security check
+    if (!page_ || !source) {
+      return false;
+    }
+    if (!unshare(last_)) {
+      DECOM_LOG_WARN("append() - no free page");
+      return false;
+    }
+
+    // copy data in page sized chunks
+    const size_type msg_size = size_;
+    if (!write_back(source, count)) {
+      // page allocation error - remove the partial data
+      (void)resize(msg_size);
+      return false;
+    }
+    return true;
+  }
+
+
+  /**
+   * Prepend a linear byte buffer in front of msg, e.g. a protocol header
+   * The head room of the first page (DECOM_MSG_POOL_PAGE_BEGIN) is used first,
+   * additional pages are filled from their end to leave head room for further headers.
+   * \param source Source buffer
+   * \param count Number of bytes
+   * \return true if successful, the msg is unchanged on page allocation error
+   */
+  bool prepend(const std::uint8_t* source, size_type count)
+  {
+    // security check
+    if (!page_ || !source) {
+      return false;
+    }
+
+    // the head room of a shared first page is not used, the data goes to new pages in front of it
+    const size_type head = is_shared(page_) ? 0U : page_->head;
+    const size_type room = count < head ? count : head;
+    const size_type rest = count - room;
+    msg_pool::pointer first = page_;
+    if (rest) {
+      // allocate all additional pages first
+      const size_type pages = (rest + pool_->page_size() - 1U) / pool_->page_size();
+      first = alloc_pages(*pool_, pages);
+      if (!first) {
+        return false;
+      }
+      // fill the new pages, the first one gets the remainder
+      msg_pool::pointer p = first;
+      for (size_type chunk = rest - (pages - 1U) * pool_->page_size(); ; chunk = p->size) {
+        p->head = p->size - chunk;
+        p->tail = p->size;
+        (void)memcpy(p->data + p->head, source, chunk);
+        source += chunk;
+        if (!p->next) break;
+        p = p->next;
+      }
+      p->next = page_;
+    }
+    // fill the head room of the former first page
+    page_->head -= room;
+    (void)memcpy(page_->data + page_->head, source, room);
+
+    page_ = first;
+    size_ += count;
+    cursor_page_ = nullptr;
+    return true;
+  }
+
+
+  /**
+   * Insert a linear byte buffer at the given position
+   * The data is copied in page sized chunks, the page at the position is split if necessary.
+   * \param position Insert position, the iterator is invalid afterwards
+   * \param source Source buffer
+   * \param count Number of bytes
+   * \return true if successful, the msg is unchanged on page allocation error
+   */
+  bool insert_range(iterator position, const std::uint8_t* source, size_type count)
+  {
+    const size_type pos = static_cast<size_type>(position - begin());
+    if (pos >= size_) {
+      return append(source, count);
+    }
+    if (pos == 0U) {
+      return prepend(source, count);
+    }
+    if (!source) {
+      return false;
+    }
+
+    // find the page of the insert position
+    msg_pool::pointer p = page_;
+    size_type offset = 0U;
+    for (; pos > offset + (p->tail - p->head); p = p->next) {
+      offset += p->tail - p->head;
+    }
+    p = unshare(p);
+    if (!p) {
+      DECOM_LOG_WARN("insert_range() - no free page");
+      return false;
+    }
+    const size_type idx = p->head + pos - offset;
+
+    if (count <= p->size - p->tail) {
+      // data fits into the page - move the rest of the page behind it
+      (void)memmove(p->data + idx + count, p->data + idx, p->tail - idx);
+      (void)memcpy(p->data + idx, source, count);
+      p->tail += count;
+    }
+    else {
+      // split the page: allocate the pages for the data and for the rest of the page first
+      const size_type rest  = p->tail - idx;
+      const size_type room  = p->size - idx;
+      const size_type pages = (count > room ? (count - room + p->size - 1U) / p->size : 0U) + (rest ? 1U : 0U);
+      msg_pool::pointer first = pages ? alloc_pages(*p->pool, pages) : nullptr;
+      if (pages && !first) {
+        return false;
+      }
+      msg_pool::pointer t = first;
+      for (; t && t->next; t = t->next);
+      if (rest) {
+        // move the rest of the page to the last new page
+        (void)memcpy(t->data, p->data + idx, rest);
+        t->tail = rest;
+      }
+      p->tail = idx;
+      if (t) {
+        t->next = p->next;
+        p->next = first;
+        if (last_ == p) {
+          last_ = t;
         }
       }
-    } while (count);
+      // copy the data behind the split position, the new pages are empty
+      size_type left = count;
+      for (msg_pool::pointer q = p; left; q = q->next) {
+        const size_type chunk = left < q->size - q->tail ? left : q->size - q->tail;
+        (void)memcpy(q->data + q->tail, source, chunk);
+        q->tail += chunk;
+        source  += chunk;
+        left    -= chunk;
+      }
+    }
+    size_ += count;
+    cursor_page_ = nullptr;
     return true;
   }
 
@@ -884,11 +1763,22 @@ public:
    */
   void append(msg& second)
   {
+    if (!page_ || !second.page_ || &second == this) {
+      DECOM_LOG_WARN("append() - invalid message");
+      return;
+    }
+    if (!unshare(last_)) {
+      // the next pointer of the last page is changed, it must be exclusive
+      DECOM_LOG_WARN("append() - no free page");
+      return;
+    }
     // concat all pages to this object
-    last_page()->next = second.page_;
+    last_->next = second.page_;
+    last_       = second.last_;
+    size_      += second.size_;
     // inc page references of second message
     for (msg_pool::pointer p = second.page_; p; p = p->next) {
-      p->ref++;
+      msg_pool::page_ref(p);
     }
   }
 
@@ -901,27 +1791,340 @@ public:
 
   /**
    * msg pool access
+   * \return The pool of the default page class
    */
   static inline msg_pool& get_msg_pool()
   {
-    static msg_pool _msg_pool;
+    static msg_pool_storage<DECOM_MSG_POOL_PAGE_SIZE, DECOM_MSG_POOL_PAGES> _msg_pool("msg_pool", msg_pool::class_default);
     return _msg_pool;
   }
 
 
+  /**
+   * msg pool access by page class
+   * \param page_class The page class, a disabled class returns the pool of the default class
+   * \return The pool of the given page class
+   */
+  static msg_pool& get_msg_pool(msg_pool::class_type page_class)
+  {
+    switch (page_class) {
+#if DECOM_MSG_POOL_SMALL_PAGES > 0U
+      case msg_pool::class_small : {
+        static msg_pool_storage<DECOM_MSG_POOL_SMALL_PAGE_SIZE, DECOM_MSG_POOL_SMALL_PAGES> _msg_pool_small("msg_pool_small", msg_pool::class_small);
+        return _msg_pool_small;
+      }
+#endif
+#if DECOM_MSG_POOL_LARGE_PAGES > 0U
+      case msg_pool::class_large : {
+        static msg_pool_storage<DECOM_MSG_POOL_LARGE_PAGE_SIZE, DECOM_MSG_POOL_LARGE_PAGES> _msg_pool_large("msg_pool_large", msg_pool::class_large);
+        return _msg_pool_large;
+      }
+#endif
+      default :
+        return get_msg_pool();
+    }
+  }
+
+
+  /**
+   * msg pool access by size
+   * \param size_hint The expected message size
+   * \return The pool of the smallest page class which holds size_hint bytes behind the page begin offset,
+   *         the largest enabled class if no class is big enough
+   */
+  static msg_pool& get_msg_pool(size_type size_hint)
+  {
+#if DECOM_MSG_POOL_SMALL_PAGES > 0U
+    if (size_hint + page_begin(DECOM_MSG_POOL_SMALL_PAGE_SIZE) <= DECOM_MSG_POOL_SMALL_PAGE_SIZE) {
+      return get_msg_pool(msg_pool::class_small);
+    }
+#endif
+#if DECOM_MSG_POOL_LARGE_PAGES > 0U
+    if (size_hint + page_begin(DECOM_MSG_POOL_PAGE_SIZE) > DECOM_MSG_POOL_PAGE_SIZE) {
+      return get_msg_pool(msg_pool::class_large);
+    }
+#endif
+    (void)size_hint;
+    return get_msg_pool();
+  }
+
+
 private:
-  // return a pointer to the last page of this msg
-  inline msg_pool::pointer last_page() const
+  // true if the page is referenced by more than one msg, the page is read only then
+  // a shared page is followed by shared pages only, so a shared last page means that the msg is shared
+  static inline bool is_shared(msg_pool::const_pointer page)
+  { return page->ref.load(std::memory_order_acquire) > 1U; }
+
+
+  // return the begin offset of a new msg in a page of the given size
+  // the offset is limited to a quarter of the page, so small pages keep room for data
+  static inline size_type page_begin(size_type page_size, size_type offset = DECOM_MSG_POOL_PAGE_BEGIN)
+  { return offset < page_size ? offset : page_size / 4U; }
+
+
+  // allocate the initial page out of the pool
+  inline void init_page(size_type offset)
+  {
+    page_ = pool_->page_alloc();
+    last_ = page_;
+    size_ = 0U;
+    cursor_page_ = nullptr;
+    if (page_) {
+      page_->head = page_->tail = page_begin(page_->size, offset);  // init pointers
+    }
+  }
+
+
+  // copy the given bytes to the end of this msg in page sized chunks, the last page must be exclusive
+  bool write_back(const std::uint8_t* source, size_type count)
+  {
+    while (count) {
+      if (last_->tail == last_->size) {
+        // last page is full - allocate a new one
+        last_->next = pool_->page_alloc();
+        if (!last_->next) {
+          // page allocation error
+          return false;
+        }
+        last_ = last_->next;
+      }
+      const size_type chunk = count < last_->size - last_->tail ? count : last_->size - last_->tail;
+      (void)memcpy(last_->data + last_->tail, source, chunk);
+      last_->tail += chunk;
+      size_       += chunk;
+      source      += chunk;
+      count       -= chunk;
+    }
+    return true;
+  }
+
+
+  // allocate a chain of the given number of empty pages, returns nullptr on page allocation error
+  static msg_pool::pointer alloc_pages(msg_pool& pool, size_type count)
+  {
+    msg_pool::pointer first = nullptr;
+    for (; count; count--) {
+      msg_pool::pointer p = pool.page_alloc();
+      if (!p) {
+        free_pages(first);
+        return nullptr;
+      }
+      p->next = first;
+      first   = p;
+    }
+    return first;
+  }
+
+
+  // Copy on write: make the given page of this msg exclusive before it is changed.
+  // Pages are shared as the tail of a page chain, so the next pointers of all shared pages
+  // in front of the given page are shared, too. These pages are copied as well.
+  // Returns the exclusive page or nullptr on page allocation error, the msg is unchanged then.
+  msg_pool::pointer unshare(msg_pool::pointer page)
+  {
+    if (!is_shared(page)) {
+      return page;
+    }
+
+    // find the first shared page
+    msg_pool::pointer prev = nullptr;
+    msg_pool::pointer first = page_;
+    for (; (first != page) && !is_shared(first); first = first->next) {
+      prev = first;
+    }
+
+    // copy the pages out of their own pool, the page sizes may differ
+    msg_pool::pointer copy = nullptr;
+    msg_pool::pointer c = nullptr;
+    for (msg_pool::pointer p = first; ; p = p->next) {
+      msg_pool::pointer n = p->pool->page_alloc();
+      if (!n) {
+        free_pages(copy);
+        return nullptr;
+      }
+      n->head = p->head;
+      n->tail = p->tail;
+      (void)memcpy(n->data + p->head, p->data + p->head, p->tail - p->head);
+      if (c) {
+        c->next = n;
+      }
+      else {
+        copy = n;
+      }
+      c = n;
+      if (p == page) {
+        break;
+      }
+    }
+
+    // link the copies, the pages behind stay shared
+    c->next = page->next;
+    if (prev) {
+      prev->next = copy;
+    }
+    else {
+      page_ = copy;
+    }
+    if (last_ == page) {
+      last_ = c;
+    }
+    cursor_page_ = nullptr;
+    cow_gen_++;   // iterators find their pages again
+
+    // release the originals
+    for (msg_pool::pointer p = first; ; ) {
+      msg_pool::pointer next = p->next;
+      const bool done = (p == page);
+      free_page(p);
+      if (done) {
+        break;
+      }
+      p = next;
+    }
+    return c;
+  }
+
+
+  // assign a segment of get_segments()
+  static inline void set_segment(segment_type& seg, const std::uint8_t* data, size_type size)
+  {
+    seg.data = data;
+    seg.size = size;
+  }
+
+
+  // assign a struct iovec like segment of get_segments()
+  template<typename IoVec>
+  static inline void set_segment(IoVec& iov, const std::uint8_t* data, size_type size)
   {
+    iov.iov_base = const_cast<std::uint8_t*>(data);
+    iov.iov_len  = size;
+  }
+
+
+  // remove the first page, the msg must have more than one page
+  inline void drop_first_page()
+  {
+    cursor_page_ = nullptr;
+    msg_pool::pointer p = page_;
+    page_ = page_->next;
+    free_page(p);
+  }
+
+
+  // remove the last page, the msg must have more than one page
+  // the page before is searched from the first page, the msg has no back links
+  inline void drop_last_page()
+  {
+    cursor_page_ = nullptr;
     msg_pool::pointer p = page_;
-    for (; p->next; p = p->next);
+    for (; p->next != last_; p = p->next);
+    free_page(last_);
+    p->next = nullptr;
+    last_   = p;
+  }
+
+
+  // make a deep copy of the pages of the given msg, page_ must be a valid, empty and exclusive page
+  bool copy_pages(const msg& m)
+  {
+    for (msg_pool::pointer p = m.page_; p; p = p->next) {
+      if (!write_back(p->data + p->head, p->tail - p->head)) {
+        // page allocation error
+        return false;
+      }
+    }
+    return true;
+  }
+
+
+  // return the page of the given msg position, the search starts at the given page and its msg position
+  // the position of the head of the returned page is stored in page_pos
+  static inline msg_pool::pointer find_page(msg_pool::pointer p, size_type& page_pos, size_type pos)
+  {
+    for (; pos >= page_pos + (p->tail - p->head); p = p->next) {
+      page_pos += p->tail - p->head;
+    }
     return p;
   }
 
-  value_type illegal_ref_;      // illegal ref, returned if [] or 'at' is out of bounds
-  msg_pool::pointer page_;      // first page of the message
+
+  // free a page or release a reference, the page is returned to its own pool
+  static inline void free_page(msg_pool::pointer p)
+  { p->pool->page_free(p); }
+
+
+  // free (dereference) the given page chain
+  // the next pointer is read before the page is released, because a freed page
+  // may be reallocated by another thread immediately
+  static inline void free_pages(msg_pool::pointer p)
+  {
+    while (p) {
+      msg_pool::pointer next = p->next;
+      free_page(p);
+      p = next;
+    }
+  }
+
+  mutable value_type illegal_ref_;        // illegal ref, returned if [] or 'at' is out of bounds
+  msg_pool::pointer page_;                // first page of the message
+  msg_pool::pointer last_;                // last page of the message, kept to make appending O(1)
+  size_type size_;                        // cached size of the message
+  msg_pool::pointer cursor_page_;         // page of the last non const indexed access
+  size_type cursor_pos_;                  // msg position of the head of cursor_page_
+  msg_pool* pool_;                        // pool of the page class of this msg, new pages are allocated out of it
+  std::uint32_t cow_gen_;                 // incremented when pages are copied on write, iterators check it
+
+  friend class msg_iterator;
 };
 
+
+///////////////////////////////////////////////////////////////////////////////
+// msg_iterator functions which need the msg class
+
+inline msg_iterator::msg_iterator(const msg* m, msg_pool::pointer page, size_type idx, size_type pos, bool writable)
+  : msg_     (m)
+  , page_    (page)
+  , idx_     (idx)
+  , pos_     (pos)
+  , gen_     (m->cow_gen_)
+  , writable_(writable)
+{
+  if (page_ && (idx_ == page_->tail)) {
+    next_page();   // skip empty pages
+  }
+}
+
+
+inline msg_iterator::reference msg_iterator::operator*() const
+{
+  sync();
+  if (writable_ && msg::is_shared(page_)) {
+    // copy on write, the msg of a writable iterator is not const
+    msg_pool::pointer p = const_cast<msg*>(msg_)->unshare(page_);
+    if (!p) {
+      DECOM_LOG_WARN2("iterator - no free page", msg_->name_);
+      return msg_->illegal_ref_;
+    }
+    page_ = p;
+    gen_  = msg_->cow_gen_;
+  }
+  return page_->data[idx_];
+}
+
+
+inline void msg_iterator::sync() const
+{
+  if (gen_ != msg_->cow_gen_) {
+    gen_ = msg_->cow_gen_;
+    seek(pos_);
+  }
+}
+
+
+inline msg_pool::pointer msg_iterator::first_page() const
+{ return msg_->page_; }
+
 } // namespace decom
 
 #endif // _DECOM_MSG_H_
@@ -11,10 +11,10 @@
 // to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
 // copies of the Software, and to permit persons to whom the Software is
 // furnished to do so, subject to the following conditions:
-// 
+//
 // The above copyright notice and this permission notice shall be included in
 // all copies or substantial portions of the Software.
-// 
+//
 // THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
 // IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
 // FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
@@ -27,11 +27,39 @@
 // This protocol is often used in automotive diagnostic environment, e.g. tester
 // communication over CAN or K-Line
 //
+// The layer keeps a session per peer (eid), so one instance can reassemble and
+// segment messages of many peers (e.g. ECUs) at the same time. A session is
+// created on first use with the same eid for both directions. If a peer uses
+// different eids for request and response (e.g. CAN IDs 0x7E0 and 0x7E8),
+// register the pair by add_session(). remove_session() removes a session, when
+// the session table is full, an idle session which was created on first use
+// is replaced by the new one.
+// The session timers are util::timer instances, which share one timer service
+// thread on platforms supporting it. The session state is guarded by one mutex,
+// which isn't held while the upper or lower layer is called. The timer callbacks
+// hold their session by a shared_ptr, so a session can be removed any time.
+// CAN FD frames (ISO15765-2:2016) of up to 64 bytes are used after setting the
+// frame length by set_frame_length(). Received frames are accepted in both
+// formats. Messages bigger than 4095 bytes are sent and received with the 32 bit
+// FF_DL escape sequence, if MAX_DL allows it.
+// If the receiver allows it (STmin = 0), the consecutive frames of a block are
+// sent back to back, all but the last one with the more flag set, so the lower
+// layer may send them in one go. Sub millisecond STmin values (0xF1 - 0xF9) are
+// honored with the us resolution of util::timer.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifndef _DECOM_PROT_ISO15765_H_
 #define _DECOM_PROT_ISO15765_H_
 
+#include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <iterator>
+
 #include "prot.h"
 #include "util/timer.h"
 #include "util/util.h"
@@ -63,6 +91,10 @@ namespace prot {
 
 // complete frame length
 #define FRAME_LENGTH                8U
+#define FRAME_LENGTH_FD             64U     // maximum CAN FD frame length
+
+// maximum data length of the 12 bit FF_DL, bigger messages use the 32 bit FF_DL escape sequence
+#define FF_DL_12BIT_MAX             4095U
 
 // flow control codes
 #define FC_CTS                      0U
@@ -74,6 +106,10 @@ namespace prot {
 #define N_Ar                        1000U
 #define N_Bs                        1000U
 #define N_Cr                        1000U
+#define BUSY_RETRY                  1U      // retry time of a CF or FC, if the lower layer is busy
+
+// maximum number of sessions (peers)
+#define ISO15765_SESSIONS_MAX       1024U
 
 // define (uncomment) this if Flow Control overflow frame should be sent, but it's uncommon
 //#define FC_SEND_OVERFLOW
@@ -85,60 +121,109 @@ private:
   // disable normal layer ctor
   iso15765(decom::layer* lower);
 
-  msg           CF_frame_;            // buffer for consecutive frames
-  eid           CF_eid_;              // CF tx eid
-  util::event   CF_tx_ev_;            // CF transmit done indication
-
-  std::uint8_t  CF_SN_;               // frame sequence number
-  std::uint16_t CF_DL_;               // actual sent data length
-  std::uint16_t CF_size_;             // complete frame size
-  std::uint16_t CF_MAX_DL_;           // maximum data length
+  /**
+   * Session context
+   * A session holds the segmentation (TX) and reassembly (RX) state of one peer
+   */
+  typedef struct tag_session_type {
+    iso15765*     owner;              // layer of the session, used by the timer callbacks
+    std::weak_ptr<tag_session_type> self;   // held by the timer callbacks, destroyed after the timers
+    eid           tx_id;              // eid of sent frames
+    eid           rx_id;              // eid of received frames
+    bool          registered;         // added by add_session(), never replaced by a new session
+
+    // TX segmentation
+    msg           tx_frame;           // cheap copy of the message to send
+    std::uint8_t  tx_npci;            // data frame type sent, NPCI_INVALID if none is in flight
+    std::uint8_t  tx_SN;              // frame sequence number
+    std::uint32_t tx_DL;              // actual sent data length
+    std::uint32_t tx_size;            // complete message size, 0 if no segmented transmission is in progress
+    std::uint8_t  tx_BScnt;           // BS counter
+    std::uint32_t tx_inflight;        // CFs waiting for their tx_done indication
+    std::uint16_t tx_busy;            // CF retries of a busy lower layer, limited by N_As
+    std::uint8_t  FC_STmin;           // STmin parameter, received by FC frame
+    std::uint8_t  FC_BS;              // BS parameter, received by FC frame
+    util::timer   tx_timer;           // STmin and FC reception (N_Bs) timer
+
+    // RX reassembly
+    msg           rx_frame;           // buffer for consecutive frames
+    std::uint8_t  rx_SN;              // next expected sequence number
+    std::uint32_t rx_DL;              // expected data length, 0 if no reception is in progress
+    std::uint8_t  rx_BScnt;           // own BS counter
+    std::uint16_t rx_busy;            // FC retries of a busy lower layer, limited by N_Ar
+    util::timer   rx_timer;           // CF reception (N_Cr) timer
+
+    tag_session_type(iso15765* _owner, eid const& _tx_id, eid const& _rx_id, bool _registered)
+      : owner(_owner)
+      , tx_id(_tx_id)
+      , rx_id(_rx_id)
+      , registered(_registered)
+      , tx_npci(NPCI_INVALID)
+      , tx_SN(0U)
+      , tx_DL(0U)
+      , tx_size(0U)
+      , tx_BScnt(0U)
+      , tx_inflight(0U)
+      , tx_busy(0U)
+      , FC_STmin(0U)
+      , FC_BS(0U)
+      , rx_SN(0U)
+      , rx_DL(0U)
+      , rx_BScnt(0U)
+      , rx_busy(0U)
+    { }
+  } session_type;
+
+  typedef std::shared_ptr<session_type> session_ptr;
+
+  // frame sent to lower layer, waiting for its tx_done indication
+  typedef std::pair<session_ptr, std::uint8_t> tx_pending_type;
+
+  // result of a received CF
+  typedef enum tag_cf_result_type {
+    cf_ignored = 0,                   // CF repeated, discarded
+    cf_error,                         // CF unexpected or wrong sequence number, reception cancelled
+    cf_overrun,                       // no free page, reception cancelled
+    cf_next,                          // CF appended, more CFs expected
+    cf_block,                         // CF appended, block complete - send FC
+    cf_complete                       // message complete
+  } cf_result_type;
+
+  std::map<eid, session_ptr>    sessions_;      // sessions by rx eid
+  std::map<eid, session_ptr>    tx_sessions_;   // sessions by tx eid
+  std::deque<tx_pending_type>   tx_pending_;    // frames in flight, in send order
+  mutable std::mutex            mutex_;         // guards the session tables, the session states and tx_pending_
 
   std::uint8_t  CF_STmin_;            // own STmin parameter, send to peer
   std::uint8_t  CF_BS_;               // own BS parameter, send to peer
-  std::uint8_t  CF_BScnt_;            // own BS counter, internal
-
-  std::uint8_t  FC_STmin_;            // STmin parameter, received by FC frame
-  std::uint8_t  FC_BS_;               // BS parameter, received by FC frame
-  std::uint8_t  FC_FS_;               // FS parameter, received by FC frame
-
-  std::uint8_t  tx_frame_;            // frame type sent
+  std::uint32_t CF_MAX_DL_;           // maximum data length
+  std::uint8_t  TX_DL_;               // frame length of sent frames, 8 for classic CAN
 
   bool          use_ext_adr_;         // use extended addressing
   bool          use_zero_padding_;    // use zero padding
   std::uint8_t  ext_source_adr_;      // extended addressing source address
   std::uint8_t  ext_target_adr_;      // Extended addressing target address
 
-  util::timer timer_TX_CF_;           // TX CF timer
-  util::timer timer_TX_FC_;           // TX FC timer
-  util::timer timer_RX_CF_;           // RX CF timer
-
 
 public:
   /**
    * Protocol ctor
    * \param lower Lower layer
-   * \param STmin TP STmin parameter (time between CF frames in [ms])
+   * \param STmin TP STmin parameter (time between CF frames in [ms], 0xF1 - 0xF9 for 100 - 900 [us])
    * \param BS TP block size parameter (max number of CF frames between FC frames)
-   * \param MAX_DL Maximum acceptable data length, 4095 is maximum by protocol
+   * \param MAX_DL Maximum acceptable data length, 4095 is maximum of the 12 bit FF_DL,
+   *        bigger messages (up to 2^32-1 bytes) use the FF_DL escape sequence of ISO15765-2:2016
    */
-  iso15765(decom::layer* lower, std::uint8_t STmin, std::uint8_t BS, std::uint16_t MAX_DL = 4095U)
+  iso15765(decom::layer* lower, std::uint8_t STmin, std::uint8_t BS, std::uint32_t MAX_DL = 4095U)
     : protocol(lower, "prot_ISO15765")   // it's VERY IMPORTANT to call the base class ctor HERE!!!
     , CF_STmin_(STmin)
     , CF_BS_(BS)
     , CF_MAX_DL_(MAX_DL)
-    , CF_DL_(0U)
-    , CF_SN_(0U)
-    , CF_size_(0U)
-    , CF_BScnt_(0U)
-    , FC_STmin_(0U)
-    , FC_BS_(0U)
-    , FC_FS_(0U)
-    , ext_source_adr_(0U)
-    , ext_target_adr_(0U)
-    , tx_frame_(NPCI_INVALID)
+    , TX_DL_(FRAME_LENGTH)
     , use_ext_adr_(false)
     , use_zero_padding_(false)
+    , ext_source_adr_(0U)
+    , ext_target_adr_(0U)
   { }
 
 
@@ -146,7 +231,28 @@ public:
    * dtor
    */
   virtual ~iso15765()
-  { }
+  {
+    // destroy the sessions first, their timers wait for running callbacks
+    std::vector<std::weak_ptr<session_type> > held;
+    {
+      std::map<eid, session_ptr> sessions;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tx_sessions_.clear();
+        tx_pending_.clear();
+        sessions.swap(sessions_);
+      }
+      for (std::map<eid, session_ptr>::const_iterator it = sessions.begin(); it != sessions.end(); ++it) {
+        held.push_back(it->second);
+      }
+    }
+    // a running timer callback holds its session, wait until it released it
+    for (std::size_t n = 0U; n < held.size(); ++n) {
+      while (!held[n].expired()) {
+        std::this_thread::yield();
+      }
+    }
+  }
 
 
   /**
@@ -168,7 +274,13 @@ public:
     bool result = protocol::open(address, id);
 
     // init this layer
-    tx_frame_ = NPCI_INVALID;
+    std::lock_guard<std::mutex> lock(mutex_);
+    tx_pending_.clear();
+    for (std::map<eid, session_ptr>::iterator it = sessions_.begin(); it != sessions_.end(); ++it) {
+      it->second->tx_npci     = NPCI_INVALID;
+      it->second->tx_inflight = 0U;
+      it->second->tx_busy     = 0U;
+    }
 
     return result;
   }
@@ -181,9 +293,18 @@ public:
   virtual void close(eid const& id = eid_any)
   {
     // FIRST close THIS layer HERE
-    timer_TX_CF_.stop();
-    timer_TX_FC_.stop();
-    timer_RX_CF_.stop();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (std::map<eid, session_ptr>::iterator it = sessions_.begin(); it != sessions_.end(); ++it) {
+        session_type& s = *it->second;
+        s.tx_timer.stop();
+        s.rx_timer.stop();
+        s.tx_frame.clear();
+        s.tx_size = 0U;
+        s.rx_frame.clear();
+        s.rx_DL   = 0U;
+      }
+    }
 
     // Close the lower layer after closing THIS layer - closing is done TOP-DOWN
     // in layer stack
@@ -203,63 +324,98 @@ public:
   {
     (void)more;
 
-    if (data.size() > CF_MAX_DL_) {    // TP protocol can handle max 4095 bytes
+    if (data.size() > CF_MAX_DL_) {
       // data size too big
-      DECOM_LOG_ERROR("msg too big (data > 4095 bytes)");
+      DECOM_LOG_ERROR("msg too big (data > MAX_DL), size: ") << data.size();
       return false;
     }
 
-    // is a msg transmission already in progress?
-    if (tx_frame_ != NPCI_INVALID) {
-      // should not happen - did you wait for tx_done ?
-      DECOM_LOG_ERROR("TX already in progress - did you wait for tx_done?");
+    session_ptr s = get_session(id, false, true);
+    if (!s) {
       return false;
     }
 
+    {
+      // is a msg transmission already in progress?
+      std::lock_guard<std::mutex> lock(mutex_);
+      if ((s->tx_npci != NPCI_INVALID) || s->tx_size || s->tx_inflight) {
+        // should not happen - did you wait for tx_done ?
+        DECOM_LOG_ERROR("TX already in progress - did you wait for tx_done?");
+        return false;
+      }
+    }
+
 
-    if (data.size() <= (use_ext_adr_ ? SF_DATALENGTH_EXT : SF_DATALENGTH)) {
+    if (data.size() <= SF_max_DL(TX_DL_)) {
       // send SF
 
-      data.push_front(NPCI_SINGLE_FRAME | (data.size() & 0x0FU));
+      if (data.size() <= (use_ext_adr_ ? SF_DATALENGTH_EXT : SF_DATALENGTH)) {
+        data.push_front(NPCI_SINGLE_FRAME | (data.size() & 0x0FU));
+      }
+      else {
+        // CAN FD frame, SF_DL escape sequence
+        data.push_front(static_cast<std::uint8_t>(data.size()));
+        data.push_front(NPCI_SINGLE_FRAME);
+      }
       if (use_ext_adr_) {
         data.push_front(ext_target_adr_);
       }
-      if (use_zero_padding_) {
-        data.insert(data.end(), data.size() < FRAME_LENGTH ? FRAME_LENGTH - data.size() : 0U, (std::uint8_t)0U);
-      }
-      
-      tx_frame_ = NPCI_SINGLE_FRAME;
-      return protocol::send(data, id);
+      pad(data);
+
+      return send_frame(*s, data, NPCI_SINGLE_FRAME);
     }
     else {
       // send FF
 
-      CF_frame_.ref_copy(data);                                         // store a cheap copy
-      CF_SN_    = 1U;                                                   // init sequence number
-      CF_DL_    = (use_ext_adr_ ? FF_DATALENGTH_EXT : FF_DATALENGTH);   // init FF data length
-      CF_size_  = (std::uint16_t)data.size();                           // set frame size
-      CF_BScnt_ = 0U;                                                   // init block counter
-      CF_eid_   = id;                                                   // tx eid
+      const std::uint32_t size = static_cast<std::uint32_t>(data.size());
+      std::uint8_t buf[FRAME_LENGTH_FD];
+      std::size_t n = 0U;
+      if (use_ext_adr_) {
+        buf[n++] = ext_target_adr_;
+      }
+      if (size <= FF_DL_12BIT_MAX) {
+        buf[n++] = static_cast<std::uint8_t>(NPCI_FIRST_FRAME | ((size >> 8U) & 0x0FU));
+        buf[n++] = static_cast<std::uint8_t>(size);
+      }
+      else {
+        // FF_DL escape sequence, 32 bit FF_DL
+        buf[n++] = NPCI_FIRST_FRAME;
+        buf[n++] = 0U;
+        buf[n++] = static_cast<std::uint8_t>(size >> 24U);
+        buf[n++] = static_cast<std::uint8_t>(size >> 16U);
+        buf[n++] = static_cast<std::uint8_t>(size >> 8U);
+        buf[n++] = static_cast<std::uint8_t>(size);
+      }
+      const std::uint32_t FF_DL = TX_DL_ - static_cast<std::uint32_t>(n);   // FF is always a complete frame
+      (void)data.get(buf + n, FF_DL);
 
       msg ff;
-      ff.push_back(NPCI_FIRST_FRAME | ((CF_size_ >> 8U) & 0x0FU));
-      ff.push_back((std::uint8_t)(CF_size_));
-      ff.insert(ff.end(), data.begin(), data.begin() + CF_DL_);
-      if (use_ext_adr_) {
-        ff.push_front(ext_target_adr_);
+      if (!ff.put(buf, TX_DL_)) {
+        return false;
       }
 
-      tx_frame_ = NPCI_FIRST_FRAME;
-      if (protocol::send(ff, CF_eid_)) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        s->tx_frame.ref_copy(data);     // store a cheap copy
+        s->tx_SN    = 1U;               // init sequence number
+        s->tx_size  = size;             // set frame size
+        s->tx_DL    = FF_DL;            // init FF data length
+        s->tx_BScnt = 0U;               // init block counter
+        s->tx_busy  = 0U;
+
+        // start timer for FC reception check before sending, the FC may be received before send returns
+        s->tx_timer.start(std::chrono::milliseconds(N_Bs), false, &timer_func_TX_FC, s.get());
+      }
+      if (send_frame(*s, ff, NPCI_FIRST_FRAME)) {
         // sending to lower lower layer was successful
-        // start timer for FC reception check
-        timer_TX_FC_.start(std::chrono::milliseconds(N_Bs), false, &timer_func_TX_FC, this);
         return true;
       }
       else {
         // FF could not be send - abort
-        CF_frame_.clear();    // release copy
-        CF_DL_ = 0U;
+        std::lock_guard<std::mutex> lock(mutex_);
+        s->tx_timer.stop();
+        s->tx_frame.clear();    // release copy
+        s->tx_size = 0U;
         return false;
       }
     }
@@ -277,29 +433,49 @@ public:
     (void)more;
 
     if (use_ext_adr_) {
-      if (data[0] != ext_source_adr_) {
+      if (data.empty() || data[0] != ext_source_adr_) {
         // source address mismatch, discard frame - this is no error
         return;
       }
       data.pop_front();   // strip address
     }
+    if (data.empty()) {
+      protocol::indication(rx_error, id);
+      return;
+    }
 
     // check the NPCI type
     switch(data[0] & 0xF0U) {
 
       case NPCI_SINGLE_FRAME :
       {
-        // single frame received - just check length and pass to upper layer
-        CF_DL_ = 0;
-        std::uint8_t SF_DL = data[0] & 0x0FU;
-        if ((SF_DL > (use_ext_adr_ ? SF_DATALENGTH_EXT : SF_DATALENGTH)) || (data.size() <= SF_DL)) {
+        // single frame received - abort a reception in progress
+        session_ptr s = get_session(id, true, false);
+        if (s) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          s->rx_timer.stop();
+          s->rx_frame.clear();
+          s->rx_DL = 0U;
+        }
+
+        // just check length and pass to upper layer
+        std::uint32_t SF_DL = data[0] & 0x0FU;
+        std::uint32_t NPCI  = 1U;
+        if (!SF_DL && (data.size() > 1U)) {
+          // CAN FD frame, SF_DL escape sequence
+          SF_DL = data[1];
+          NPCI  = 2U;
+        }
+        if (!SF_DL || (SF_DL > SF_max_DL(frame_length(data))) || (data.size() < NPCI + SF_DL)) {
           // error - frame length wrong, discard frame
           protocol::indication(rx_error, id);
           break;
         }
 
         // frame is okay
-        data.pop_front();     // strip NPCI
+        for (; NPCI; --NPCI) {
+          data.pop_front();   // strip NPCI
+        }
         data.resize(SF_DL);   // resize to actual data length
         protocol::receive(data, id);
         break;
@@ -308,119 +484,119 @@ public:
       case NPCI_FIRST_FRAME :
       {
         // first frame received
-        CF_DL_ = util::make_large<std::uint8_t, std::uint16_t>(data[1], data[0] & 0x0FU);
-        if ((CF_DL_ < (use_ext_adr_ ? FF_DATALENGTH_EXT : FF_DATALENGTH) + 2U)) {
+        session_ptr s = get_session(id, true, true);
+        if (!s) {
+          // session table full, discard frame
+          protocol::indication(rx_error, id);
+          break;
+        }
+
+        // a reception in progress is aborted
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          s->rx_timer.stop();
+          s->rx_frame.clear();
+          s->rx_DL = 0U;
+        }
+
+        std::uint32_t NPCI = 2U;
+        std::uint32_t FF_DL = data.size() < 2U ? 0U : util::make_large<std::uint8_t, std::uint16_t>(data[1], data[0] & 0x0FU);
+        if (!FF_DL && (data.size() >= 6U)) {
+          // FF_DL escape sequence, 32 bit FF_DL, must not be used for smaller messages
+          NPCI  = 6U;
+          FF_DL = util::make_large<std::uint16_t, std::uint32_t>(util::make_large<std::uint8_t, std::uint16_t>(data[5], data[4]),
+                                                                 util::make_large<std::uint8_t, std::uint16_t>(data[3], data[2]));
+          if (FF_DL <= FF_DL_12BIT_MAX) {
+            FF_DL = 0U;
+          }
+        }
+        if ((FF_DL <= SF_max_DL(frame_length(data))) || (data.size() <= NPCI)) {
           // error - frame length too small, discard frame
-          CF_frame_.clear();
-          CF_DL_ = 0U;
           protocol::indication(rx_error, id);
           break;
         }
-        if (CF_DL_ > CF_MAX_DL_) {
+        if (FF_DL > CF_MAX_DL_) {
           // error - frame too big, discard frame
-          DECOM_LOG_WARN("FF frame discarded, size too big: ") << CF_DL_;
-          CF_frame_.clear();
-          CF_DL_ = 0U;
+          DECOM_LOG_WARN("FF frame discarded, size too big: ") << FF_DL;
           #if defined(FC_SEND_OVERFLOW)
             // send FC
-            send_FC(FC_OVERFLOW, id);
+            send_FC(*s, FC_OVERFLOW);
           #endif
           protocol::indication(rx_error, id);
           break;
         }
 
-        DECOM_LOG_DEBUG("FF frame received, size: ") << CF_DL_;
+        DECOM_LOG_DEBUG("FF frame received, size: ") << FF_DL;
 
         // frame is okay
-        data.pop_front();     // strip NPCI
-        data.pop_front();
-        data.resize(use_ext_adr_ ? FF_DATALENGTH_EXT : FF_DATALENGTH);  // resize to actual data length
-        CF_frame_ = data;     // init buffer
-        CF_SN_    = 1U;       // init SN (next expected seq number)
-        CF_BScnt_ = 0U;       // init block counter
+        for (; NPCI; --NPCI) {
+          data.pop_front();   // strip NPCI
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          s->rx_frame = data;   // init buffer
+          s->rx_DL    = FF_DL;
+          s->rx_SN    = 1U;     // init SN (next expected seq number)
+          s->rx_BScnt = 0U;     // init block counter
+          s->rx_busy  = 0U;
+
+          // trigger timeout for next CF frame reception
+          s->rx_timer.start(std::chrono::milliseconds(N_Cr), false, &timer_func_RX_CF, s.get());
+        }
 
         // send FC
-        send_FC(FC_CTS, id);
-
-        // trigger timeout for next CF frame reception
-        timer_RX_CF_.start(std::chrono::milliseconds(N_Cr), false, &iso15765::timer_func_RX_CF, this);
+        send_FC_CTS(*s);
         break;
       }
 
       case NPCI_CONSECUTIVE_FRAME :
       {
         // consecutive frame received
-
-        // kill timer
-        timer_RX_CF_.stop();
-
-        if (CF_DL_ == 0U) {
-          // no CF expected
-          protocol::indication(rx_error, id);
-          break;
-        }
-
-        // check sequence number
-        std::uint8_t SN = data[0] & 0x0FU;
-        if (SN != CF_SN_) {
-// TBD
-          if ((SN != CF_SN_ - 1U) || ((SN == 0x0FU) && (CF_SN_== 0x00U))) {  // <--- this...  may happen
-            break;
-          }
-          else {
-            // error - wrong sequence number, discard frame and cancel reception
-            CF_DL_ = 0U;
-            CF_frame_.clear();
+        session_ptr s = get_session(id, true, false);
+        msg frame;
+        switch (s ? receive_CF(*s, data, frame) : cf_error) {
+          case cf_error :
             protocol::indication(rx_error, id);
             break;
-          }
-        }
-        else {
-          // generate next SN
-          CF_SN_ = ++CF_SN_ & 0x0FU;
-        }
-
-        // frame is okay
-        data.pop_front();     // strip NPCI
-
-        // append new data to buffer, don't use CF_frame_.append() here, because data is really small
-        CF_frame_.insert(CF_frame_.end(), data.begin(), data.end());
-
-        // frame done?
-        if (CF_frame_.size() >= CF_DL_) {
-          // frame complete - send frame to upper layer
-          CF_frame_.resize(CF_DL_);
-          protocol::receive(CF_frame_, id);
-          CF_frame_.clear();
-          CF_DL_ = 0U;
-          break;
-        }
-
-        if (CF_BS_ && (++CF_BScnt_ >= CF_BS_)) {
-          // complete block received, send FC
-          CF_BScnt_ = 0U;
-          send_FC(FC_CTS, id);
+          case cf_overrun :
+            protocol::indication(rx_overrun, id);
+            break;
+          case cf_block :
+            // complete block received, send FC
+            send_FC_CTS(*s);
+            break;
+          case cf_complete :
+            // frame complete - send frame to upper layer
+            protocol::receive(frame, id);
+            break;
+          default :
+            break;
         }
-
-        // restart timer
-        timer_RX_CF_.start(std::chrono::milliseconds(N_Cr), false, &iso15765::timer_func_RX_CF, this);
         break;
       }
 
       case NPCI_FLOW_CONTROL :
       {
         // flow control frame received
-
-        // kill surveillance timer
-        timer_TX_FC_.stop();
+        session_ptr s = get_session(id, true, false);
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!s || !s->tx_size) {
+          // no segmented transmission in progress, discard frame
+          DECOM_LOG_DEBUG("Unexpected FC frame discarded");
+          break;
+        }
 
         if (data.size() < FC_DATALENGTH) {
           // FC frame is too short - abort
+          s->tx_timer.stop();
+          lock.unlock();
           protocol::indication(rx_error, id);
           break;
         }
         if ((data[0] & 0x0FU) > 1U) {
           // FS format error - abort
+          s->tx_timer.stop();
+          lock.unlock();
           protocol::indication(rx_error, id);
           break;
         }
@@ -428,14 +604,24 @@ public:
         DECOM_LOG_DEBUG("FC frame received");
 
         // frame is okay - store values
-        FC_FS_    = data[0] & 0x01U;    // 0 = CTS (ContinueToSend), 1 = WT (Wait)
-        FC_BS_    = data[1];
-        FC_STmin_ = data[2];
-        CF_BScnt_ = 0U;                 // reset block counter
-
-        if (FC_FS_ == 0U) {
-          // CTS set - send next consecutive frame
-          timer_TX_CF_.start(std::chrono::milliseconds(FC_STmin_), false, &timer_func_TX_CF, this);
+        // the block counter and timer are shared with the tx_done indication of the last CF
+        s->FC_BS    = data[1];
+        s->FC_STmin = data[2];
+        s->tx_BScnt = 0U;               // reset block counter
+
+        if ((data[0] & 0x01U) == FC_CTS) {
+          // CTS (ContinueToSend) set - send next consecutive frame
+          // if CFs are still in flight, the next one is sent after their tx_done indication
+          if (s->tx_inflight) {
+            s->tx_timer.stop();
+          }
+          else {
+            s->tx_timer.start(STmin_time(s->FC_STmin), false, &timer_func_TX_CF, s.get());
+          }
+        }
+        else {
+          // WT (Wait) - wait for next FC frame
+          s->tx_timer.start(std::chrono::milliseconds(N_Bs), false, &timer_func_TX_FC, s.get());
         }
         break;
       }
@@ -463,25 +649,43 @@ public:
         break;
 
       case tx_done :
-        switch (tx_frame_)
-        {
-          case NPCI_SINGLE_FRAME :
-            protocol::indication(code, id);
-            break;
-          case NPCI_CONSECUTIVE_FRAME :
-            if (confirm_CF()) {
-              protocol::indication(code, id);
-            }
-            break;
-          default :
-            break;
+      case tx_error :
+      case tx_timeout :
+      case tx_overrun :
+      {
+        tx_pending_type frame;
+        if (!tx_pending_pop(id, frame) || (frame.second == NPCI_FLOW_CONTROL)) {
+          // no data frame in flight
+          break;
+        }
+        session_type& s = *frame.first;
+
+        if (frame.second == NPCI_CONSECUTIVE_FRAME) {
+          if (confirm_CF(s, code == tx_done)) {
+            protocol::indication(tx_done, s.tx_id);
+          }
+          break;
+        }
+
+        if (code != tx_done) {
+          // don't pass any com errors from lower layer, but abort a segmented transmission
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (s.tx_size) {
+            s.tx_timer.stop();
+            s.tx_frame.clear();
+            s.tx_size = 0U;
+          }
+          break;
+        }
+
+        if (frame.second == NPCI_SINGLE_FRAME) {
+          protocol::indication(code, s.tx_id);
         }
-        tx_frame_ = NPCI_INVALID;
         break;
+      }
 
       default :
         // don't pass any com errors from lower layer
-        tx_frame_ = NPCI_INVALID;
         break;
     }
   }
@@ -512,84 +716,492 @@ public:
   }
 
 
+  /**
+   * Frame length setup (TX_DL)
+   * Frames bigger than 8 bytes are CAN FD frames, they are always padded to the next valid CAN FD frame length.
+   * \param length Maximum length of sent frames, 8 for classic CAN (default), 12, 16, 20, 24, 32, 48 or 64 for CAN FD
+   * \return true if successful, false if length is no valid frame length
+   */
+  bool set_frame_length(std::uint8_t length)
+  {
+    if ((length < FRAME_LENGTH) || (length > FRAME_LENGTH_FD) || (dlc_length(length) != length)) {
+      DECOM_LOG_ERROR("Invalid frame length: ") << static_cast<std::uint32_t>(length);
+      return false;
+    }
+    TX_DL_ = length;
+    return true;
+  }
+
+
+  /**
+   * Register a session which uses different eids for both directions
+   * Messages are sent by tx_id and received by rx_id, e.g. CAN request ID 0x7E0 and response ID 0x7E8.
+   * Sessions with the same eid for both directions don't need to be registered, they are created on first use.
+   * \param tx_id The eid of transmitted frames, used by send() and indicated on tx_done
+   * \param rx_id The eid of received frames, used by receive()
+   * \return true if successful, false if one of the eids is already used or the session table is full
+   */
+  bool add_session(eid const& tx_id, eid const& rx_id)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sessions_.count(rx_id) || tx_sessions_.count(tx_id) || (sessions_.size() >= ISO15765_SESSIONS_MAX)) {
+      DECOM_LOG_WARN("Session can't be added");
+      return false;
+    }
+    session_ptr s = make_session(tx_id, rx_id, true);
+    sessions_[rx_id]    = s;
+    tx_sessions_[tx_id] = s;
+    return true;
+  }
+
+
+  /**
+   * Remove a session, a transmission or reception in progress is aborted without indication
+   * Frames of the session which are in flight on the lower layer are still confirmed.
+   * \param rx_id The eid of received frames of the session
+   * \return true if successful, false if no session uses the eid
+   */
+  bool remove_session(eid const& rx_id)
+  {
+    session_ptr s;    // destroyed after the lock is released, its timers wait for running callbacks
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<eid, session_ptr>::iterator it = sessions_.find(rx_id);
+    if (it == sessions_.end()) {
+      return false;
+    }
+    s = erase_session(it);
+    s->tx_frame.clear();
+    s->tx_size = 0U;
+    s->rx_frame.clear();
+    s->rx_DL = 0U;
+    return true;
+  }
+
+
+  /**
+   * Returns the number of sessions
+   */
+  std::size_t sessions() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sessions_.size();
+  }
+
+
 private:
 
-  bool confirm_CF()
+  /**
+   * Find a session, the returned pointer keeps the session valid if it's removed meanwhile
+   * If the session table is full, an idle session which was created on first use is replaced.
+   * \param id The eid to look for
+   * \param rx true to look for the rx eid, false for the tx eid
+   * \param create true to create a session with the given eid for both directions if not found
+   * \return Pointer to the session, nullptr if not found or the session table is full
+   */
+  session_ptr get_session(eid const& id, bool rx, bool create)
   {
-    CF_SN_++;
-    CF_DL_ += (use_ext_adr_ ? CF_DATALENGTH_EXT : CF_DATALENGTH);
+    session_ptr evicted;    // destroyed after the lock is released, its timers wait for running callbacks
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<eid, session_ptr>& table = rx ? sessions_ : tx_sessions_;
+    std::map<eid, session_ptr>::iterator it = table.find(id);
+    if (it != table.end()) {
+      return it->second;
+    }
+    if (!create) {
+      return nullptr;
+    }
+    if (sessions_.size() >= ISO15765_SESSIONS_MAX) {
+      for (it = sessions_.begin(); it != sessions_.end(); ++it) {
+        const session_type& s = *it->second;
+        if (!s.registered && !s.tx_size && !s.rx_DL && (s.tx_npci == NPCI_INVALID) && !s.tx_inflight) {
+          break;
+        }
+      }
+      if (it == sessions_.end()) {
+        DECOM_LOG_WARN("Session table full, max sessions: ") << ISO15765_SESSIONS_MAX;
+        return nullptr;
+      }
+      DECOM_LOG_DEBUG("Idle session replaced");
+      evicted = erase_session(it);
+    }
+
+    // the eid may be used in the other direction by a registered session already, don't replace it there
+    session_ptr s = make_session(id, id, false);
+    sessions_.insert(std::make_pair(id, s));
+    tx_sessions_.insert(std::make_pair(id, s));
+    return s;
+  }
+
+
+  // create a session, the timer callbacks hold it by its self pointer
+  session_ptr make_session(eid const& tx_id, eid const& rx_id, bool registered)
+  {
+    session_ptr s = std::make_shared<session_type>(this, tx_id, rx_id, registered);
+    s->self = s;
+    return s;
+  }
+
+
+  // remove a session from the session tables and stop its timers, mutex_ must be held
+  session_ptr erase_session(std::map<eid, session_ptr>::iterator it)
+  {
+    session_ptr s = it->second;
+    sessions_.erase(it);
+    std::map<eid, session_ptr>::iterator tx = tx_sessions_.find(s->tx_id);
+    if ((tx != tx_sessions_.end()) && (tx->second == s)) {
+      tx_sessions_.erase(tx);
+    }
+    s->tx_timer.stop();
+    s->rx_timer.stop();
+    return s;
+  }
+
+
+  /**
+   * Send a frame of the session to the lower layer
+   * \param s Session
+   * \param frame The frame to send
+   * \param npci The frame type
+   * \param more true if the frame is followed by another frame of a CF burst
+   * \return true if Send is successful
+   */
+  bool send_frame(session_type& s, msg& frame, std::uint8_t npci, bool more = false)
+  {
+    {
+      // queue the frame first, tx_done may be indicated before send returns
+      std::lock_guard<std::mutex> lock(mutex_);
+      tx_pending_.push_back(tx_pending_type(s.self.lock(), npci));
+      if (npci == NPCI_CONSECUTIVE_FRAME) {
+        s.tx_inflight++;
+      }
+      if (npci != NPCI_FLOW_CONTROL) {
+        s.tx_npci = npci;
+      }
+    }
+
+    if (protocol::send(frame, s.tx_id, more)) {
+      return true;
+    }
+
+    // not sent, remove the frame again
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::deque<tx_pending_type>::reverse_iterator it = tx_pending_.rbegin(); it != tx_pending_.rend(); ++it) {
+      if (it->first.get() == &s) {
+        tx_pending_.erase(std::next(it).base());
+        break;
+      }
+    }
+    if (npci == NPCI_CONSECUTIVE_FRAME) {
+      s.tx_inflight--;
+    }
+    if (npci != NPCI_FLOW_CONTROL) {
+      s.tx_npci = NPCI_INVALID;
+    }
+    return false;
+  }
+
+
+  /**
+   * Remove the frame an indication of the lower layer belongs to
+   * This is the oldest frame of the session with the given tx eid, or the oldest frame at all if no session
+   * matches, because not all lower layers pass the eid with the indication
+   * \param id The eid of the indication
+   * \param frame The removed frame
+   * \return true if a frame was in flight
+   */
+  bool tx_pending_pop(eid const& id, tx_pending_type& frame)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tx_pending_.empty()) {
+      return false;
+    }
+    std::deque<tx_pending_type>::iterator it = tx_pending_.begin();
+    for (; it != tx_pending_.end(); ++it) {
+      if (it->first->tx_id == id) {
+        break;
+      }
+    }
+    if (it == tx_pending_.end()) {
+      it = tx_pending_.begin();
+    }
+    frame = *it;
+    tx_pending_.erase(it);
+    if (frame.first->tx_npci == frame.second) {
+      frame.first->tx_npci = NPCI_INVALID;
+    }
+    return true;
+  }
+
+
+  /**
+   * Confirm a CF which was handed to the lower layer
+   * The next step of the transmission is done when the last CF in flight is confirmed
+   * \param s Session
+   * \param done true if the CF was sent, false aborts the transmission
+   * \return true if the message is completely sent
+   */
+  bool confirm_CF(session_type& s, bool done = true)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!done && s.tx_size) {
+      // don't pass any com errors from lower layer, but abort the segmented transmission
+      s.tx_timer.stop();
+      s.tx_frame.clear();
+      s.tx_size = 0U;
+    }
+    if (--s.tx_inflight || !s.tx_size) {
+      // CFs still in flight or transmission aborted
+      return false;
+    }
 
     // check if frame is complete
-    if (CF_DL_ >= CF_size_) {
+    if (s.tx_DL >= s.tx_size) {
       // frame completely sent
-      CF_frame_.clear();
-      CF_DL_ = 0U;
+      s.tx_frame.clear();
+      s.tx_size = 0U;
       return true;
     }
 
     // check BS
-    if (FC_BS_ && (CF_BScnt_++ >= FC_BS_)) {
+    if (s.FC_BS && (s.tx_BScnt >= s.FC_BS)) {
       // block completely sent - wait for FC from receiver
 
       // trigger timer for next FC reception
-      timer_TX_FC_.start(std::chrono::milliseconds(N_Bs), false, &timer_func_TX_FC, this);
+      s.tx_timer.start(std::chrono::milliseconds(N_Bs), false, &timer_func_TX_FC, &s);
     }
     else {
       // trigger timer for next CF frame
-      timer_TX_CF_.start(std::chrono::milliseconds(FC_STmin_), false, &timer_func_TX_CF, this);
+      s.tx_timer.start(s.tx_busy ? std::chrono::milliseconds(BUSY_RETRY) : STmin_time(s.FC_STmin), false, &timer_func_TX_CF, &s);
     }
-  
+
     return false;   // CF transmission still in progress
   }
 
 
-  void send_CF()
+  /**
+   * Send the next CF, or the rest of the block as burst if STmin is 0
+   * The session is held by an additional in flight count while the burst is sent, so the
+   * tx_done indications of the lower layer can't start the next step before the burst is complete
+   * \param s Session
+   */
+  void send_CF(session_type& s)
   {
-    msg cf;
-    cf.push_back(NPCI_CONSECUTIVE_FRAME | (CF_SN_ & 0x0FU));
-    cf.insert(cf.end(), CF_frame_.begin() + CF_DL_, (CF_DL_ + (use_ext_adr_ ? CF_DATALENGTH_EXT : CF_DATALENGTH) < CF_frame_.size()) ? CF_frame_.begin() + CF_DL_ + (use_ext_adr_ ? CF_DATALENGTH_EXT : CF_DATALENGTH) : CF_frame_.end());
-    if (use_ext_adr_) {
-      cf.push_front(ext_target_adr_);
+    bool burst;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!s.tx_size) {
+        // transmission aborted meanwhile
+        return;
+      }
+      s.tx_inflight++;
+      burst = !s.FC_STmin;
     }
-    if (use_zero_padding_) {
-      cf.insert(cf.end(), cf.size() < FRAME_LENGTH ? FRAME_LENGTH - cf.size() : 0,  (std::uint8_t)0);
+
+    for (bool last = false; !last; ) {
+      std::uint8_t buf[FRAME_LENGTH_FD];
+      std::uint32_t n = 0U;
+      std::uint32_t CF_DL;
+      {
+        // the frame is built and accounted before sending, tx_done may be indicated before send returns
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!s.tx_size) {
+          // transmission aborted meanwhile
+          break;
+        }
+        if (use_ext_adr_) {
+          buf[n++] = ext_target_adr_;
+        }
+        buf[n++] = static_cast<std::uint8_t>(NPCI_CONSECUTIVE_FRAME | (s.tx_SN & 0x0FU));
+
+        // copy the data, tx_frame is only read, so its pages stay shared with the msg of the sender
+        CF_DL = TX_DL_ - n;
+        CF_DL = CF_DL < s.tx_size - s.tx_DL ? CF_DL : s.tx_size - s.tx_DL;
+        (void)s.tx_frame.get(buf + n, CF_DL, s.tx_DL);
+        n += CF_DL;
+        n = padded_length(n);
+        for (std::uint32_t i = CF_DL + (use_ext_adr_ ? 2U : 1U); i < n; ++i) {
+          buf[i] = 0U;
+        }
+
+        s.tx_SN++;
+        s.tx_DL += CF_DL;
+        s.tx_BScnt++;
+        last = !burst || (s.tx_DL >= s.tx_size) || (s.FC_BS && (s.tx_BScnt >= s.FC_BS));
+      }
+
+      msg cf;
+      if (cf.put(buf, n) && send_frame(s, cf, NPCI_CONSECUTIVE_FRAME, !last)) {
+        // sending to lower layer was successful
+        std::lock_guard<std::mutex> lock(mutex_);
+        s.tx_busy = 0U;
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      s.tx_SN--;
+      s.tx_DL -= CF_DL;
+      s.tx_BScnt--;
+
+      // transmission error on lower layer, e.g. CAN is busy or the tx queue is full by a burst
+      if (!s.tx_size || (++s.tx_busy * BUSY_RETRY < N_As)) {
+        // aborted meanwhile or try again, the retry timer is started by releasing the session below
+        break;
+      }
+
+      // lower layer didn't send within N_As - abort frame transmission
+      s.tx_frame.clear();
+      s.tx_size = 0U;
+      lock.unlock();
+      protocol::indication(tx_error, s.tx_id);   // inform upper layer
+      break;
     }
 
-    tx_frame_ = NPCI_CONSECUTIVE_FRAME;
-    if (protocol::send(cf, CF_eid_)) {
-      // sending to lower layer was successful
-      return;
+    // release the session
+    if (confirm_CF(s)) {
+      protocol::indication(tx_done, s.tx_id);
     }
-    else {
-      // transmission error on lower layer - two strategies here:
-      // 1. restart STmin timer to try again (lower layer e.g. CAN may be busy)
-      // 2. abort frame transmission
-    #if (0)
-      // retrigger timer for next CF frame
-      timer_TX_CF_.start(std::chrono::milliseconds(FC_STmin_), false, &timer_func_TX_CF, this);
-    #else
-      // abort frame transmission
-      CF_frame_.clear();
-      CF_DL_ = 0U;
-      protocol::indication(tx_error);   // inform upper layer
-    #endif
-      return;
+  }
+
+
+  void send_CF_abort(session_type& s)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!s.tx_size) {
+        // transmission completed or aborted meanwhile
+        return;
+      }
+      s.tx_frame.clear();
+      s.tx_size = 0U;
     }
+    DECOM_LOG_NOTICE("CF frame abort");
+
+    // inform upper layer
+    protocol::indication(rx_timeout, s.tx_id);
   }
 
 
-  void send_CF_abort()
+  void receive_CF_abort(session_type& s)
   {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!s.rx_DL) {
+        // reception completed or aborted meanwhile
+        return;
+      }
+      s.rx_frame.clear();
+      s.rx_DL = 0U;
+    }
     DECOM_LOG_NOTICE("CF frame abort");
-    CF_frame_.clear();
-    CF_DL_ = 0U;
 
     // inform upper layer
-    protocol::indication(rx_timeout);
+    protocol::indication(rx_timeout, s.rx_id);
+  }
+
+
+  /**
+   * Append a received CF to the reassembly buffer
+   * \param s Session
+   * \param data The received CF
+   * \param frame The complete message, if cf_complete is returned
+   * \return Result of the CF
+   */
+  cf_result_type receive_CF(session_type& s, msg& data, msg& frame)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (s.rx_DL == 0U) {
+      // no CF expected
+      return cf_error;
+    }
+
+    // kill timer
+    s.rx_timer.stop();
+
+    // check sequence number
+    std::uint8_t SN = data[0] & 0x0FU;
+    if (SN != s.rx_SN) {
+// TBD
+      if ((SN != s.rx_SN - 1U) || ((SN == 0x0FU) && (s.rx_SN == 0x00U))) {  // <--- this...  may happen
+        return cf_ignored;
+      }
+      else {
+        // error - wrong sequence number, discard frame and cancel reception
+        s.rx_DL = 0U;
+        s.rx_frame.clear();
+        return cf_error;
+      }
+    }
+    else {
+      // generate next SN
+      s.rx_SN = (s.rx_SN + 1U) & 0x0FU;
+    }
+
+    // frame is okay - append new data to buffer without the NPCI and the padding of the last frame
+    // the data is copied, not appended by pages, because it's really small
+    std::uint8_t buf[FRAME_LENGTH_FD];
+    std::uint32_t CF_DL = static_cast<std::uint32_t>(data.size()) - 1U;
+    CF_DL = CF_DL < sizeof(buf) ? CF_DL : static_cast<std::uint32_t>(sizeof(buf));
+    CF_DL = CF_DL < s.rx_DL - s.rx_frame.size() ? CF_DL : s.rx_DL - static_cast<std::uint32_t>(s.rx_frame.size());
+    if (CF_DL && (!data.get(buf, CF_DL, 1U) || !s.rx_frame.append(buf, CF_DL))) {
+      // no free page, cancel reception
+      s.rx_DL = 0U;
+      s.rx_frame.clear();
+      return cf_overrun;
+    }
+
+    // frame done?
+    if (s.rx_frame.size() >= s.rx_DL) {
+      // the upper layer gets the pages of the buffer, it's passed up outside the lock
+      s.rx_frame.resize(s.rx_DL);
+      frame.ref_copy(s.rx_frame);
+      s.rx_frame.clear();
+      s.rx_DL = 0U;
+      return cf_complete;
+    }
+
+    // restart timer
+    s.rx_timer.start(std::chrono::milliseconds(N_Cr), false, &timer_func_RX_CF, &s);
+
+    if (CF_BS_ && (++s.rx_BScnt >= CF_BS_)) {
+      s.rx_BScnt = 0U;
+      return cf_block;
+    }
+    return cf_next;
+  }
+
+
+  /**
+   * Send FC CTS, if the lower layer is busy (e.g. by a CF burst of this layer) the FC
+   * is sent again by the rx timer until N_Ar is expired
+   * \param s Session
+   */
+  void send_FC_CTS(session_type& s)
+  {
+    const bool sent = send_FC(s, FC_CTS);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (sent) {
+        if (s.rx_busy) {
+          // FC was sent again, restart timer for next CF frame reception
+          s.rx_busy = 0U;
+          s.rx_timer.start(std::chrono::milliseconds(N_Cr), false, &timer_func_RX_CF, &s);
+        }
+        return;
+      }
+
+      if (++s.rx_busy * BUSY_RETRY < N_Ar) {
+        s.rx_timer.start(std::chrono::milliseconds(BUSY_RETRY), false, &timer_func_RX_CF, &s);
+        return;
+      }
+      s.rx_busy = 0U;
+    }
+
+    // lower layer didn't send within N_Ar - abort reception
+    receive_CF_abort(s);
   }
 
 
-  bool send_FC(std::uint8_t FS, decom::eid const& id)
+  bool send_FC(session_type& s, std::uint8_t FS)
   {
     msg fc;
     fc.push_back(NPCI_FLOW_CONTROL | (FS & 0x0FU));
@@ -598,21 +1210,80 @@ private:
     if (use_ext_adr_) {
       fc.push_front(ext_target_adr_);
     }
-    if (use_zero_padding_) {
-      fc.insert(fc.end(), fc.size() < FRAME_LENGTH ? FRAME_LENGTH - fc.size() : 0, (std::uint8_t)0);
+    pad(fc);
+
+    return send_frame(s, fc, NPCI_FLOW_CONTROL);
+  }
+
+
+  // maximum SF data length of the given frame length
+  inline std::uint32_t SF_max_DL(std::uint32_t length) const
+  {
+    if (length <= FRAME_LENGTH) {
+      return use_ext_adr_ ? SF_DATALENGTH_EXT : SF_DATALENGTH;
+    }
+    // CAN FD frame, SF_DL escape sequence
+    return (length < FRAME_LENGTH_FD ? length : FRAME_LENGTH_FD) - (use_ext_adr_ ? 3U : 2U);
+  }
+
+
+  // length of a received frame, including the stripped extended address
+  inline std::uint32_t frame_length(const msg& data) const
+  { return static_cast<std::uint32_t>(data.size()) + (use_ext_adr_ ? 1U : 0U); }
+
+
+  // next valid CAN FD frame length
+  static inline std::uint32_t dlc_length(std::uint32_t length)
+  {
+    return length <= 8U ? length : length <= 12U ? 12U : length <= 16U ? 16U : length <= 20U ? 20U :
+           length <= 24U ? 24U : length <= 32U ? 32U : length <= 48U ? 48U : 64U;
+  }
+
+
+  // length of a frame after padding
+  inline std::uint32_t padded_length(std::uint32_t length) const
+  {
+    if (length > FRAME_LENGTH) {
+      // CAN FD frame, must have a valid frame length
+      return dlc_length(length);
+    }
+    return use_zero_padding_ ? static_cast<std::uint32_t>(FRAME_LENGTH) : length;
+  }
+
+
+  // pad the frame with zeros
+  void pad(msg& frame) const
+  {
+    const std::uint32_t length = padded_length(static_cast<std::uint32_t>(frame.size()));
+    if (frame.size() < length) {
+      frame.insert(frame.end(), length - frame.size(), (std::uint8_t)0U);
     }
+  }
 
-    tx_frame_ = NPCI_FLOW_CONTROL;
-    return protocol::send(fc, id);
+
+  // STmin parameter as time, reserved values are handled as maximum STmin of 127 ms
+  static inline std::chrono::microseconds STmin_time(std::uint8_t STmin)
+  {
+    if (STmin <= 0x7FU) {
+      return std::chrono::milliseconds(STmin);
+    }
+    if ((STmin >= 0xF1U) && (STmin <= 0xF9U)) {
+      return std::chrono::microseconds((STmin - 0xF0U) * 100U);
+    }
+    return std::chrono::milliseconds(0x7FU);
   }
 
 
   // timer
+  // the callbacks hold their session, so it may be removed while they run
 
   static void timer_func_TX_CF(void* arg)
   {
     // STmin expired, send next consecutive frame
-    ((iso15765*)arg)->send_CF();
+    session_ptr s = static_cast<session_type*>(arg)->self.lock();
+    if (s) {
+      s->owner->send_CF(*s);
+    }
   }
 
 
@@ -620,15 +1291,32 @@ private:
   {
     // waiting for FC frame expired, this is an error condition
     // the upper layer needs to be informed that the receiver didn't answer
-    ((iso15765*)arg)->send_CF_abort();
+    session_ptr s = static_cast<session_type*>(arg)->self.lock();
+    if (s) {
+      s->owner->send_CF_abort(*s);
+    }
   }
 
 
   static void timer_func_RX_CF(void* arg)
   {
+    session_ptr s = static_cast<session_type*>(arg)->self.lock();
+    if (!s) {
+      return;
+    }
+    bool busy;
+    {
+      std::lock_guard<std::mutex> lock(s->owner->mutex_);
+      busy = s->rx_busy != 0U;
+    }
+    if (busy) {
+      // FC couldn't be sent, try again
+      s->owner->send_FC_CTS(*s);
+      return;
+    }
     // waiting for next CF frame from sender expired, this is an error condition
     // the upper layer needs to be informed that the sender has a timeout
-    ((iso15765*)arg)->send_CF_abort();
+    s->owner->receive_CF_abort(*s);
   }
 };
 
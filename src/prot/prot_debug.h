@@ -90,7 +90,7 @@ public:
    */
   virtual bool send(msg& data, eid const& id = eid_any, bool more = false)
   {
-    DECOM_LOG_DUMP(DECOM_LOG_LEVEL_DEBUG, upper_->name_ << " -> " << lower_->name_ << ", eid " << format_eid(id).str().c_str() << (more ? ", more" : ", last") << ", len " << data.size(), data.begin(), data.end());
+    DECOM_LOG_DUMP(DECOM_LOG_LEVEL_DEBUG, upper_->name_ << " -> " << lower_->name_ << ", eid " << format_eid(id).str().c_str() << (more ? ", more" : ", last") << ", len " << data.size(), data.cbegin(), data.cend());
     return protocol::send(data, id, more);
   }
 
@@ -103,7 +103,7 @@ public:
    */
   virtual void receive(msg& data, eid const& id = eid_any, bool more = false)
   {
-    DECOM_LOG_DUMP(DECOM_LOG_LEVEL_DEBUG, lower_->name_ << " -> " << upper_->name_ << ", eid " << format_eid(id).str().c_str() << (more ? ", more" : ", last") << ", len " << data.size(), data.begin(), data.end());
+    DECOM_LOG_DUMP(DECOM_LOG_LEVEL_DEBUG, lower_->name_ << " -> " << upper_->name_ << ", eid " << format_eid(id).str().c_str() << (more ? ", more" : ", last") << ", len " << data.size(), data.cbegin(), data.cend());
     protocol::receive(data, id, more);
   }
 
@@ -112,7 +112,7 @@ public:
   virtual void receive(msg& data, eid const& id = eid_any, bool more = false)
   {
     // get the count of upper layers which match the eid
-    // if the msg is distributed to more than one upper layer, make a real copy of data because any upper layer may strip/modify data
+    // if the msg is distributed to more than one upper layer, each one gets a ref copy of data
     std::vector<upper_layers_type>::iterator it, it1;
     std::uint32_t cnt = 0U;
     for (it = upper_layers_.begin(); it != upper_layers_.end(); ++it) {
@@ -124,6 +124,10 @@ public:
       }
     }
 
+    if (cnt == 0U) {
+      // no upper layer with according eid
+      return;
+    }
     if (cnt < 2U) {
       // only one upper layer with according eid
       it1->layer->receive(data, id, more);
@@ -131,12 +135,13 @@ public:
     }
     else {
       // two or more upper layers with according eid
-      msg org = data;   // make a real copy of data because any upper layer may strip/modify data
+      msg org;
+      org.ref_copy(data);   // cheap copy, an upper layer which strips/modifies data copies the affected pages only
       for (it = upper_layers_.begin(); it != upper_layers_.end(); ++it) {
         if ((it->eid == id || it->eid.is_any()) && it->include) {
           if (it != upper_layers_.begin()) {
             // restore data and pass fresh copy to upper layer
-            data = org;
+            data.ref_copy(org);
           }
           // distribute data to all upper layers which have a generic (-1) or a matching channel ID
           it->layer->receive(data, id, more);
@@ -135,7 +135,7 @@ public:
    */
   virtual bool send(msg& data, eid const& id = eid_any)
   {
-    for (decom::msg::const_iterator it = data.begin(); it != data.end(); ++it)
+    for (decom::msg::const_iterator it = data.cbegin(); it != data.cend(); ++it)
     {
       std::uint8_t val = 0U;
 
@@ -27,14 +27,36 @@
 //
 // This class implements the SLIP protocol after rfc1055
 // It's used to transfer discrete packets over byte streams and serial lines.
+// Data is not processed byte by byte: END and ESC bytes are searched 16/32
+// bytes at once (SSE2, AVX2 or NEON, 8 bytes at once else) and the runs in
+// between are copied in bulk into the pool pages.
+// In batch mode (set_rx_batch()) all packets which are completed by one
+// received msg are passed to the upper layer by a single receive_batch() call.
 //
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifndef _DECOM_PROT_SLIP_H_
 #define _DECOM_PROT_SLIP_H_
 
+#include <cstring>
+#include <vector>
+
 #include "../prot.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DECOM_SLIP_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define DECOM_SLIP_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DECOM_SLIP_NEON
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>   // _BitScanForward
+#endif
+
 
 /////////////////////////////////////////////////////////////////////
 
@@ -58,11 +80,19 @@ private:
     RCV_ESC           // ESC delimiter received
   } rx_state_type;
 
+  // number of segments which are fetched out of a msg at once
+  static const std::size_t SLIP_SEGMENTS = 8U;
+
+  // maximum number of packets which are passed to the upper layer in one batch
+  static const std::size_t SLIP_RX_BATCH = 32U;
+
   rx_state_type rx_state_;      // receive message state
   bool          is_open_;       // true if layer is open
+  bool          rx_batched_;    // true to pass the received packets in batches
 
   decom::msg    rx_msg_;        // receive message buffer
   decom::msg    tx_msg_;        // transmit message buffer
+  std::vector<decom::msg> rx_batch_;  // received packets of the actual batch
 
 
 public:
@@ -76,6 +106,7 @@ public:
     : protocol(lower, name)
     , rx_state_(RCV_IDLE)
     , is_open_(false)
+    , rx_batched_(false)
   {
     // SLIP has no defined MTU, limit is the maximum message buffer size
     mtu() = 0U;
@@ -156,24 +187,36 @@ public:
       tx_msg_.push_front(END);
     }
 
-    // insert ESC_END or ESC_ESC
-    for (auto it : packet) {
-      switch (it) {
-        // if it's the same code as an END character, we send a special two character code so as not to make the receiver think we sent an END
-        case END :
-          tx_msg_.push_back(ESC);
-          tx_msg_.push_back(ESC_END);
-          break;
-        // if it's the same code as an ESC character, we send a special two character code so as not to make the receiver think we sent an ESC
-        case ESC :
-          tx_msg_.push_back(ESC);
-          tx_msg_.push_back(ESC_ESC);
-          break;
-        default :
-          tx_msg_.push_back(it);
-          break;
+    // copy the runs between END and ESC bytes, insert ESC_END or ESC_ESC for them
+    bool ok = true;
+    decom::msg::segment_type seg[SLIP_SEGMENTS];
+    decom::msg::size_type offset = 0U;
+    for (decom::msg::size_type n; ok && (n = packet.get_segments(seg, SLIP_SEGMENTS, offset)) != 0U; ) {
+      for (decom::msg::size_type i = 0U; ok && (i < n); ++i) {
+        const std::uint8_t* p   = seg[i].data;
+        const std::uint8_t* end = seg[i].data + seg[i].size;
+        while (ok && (p < end)) {
+          const std::uint8_t* q = scan(p, end);
+          if (q != p) {
+            ok = tx_msg_.append(p, static_cast<decom::msg::size_type>(q - p));
+          }
+          if (q == end) {
+            break;
+          }
+          // if it's the same code as an END or ESC character, we send a special two character code so as not to make the receiver think we sent an END or ESC
+          const std::uint8_t esc[2] = { ESC, *q == END ? ESC_END : ESC_ESC };
+          ok = ok && tx_msg_.append(esc, 2U);
+          p = q + 1;
+        }
+        offset += seg[i].size;
       }
     }
+    if (!ok) {
+      // page allocation error, discard the packet
+      DECOM_LOG_WARN("Packet encoding failed, no free page");
+      tx_msg_.clear();
+      return false;
+    }
 
     if (!more) {
       // tell the receiver that we're done sending the packet
@@ -208,42 +251,99 @@ public:
       return;
     }
 
-    // scan and process incoming byte stream
-    for (const auto& it : data) {
+    // scan and process incoming byte stream segment by segment
+    decom::msg::segment_type seg[SLIP_SEGMENTS];
+    decom::msg::size_type offset = 0U;
+    for (decom::msg::size_type n; (n = data.get_segments(seg, SLIP_SEGMENTS, offset)) != 0U; ) {
+      for (decom::msg::size_type i = 0U; i < n; ++i) {
+        decode(seg[i].data, seg[i].data + seg[i].size);
+        offset += seg[i].size;
+      }
+    }
+
+    // pass the remaining packets of the batch
+    if (!rx_batch_.empty()) {
+      rx_deliver();
+    }
+  }
+
+
+  /**
+   * Enable or disable the batch mode
+   * In batch mode the packets are passed by receive_batch() to the upper layer.
+   * \param enable True to enable the batch mode
+   */
+  void set_rx_batch(bool enable)
+  {
+    rx_batched_ = enable;
+    if (enable) {
+      // no reallocation (and msg copies) in the receive path
+      rx_batch_.reserve(SLIP_RX_BATCH);
+    }
+  }
+
+
+  /////////////////////////////////////////////////////////////////////////////
+  // P R I V A T E
+private:
+
+  // decode a span of the incoming byte stream
+  void decode(const std::uint8_t* p, const std::uint8_t* end)
+  {
+    while (p < end) {
       switch (rx_state_)
       {
-        case RCV_IDLE :
+        case RCV_IDLE : {
           // wait for starting END delimiter
-          if (it == END) {
-            rx_state_ = RCV_DATA;           // packet data start
+          const void* q = std::memchr(p, END, static_cast<std::size_t>(end - p));
+          if (!q) {
+            return;
           }
+          p = static_cast<const std::uint8_t*>(q) + 1;
+          rx_state_ = RCV_DATA;             // packet data start
           break;
-        case RCV_DATA :
-          // packet receive
-          if (it == ESC) {
+        }
+        case RCV_DATA : {
+          // packet receive, append the data up to the next END or ESC
+          const std::uint8_t* q = scan(p, end);
+          if (q != p) {
+            (void)rx_msg_.append(p, static_cast<decom::msg::size_type>(q - p));
+          }
+          if (q == end) {
+            return;
+          }
+          p = q + 1;
+          if (*q == ESC) {
             // ESC detected
             rx_state_ = RCV_ESC;
             break;
           }
-          if (it == END) {
-            // END delimiter detected
-            if (rx_msg_.size()) {           // discard empty packets
+          // END delimiter detected
+          if (rx_msg_.size()) {             // discard empty packets
+            if (rx_batched_) {
+              // move the packet to the batch
+              rx_batch_.emplace_back();
+              rx_batch_.back().ref_copy(rx_msg_);
+              if (rx_batch_.size() >= SLIP_RX_BATCH) {
+                rx_deliver();
+              }
+            }
+            else {
               protocol::receive(rx_msg_);   // pass packet to upper layer
-              rx_msg_.clear();              // reset receiver buffer
-             }
-             rx_state_ = RCV_IDLE;          // reset state
-            break;
+            }
+            rx_msg_.clear();                // reset receiver buffer
           }
-          // append data
-          rx_msg_.push_back(it);
+          rx_state_ = RCV_IDLE;             // reset state
           break;
-        case RCV_ESC :
-          if (it == ESC_END) {
+        }
+        case RCV_ESC : {
+          const std::uint8_t c = *p++;
+          if (c == ESC_END) {
             rx_msg_.push_back(END);         // "END" data byte received
             rx_state_ = RCV_DATA;           // continue packet data
             break;
           }
-          if (it == ESC_ESC) {
+          if (c == ESC_ESC) {
             rx_msg_.push_back(ESC);         // "ESC" data byte received
             rx_state_ = RCV_DATA;           // continue packet data
             break;
@@ -253,6 +353,7 @@ public:
           rx_msg_.clear();                  // reset receiver buffer
           rx_state_ = RCV_IDLE;             // reset state
           break;
+        }
         default :
           // unknown state. should not happen, reset anyway
           DECOM_LOG_ERROR("Unknown rx_state_ ") << rx_state_;
@@ -263,6 +364,106 @@ public:
     }
   }
 
+
+  // pass the batch to the upper layer
+  void rx_deliver()
+  {
+    for (std::size_t i = 0U; i < rx_batch_.size(); ++i) {
+      stats_in(rx_batch_[i]);
+    }
+    if (upper_) {
+      upper_->receive_batch(&rx_batch_[0], rx_batch_.size());
+    }
+    rx_batch_.clear();
+  }
+
+
+  /**
+   * Find the first END or ESC byte
+   * \param p Start of the data
+   * \param end End of the data
+   * \return Pointer to the first END or ESC byte, end if there is none
+   */
+  static const std::uint8_t* scan(const std::uint8_t* p, const std::uint8_t* end)
+  {
+#if defined(DECOM_SLIP_AVX2)
+    const __m256i end32 = _mm256_set1_epi8(static_cast<char>(END));
+    const __m256i esc32 = _mm256_set1_epi8(static_cast<char>(ESC));
+    for (; end - p >= 32; p += 32) {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      const std::uint32_t mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, end32), _mm256_cmpeq_epi8(v, esc32))));
+      if (mask) {
+        return p + ctz(mask);
+      }
+    }
+#endif
+#if defined(DECOM_SLIP_AVX2) || defined(DECOM_SLIP_SSE2)
+    const __m128i end16 = _mm_set1_epi8(static_cast<char>(END));
+    const __m128i esc16 = _mm_set1_epi8(static_cast<char>(ESC));
+    for (; end - p >= 16; p += 16) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const std::uint32_t mask = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, end16), _mm_cmpeq_epi8(v, esc16))));
+      if (mask) {
+        return p + ctz(mask);
+      }
+    }
+#elif defined(DECOM_SLIP_NEON)
+    const uint8x16_t end16 = vdupq_n_u8(END);
+    const uint8x16_t esc16 = vdupq_n_u8(ESC);
+    for (; end - p >= 16; p += 16) {
+      const uint8x16_t v = vld1q_u8(p);
+      const uint8x16_t m = vorrq_u8(vceqq_u8(v, end16), vceqq_u8(v, esc16));
+      // narrow to 4 bits per byte
+      const std::uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+      if (mask) {
+        return p + ctz64(mask) / 4U;
+      }
+    }
+#endif
+    // 8 bytes at once (SWAR), a zero byte in word ^ pattern is a match
+    const std::uint64_t ones  = 0x0101010101010101ULL;
+    const std::uint64_t highs = 0x8080808080808080ULL;
+    for (; end - p >= 8; p += 8) {
+      std::uint64_t w;
+      (void)std::memcpy(&w, p, 8U);
+      const std::uint64_t x = w ^ (ones * END);
+      const std::uint64_t y = w ^ (ones * ESC);
+      if (((x - ones) & ~x & highs) | ((y - ones) & ~y & highs)) {
+        break;    // the byte loop below finds it
+      }
+    }
+    while ((p < end) && (*p != END) && (*p != ESC)) {
+      ++p;
+    }
+    return p;
+  }
+
+
+  // count trailing zeros, x must not be 0
+  static inline unsigned ctz(std::uint32_t x)
+  {
+#if defined(_MSC_VER)
+    unsigned long i;
+    (void)_BitScanForward(&i, x);
+    return static_cast<unsigned>(i);
+#elif defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_ctz(x));
+#else
+    unsigned i = 0U;
+    for (; !(x & 1U); x >>= 1U) {
+      ++i;
+    }
+    return i;
+#endif
+  }
+
+
+  static inline unsigned ctz64(std::uint64_t x)
+  {
+    const std::uint32_t lo = static_cast<std::uint32_t>(x);
+    return lo ? ctz(lo) : 32U + ctz(static_cast<std::uint32_t>(x >> 32U));
+  }
+
 };
 
 } // namespace prot
@@ -25,7 +25,12 @@
 //
 // \brief event class
 //
-// This class abstracts waitable events (signals) based on std::condition_variable and std::mutex
+// This class abstracts waitable (manual reset) events. The state is an atomic,
+// so set(), reset() and get() are lock free. A waiter spins for a short,
+// adaptive time before it parks on a condition variable. The spin count grows
+// when events typically arrive while spinning (e.g. synchronous request/response
+// with a fast lower layer) and shrinks when the waiter had to park anyway.
+// set() only takes the mutex if a waiter is parked.
 // Usage: decom::util::event ev;
 //        if (ev.wait_for(std::chrono::milliseconds(1000)) == std::no_timeout) {   // wait for one second to get event set
 //          // event was set
@@ -41,11 +46,17 @@
 #define _DECOM_UTIL_EVENT_H_
 
 #include <cstdint>
+#include <atomic>
 #include <mutex>
+#include <thread>
 #include <ratio>
 #include <chrono>
 #include <condition_variable>   // std::condition_variable
 
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>             // _mm_pause()
+#endif
+
 
 namespace decom {
 namespace util {
@@ -53,20 +64,28 @@ namespace util {
 
 class event
 {
+  // defines the spin limits of a waiter in cpu relax cycles (some 10 ns each)
+  static const std::uint32_t EVENT_SPIN_MIN = 64U;
+  static const std::uint32_t EVENT_SPIN_MAX = 4096U;
+
 public:
   event()
     : state_(false)
+    , waiters_(0U)
+    , spin_(EVENT_SPIN_MIN)
   { }
 
 
   /**
-   * Set the event
+   * Set the event and wake up all waiters
    */
   inline void set()
   {
-    std::lock_guard<std::mutex> lk(m_);
-    state_ = true;
-    c_.notify_one();
+    state_.store(true);   // sequentially consistent against waiters_, see park()
+    if (waiters_.load()) {
+      std::lock_guard<std::mutex> lk(m_);
+      c_.notify_all();
+    }
   }
 
 
@@ -75,7 +94,7 @@ public:
    */
   inline void reset()
   {
-    state_ = false;
+    state_.store(false, std::memory_order_release);
   }
 
 
@@ -84,7 +103,7 @@ public:
    */
   inline bool get() const
   {
-    return state_;
+    return state_.load(std::memory_order_acquire);
   }
 
 
@@ -95,10 +114,16 @@ public:
    */
   inline void wait()
   {
+    if (spin()) {
+      return;
+    }
+    park();
     std::unique_lock<std::mutex> lk(m_);
-    while (!state_) {
+    while (!state_.load(std::memory_order_acquire)) {
       c_.wait(lk);
     }
+    lk.unlock();
+    unpark();
   }
 
 
@@ -112,18 +137,95 @@ public:
   template<typename Rep, typename Period>
   std::cv_status wait_for(const std::chrono::duration<Rep, Period>& rel_time)
   {
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + rel_time;
+    if (spin()) {
+      return std::cv_status::no_timeout;
+    }
+    park();
     std::unique_lock<std::mutex> lk(m_);
-    if (!state_) {
-      return c_.wait_for<Rep, Period>(lk, rel_time);
+    bool signaled;
+    while (!(signaled = state_.load(std::memory_order_acquire))) {
+      if (c_.wait_until(lk, deadline) == std::cv_status::timeout) {
+        signaled = state_.load(std::memory_order_acquire);
+        break;
+      }
     }
-    return std::cv_status::no_timeout;
+    lk.unlock();
+    unpark();
+    return signaled ? std::cv_status::no_timeout : std::cv_status::timeout;
   }
 
 
 private:
-  std::mutex m_;
-  std::condition_variable c_;
-  volatile bool state_;
+
+  // spin for the event, returns true if the event is set
+  bool spin()
+  {
+    if (state_.load(std::memory_order_acquire)) {
+      return true;
+    }
+    if (!multicore()) {
+      // spinning only delays the setting thread
+      return false;
+    }
+    const std::uint32_t count = spin_.load(std::memory_order_relaxed);
+    for (std::uint32_t i = 0U; i < count; ++i) {
+      relax();
+      if (state_.load(std::memory_order_acquire)) {
+        // got it, spin longer next time
+        spin_.store(count < EVENT_SPIN_MAX / 2U ? count * 2U : static_cast<std::uint32_t>(EVENT_SPIN_MAX), std::memory_order_relaxed);
+        return true;
+      }
+    }
+    // spinning didn't pay, spin shorter next time
+    spin_.store(count > EVENT_SPIN_MIN * 2U ? count / 2U : static_cast<std::uint32_t>(EVENT_SPIN_MIN), std::memory_order_relaxed);
+    return false;
+  }
+
+
+  // register a parking waiter, set() must see the waiter or the waiter must see the state
+  inline void park()
+  {
+    (void)waiters_.fetch_add(1U);
+  }
+
+
+  inline void unpark()
+  {
+    (void)waiters_.fetch_sub(1U, std::memory_order_relaxed);
+  }
+
+
+  // cpu hint for spin loops
+  static inline void relax()
+  {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    _mm_pause();
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    __builtin_ia32_pause();
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__arm__))
+    __asm__ __volatile__("yield");
+#else
+    std::this_thread::yield();
+#endif
+  }
+
+
+  static inline bool multicore()
+  {
+    static const bool multi = std::thread::hardware_concurrency() > 1U;
+    return multi;
+  }
+
+
+  std::atomic<bool>           state_;     // event state
+  std::atomic<std::uint32_t>  waiters_;   // number of parked waiters
+  std::atomic<std::uint32_t>  spin_;      // adaptive spin count
+  std::mutex                  m_;
+  std::condition_variable     c_;
+
+  event(const event&);              // no copy
+  event& operator=(const event&);   // no assignment
 };
 
 
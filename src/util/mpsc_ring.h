@@ -0,0 +1,176 @@
+///////////////////////////////////////////////////////////////////////////////
+// \author (c) Marco Paland (info@paland.com)
+//             2011-2021, PALANDesign Hannover, Germany
+//
+// \license The MIT License (MIT)
+//
+// This file is part of the decom library.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// \brief Bounded lock-free multi producer single consumer ring
+//
+// This class implements a bounded MPSC ring of SIZE slots (power of 2) to hand
+// elements (e.g. msg handles) from any number of threads to one consumer thread.
+// Each slot has a sequence number, so producers only contend on the enqueue
+// position and the consumer never blocks a producer. push() fails if the ring
+// is full, the caller can report this as a failed send then.
+// The consumer takes all available elements at once by drain(), so one wakeup
+// delivers a whole batch.
+// Usage: decom::util::mpsc_ring<item, 64U> ring;
+//        ring.push(a, b);                          // any thread, constructs item(a, b) in place
+//        ring.drain([](item& i) { ... });          // consumer thread only
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _DECOM_UTIL_MPSC_RING_H_
+#define _DECOM_UTIL_MPSC_RING_H_
+
+#include <cstddef>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+namespace decom {
+namespace util {
+
+
+template<typename T, std::size_t SIZE>
+class mpsc_ring
+{
+  static_assert(SIZE >= 2U && !(SIZE & (SIZE - 1U)), "SIZE must be a power of 2");
+
+public:
+  mpsc_ring()
+    : enqueue_(0U)
+    , dequeue_(0U)
+  {
+    for (std::size_t i = 0U; i < SIZE; ++i) {
+      slot_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+
+  // dtor, destroys the remaining elements
+  ~mpsc_ring()
+  {
+    drain([](T&) { });
+  }
+
+
+  /**
+   * Construct an element at the end of the ring, may be called by any thread
+   * \param args Arguments of the element ctor
+   * \return true if successful, false if the ring is full
+   */
+  template<typename... Args>
+  bool push(Args&&... args)
+  {
+    std::size_t pos = enqueue_.load(std::memory_order_relaxed);
+    slot_type* s;
+    for (;;) {
+      s = &slot_[pos & (SIZE - 1U)];
+      const std::size_t seq = s->seq.load(std::memory_order_acquire);
+      const std::ptrdiff_t dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+      if (!dif) {
+        // slot is free, claim it
+        if (enqueue_.compare_exchange_weak(pos, pos + 1U, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (dif < 0) {
+        // slot still holds an element of the last round
+        return false;
+      }
+      else {
+        // another producer claimed the slot
+        pos = enqueue_.load(std::memory_order_relaxed);
+      }
+    }
+    ::new (&s->storage) T(std::forward<Args>(args)...);
+    s->seq.store(pos + 1U, std::memory_order_release);   // publish
+    return true;
+  }
+
+
+  /**
+   * Pass all available elements to func and remove them, consumer thread only
+   * Elements which are pushed during the drain are processed, too.
+   * \param func Function or functor called as func(T&) for each element in push order
+   * \param max Maximum number of elements to process
+   * \return Number of processed elements
+   */
+  template<typename Func>
+  std::size_t drain(Func func, std::size_t max = static_cast<std::size_t>(-1))
+  {
+    std::size_t count = 0U;
+    while (count < max) {
+      slot_type& s = slot_[dequeue_ & (SIZE - 1U)];
+      if (s.seq.load(std::memory_order_acquire) != dequeue_ + 1U) {
+        break;  // empty or the element is not published yet
+      }
+      T* e = reinterpret_cast<T*>(&s.storage);
+      func(*e);
+      e->~T();
+      s.seq.store(dequeue_ + SIZE, std::memory_order_release);   // free the slot for the next round
+      ++dequeue_;
+      ++count;
+    }
+    return count;
+  }
+
+
+  /**
+   * Returns true if no element is available, consumer thread only
+   */
+  inline bool empty() const
+  {
+    return slot_[dequeue_ & (SIZE - 1U)].seq.load(std::memory_order_acquire) != dequeue_ + 1U;
+  }
+
+
+  /**
+   * Maximum number of elements
+   */
+  inline std::size_t capacity() const
+  { return SIZE; }
+
+
+  /////////////////////////////////////////////////////////////////////////////
+  // P R I V A T E
+private:
+
+  typedef struct tag_slot_type {
+    std::atomic<std::size_t> seq;   // sequence number, pos: free, pos + 1: element published
+    typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+  } slot_type;
+
+  slot_type slot_[SIZE];
+  std::atomic<std::size_t> enqueue_;  // next position to push, shared by the producers
+  std::size_t dequeue_;               // next position to drain, consumer only
+
+  mpsc_ring(const mpsc_ring&);              // no copy
+  mpsc_ring& operator=(const mpsc_ring&);   // no assignment
+};
+
+} // namespace util
+} // namespace decom
+
+#endif // _DECOM_UTIL_MPSC_RING_H_
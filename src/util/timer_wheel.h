@@ -0,0 +1,382 @@
+///////////////////////////////////////////////////////////////////////////////
+// \author (c) Marco Paland (info@paland.com)
+//             2011-2021, PALANDesign Hannover, Germany
+//
+// \license The MIT License (MIT)
+//
+// This file is part of the decom library.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// \brief Hierarchical timing wheel
+//
+// This class implements a hierarchical timing wheel with LEVELS levels of
+// SLOTS slots each. Timers are intrusive nodes, so add and remove are O(1)
+// without any allocation. Timers of upper levels are cascaded down when the
+// wheel passes their slot.
+// The wheel has no notion of time and is not thread safe, the time unit of a
+// tick and the locking is up to the user, see util::timer.
+// A per level slot bitmap gives the next tick with something to do, so the
+// driving thread only needs to wake up then and can skip all idle ticks.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _DECOM_UTIL_TIMER_WHEEL_H_
+#define _DECOM_UTIL_TIMER_WHEEL_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+
+
+namespace decom {
+namespace util {
+
+
+class timer_wheel
+{
+public:
+  static const unsigned SLOT_BITS = 6U;                 // 64 slots per level, matches the bitmap width
+  static const unsigned SLOTS     = 1U << SLOT_BITS;
+  static const unsigned LEVELS    = 6U;                 // 2^36 ticks range, longer timers are cascaded repeatedly
+
+  /**
+   * Timer node, derive the timer from it
+   * A node is linked into exactly one slot or the expired list
+   */
+  class node
+  {
+  public:
+    node()
+      : next_(nullptr)
+      , prev_(nullptr)
+      , expires_(0U)
+      , level_(0U)
+      , slot_(0U)
+    { }
+
+    // true if the node is in the wheel
+    inline bool is_linked() const
+    { return next_ != nullptr; }
+
+    // tick when the node expires
+    inline std::uint64_t expires() const
+    { return expires_; }
+
+  private:
+    node* next_;
+    node* prev_;
+    std::uint64_t expires_;
+    std::uint8_t  level_;   // LEVELS for the expired list
+    std::uint8_t  slot_;
+
+    node(const node&);              // no copy
+    node& operator=(const node&);   // no assignment
+
+    friend class timer_wheel;
+  };
+
+
+  /**
+   * ctor
+   * \param now Current tick
+   */
+  timer_wheel(std::uint64_t now = 0U)
+    : now_(now)
+    , count_(0U)
+  {
+    for (unsigned l = 0U; l < LEVELS; ++l) {
+      for (unsigned s = 0U; s < SLOTS; ++s) {
+        init(slot_[l][s]);
+      }
+      bitmap_[l] = 0U;
+    }
+    init(expired_);
+  }
+
+
+  /**
+   * Next tick to process
+   */
+  inline std::uint64_t now() const
+  { return now_; }
+
+
+  /**
+   * Number of linked nodes
+   */
+  inline std::size_t size() const
+  { return count_; }
+
+
+  inline bool empty() const
+  { return !count_; }
+
+
+  /**
+   * Set the current tick of an empty wheel
+   * Use this before adding a node after the wheel was idle, so the node is placed relative to the actual time
+   * \param now Current tick
+   */
+  inline void reset(std::uint64_t now)
+  {
+    if (!count_) {
+      now_ = now;
+    }
+  }
+
+
+  /**
+   * Add or re-add a node, O(1)
+   * \param n Node
+   * \param expires Tick when the node expires, nodes with an expired tick expire on the next expire() call
+   */
+  void add(node& n, std::uint64_t expires)
+  {
+    if (n.is_linked()) {
+      unlink(n);
+      --count_;
+    }
+    n.expires_ = expires;
+    link(n);
+    ++count_;
+  }
+
+
+  /**
+   * Remove a node, O(1)
+   * Nothing happens if the node isn't linked
+   * \param n Node
+   */
+  void remove(node& n)
+  {
+    if (n.is_linked()) {
+      unlink(n);
+      --count_;
+    }
+  }
+
+
+  /**
+   * Advance the wheel to the given tick and return the next expired node
+   * Call this until it returns nullptr. The returned node is removed from the wheel
+   * and can be re-added (e.g. for periodic timers) or freed.
+   * \param tick Current tick
+   * \return Next expired node, nullptr if no more nodes expired until tick
+   */
+  node* expire(std::uint64_t tick)
+  {
+    while (expired_.next_ == &expired_ && now_ <= tick) {
+      const std::uint64_t next = next_tick();
+      if (next > tick) {
+        // nothing to do until tick
+        now_ = tick + 1U;
+        break;
+      }
+      now_ = next;
+      process();
+    }
+
+    if (expired_.next_ == &expired_) {
+      return nullptr;
+    }
+    node* n = expired_.next_;
+    unlink(*n);
+    --count_;
+    return n;
+  }
+
+
+  /**
+   * Returns the next tick with something to do, this is either an expiration or a cascade of an upper level
+   * \return Next tick to call expire() with, max value if the wheel is empty
+   */
+  std::uint64_t next_tick() const
+  {
+    if (expired_.next_ != &expired_) {
+      return now_;
+    }
+
+    std::uint64_t next = std::numeric_limits<std::uint64_t>::max();
+    for (unsigned l = 0U; l < LEVELS; ++l) {
+      if (!bitmap_[l]) {
+        continue;
+      }
+      const unsigned      shift = SLOT_BITS * l;
+      const std::uint64_t base  = now_ >> shift;
+      const unsigned      idx   = static_cast<unsigned>(base & (SLOTS - 1U));
+      // the current slot of an upper level is already cascaded, unless now_ is at its beginning
+      std::uint64_t bits = bitmap_[l] >> idx;
+      if (l && (now_ & ((static_cast<std::uint64_t>(1U) << shift) - 1U))) {
+        bits &= ~static_cast<std::uint64_t>(1U);
+      }
+      const std::uint64_t t = bits ? ((base + ctz(bits)) << shift)
+                                   : (((base | (SLOTS - 1U)) + 1U + ctz(bitmap_[l])) << shift);  // next rotation
+      if (t < next) {
+        next = t;
+      }
+    }
+    return next;
+  }
+
+
+  /////////////////////////////////////////////////////////////////////////////
+  // P R I V A T E
+private:
+
+  static inline void init(node& head)
+  {
+    head.next_ = &head;
+    head.prev_ = &head;
+  }
+
+
+  // link the node into its slot according to its expiration
+  void link(node& n)
+  {
+    std::uint64_t expires = n.expires_ < now_ ? now_ : n.expires_;
+    const std::uint64_t delta = expires - now_;
+
+    unsigned l = 0U;
+    while ((l < LEVELS - 1U) && (delta >> (SLOT_BITS * (l + 1U)))) {
+      ++l;
+    }
+    if (delta >> (SLOT_BITS * LEVELS)) {
+      // out of range, the node is cascaded in the last slot and re-added then
+      expires = now_ + (static_cast<std::uint64_t>(1U) << (SLOT_BITS * LEVELS)) - 1U;
+    }
+    const unsigned s = static_cast<unsigned>((expires >> (SLOT_BITS * l)) & (SLOTS - 1U));
+
+    n.level_ = static_cast<std::uint8_t>(l);
+    n.slot_  = static_cast<std::uint8_t>(s);
+    insert(slot_[l][s], n);
+    bitmap_[l] |= static_cast<std::uint64_t>(1U) << s;
+  }
+
+
+  void unlink(node& n)
+  {
+    n.prev_->next_ = n.next_;
+    n.next_->prev_ = n.prev_;
+    if (n.level_ < LEVELS) {
+      node& head = slot_[n.level_][n.slot_];
+      if (head.next_ == &head) {
+        bitmap_[n.level_] &= ~(static_cast<std::uint64_t>(1U) << n.slot_);
+      }
+    }
+    n.next_ = nullptr;
+    n.prev_ = nullptr;
+  }
+
+
+  // insert at the tail of the list
+  static inline void insert(node& head, node& n)
+  {
+    n.next_ = &head;
+    n.prev_ = head.prev_;
+    head.prev_->next_ = &n;
+    head.prev_ = &n;
+  }
+
+
+  // process the tick now_
+  void process()
+  {
+    const unsigned idx = static_cast<unsigned>(now_ & (SLOTS - 1U));
+    if (!idx) {
+      // cascade the upper levels
+      for (unsigned l = 1U; l < LEVELS; ++l) {
+        const unsigned s = static_cast<unsigned>((now_ >> (SLOT_BITS * l)) & (SLOTS - 1U));
+        cascade(l, s);
+        if (s) {
+          break;
+        }
+      }
+    }
+
+    // move the expired nodes to the expired list
+    node& head = slot_[0][idx];
+    while (head.next_ != &head) {
+      node* n = head.next_;
+      n->prev_->next_ = n->next_;
+      n->next_->prev_ = n->prev_;
+      n->level_ = LEVELS;
+      insert(expired_, *n);
+    }
+    bitmap_[0] &= ~(static_cast<std::uint64_t>(1U) << idx);
+    ++now_;
+  }
+
+
+  // re-add all nodes of the given slot, they are placed into lower levels
+  void cascade(unsigned level, unsigned slot)
+  {
+    node& head = slot_[level][slot];
+    if (head.next_ == &head) {
+      return;
+    }
+    // detach the list first, nodes may be re-added into the same slot
+    node list;
+    init(list);
+    list.next_ = head.next_;
+    list.prev_ = head.prev_;
+    list.next_->prev_ = &list;
+    list.prev_->next_ = &list;
+    init(head);
+    bitmap_[level] &= ~(static_cast<std::uint64_t>(1U) << slot);
+
+    while (list.next_ != &list) {
+      node* n = list.next_;
+      list.next_ = n->next_;
+      n->next_->prev_ = &list;
+      link(*n);
+    }
+  }
+
+
+  // count trailing zeros, x must not be 0
+  static inline unsigned ctz(std::uint64_t x)
+  {
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_ctzll(x));
+#else
+    static const std::uint8_t debruijn[64] = {
+       0,  1,  2, 53,  3,  7, 54, 27,  4, 38, 41,  8, 34, 55, 48, 28,
+      62,  5, 39, 46, 44, 42, 22,  9, 24, 35, 59, 56, 49, 18, 29, 11,
+      63, 52,  6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+      51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12
+    };
+    return debruijn[((x & (~x + 1U)) * 0x022FDD63CC95386DULL) >> 58U];
+#endif
+  }
+
+
+  std::uint64_t now_;                   // next tick to process
+  std::size_t   count_;                 // number of linked nodes
+  std::uint64_t bitmap_[LEVELS];        // non empty slots
+  node          slot_[LEVELS][SLOTS];   // slot list heads
+  node          expired_;               // expired nodes, not yet returned by expire()
+
+  timer_wheel(const timer_wheel&);              // no copy
+  timer_wheel& operator=(const timer_wheel&);   // no assignment
+};
+
+} // namespace util
+} // namespace decom
+
+#endif // _DECOM_UTIL_TIMER_WHEEL_H_
@@ -8,11 +8,25 @@
 ///////////////////////////////////////////////////////////
 // INCLUDE AVAILABLE UNIT TESTS HERE
 #include "test_msg.h"
+#include "test_util_timer_wheel.h"
+#include "test_util_mpsc_ring.h"
+#include "test_util_event.h"
+#if defined(DECOM_REACTOR)
+#include "test_util_reactor.h"
+#endif
+#include "test_dev_generic.h"
 #include "test_prot_intel_hex.h"
 #include "test_prot_iso15765.h"
+#include "test_prot_slip.h"
+#if defined(__linux__)
+#include "test_com_tcp.h"
+#include "test_com_udp.h"
+#include "test_com_serial.h"
+#include "test_com_usbhid.h"
+#endif
 //#include "test_prot_zvt.h"
 //#include "test_prot_scheduler.h"
-#include "test_com_inet.h"
+//#include "test_com_inet.h"
 ///////////////////////////////////////////////////////////
 
 namespace decom {
@@ -28,8 +42,22 @@ private:
   void test_modules()
   {
     msg(*result_stream_, format_);
+    util_timer_wheel(*result_stream_, format_);
+    util_mpsc_ring(*result_stream_, format_);
+    util_event(*result_stream_, format_);
+#if defined(DECOM_REACTOR)
+    util_reactor(*result_stream_, format_);
+#endif
+    dev_generic(*result_stream_, format_);
     //prot_intel_hex(*result_stream_, format_);
-    //prot_iso15765(*result_stream_, format_);
+    prot_iso15765(*result_stream_, format_);
+    prot_slip(*result_stream_, format_);
+#if defined(__linux__)
+    com_tcp(*result_stream_, format_);
+    com_udp(*result_stream_, format_);
+    com_serial(*result_stream_, format_);
+    com_usbhid(*result_stream_, format_);
+#endif
     //prot_zvt(*result_stream_, format_);
     //prot_scheduler(*result_stream_, format_);
     //com_inet(*result_stream_, format_);
@@ -0,0 +1,250 @@
+#ifndef _DECOM_TEST_COM_SERIAL_H_
+#define _DECOM_TEST_COM_SERIAL_H_
+
+// the pty is opened without openpty(), <pty.h> includes <termios.h>, which conflicts with termios2
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "../src/impl/linux/com/com_serial.h"
+#include "test.h"
+
+
+namespace decom {
+namespace test {
+
+
+class com_serial : public test
+{
+  // TEST CASES
+public:
+  com_serial(std::ostream& result_file, format_type format)
+    : test("com_serial", result_file, format)
+  {
+    pty();
+  }
+
+
+protected:
+
+  typedef decom::layer::status_type status_type;
+
+  // keeps the received data, the size of each received chunk and the indications
+  class sink : public decom::layer
+  {
+  public:
+    sink(decom::layer* lower)
+      : layer(lower, "serial_sink")
+    { }
+
+    virtual void receive(decom::msg& data, decom::eid const&, bool)
+    {
+      // the data is copied to release the receive pages
+      std::vector<decom::msg::segment_type> seg(data.segment_count());
+      (void)data.get_segments(&seg[0], seg.size());
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::size_t i = 0U; i < seg.size(); ++i) {
+        (void)rx.append(seg[i].data, seg[i].size);
+      }
+      chunks.push_back(data.size());
+    }
+
+    virtual void indication(status_type code, decom::eid const&)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ind.push_back(code);
+    }
+
+    // number of indications of the given code
+    std::size_t count(status_type code)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::size_t n = 0U;
+      for (std::size_t i = 0U; i < ind.size(); ++i) {
+        n += ind[i] == code ? 1U : 0U;
+      }
+      return n;
+    }
+
+    // size of the received data
+    std::size_t rx_size()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return rx.size();
+    }
+
+    // clear the received data and chunks
+    void rx_clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      rx.clear();
+      chunks.clear();
+    }
+
+    std::mutex mutex;
+    decom::msg rx;
+    std::vector<std::size_t> chunks;
+    std::vector<status_type> ind;
+  };
+
+
+  // serial port on the slave side of a pty, closed before the sink is unbound and the master is closed
+  struct port
+  {
+    decom::com::serial com;
+    sink               s;
+    int                master;
+    port(int master_fd)
+      : com(115200U)
+      , s(&com)
+      , master(master_fd)
+    { }
+    ~port()
+    { com.close(); (void)::close(master); }
+  };
+
+
+  static decom::msg pattern(std::size_t size, std::uint8_t seed)
+  {
+    decom::msg m;
+    for (std::size_t i = 0U; i < size; ++i) {
+      m.push_back(static_cast<std::uint8_t>(i * 7U + seed));
+    }
+    return m;
+  }
+
+
+  // write the pattern to the master side of the pty
+  static bool write_pattern(int fd, std::size_t size, std::uint8_t seed)
+  {
+    std::vector<std::uint8_t> buf(size);
+    for (std::size_t i = 0U; i < size; ++i) {
+      buf[i] = static_cast<std::uint8_t>(i * 7U + seed);
+    }
+    return ::write(fd, &buf[0], size) == static_cast<ssize_t>(size);
+  }
+
+
+  // read the given number of bytes from the master side of the pty, 2s at most
+  static decom::msg read_master(int fd, std::size_t size)
+  {
+    decom::msg m;
+    std::uint8_t buf[256];
+    while (m.size() < size) {
+      struct pollfd pfd = { fd, POLLIN, 0 };
+      if (::poll(&pfd, 1U, 2000) <= 0) {
+        break;
+      }
+      const ssize_t n = ::read(fd, buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+      (void)m.append(buf, static_cast<std::size_t>(n));
+    }
+    return m;
+  }
+
+
+  // poll the predicate for 2s at most
+  template<typename Predicate>
+  static bool wait_for(Predicate pred)
+  {
+    for (int i = 0; i < 200; ++i) {
+      if (pred()) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  }
+
+
+  void pty()
+  {
+    TEST_BEGIN("pty");
+    DECOM_LOG_NOTICE2("pty", "serial test");
+
+    // the slave stays open until the port is opened, so that the pty isn't hung up meanwhile
+    const int master = ::posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    char name[64];
+    if ((master < 0) || ::grantpt(master) || ::unlockpt(master) || ::ptsname_r(master, name, sizeof(name))) {
+      if (master >= 0) {
+        (void)::close(master);
+      }
+      TEST_SKIP;
+      return;
+    }
+    const int slave = ::open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+    port p(master);
+    decom::com::serial& com = p.com;
+    sink& s = p.s;
+
+    // a pty doesn't support the low latency mode, this is no error
+    const bool opened = s.open(name);
+    if (slave >= 0) {
+      (void)::close(slave);
+    }
+    TEST_CHECK(opened);
+    TEST_CHECK(s.count(decom::layer::connected) == 1U);
+
+    // rx path, VMIN = 0: the data is passed up as soon as it's available
+    TEST_CHECK(write_pattern(master, 1000U, 1U));
+    TEST_CHECK(wait_for([&]() { return s.rx_size() == 1000U; }));
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      TEST_CHECK(s.rx == pattern(1000U, 1U));
+    }
+    s.rx_clear();
+
+    // VMIN = 10, VTIME = 0: nothing is passed up before 10 bytes arrived
+    TEST_CHECK(com.set_rx_batching(10U, 0U));
+    TEST_CHECK(write_pattern(master, 5U, 2U));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    TEST_CHECK(s.rx_size() == 0U);
+    TEST_CHECK(write_pattern(master, 5U, 7U));
+    TEST_CHECK(wait_for([&]() { return s.rx_size() == 10U; }));
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      TEST_CHECK((s.chunks.size() == 1U) && (s.chunks[0] == 10U));
+    }
+    s.rx_clear();
+
+    // VMIN = 10, VTIME = 1: less than 10 bytes are passed up after the line is idle for 100ms
+    TEST_CHECK(com.set_rx_batching(10U, 1U));
+    TEST_CHECK(write_pattern(master, 3U, 3U));
+    TEST_CHECK(wait_for([&]() { return s.rx_size() == 3U; }));
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      TEST_CHECK((s.chunks.size() == 1U) && (s.chunks[0] == 3U));
+      TEST_CHECK(s.rx == pattern(3U, 3U));
+    }
+    s.rx_clear();
+    TEST_CHECK(com.set_rx_batching(0U, 0U));
+
+    // tx path, tx_done is indicated after the data is drained to the pty
+    {
+      decom::msg tx = pattern(2000U, 4U);
+      TEST_CHECK(s.send(tx));
+      TEST_CHECK(wait_for([&]() { return s.count(decom::layer::tx_done) == 1U; }));
+      TEST_CHECK(read_master(master, 2000U) == pattern(2000U, 4U));
+      TEST_CHECK(s.count(decom::layer::tx_error) == 0U);
+    }
+
+    s.close();
+    TEST_CHECK(s.count(decom::layer::disconnected) == 1U);
+
+    TEST_END;
+  }
+};
+
+} // namespace test
+} // namespace decom
+
+#endif // _DECOM_TEST_COM_SERIAL_H_
@@ -0,0 +1,217 @@
+#ifndef _DECOM_TEST_COM_TCP_H_
+#define _DECOM_TEST_COM_TCP_H_
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <thread>
+#include <chrono>
+
+#include "../src/impl/linux/com/com_tcp.h"
+#include "test.h"
+
+
+namespace decom {
+namespace test {
+
+
+class com_tcp : public test
+{
+  // TEST CASES
+public:
+  com_tcp(std::ostream& result_file, format_type format)
+    : test("com_tcp", result_file, format)
+  {
+    server_client();
+  }
+
+
+protected:
+
+  typedef decom::layer::status_type status_type;
+
+  // keeps the received data and the indications of all eids
+  class sink : public decom::layer
+  {
+  public:
+    sink(decom::layer* lower)
+      : layer(lower, "tcp_sink")
+    { }
+
+    virtual void receive(decom::msg& data, decom::eid const& id, bool)
+    {
+      // the stream may be received in several parts, the data is copied to release the receive pages
+      std::vector<decom::msg::segment_type> seg(data.segment_count());
+      (void)data.get_segments(&seg[0], seg.size());
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::size_t i = 0U; i < seg.size(); ++i) {
+        (void)rx[id].append(seg[i].data, seg[i].size);
+      }
+    }
+
+    virtual void indication(status_type code, decom::eid const& id)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ind.push_back(std::make_pair(code, id));
+    }
+
+    // number of indications of the given code
+    std::size_t count(status_type code)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::size_t n = 0U;
+      for (std::size_t i = 0U; i < ind.size(); ++i) {
+        n += ind[i].first == code ? 1U : 0U;
+      }
+      return n;
+    }
+
+    // true if the indication of the given code and eid was given
+    bool has(status_type code, decom::eid const& id)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::size_t i = 0U; i < ind.size(); ++i) {
+        if ((ind[i].first == code) && (ind[i].second == id)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // size of the data received from the given eid
+    std::size_t rx_size(decom::eid const& id)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::map<decom::eid, decom::msg>::const_iterator it = rx.find(id);
+      return it == rx.end() ? 0U : it->second.size();
+    }
+
+    std::mutex mutex;
+    std::map<decom::eid, decom::msg> rx;
+    std::vector<std::pair<status_type, decom::eid> > ind;
+  };
+
+
+  // communicator with its sink, closed before the sink is unbound
+  struct endpoint
+  {
+    decom::com::tcp com;
+    sink            s;
+    endpoint(bool server)
+      : com(server, false, 2U)
+      , s(&com)
+    { }
+    ~endpoint()
+    { com.close(); }
+  };
+
+
+  static decom::msg pattern(std::size_t size, std::uint8_t seed)
+  {
+    decom::msg m;
+    for (std::size_t i = 0U; i < size; ++i) {
+      m.push_back(static_cast<std::uint8_t>(i * 7U + seed));
+    }
+    return m;
+  }
+
+
+  // poll the predicate for 2s at most
+  template<typename Predicate>
+  static bool wait_for(Predicate pred)
+  {
+    for (int i = 0; i < 200; ++i) {
+      if (pred()) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  }
+
+
+  void server_client()
+  {
+    TEST_BEGIN("server/client");
+    DECOM_LOG_NOTICE2("server/client", "tcp test");
+
+    endpoint server(true);
+    endpoint client1(false);
+    endpoint client2(false);
+    TEST_CHECK(server.s.open("127.0.0.1:50311"));
+    TEST_CHECK(client1.s.open("127.0.0.1:50311"));
+    TEST_CHECK(client2.s.open("127.0.0.1:50311"));
+
+    // connected indications, the server maps the clients to the eids of their addresses and ports
+    TEST_CHECK(wait_for([&]() { return server.s.count(decom::layer::connected) == 2U; }));
+    TEST_CHECK(client1.s.has(decom::layer::connected, decom::eid_any));
+    TEST_CHECK(client2.s.has(decom::layer::connected, decom::eid_any));
+    decom::eid id1, id2;
+    {
+      std::lock_guard<std::mutex> lock(server.s.mutex);
+      id1 = server.s.ind[0].second;
+      id2 = server.s.ind[1].second;
+    }
+    TEST_CHECK(id1 != id2);
+    TEST_CHECK((id1.addr().addr[0] == 127U) && (id1.addr().addr[3] == 1U) && (id1.port() != 0U));
+    TEST_CHECK((id2.addr().addr[0] == 127U) && (id2.addr().addr[3] == 1U) && (id2.port() != 0U));
+
+    // multi page message from client 1 to the server, the connect order may differ from the open order
+    {
+      decom::msg tx = pattern(2000U, 1U);
+      TEST_CHECK(tx.segment_count() > 1U);
+      TEST_CHECK(client1.s.send(tx));
+      TEST_CHECK(wait_for([&]() { return server.s.rx_size(id1) + server.s.rx_size(id2) == 2000U; }));
+      if (server.s.rx_size(id2)) {
+        std::swap(id1, id2);
+      }
+      TEST_CHECK(wait_for([&]() { return client1.s.has(decom::layer::tx_done, decom::eid_any); }));
+      std::lock_guard<std::mutex> lock(server.s.mutex);
+      TEST_CHECK(server.s.rx[id1] == pattern(2000U, 1U));
+    }
+
+    // multi page message from the server to client 1, client 2 gets nothing
+    {
+      decom::msg tx = pattern(3000U, 2U);
+      TEST_CHECK(server.s.send(tx, id1));
+      TEST_CHECK(wait_for([&]() { return client1.s.rx_size(decom::eid_any) == 3000U; }));
+      TEST_CHECK(wait_for([&]() { return server.s.has(decom::layer::tx_done, id1); }));
+      std::lock_guard<std::mutex> lock(client1.s.mutex);
+      TEST_CHECK(client1.s.rx[decom::eid_any] == pattern(3000U, 2U));
+    }
+    TEST_CHECK(client2.s.rx_size(decom::eid_any) == 0U);
+
+    // client 2 is received on its own eid
+    {
+      decom::msg tx = pattern(100U, 3U);
+      TEST_CHECK(client2.s.send(tx));
+      TEST_CHECK(wait_for([&]() { return server.s.rx_size(id2) == 100U; }));
+      TEST_CHECK(server.s.rx_size(id1) == 2000U);
+    }
+
+    // sending to an unknown eid fails
+    {
+      decom::msg tx = pattern(10U, 4U);
+      decom::eid unknown = id1;
+      unknown.port() = 0U;
+      TEST_CHECK(!server.s.send(tx, unknown));
+    }
+
+    // disconnected indications, the closing side and the peer
+    client2.s.close();
+    TEST_CHECK(client2.s.has(decom::layer::disconnected, decom::eid_any));
+    TEST_CHECK(wait_for([&]() { return server.s.has(decom::layer::disconnected, id2); }));
+    TEST_CHECK(!server.s.has(decom::layer::disconnected, id1));
+    server.s.close();
+    TEST_CHECK(server.s.has(decom::layer::disconnected, id1));
+    TEST_CHECK(wait_for([&]() { return client1.s.has(decom::layer::disconnected, decom::eid_any); }));
+
+    TEST_END;
+  }
+};
+
+} // namespace test
+} // namespace decom
+
+#endif // _DECOM_TEST_COM_TCP_H_
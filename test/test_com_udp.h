@@ -0,0 +1,221 @@
+#ifndef _DECOM_TEST_COM_UDP_H_
+#define _DECOM_TEST_COM_UDP_H_
+
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <thread>
+#include <chrono>
+
+#include "../src/impl/linux/com/com_udp.h"
+#include "test.h"
+
+
+namespace decom {
+namespace test {
+
+
+class com_udp : public test
+{
+  // TEST CASES
+public:
+  com_udp(std::ostream& result_file, format_type format)
+    : test("com_udp", result_file, format)
+  {
+    loopback();
+  }
+
+
+protected:
+
+  typedef decom::layer::status_type status_type;
+
+  // keeps the received datagrams in order and the indications
+  class sink : public decom::layer
+  {
+  public:
+    sink(decom::layer* lower)
+      : layer(lower, "udp_sink")
+    { }
+
+    virtual void receive(decom::msg& data, decom::eid const& id, bool)
+    {
+      // the datagram is copied to release the receive pages
+      std::vector<decom::msg::segment_type> seg(data.segment_count());
+      (void)data.get_segments(&seg[0], seg.size());
+      decom::msg copy;
+      for (std::size_t i = 0U; i < seg.size(); ++i) {
+        (void)copy.append(seg[i].data, seg[i].size);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      rx.push_back(std::make_pair(id, copy));
+    }
+
+    virtual void indication(status_type code, decom::eid const& id)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ind.push_back(std::make_pair(code, id));
+    }
+
+    // number of indications of the given code
+    std::size_t count(status_type code)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::size_t n = 0U;
+      for (std::size_t i = 0U; i < ind.size(); ++i) {
+        n += ind[i].first == code ? 1U : 0U;
+      }
+      return n;
+    }
+
+    // number of received datagrams
+    std::size_t rx_count()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return rx.size();
+    }
+
+    std::mutex mutex;
+    std::vector<std::pair<decom::eid, decom::msg> > rx;
+    std::vector<std::pair<status_type, decom::eid> > ind;
+  };
+
+
+  // communicator with its sink, closed before the sink is unbound
+  struct endpoint
+  {
+    decom::com::udp com;
+    sink            s;
+    endpoint(bool server)
+      : com(server)
+      , s(&com)
+    { }
+    ~endpoint()
+    { com.close(); }
+  };
+
+
+  static decom::msg pattern(std::size_t size, std::uint8_t seed)
+  {
+    decom::msg m;
+    for (std::size_t i = 0U; i < size; ++i) {
+      m.push_back(static_cast<std::uint8_t>(i * 7U + seed));
+    }
+    return m;
+  }
+
+
+  // poll the predicate for 2s at most
+  template<typename Predicate>
+  static bool wait_for(Predicate pred)
+  {
+    for (int i = 0; i < 200; ++i) {
+      if (pred()) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  }
+
+
+  void loopback()
+  {
+    TEST_BEGIN("loopback");
+    DECOM_LOG_NOTICE2("loopback", "udp test");
+
+    endpoint server(true);
+    endpoint client(false);
+    client.com.set_source_address("127.0.0.1:50313");
+    TEST_CHECK(server.s.open("127.0.0.1:50312"));
+    TEST_CHECK(client.s.open("127.0.0.1:50312"));
+    TEST_CHECK(server.s.count(decom::layer::connected) == 1U);
+    TEST_CHECK(client.s.count(decom::layer::connected) == 1U);
+
+    // a multi page datagram, received with the source address and port as eid
+    {
+      decom::msg tx = pattern(1500U, 1U);
+      TEST_CHECK(tx.segment_count() > 1U);
+      TEST_CHECK(client.s.send(tx));
+      // tx_done is given by send() after the datagram is in the socket
+      TEST_CHECK(client.s.count(decom::layer::tx_done) == 1U);
+      TEST_CHECK(wait_for([&]() { return server.s.rx_count() == 1U; }));
+      std::lock_guard<std::mutex> lock(server.s.mutex);
+      const decom::eid& id = server.s.rx[0].first;
+      TEST_CHECK((id.addr().addr[0] == 127U) && (id.addr().addr[1] == 0U) && (id.addr().addr[2] == 0U) && (id.addr().addr[3] == 1U));
+      TEST_CHECK(id.port() == 50313U);
+      TEST_CHECK(server.s.rx[0].second == pattern(1500U, 1U));
+    }
+
+    // the reply to the source eid is received by the client
+    decom::eid peer;
+    {
+      std::lock_guard<std::mutex> lock(server.s.mutex);
+      peer = server.s.rx[0].first;
+    }
+    {
+      decom::msg tx = pattern(100U, 2U);
+      TEST_CHECK(server.s.send(tx, peer));
+      TEST_CHECK(server.s.count(decom::layer::tx_done) == 1U);
+      TEST_CHECK(wait_for([&]() { return client.s.rx_count() == 1U; }));
+      std::lock_guard<std::mutex> lock(client.s.mutex);
+      TEST_CHECK(client.s.rx[0].first == decom::eid_any);
+      TEST_CHECK(client.s.rx[0].second == pattern(100U, 2U));
+    }
+
+    // the server needs a destination eid
+    {
+      decom::msg tx = pattern(10U, 3U);
+      TEST_CHECK(!server.s.send(tx));
+    }
+
+    // a batch of datagrams, queued with 'more' and sent with one sendmmsg() by the last datagram without 'more'
+    // the datagrams are queued, so tx_done is indicated by the sending send() call
+    {
+      const std::size_t batch = 16U;
+      for (std::size_t i = 0U; i < batch - 1U; ++i) {
+        decom::msg tx = pattern(200U + i, static_cast<std::uint8_t>(i));
+        TEST_CHECK(client.s.send(tx, decom::eid_any, true));
+      }
+      decom::msg tx = pattern(200U + batch - 1U, static_cast<std::uint8_t>(batch - 1U));
+      TEST_CHECK(client.s.send(tx, decom::eid_any, false));
+      TEST_CHECK(client.s.count(decom::layer::tx_done) == 1U + batch);
+
+      // all datagrams are received in order, the receiver reads them in batches with recvmmsg()
+      TEST_CHECK(wait_for([&]() { return server.s.rx_count() == 1U + batch; }));
+      std::lock_guard<std::mutex> lock(server.s.mutex);
+      for (std::size_t i = 0U; i < batch; ++i) {
+        TEST_CHECK(server.s.rx[1U + i].first == peer);
+        TEST_CHECK(server.s.rx[1U + i].second == pattern(200U + i, static_cast<std::uint8_t>(i)));
+      }
+    }
+
+    // a queued datagram is sent by the flush timer if no datagram without 'more' follows
+    {
+      decom::msg tx = pattern(50U, 4U);
+      TEST_CHECK(client.s.send(tx, decom::eid_any, true));
+      TEST_CHECK(wait_for([&]() { return client.s.count(decom::layer::tx_done) == 18U; }));
+      TEST_CHECK(wait_for([&]() { return server.s.rx_count() == 18U; }));
+      std::lock_guard<std::mutex> lock(server.s.mutex);
+      TEST_CHECK(server.s.rx[17].second == pattern(50U, 4U));
+    }
+
+    // a datagram exceeding the mtu is refused
+    {
+      decom::msg tx = pattern(3000U, 5U);
+      TEST_CHECK(!client.s.send(tx));
+    }
+
+    client.s.close();
+    TEST_CHECK(client.s.count(decom::layer::disconnected) == 1U);
+    server.s.close();
+    TEST_CHECK(server.s.count(decom::layer::disconnected) == 1U);
+
+    TEST_END;
+  }
+};
+
+} // namespace test
+} // namespace decom
+
+#endif // _DECOM_TEST_COM_UDP_H_
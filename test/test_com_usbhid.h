@@ -0,0 +1,390 @@
+#ifndef _DECOM_TEST_COM_USBHID_H_
+#define _DECOM_TEST_COM_USBHID_H_
+
+#include <linux/uhid.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#include "../src/impl/linux/com/com_usbhid.h"
+#include "test.h"
+
+
+namespace decom {
+namespace test {
+
+
+class com_usbhid : public test
+{
+  // TEST CASES
+public:
+  com_usbhid(std::ostream& result_file, format_type format)
+    : test("com_usbhid", result_file, format)
+  {
+    uhid();
+  }
+
+
+protected:
+
+  typedef decom::layer::status_type status_type;
+
+  // virtual HID device of the uhid driver, serves the output and feature reports of the hidraw node
+  class uhid_device
+  {
+  public:
+    uhid_device()
+      : fd_(::open("/dev/uhid", O_RDWR | O_CLOEXEC))
+      , running_(false)
+    { }
+
+    ~uhid_device()
+    {
+      if (running_) {
+        struct uhid_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.type = UHID_DESTROY;
+        (void)write_event(ev);
+        running_ = false;
+        thread_.join();
+      }
+      if (fd_ >= 0) {
+        (void)::close(fd_);
+      }
+    }
+
+    // create the device with the given report descriptor
+    bool create(std::uint16_t vendor_id, std::uint16_t product_id, const char* serial_number, const std::uint8_t* desc, std::size_t desc_size)
+    {
+      if ((fd_ < 0) || (desc_size > HID_MAX_DESCRIPTOR_SIZE)) {
+        return false;
+      }
+      struct uhid_event ev;
+      std::memset(&ev, 0, sizeof(ev));
+      ev.type = UHID_CREATE2;
+      std::strcpy(reinterpret_cast<char*>(ev.u.create2.name), "decom test device");
+      std::strcpy(reinterpret_cast<char*>(ev.u.create2.uniq), serial_number);
+      std::memcpy(ev.u.create2.rd_data, desc, desc_size);
+      ev.u.create2.rd_size = static_cast<std::uint16_t>(desc_size);
+      ev.u.create2.bus     = BUS_USB;
+      ev.u.create2.vendor  = vendor_id;
+      ev.u.create2.product = product_id;
+      if (!write_event(ev)) {
+        return false;
+      }
+      running_ = true;
+      std::thread t(&uhid_device::event_thread, this);
+      thread_.swap(t);
+      return true;
+    }
+
+    // send an input report, numbered reports start with the report ID
+    bool input(const std::vector<std::uint8_t>& report)
+    {
+      struct uhid_event ev;
+      std::memset(&ev, 0, sizeof(ev));
+      ev.type = UHID_INPUT2;
+      ev.u.input2.size = static_cast<std::uint16_t>(report.size());
+      std::memcpy(ev.u.input2.data, &report[0], report.size());
+      return write_event(ev);
+    }
+
+    // number of received output reports
+    std::size_t output_count()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return output.size();
+    }
+
+    std::mutex mutex;
+    std::vector<std::vector<std::uint8_t> > output;                  // received output reports
+    std::map<std::uint8_t, std::vector<std::uint8_t> > feature;      // feature reports by report ID
+
+  private:
+    bool write_event(const struct uhid_event& ev)
+    {
+      return ::write(fd_, &ev, sizeof(ev)) == static_cast<ssize_t>(sizeof(ev));
+    }
+
+    static void event_thread(uhid_device* d)
+    {
+      while (d->running_) {
+        struct pollfd pfd = { d->fd_, POLLIN, 0 };
+        if (::poll(&pfd, 1U, 100) <= 0) {
+          continue;
+        }
+        struct uhid_event ev;
+        if (::read(d->fd_, &ev, sizeof(ev)) <= 0) {
+          continue;
+        }
+        struct uhid_event reply;
+        std::memset(&reply, 0, sizeof(reply));
+        switch (ev.type) {
+          case UHID_OUTPUT : {
+            std::lock_guard<std::mutex> lock(d->mutex);
+            d->output.push_back(std::vector<std::uint8_t>(ev.u.output.data, ev.u.output.data + ev.u.output.size));
+            break;
+          }
+          case UHID_SET_REPORT : {
+            // the report data starts with the report ID
+            {
+              std::lock_guard<std::mutex> lock(d->mutex);
+              d->feature[ev.u.set_report.rnum].assign(ev.u.set_report.data, ev.u.set_report.data + ev.u.set_report.size);
+            }
+            reply.type = UHID_SET_REPORT_REPLY;
+            reply.u.set_report_reply.id  = ev.u.set_report.id;
+            reply.u.set_report_reply.err = 0U;
+            (void)d->write_event(reply);
+            break;
+          }
+          case UHID_GET_REPORT : {
+            reply.type = UHID_GET_REPORT_REPLY;
+            reply.u.get_report_reply.id = ev.u.get_report.id;
+            std::lock_guard<std::mutex> lock(d->mutex);
+            std::map<std::uint8_t, std::vector<std::uint8_t> >::const_iterator it = d->feature.find(ev.u.get_report.rnum);
+            if ((ev.u.get_report.rtype == UHID_FEATURE_REPORT) && (it != d->feature.end())) {
+              reply.u.get_report_reply.size = static_cast<std::uint16_t>(it->second.size());
+              std::memcpy(reply.u.get_report_reply.data, &it->second[0], it->second.size());
+            }
+            else {
+              reply.u.get_report_reply.err = EIO;
+            }
+            (void)d->write_event(reply);
+            break;
+          }
+          default:
+            // start, stop, open and close
+            break;
+        }
+      }
+    }
+
+    int               fd_;
+    std::atomic<bool> running_;
+    std::thread       thread_;
+  };
+
+
+  // keeps the received reports in order and the indications
+  class sink : public decom::layer
+  {
+  public:
+    sink(decom::layer* lower)
+      : layer(lower, "usbhid_sink")
+    { }
+
+    virtual void receive(decom::msg& data, decom::eid const& id, bool)
+    {
+      std::vector<decom::msg::segment_type> seg(data.segment_count());
+      (void)data.get_segments(&seg[0], seg.size());
+      decom::msg copy;
+      for (std::size_t i = 0U; i < seg.size(); ++i) {
+        (void)copy.append(seg[i].data, seg[i].size);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      rx.push_back(std::make_pair(id, copy));
+    }
+
+    virtual void indication(status_type code, decom::eid const& id)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ind.push_back(std::make_pair(code, id));
+    }
+
+    // number of indications of the given code
+    std::size_t count(status_type code)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::size_t n = 0U;
+      for (std::size_t i = 0U; i < ind.size(); ++i) {
+        n += ind[i].first == code ? 1U : 0U;
+      }
+      return n;
+    }
+
+    // number of received reports
+    std::size_t rx_count()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return rx.size();
+    }
+
+    std::mutex mutex;
+    std::vector<std::pair<decom::eid, decom::msg> > rx;
+    std::vector<std::pair<status_type, decom::eid> > ind;
+  };
+
+
+  // communicator with its sink, closed before the sink is unbound
+  struct endpoint
+  {
+    decom::com::usbhid com;
+    sink               s;
+    endpoint()
+      : s(&com)
+    { }
+    ~endpoint()
+    { com.close(); }
+  };
+
+
+  static std::vector<std::uint8_t> pattern(std::size_t size, std::uint8_t seed)
+  {
+    std::vector<std::uint8_t> v(size);
+    for (std::size_t i = 0U; i < size; ++i) {
+      v[i] = static_cast<std::uint8_t>(i * 7U + seed);
+    }
+    return v;
+  }
+
+
+  static decom::msg to_msg(const std::vector<std::uint8_t>& v)
+  {
+    decom::msg m;
+    (void)m.append(&v[0], v.size());
+    return m;
+  }
+
+
+  // poll the predicate for 2s at most
+  template<typename Predicate>
+  static bool wait_for(Predicate pred)
+  {
+    for (int i = 0; i < 200; ++i) {
+      if (pred()) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  }
+
+
+  void uhid()
+  {
+    TEST_BEGIN("uhid");
+    DECOM_LOG_NOTICE2("uhid", "usbhid test");
+
+    // vendor defined device with numbered reports:
+    // report 1: 8 bytes input/output, report 2: 16 bytes input/output, report 3: 4 bytes feature
+    static const std::uint8_t desc[] = {
+      0x06U, 0x00U, 0xFFU,    // usage page (vendor defined 0xFF00)
+      0x09U, 0x01U,           // usage (1)
+      0xA1U, 0x01U,           // collection (application)
+      0x15U, 0x00U,           //   logical minimum (0)
+      0x26U, 0xFFU, 0x00U,    //   logical maximum (255)
+      0x75U, 0x08U,           //   report size (8)
+      0x85U, 0x01U,           //   report ID (1)
+      0x95U, 0x08U,           //   report count (8)
+      0x09U, 0x02U,           //   usage (2)
+      0x81U, 0x02U,           //   input (data, var, abs)
+      0x09U, 0x03U,           //   usage (3)
+      0x91U, 0x02U,           //   output (data, var, abs)
+      0x85U, 0x02U,           //   report ID (2)
+      0x95U, 0x10U,           //   report count (16)
+      0x09U, 0x04U,           //   usage (4)
+      0x81U, 0x02U,           //   input (data, var, abs)
+      0x09U, 0x05U,           //   usage (5)
+      0x91U, 0x02U,           //   output (data, var, abs)
+      0x85U, 0x03U,           //   report ID (3)
+      0x95U, 0x04U,           //   report count (4)
+      0x09U, 0x06U,           //   usage (6)
+      0xB1U, 0x02U,           //   feature (data, var, abs)
+      0xC0U                   // end collection
+    };
+    const std::uint16_t vid = 0x1209U, pid = 0xDEC0U;
+
+    // the uhid driver is needed to create the virtual device
+    uhid_device dev;
+    if (!dev.create(vid, pid, "decom-0815", desc, sizeof(desc))) {
+      TEST_SKIP;
+      return;
+    }
+
+    endpoint ep;
+
+    // the hidraw node of the device is created asynchronously
+    std::vector<decom::com::usbhid::hid_device_info_type> info;
+    TEST_CHECK(wait_for([&]() { info = ep.com.enumerate(vid, pid); return !info.empty() && !::access(info[0].path.c_str(), R_OK | W_OK); }));
+    TEST_CHECK(info[0].serial_number == "decom-0815");
+    TEST_CHECK(info[0].report_ids);
+    TEST_CHECK((info[0].usage_page == 0xFF00U) && (info[0].usage == 0x01U));
+    TEST_CHECK(info[0].input_report_length == 17U);
+    TEST_CHECK(info[0].output_report_length == 17U);
+
+    // open by VID:PID:serial
+    TEST_CHECK(!ep.s.open("1209:dec0:unknown"));
+    TEST_CHECK(ep.s.open("1209:dec0:decom-0815"));
+    TEST_CHECK(ep.s.count(decom::layer::connected) == 1U);
+
+    // input reports are received with the report ID as eid
+    {
+      std::vector<std::uint8_t> report1 = pattern(8U, 1U);
+      report1.insert(report1.begin(), 0x01U);
+      std::vector<std::uint8_t> report2 = pattern(16U, 2U);
+      report2.insert(report2.begin(), 0x02U);
+      TEST_CHECK(dev.input(report1));
+      TEST_CHECK(dev.input(report2));
+      TEST_CHECK(wait_for([&]() { return ep.s.rx_count() == 2U; }));
+      std::lock_guard<std::mutex> lock(ep.s.mutex);
+      TEST_CHECK(ep.s.rx[0].first == decom::eid(1U));
+      TEST_CHECK(ep.s.rx[0].second == to_msg(pattern(8U, 1U)));
+      TEST_CHECK(ep.s.rx[1].first == decom::eid(2U));
+      TEST_CHECK(ep.s.rx[1].second == to_msg(pattern(16U, 2U)));
+    }
+
+    // output reports are sent with the eid as report ID, padded to the output report length
+    {
+      decom::msg tx = to_msg(pattern(16U, 3U));
+      TEST_CHECK(ep.s.send(tx, decom::eid(2U)));
+      TEST_CHECK(wait_for([&]() { return ep.s.count(decom::layer::tx_done) == 1U; }));
+      TEST_CHECK(wait_for([&]() { return dev.output_count() == 1U; }));
+      tx = to_msg(pattern(8U, 4U));
+      TEST_CHECK(ep.s.send(tx, decom::eid(1U)));
+      TEST_CHECK(wait_for([&]() { return ep.s.count(decom::layer::tx_done) == 2U; }));
+      TEST_CHECK(wait_for([&]() { return dev.output_count() == 2U; }));
+
+      std::lock_guard<std::mutex> lock(dev.mutex);
+      std::vector<std::uint8_t> report2 = pattern(16U, 3U);
+      report2.insert(report2.begin(), 0x02U);
+      TEST_CHECK(dev.output[0] == report2);
+      std::vector<std::uint8_t> report1 = pattern(8U, 4U);
+      report1.insert(report1.begin(), 0x01U);
+      report1.resize(17U, 0U);
+      TEST_CHECK(dev.output[1] == report1);
+    }
+
+    // feature reports
+    {
+      TEST_CHECK(ep.com.send_feature_report(0x03U, to_msg(pattern(4U, 5U))));
+      {
+        std::lock_guard<std::mutex> lock(dev.mutex);
+        std::vector<std::uint8_t> report3 = pattern(4U, 5U);
+        report3.insert(report3.begin(), 0x03U);
+        TEST_CHECK(dev.feature[0x03U] == report3);
+      }
+      decom::msg feature;
+      TEST_CHECK(ep.com.get_feature_report(0x03U, feature));
+      TEST_CHECK(feature == to_msg(pattern(4U, 5U)));
+    }
+
+    ep.s.close();
+    TEST_CHECK(ep.s.count(decom::layer::disconnected) == 1U);
+
+    TEST_END;
+  }
+};
+
+} // namespace test
+} // namespace decom
+
+#endif // _DECOM_TEST_COM_USBHID_H_
@@ -0,0 +1,336 @@
+#ifndef _DECOM_TEST_DEV_GENERIC_H_
+#define _DECOM_TEST_DEV_GENERIC_H_
+
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "../src/com/com_generic.h"
+#include "../src/dev/dev_generic.h"
+#include "test.h"
+
+
+namespace decom {
+namespace test {
+
+class dev_generic : public test
+{
+  // TEST CASES
+public:
+  dev_generic(std::ostream& result_file, format_type format)
+    : test("dev_generic", result_file, format)
+  {
+    single();
+    window();
+    flush();
+    rejected();
+    blocking();
+    disconnect();
+    batch();
+  }
+
+
+protected:
+
+  // communicator which indicates the transmissions on demand, like a high latency link
+  class deferred : public decom::com::communicator
+  {
+  public:
+    deferred()
+      : communicator("com_deferred")
+      , sent(0U)
+      , reject(false)
+      , interleave(nullptr)
+    { }
+
+    virtual bool open(const char*, eid const& id = eid_any) override
+    {
+      communicator::indication(connected, id);
+      return true;
+    }
+
+    virtual void close(eid const& = eid_any) override
+    { }
+
+    virtual bool send(decom::msg& data, eid const& id = eid_any, bool more = false) override
+    {
+      if (reject) {
+        if (interleave) {
+          // another writer sends its msg while the rejected one is in the lower layer
+          decom::dev::generic* dev = interleave;
+          interleave = nullptr;
+          reject = false;
+          (void)dev->write_async(data, nullptr, nullptr, id, more);
+          reject = true;
+        }
+        return false;
+      }
+      ++sent;
+      return true;
+    }
+
+    void complete(status_type code = tx_done)
+    {
+      communicator::indication(code);
+    }
+
+    void connect(bool on)
+    {
+      communicator::indication(on ? connected : disconnected);
+    }
+
+    std::size_t sent;
+    bool reject;
+    decom::dev::generic* interleave;
+  };
+
+
+  typedef decom::layer::status_type status_type;
+
+  struct completion
+  {
+    std::vector<std::uint64_t> token;
+    std::vector<status_type>   status;
+  };
+
+  static void on_complete(void* arg, std::uint64_t token, status_type status)
+  {
+    completion* c = static_cast<completion*>(arg);
+    c->token.push_back(token);
+    c->status.push_back(status);
+  }
+
+
+  void single()
+  {
+    TEST_BEGIN("single");
+
+    deferred com;
+    decom::dev::generic dev(&com);
+    dev.open();
+    decom::msg m;
+    m.push_back(1U);
+
+    // default window is one message
+    TEST_CHECK(dev.write(m, eid_any, false, false));
+    TEST_CHECK(!dev.write(m, eid_any, false, false));
+    TEST_CHECK(dev.tx_pending() == 1U);
+    com.complete();
+    TEST_CHECK(dev.tx_pending() == 0U);
+    TEST_CHECK(dev.write(m, eid_any, false, false));
+    TEST_CHECK(com.sent == 2U);
+    TEST_END;
+  }
+
+
+  void window()
+  {
+    TEST_BEGIN("window");
+
+    deferred com;
+    decom::dev::generic dev(&com);
+    dev.open();
+    dev.set_tx_window(4U);
+    completion c;
+    decom::msg m;
+    m.push_back(1U);
+
+    for (std::uint64_t i = 1U; i <= 4U; ++i) {
+      TEST_CHECK(dev.write_async(m, &on_complete, &c) == i);
+    }
+    TEST_CHECK(dev.write_async(m, &on_complete, &c) == 0U);   // window full
+    TEST_CHECK(dev.tx_pending() == 4U);
+
+    // indications are assigned in send order
+    com.complete();
+    com.complete(decom::layer::tx_error);
+    TEST_CHECK(c.token.size() == 2U);
+    TEST_CHECK(c.token[0] == 1U && c.status[0] == decom::layer::tx_done);
+    TEST_CHECK(c.token[1] == 2U && c.status[1] == decom::layer::tx_error);
+    TEST_CHECK(dev.write_async(m, &on_complete, &c) == 5U);
+    com.complete();
+    com.complete();
+    com.complete();
+    com.complete();   // unexpected, ignored
+    TEST_CHECK(c.token.size() == 5U);
+    TEST_CHECK(c.token[4] == 5U);
+    TEST_CHECK(dev.tx_pending() == 0U);
+    TEST_END;
+  }
+
+
+  void flush()
+  {
+    TEST_BEGIN("flush");
+
+    deferred com;
+    decom::dev::generic dev(&com);
+    dev.open();
+    dev.set_tx_window(8U);
+    decom::msg m;
+    m.push_back(1U);
+
+    TEST_CHECK(dev.flush());  // nothing outstanding
+    TEST_CHECK(dev.write_async(m) == 1U);
+    TEST_CHECK(dev.write_async(m) == 2U);
+    TEST_CHECK(!dev.flush(std::chrono::milliseconds(10)));   // timeout
+    com.complete(decom::layer::tx_timeout);
+    com.complete();
+    TEST_CHECK(!dev.flush());   // error is reported once
+    TEST_CHECK(dev.flush());
+    TEST_END;
+  }
+
+
+  void rejected()
+  {
+    TEST_BEGIN("rejected");
+
+    deferred com;
+    decom::dev::generic dev(&com);
+    dev.open();
+    decom::msg m;
+    m.push_back(1U);
+
+    com.reject = true;
+    TEST_CHECK(dev.write_async(m) == 0U);
+    TEST_CHECK(!dev.write(m));
+    TEST_CHECK(dev.tx_pending() == 0U);
+    com.reject = false;
+    TEST_CHECK(dev.write_async(m) == 1U);   // token is reused
+
+    // token 2 is rejected after token 3 was sent by another writer
+    dev.set_tx_window(4U);
+    com.reject = true;
+    com.interleave = &dev;
+    TEST_CHECK(dev.write_async(m) == 0U);
+    com.reject = false;
+    TEST_CHECK(com.sent == 2U);
+    com.complete();   // token 1, token 2 is skipped
+    TEST_CHECK(dev.tx_pending() == 1U);
+    com.complete();   // token 3
+    TEST_CHECK(dev.tx_pending() == 0U);
+    TEST_CHECK(dev.flush());
+    TEST_CHECK(dev.write_async(m) == 4U);
+    TEST_END;
+  }
+
+
+  void blocking()
+  {
+    TEST_BEGIN("blocking");
+
+    // com::generic indicates within send()
+    decom::com::generic com;
+    decom::dev::generic dev(&com);
+    dev.open();
+    dev.set_tx_window(2U);
+    decom::msg m;
+    m.push_back(1U);
+    for (int i = 0; i < 10; ++i) {
+      TEST_CHECK(dev.write(m));
+    }
+    TEST_CHECK(dev.tx_pending() == 0U);
+    TEST_END;
+  }
+
+
+  void disconnect()
+  {
+    TEST_BEGIN("disconnect");
+
+    deferred com;
+    decom::dev::generic dev(&com);
+    dev.open();
+    dev.set_tx_window(4U);
+    completion c;
+    decom::msg m;
+    m.push_back(1U);
+
+    // disconnect completes the outstanding messages with tx_error
+    for (std::uint64_t i = 1U; i <= 3U; ++i) {
+      TEST_CHECK(dev.write_async(m, &on_complete, &c) == i);
+    }
+    com.connect(false);
+    TEST_CHECK(c.token.size() == 3U);
+    for (std::size_t i = 0U; i < 3U; ++i) {
+      TEST_CHECK(c.token[i] == i + 1U && c.status[i] == decom::layer::tx_error);
+    }
+    TEST_CHECK(dev.tx_pending() == 0U);
+    TEST_CHECK(!dev.flush());
+    TEST_CHECK(dev.write_async(m) == 0U);   // not connected
+    com.complete();                         // late indication, ignored
+    TEST_CHECK(c.token.size() == 3U);
+
+    // close releases a waiting flush()
+    com.connect(true);
+    TEST_CHECK(dev.write_async(m, &on_complete, &c) == 4U);
+    bool result = true;
+    std::thread th([&]() { result = dev.flush(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    dev.close();
+    th.join();
+    TEST_CHECK(!result);
+    TEST_CHECK(c.token.size() == 4U);
+    TEST_CHECK(c.token[3] == 4U && c.status[3] == decom::layer::tx_error);
+    TEST_CHECK(dev.tx_pending() == 0U);
+    TEST_END;
+  }
+
+
+  static void on_receive(void* arg, decom::msg& data, decom::eid const&)
+  {
+    static_cast<std::vector<std::uint8_t>*>(arg)->push_back(data[0]);
+  }
+
+
+  // a callback which reads the device must not deadlock
+  static void on_receive_read(void* arg, decom::msg&, decom::eid const&)
+  {
+    std::vector<std::uint8_t> rx;
+    decom::eid id;
+    (void)static_cast<decom::dev::generic*>(arg)->read(rx, id, std::chrono::milliseconds(0));
+  }
+
+
+  void batch()
+  {
+    TEST_BEGIN("batch");
+
+    deferred com;
+    decom::dev::generic dev(&com);
+    std::vector<std::uint8_t> seen;
+    dev.set_receive_callback(&seen, &on_receive);
+    dev.open();
+
+    decom::msg m[3];
+    for (std::uint8_t i = 0U; i < 3U; ++i) {
+      m[i].push_back(i);
+    }
+    dev.receive_batch(m, 3U);
+    TEST_CHECK(seen.size() == 3U && seen[0] == 0U && seen[2] == 2U);
+
+    // the receive buffer holds the last msg
+    std::vector<std::uint8_t> rx;
+    decom::eid id;
+    TEST_CHECK(dev.read(rx, id, std::chrono::milliseconds(0)));
+    TEST_CHECK(rx.size() == 1U && rx[0] == 2U);
+
+    dev.set_receive_callback(&dev, &on_receive_read);
+    dev.receive_batch(m, 3U);
+    TEST_CHECK(dev.read(rx, id, std::chrono::milliseconds(0)));
+    TEST_CHECK(rx.size() == 1U && rx[0] == 2U);
+
+    // without callback
+    dev.set_receive_callback(nullptr, nullptr);
+    dev.receive_batch(m, 3U);
+    TEST_CHECK(dev.read(rx, id, std::chrono::milliseconds(0)));
+    TEST_CHECK(rx.size() == 1U && rx[0] == 2U);
+    TEST_END;
+  }
+};
+
+} // namespace test
+} // namespace decom
+
+#endif // _DECOM_TEST_DEV_GENERIC_H_
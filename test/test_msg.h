@@ -1,6 +1,12 @@
 #ifndef _DECOM_TEST_MSG_H_
 #define _DECOM_TEST_MSG_H_
 
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+
 #include "../src/msg.h"
 #include "test.h"
 
@@ -22,10 +28,17 @@ public:
     insert();
     erase();
     resize();
+    pop();
     copy();
+    copy_shared();
     access();
     iterators();
     get();
+    segments();
+    bulk();
+    magazine();
+    page_classes();
+    back_pressure();
     dummy();
   }
 
@@ -156,6 +169,23 @@ protected:
     TEST_CHECK(m[2] == 10);
     TEST_CHECK(m[3] == 10);
     TEST_CHECK(m[4] == 10);
+
+    // insert at the end, the new element is on a new page
+    m.clear();
+    for (int i = 0; i < 300; ++i) {
+      m.insert(m.end(), (decom::msg::value_type)i);
+    }
+    decom::msg r;
+    r.push_back(0xFFU);
+    for (int i = 0; i < 300; i += 7) {
+      r.insert(r.end(), m.begin() + i, i + 7 < 300 ? m.begin() + i + 7 : m.end());
+    }
+    r.pop_front();
+    TEST_CHECK(m.size() == 300U);
+    TEST_CHECK(r == m);
+    for (int i = 0; i < 300; ++i) {
+      TEST_CHECK(m[i] == (decom::msg::value_type)i);
+    }
     TEST_END;
   }
 
@@ -214,6 +244,68 @@ protected:
     TEST_CHECK(m[1] == 4);
     TEST_CHECK(m[2] == 9);
 
+    // grow without init leaves the page content, e.g. to receive data in place
+    TEST_CHECK(m.resize(DECOM_MSG_POOL_PAGE_SIZE * 2U, false));
+    TEST_CHECK(m.size() == DECOM_MSG_POOL_PAGE_SIZE * 2U);
+    TEST_CHECK(m[3] == 16);
+    m.resize(3);
+    TEST_CHECK(m.resize(4));
+    TEST_CHECK(m[3] == 0);
+
+    TEST_END;
+  }
+
+
+  void pop()
+  {
+    TEST_BEGIN("pop_back/pop_front");
+    DECOM_LOG_NOTICE2("pop", "msg test");
+
+    decom::msg_pool& pool = decom::msg::get_msg_pool();
+    const decom::msg::size_type used = pool.used_pages();
+
+    decom::msg m;
+    for (std::uint16_t i = 0U; i < DECOM_MSG_POOL_PAGE_SIZE * 3U; i++) {
+      TEST_CHECK(m.push_back(static_cast<std::uint8_t>(i)));
+      TEST_CHECK(m.back() == static_cast<std::uint8_t>(i));
+    }
+    TEST_CHECK(m.size() == DECOM_MSG_POOL_PAGE_SIZE * 3U);
+    const decom::msg::size_type pages = pool.used_pages() - used;
+
+    // remove the back across page borders, emptied pages are released
+    for (std::uint16_t i = DECOM_MSG_POOL_PAGE_SIZE * 3U; i > DECOM_MSG_POOL_PAGE_SIZE; i--) {
+      TEST_CHECK(m.back() == static_cast<std::uint8_t>(i - 1U));
+      m.pop_back();
+      TEST_CHECK(m.size() == i - 1U);
+    }
+    TEST_CHECK(pool.used_pages() < used + pages);
+    TEST_CHECK(m.push_back(0xAAU));
+    TEST_CHECK(m.back() == 0xAAU);
+    TEST_CHECK(m.size() == DECOM_MSG_POOL_PAGE_SIZE + 1U);
+
+    // remove the front across page borders
+    for (std::uint16_t i = 0U; i < DECOM_MSG_POOL_PAGE_SIZE; i++) {
+      TEST_CHECK(m.front() == static_cast<std::uint8_t>(i));
+      m.pop_front();
+    }
+    TEST_CHECK(m.size() == 1U);
+    TEST_CHECK(m.front() == 0xAAU);
+    TEST_CHECK(m.back() == 0xAAU);
+    m.pop_front();
+    TEST_CHECK(m.empty());
+    m.pop_back();   // no effect on an empty msg
+    TEST_CHECK(m.size() == 0U);
+    TEST_CHECK(pool.used_pages() == used + 1U);
+
+    // appended msg is reflected in size and back
+    decom::msg m2;
+    m2.push_back(0x11U);
+    m2.push_back(0x22U);
+    m.push_back(0x10U);
+    m.append(m2);
+    TEST_CHECK(m.size() == 3U);
+    TEST_CHECK(m.back() == 0x22U);
+
     TEST_END;
   }
 
@@ -238,13 +330,22 @@ protected:
     TEST_CHECK(cc->at(2) == 9);
     TEST_CHECK(cc->at(3) == 16);
 
-    // prohibit msg change
-    TEST_CHECK(!m.push_back(1U));
-    TEST_CHECK(!m.push_front(1U));
-    TEST_CHECK(m.size() == 4);
-    TEST_CHECK(!cc->push_back(1U));
-    TEST_CHECK(!cc->push_front(1U));
+    // copy on write, a change of one msg doesn't change the other
+    TEST_CHECK(m.push_back(1U));
+    TEST_CHECK(m.push_front(1U));
+    TEST_CHECK(m.size() == 6);
     TEST_CHECK(cc->size() == 4);
+    TEST_CHECK(cc->at(0) == 1);
+    TEST_CHECK(cc->at(3) == 16);
+    TEST_CHECK(cc->push_back(2U));
+    TEST_CHECK(cc->push_front(2U));
+    TEST_CHECK(cc->size() == 6);
+    TEST_CHECK(cc->at(0) == 2);
+    TEST_CHECK(cc->at(5) == 2);
+    TEST_CHECK(m[1] == 1);
+    TEST_CHECK(m[5] == 1);
+    m.pop_front();
+    m.pop_back();
     TEST_CHECK(m.size() == 4);
 
     cc->clear();
@@ -261,13 +362,19 @@ protected:
     TEST_CHECK(cc2[2] == 9);
     TEST_CHECK(cc2[3] == 16);
 
-    // prohibit msg change
+    // copy on write
     m.push_back(1U);
     m.push_front(1U);
-    TEST_CHECK(m.size() == 4);
-    cc2.push_back(1U);
-    cc2.push_front(1U);
+    TEST_CHECK(m.size() == 6);
     TEST_CHECK(cc2.size() == 4);
+    cc2.pop_front();
+    cc2.pop_back();
+    TEST_CHECK(cc2.size() == 2);
+    TEST_CHECK(cc2[0] == 4);
+    TEST_CHECK(cc2[1] == 9);
+    TEST_CHECK(m.size() == 6);
+    m.pop_front();
+    m.pop_back();
     TEST_CHECK(m.size() == 4);
 
     cc2.clear();
@@ -300,6 +407,128 @@ protected:
     TEST_END;
   }
 
+  void copy_shared()
+  {
+    TEST_BEGIN("copy/shared pages");
+
+    const std::size_t used = decom::msg::get_msg_pool().used_pages();
+
+    // deep copy of a multi page msg
+    decom::msg m;
+    for (std::uint16_t i = 0; i < DECOM_MSG_POOL_PAGE_SIZE * 3; i++) {
+      TEST_CHECK(m.push_back(static_cast<std::uint8_t>(i)));
+    }
+    decom::msg rc(m);
+    TEST_CHECK(rc == m);
+    rc = m;
+    TEST_CHECK(rc == m);
+    rc[0] = 0xAAU;
+    TEST_CHECK(m[0] == 0U);
+
+    // append to a shared msg must not change the other msg
+    decom::msg tail;
+    for (std::uint8_t i = 0U; i < 4U; i++) {
+      tail.push_back(0x55U);
+    }
+    decom::msg cc;
+    cc.ref_copy(m);
+    cc.append(tail);
+    TEST_CHECK(cc.size() == DECOM_MSG_POOL_PAGE_SIZE * 3 + 4U);
+    TEST_CHECK(m.size() == DECOM_MSG_POOL_PAGE_SIZE * 3);
+    TEST_CHECK(cc[DECOM_MSG_POOL_PAGE_SIZE * 3] == 0x55U);
+
+    // header strip and header add on a shared msg copy one page at most
+    decom::msg_pool& pool = decom::msg::get_msg_pool();
+    cc.ref_copy(m);
+    const std::size_t pages = pool.used_pages();
+    cc.pop_front();
+    TEST_CHECK(pool.used_pages() == pages + 1U);
+    TEST_CHECK(cc.size() == m.size() - 1U);
+    TEST_CHECK(cc[0] == 1U);
+    TEST_CHECK(m[0] == 0U);
+    cc.push_front(0xAAU);
+    TEST_CHECK(pool.used_pages() == pages + 1U);
+    TEST_CHECK(cc[0] == 0xAAU);
+    TEST_CHECK(m[0] == 0U);
+
+    // shrink a shared msg
+    cc.ref_copy(m);
+    TEST_CHECK(cc.resize(DECOM_MSG_POOL_PAGE_SIZE / 2U));
+    TEST_CHECK(cc.size() == DECOM_MSG_POOL_PAGE_SIZE / 2U);
+    TEST_CHECK(m.size() == DECOM_MSG_POOL_PAGE_SIZE * 3);
+    TEST_CHECK(cc[DECOM_MSG_POOL_PAGE_SIZE / 2U - 1U] == m[DECOM_MSG_POOL_PAGE_SIZE / 2U - 1U]);
+
+    // insert into a shared msg
+    const std::uint8_t data[2] = { 0x11U, 0x22U };
+    cc.ref_copy(m);
+    TEST_CHECK(cc.insert_range(cc.begin() + 2U, data, 2U));
+    TEST_CHECK(cc.size() == m.size() + 2U);
+    TEST_CHECK(cc[2] == 0x11U);
+    TEST_CHECK(cc[4] == 2U);
+    TEST_CHECK(m[2] == 2U);
+    TEST_CHECK(cc[DECOM_MSG_POOL_PAGE_SIZE * 3 + 1U] == m[DECOM_MSG_POOL_PAGE_SIZE * 3 - 1U]);
+
+    // element access on a shared msg copies the pages up to the accessed one
+    const decom::msg& cm = m;
+    cc.ref_copy(m);
+    {
+      const std::size_t shared_used = pool.used_pages();
+      const decom::msg rr(m, decom::msg::ref_type());   // ref copy without an initial page
+      TEST_CHECK(pool.used_pages() == shared_used);
+      TEST_CHECK(rr == m);
+    }
+    TEST_CHECK(cc.at(DECOM_MSG_POOL_PAGE_SIZE / 2U) == cm[DECOM_MSG_POOL_PAGE_SIZE / 2U]);
+    cc.ref_copy(m);
+    const std::size_t shared = pool.used_pages();
+    cc[1] = 0xAAU;
+    TEST_CHECK(pool.used_pages() == shared + 1U);
+    TEST_CHECK(cc[1] == 0xAAU);
+    TEST_CHECK(cm[1] == 1U);
+    cc.at(DECOM_MSG_POOL_PAGE_SIZE + 1U) = 0xBBU;
+    TEST_CHECK(pool.used_pages() == shared + 2U);
+    TEST_CHECK(cm[DECOM_MSG_POOL_PAGE_SIZE + 1U] == static_cast<std::uint8_t>(DECOM_MSG_POOL_PAGE_SIZE + 1U));
+    cc.back() = 0xCCU;
+    const std::size_t copied = pool.used_pages();
+    TEST_CHECK(copied > shared + 2U);
+    cc[DECOM_MSG_POOL_PAGE_SIZE * 2U] = 0xCCU;   // all pages are exclusive now
+    TEST_CHECK(pool.used_pages() == copied);
+    TEST_CHECK(cm.back() == static_cast<std::uint8_t>(DECOM_MSG_POOL_PAGE_SIZE * 3 - 1U));
+    cc.ref_copy(m);
+    cc.front() = 0xDDU;
+    TEST_CHECK(cm.front() == 0U);
+    TEST_CHECK(cc == cc);
+
+    // writes through iterators, a second iterator finds its page again after the first one copied it
+    cc.ref_copy(m);
+    decom::msg::iterator it2 = cc.begin() + 3U;
+    *(cc.begin() + 2U) = 0xEEU;
+    *it2 = 0xEFU;
+    ++it2;
+    TEST_CHECK(*it2 == 4U);
+    TEST_CHECK(cc[2] == 0xEEU && cc[3] == 0xEFU);
+    TEST_CHECK(cm[2] == 2U && cm[3] == 3U);
+    cc.ref_copy(m);
+    std::size_t n = 0U;
+    for (decom::msg::iterator it = cc.begin(), e = cc.end(); it != e; ++it, ++n) {
+      *it = 0x77U;
+    }
+    TEST_CHECK(n == m.size());
+    TEST_CHECK(cc.size() == m.size() && cc.back() == 0x77U && cc[DECOM_MSG_POOL_PAGE_SIZE] == 0x77U);
+    n = 0U;
+    for (decom::msg::const_iterator it = cm.begin(), e = cm.end(); it != e; ++it, ++n) {
+      if (*it != static_cast<std::uint8_t>(n)) break;
+    }
+    TEST_CHECK(n == m.size());
+
+    m.clear();
+    cc.clear();
+    rc.clear();
+    tail.clear();
+    TEST_CHECK(decom::msg::get_msg_pool().used_pages() == used + 4U);
+    TEST_END;
+  }
+
+
   void access()
   {
     TEST_BEGIN("element access");
@@ -335,6 +564,42 @@ protected:
     m.pop_front();
     TEST_CHECK(m.front() == 4);
     TEST_CHECK(m.size() == 3);
+
+    // indexed access over several pages, ascending, descending and after a front change
+    decom::msg m2;
+    for (std::uint16_t i = 0U; i < DECOM_MSG_POOL_PAGE_SIZE * 3U; i++) {
+      m2.push_back(static_cast<std::uint8_t>(i));
+    }
+    bool ok = true;
+    for (std::uint16_t i = 0U; i < DECOM_MSG_POOL_PAGE_SIZE * 3U; i++) {
+      ok = ok && (m2[i] == static_cast<std::uint8_t>(i));
+    }
+    for (std::uint16_t i = DECOM_MSG_POOL_PAGE_SIZE * 3U; i > 0U; i--) {
+      ok = ok && (m2.at(i - 1U) == static_cast<std::uint8_t>(i - 1U));
+    }
+    TEST_CHECK(ok);
+    m2.push_front(0xAAU);
+    TEST_CHECK(m2[0] == 0xAAU);
+    TEST_CHECK(m2[DECOM_MSG_POOL_PAGE_SIZE + 1U] == static_cast<std::uint8_t>(DECOM_MSG_POOL_PAGE_SIZE));
+    TEST_CHECK(m2[DECOM_MSG_POOL_PAGE_SIZE * 3U + 1U] == 0xCCU);   // illegal ref
+
+    // concurrent const access of the same msg, ascending and descending
+    const decom::msg& c = m2;
+    bool ok_asc = true, ok_desc = true;
+    std::thread t([&]() {
+      for (int n = 0; n < 100; n++) {
+        for (std::uint16_t i = 1U; i <= DECOM_MSG_POOL_PAGE_SIZE * 3U; i++) {
+          ok_asc = ok_asc && (c[i] == static_cast<std::uint8_t>(i - 1U));
+        }
+      }
+    });
+    for (int n = 0; n < 100; n++) {
+      for (std::uint16_t i = DECOM_MSG_POOL_PAGE_SIZE * 3U; i > 0U; i--) {
+        ok_desc = ok_desc && (c.at(i) == static_cast<std::uint8_t>(i - 1U));
+      }
+    }
+    t.join();
+    TEST_CHECK(ok_asc && ok_desc);
     TEST_END;
   }
 
@@ -359,6 +624,27 @@ protected:
     for (decom::msg::const_iterator cit = m.begin(); cit != m.end(); ++cit) {
       TEST_CHECK(*cit == 0x55);
     }
+
+    // random access over several pages
+    decom::msg m2;
+    for (std::uint16_t i = 0U; i < DECOM_MSG_POOL_PAGE_SIZE * 3U; i++) {
+      m2.push_back(static_cast<std::uint8_t>(i));
+    }
+    decom::msg::iterator it = m2.begin();
+    TEST_CHECK(std::distance(m2.begin(), m2.end()) == DECOM_MSG_POOL_PAGE_SIZE * 3U);
+    TEST_CHECK(m2.end() - m2.begin() == DECOM_MSG_POOL_PAGE_SIZE * 3U);
+    it += DECOM_MSG_POOL_PAGE_SIZE + 2U;
+    TEST_CHECK(*it == static_cast<std::uint8_t>(DECOM_MSG_POOL_PAGE_SIZE + 2U));
+    TEST_CHECK(it - m2.begin() == DECOM_MSG_POOL_PAGE_SIZE + 2U);
+    TEST_CHECK(m2.begin() < it);
+    TEST_CHECK(it < m2.end());
+    it -= 4U;
+    TEST_CHECK(*it == static_cast<std::uint8_t>(DECOM_MSG_POOL_PAGE_SIZE - 2U));
+    TEST_CHECK(it[3] == static_cast<std::uint8_t>(DECOM_MSG_POOL_PAGE_SIZE + 1U));
+    it += DECOM_MSG_POOL_PAGE_SIZE * 2U + 2U;
+    TEST_CHECK(it == m2.end());
+    --it;
+    TEST_CHECK(*it == static_cast<std::uint8_t>(DECOM_MSG_POOL_PAGE_SIZE * 3U - 1U));
     TEST_END;
   }
 
@@ -431,9 +717,406 @@ protected:
     m1.get(buf,  4, 15);
     TEST_CHECK(memcmp(buf, buf_ref + 15, 4) == 0);
 
+    // start in the second half of a page
+    memset(buf, 0, 23);
+    m1.get(buf,  2, 3);
+    TEST_CHECK(memcmp(buf, buf_ref + 3, 2) == 0);
+
+    memset(buf, 0, 23);
+    m1.get(buf,  9, 12);
+    TEST_CHECK(memcmp(buf, buf_ref + 12, 9) == 0);
+
     TEST_END;
   }
 
+
+  void segments()
+  {
+    TEST_BEGIN("segments");
+
+    decom::msg m;
+    for (std::uint16_t i = 0U; i < DECOM_MSG_POOL_PAGE_SIZE * 2U; i++) {
+      m.push_back(static_cast<std::uint8_t>(i));
+    }
+    m.push_front(0xAAU);
+
+    const decom::msg::size_type count = m.segment_count();
+    TEST_CHECK(count >= 2U);
+
+    decom::msg::segment_type seg[8];
+    TEST_CHECK(m.get_segments(seg, 8U) == count);
+    decom::msg::size_type len = 0U;
+    bool ok = true;
+    for (decom::msg::size_type n = 0U; n < count; n++) {
+      for (decom::msg::size_type i = 0U; i < seg[n].size; i++) {
+        ok = ok && (seg[n].data[i] == m[len + i]);
+      }
+      len += seg[n].size;
+    }
+    TEST_CHECK(ok);
+    TEST_CHECK(len == m.size());
+
+    // iovec like export with offset, limited count
+    struct iovec_type { void* iov_base; std::size_t iov_len; } iov[8];
+    TEST_CHECK(m.get_segments(iov, 1U, 3U) == 1U);
+    TEST_CHECK(*static_cast<std::uint8_t*>(iov[0].iov_base) == m[3]);
+    TEST_CHECK(iov[0].iov_len == seg[0].size - 3U);
+    TEST_CHECK(m.get_segments(iov, 8U, m.size()) == 0U);
+
+    decom::msg e;
+    TEST_CHECK(e.segment_count() == 0U);
+    TEST_CHECK(e.get_segments(seg, 8U) == 0U);
+
+    TEST_END;
+  }
+
+  void bulk()
+  {
+    TEST_BEGIN("bulk append/prepend/insert");
+
+    std::uint8_t buf[DECOM_MSG_POOL_PAGE_SIZE * 3U];
+    for (std::size_t i = 0U; i < sizeof(buf); i++) {
+      buf[i] = static_cast<std::uint8_t>(i);
+    }
+    std::uint8_t ref[DECOM_MSG_POOL_PAGE_SIZE * 8U];
+    std::uint8_t out[DECOM_MSG_POOL_PAGE_SIZE * 8U];
+
+    decom::msg m;
+    TEST_CHECK(m.append(buf, 10U));
+    TEST_CHECK(m.append(buf, sizeof(buf)));
+    TEST_CHECK(m.size() == 10U + sizeof(buf));
+    memcpy(ref, buf, 10U);
+    memcpy(ref + 10U, buf, sizeof(buf));
+    m.get(out, m.size());
+    TEST_CHECK(memcmp(out, ref, m.size()) == 0);
+
+    // header in the head room and in front pages
+    decom::msg h;
+    TEST_CHECK(h.append(buf, 20U));
+    TEST_CHECK(h.prepend(buf + 100U, 4U));
+    TEST_CHECK(h.size() == 24U);
+    TEST_CHECK(h[0] == 100U && h[3] == 103U && h[4] == 0U);
+    TEST_CHECK(h.prepend(buf, DECOM_MSG_POOL_PAGE_SIZE * 2U));
+    TEST_CHECK(h.size() == DECOM_MSG_POOL_PAGE_SIZE * 2U + 24U);
+    memcpy(ref, buf, DECOM_MSG_POOL_PAGE_SIZE * 2U);
+    memcpy(ref + DECOM_MSG_POOL_PAGE_SIZE * 2U, buf + 100U, 4U);
+    memcpy(ref + DECOM_MSG_POOL_PAGE_SIZE * 2U + 4U, buf, 20U);
+    h.get(out, h.size());
+    TEST_CHECK(memcmp(out, ref, h.size()) == 0);
+    TEST_CHECK(h.push_front(0xAAU));   // head room is left in the first page
+    TEST_CHECK(h.front() == 0xAAU);
+
+    // insert within a page and with a page split
+    decom::msg i;
+    TEST_CHECK(i.append(buf, 20U));
+    TEST_CHECK(i.insert_range(i.begin() + 5U, buf + 200U, 3U));
+    memcpy(ref, buf, 5U);
+    memcpy(ref + 5U, buf + 200U, 3U);
+    memcpy(ref + 8U, buf + 5U, 15U);
+    TEST_CHECK(i.size() == 23U);
+    i.get(out, i.size());
+    TEST_CHECK(memcmp(out, ref, i.size()) == 0);
+
+    TEST_CHECK(i.insert_range(i.begin() + 10U, buf, sizeof(buf)));
+    memmove(ref + 10U + sizeof(buf), ref + 10U, 13U);
+    memcpy(ref + 10U, buf, sizeof(buf));
+    TEST_CHECK(i.size() == 23U + sizeof(buf));
+    i.get(out, i.size());
+    TEST_CHECK(memcmp(out, ref, i.size()) == 0);
+    TEST_CHECK(i.back() == ref[i.size() - 1U]);
+
+    const std::uint8_t tail[2] = { 0x11U, 0x22U };
+    i.insert(i.end(), tail, tail + 2U);
+    TEST_CHECK(i.size() == 25U + sizeof(buf));
+    TEST_CHECK(i.back() == 0x22U);
+
+    TEST_END;
+  }
+
+
+  void magazine()
+  {
+    TEST_BEGIN("magazine");
+
+#if DECOM_MSG_POOL_MAGAZINE_SIZE > 0U
+    const std::size_t used = decom::msg::get_msg_pool().used_pages();
+    {
+      // warm up the thread cache
+      decom::msg m;
+    }
+    const std::uint32_t hits = decom::msg::get_msg_pool().magazine_hits();
+    TEST_CHECK(decom::msg::get_msg_pool().magazine_pages() > 0U);
+    {
+      // the page must be served by the thread cache
+      decom::msg m;
+      TEST_CHECK(decom::msg::get_msg_pool().magazine_hits() == hits + 1U);
+      TEST_CHECK(decom::msg::get_msg_pool().used_pages() == used + 1U);
+    }
+    {
+      // more pages than the magazine can hold
+      decom::msg m;
+      for (std::size_t i = 0U; i < DECOM_MSG_POOL_PAGE_SIZE * DECOM_MSG_POOL_MAGAZINE_SIZE * 2U; i++) {
+        TEST_CHECK(m.push_back(static_cast<std::uint8_t>(i)));
+      }
+    }
+    TEST_CHECK(decom::msg::get_msg_pool().magazine_pages() <= DECOM_MSG_POOL_MAGAZINE_SIZE);
+    TEST_CHECK(decom::msg::get_msg_pool().used_pages() == used);
+
+    {
+      // two pools of the same class on one thread, the pages must not be mixed up
+      decom::msg_pool_storage<64U, 8U> pool_a("pool_a", decom::msg_pool::class_default);
+      decom::msg_pool_storage<64U, 8U> pool_b("pool_b", decom::msg_pool::class_default);
+      decom::msg_pool::pointer p = pool_a.page_alloc();
+      TEST_CHECK(p && (p->pool == &pool_a));
+      pool_a.page_free(p);
+      TEST_CHECK(pool_a.magazine_misses() == 1U);
+      const std::size_t cached = pool_a.magazine_pages();
+      TEST_CHECK(cached > 0U);
+
+      // reading the statistics of another pool doesn't rebind the thread cache
+      TEST_CHECK(pool_b.magazine_pages() == 0U);
+      TEST_CHECK(pool_b.magazine_misses() == 0U);
+      TEST_CHECK(pool_a.magazine_pages() == cached);
+      TEST_CHECK(pool_a.free_pages() == 8U);
+
+      // binding the cache to another pool gives the pages back and resets the statistics
+      p = pool_b.page_alloc();
+      TEST_CHECK(p && (p->pool == &pool_b));
+      pool_b.page_free(p);
+      TEST_CHECK(pool_b.magazine_misses() == 1U);
+      TEST_CHECK(pool_b.magazine_hits() == 0U);
+      TEST_CHECK(pool_a.magazine_pages() == 0U);
+      TEST_CHECK(pool_a.free_pages() == 8U);
+
+      // all pages of pool_a are available and belong to it
+      std::vector<decom::msg_pool::pointer> pages;
+      for (p = pool_a.page_alloc(); p; p = pool_a.page_alloc()) {
+        TEST_CHECK(p->pool == &pool_a);
+        pages.push_back(p);
+      }
+      TEST_CHECK(pages.size() == 8U);
+      for (std::size_t i = 0U; i < pages.size(); i++) {
+        pool_a.page_free(pages[i]);
+      }
+      TEST_CHECK(!pool_a.used_pages() && !pool_b.used_pages());
+    }
+
+    {
+      // a pool is destroyed while another thread caches its pages and a new pool is created at the same address,
+      // the cache of the other thread must not hand out or give back the pages of the destroyed pool
+      typedef decom::msg_pool_storage<64U, 8U> pool_type;
+      std::aligned_storage<sizeof(pool_type), alignof(pool_type)>::type storage;
+      pool_type* pool = new (&storage) pool_type("pool_c", decom::msg_pool::class_default);
+      std::atomic<int> step(0);
+      std::thread t(&cache_pages_twice, static_cast<decom::msg_pool*>(pool), &step);
+      while (step != 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      pool->~pool_type();
+      pool = new (&storage) pool_type("pool_d", decom::msg_pool::class_default);
+      step = 2;
+      while (step != 3) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      // the pages of the other thread are taken out of the free list of the new pool
+      const bool taken = pool->free_pages() + 2U == 8U;
+      step = 4;
+      t.join();
+      TEST_CHECK(taken);
+
+      TEST_CHECK(pool->free_pages() == 8U);
+      std::vector<decom::msg_pool::pointer> pages;
+      for (decom::msg_pool::pointer p = pool->page_alloc(); p; p = pool->page_alloc()) {
+        TEST_CHECK(std::find(pages.begin(), pages.end(), p) == pages.end());
+        pages.push_back(p);
+      }
+      TEST_CHECK(pages.size() == 8U);
+      for (std::size_t i = 0U; i < pages.size(); i++) {
+        pool->page_free(pages[i]);
+      }
+      pool->~pool_type();
+    }
+    TEST_CHECK(decom::msg::get_msg_pool().used_pages() == used);
+    TEST_END;
+#else
+    TEST_SKIP;
+#endif
+  }
+
+  // caches pages of the pool, then allocates two pages of the pool after step 2 and frees them after step 4,
+  // the thread cache keeps the pages until the thread ends
+  static void cache_pages_twice(decom::msg_pool* pool, std::atomic<int>* step)
+  {
+    pool->page_free(pool->page_alloc());
+    *step = 1;
+    while (*step != 2) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    decom::msg_pool::pointer p0 = pool->page_alloc();
+    decom::msg_pool::pointer p1 = pool->page_alloc();
+    *step = 3;
+    while (*step != 4) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    pool->page_free(p0);
+    pool->page_free(p1);
+  }
+
+
+  // allocates and frees pages, so that they are kept in the thread cache until the thread ends
+  static void cache_pages(decom::msg_pool* pool, std::mutex* mutex)
+  {
+    pool->page_free(pool->page_alloc());
+    std::lock_guard<std::mutex> lock(*mutex);
+  }
+
+
+  static void free_later(decom::msg_pool* pool, decom::msg_pool::pointer p0, decom::msg_pool::pointer p1)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    pool->page_free(p0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    pool->page_free(p1);
+  }
+
+
+  static void count_free(void* arg)
+  {
+    (void)static_cast<std::atomic<int>*>(arg)->fetch_add(1);
+  }
+
+
+  void back_pressure()
+  {
+    TEST_BEGIN("pool back-pressure");
+    DECOM_LOG_NOTICE2("back-pressure", "msg test");
+
+    decom::msg_pool& pool = decom::msg::get_msg_pool();
+
+    // let another thread cache some pages
+    const std::size_t free = pool.free_pages();
+    std::mutex cache_mutex;
+    std::unique_lock<std::mutex> cache_lock(cache_mutex);
+    std::thread c(&cache_pages, &pool, &cache_mutex);
+    while (pool.free_pages() == free) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // exhaust the pool, the pages in the cache of the other thread are not free for this thread
+    std::vector<decom::msg_pool::pointer> pages;
+    for (decom::msg_pool::pointer p = pool.page_alloc(); p; p = pool.page_alloc()) {
+      pages.push_back(p);
+    }
+    TEST_CHECK(pool.used_pages() < pool.max_size());
+    TEST_CHECK(!pool.free_pages());
+    TEST_CHECK(!pool.has_free(1U));
+    TEST_CHECK(pool.try_alloc(std::chrono::milliseconds(10)) == nullptr);
+    TEST_CHECK(!pool.wait_free(1U, std::chrono::milliseconds(10)));
+
+    // the cached pages are given back when the thread ends
+    cache_lock.unlock();
+    c.join();
+    TEST_CHECK(pool.free_pages() == pool.max_size() - pool.used_pages());
+    for (std::size_t n = pool.free_pages(); n; n--) {
+      pages.push_back(pool.page_alloc());
+    }
+    TEST_CHECK(!pool.has_free(1U));
+
+    // free pages in another thread while waiting
+    decom::msg_pool::pointer p0 = pages.back();
+    pages.pop_back();
+    decom::msg_pool::pointer p1 = pages.back();
+    pages.pop_back();
+    std::thread t(&free_later, &pool, p0, p1);
+    decom::msg_pool::pointer p = pool.try_alloc(std::chrono::milliseconds(2000));
+    TEST_CHECK(p != nullptr);
+    TEST_CHECK(pool.wait_free(1U, std::chrono::milliseconds(2000)));
+    t.join();
+    pool.page_free(p);
+    TEST_CHECK(pool.has_free(2U));
+
+    // free pages notification, called once when the number of pages is free
+    std::atomic<int> notified(0);
+    TEST_CHECK(!pool.notify_free(2U, &count_free, &notified));   // free already
+    pages.push_back(pool.page_alloc());
+    pages.push_back(pool.page_alloc());
+    TEST_CHECK(!pool.has_free(1U));
+    TEST_CHECK(pool.notify_free(2U, &count_free, &notified));
+    p0 = pages.back();
+    pages.pop_back();
+    p1 = pages.back();
+    pages.pop_back();
+    std::thread n(&free_later, &pool, p0, p1);
+    for (int i = 0; (i < 2000) && !notified; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    n.join();
+    TEST_CHECK(notified == 1);
+    pages.push_back(pool.page_alloc());
+    pool.page_free(pages.back());
+    pages.pop_back();
+    TEST_CHECK(notified == 1);   // one-shot
+
+    // a cancelled notification isn't called
+    pages.push_back(pool.page_alloc());
+    pages.push_back(pool.page_alloc());
+    TEST_CHECK(pool.notify_free(1U, &count_free, &notified));
+    pool.cancel_free_notify(&notified);
+    pool.page_free(pages.back());
+    pages.pop_back();
+    TEST_CHECK(notified == 1);
+
+    for (std::size_t i = 0U; i < pages.size(); i++) {
+      pool.page_free(pages[i]);
+    }
+    TEST_END;
+  }
+
+
+  void page_classes()
+  {
+    TEST_BEGIN("page classes");
+
+    msg_pool& pool_small   = decom::msg::get_msg_pool(msg_pool::class_small);
+    msg_pool& pool_default = decom::msg::get_msg_pool();
+    msg_pool& pool_large   = decom::msg::get_msg_pool(msg_pool::class_large);
+    TEST_CHECK(pool_default.page_size() == DECOM_MSG_POOL_PAGE_SIZE);
+    TEST_CHECK(pool_small.page_size() <= pool_default.page_size());
+    TEST_CHECK(pool_large.page_size() >= pool_default.page_size());
+
+    // class selection by size
+    TEST_CHECK(&decom::msg::get_msg_pool(static_cast<std::size_t>(8U)) == &pool_small);
+    TEST_CHECK(&decom::msg::get_msg_pool(static_cast<std::size_t>(DECOM_MSG_POOL_PAGE_SIZE / 2U)) == &pool_default);
+    TEST_CHECK(&decom::msg::get_msg_pool(static_cast<std::size_t>(DECOM_MSG_POOL_PAGE_SIZE * 8U)) == &pool_large);
+
+    const std::size_t used_small = pool_small.used_pages();
+    const std::size_t used_large = pool_large.used_pages();
+    {
+      // large message in a large page class
+      decom::msg m(pool_large);
+      for (std::uint16_t i = 0; i < DECOM_MSG_POOL_PAGE_SIZE * 8; i++) {
+        TEST_CHECK(m.push_back(static_cast<std::uint8_t>(i)));
+      }
+      TEST_CHECK(m.size() == DECOM_MSG_POOL_PAGE_SIZE * 8);
+      TEST_CHECK(m[DECOM_MSG_POOL_PAGE_SIZE * 8 - 1] == static_cast<std::uint8_t>(DECOM_MSG_POOL_PAGE_SIZE * 8 - 1));
+
+      // mixed classes
+      decom::msg s(8U, static_cast<std::uint8_t>(0xAAU));
+      TEST_CHECK(s.size() == 8U);
+      decom::msg c(m);
+      c.append(s);
+      TEST_CHECK(c.size() == DECOM_MSG_POOL_PAGE_SIZE * 8 + 8U);
+      TEST_CHECK(c[DECOM_MSG_POOL_PAGE_SIZE * 8] == 0xAAU);
+      decom::msg d;
+      d = c;
+      TEST_CHECK(d == c);
+    }
+    TEST_CHECK(pool_small.used_pages() == used_small);
+    TEST_CHECK(pool_large.used_pages() == used_large);
+    TEST_END;
+  }
+
+
   void dummy()
   {
     TEST_BEGIN("dummy skipped");
@@ -1,6 +1,10 @@
 #ifndef _DECOM_TEST_ISO15765_H_
 #define _DECOM_TEST_ISO15765_H_
 
+#include <map>
+#include <mutex>
+#include <vector>
+
 #include "../src/prot/automotive/prot_iso15765.h"
 #include "../src/prot/prot_debug.h"
 #include "../src/com/com_generic.h"
@@ -23,6 +27,10 @@ public:
     SFtest();
     CFtest();
     looptest();
+    sessions();
+    fd();
+    burst();
+    remove();
   }
 
 
@@ -140,16 +148,16 @@ protected:
     TEST_CHECK(rx[7] == 0x06);
     TEST_CHECK(rx.size() == 8);
 
-    // tx still in use, can't be changed (this generates an ERROR in log, don't worry)
+    // tx is still in use by the layer, changing it copies the shared pages
     tx.push_back(9);
-    TEST_CHECK(tx.size() == 8);
+    TEST_CHECK(tx.size() == 9);
 
     // send FC frame manually
     decom::msg fc;
     fc.push_back(0x30);
     fc.push_back(0x0);
     fc.push_back(0x0);
-    gen_com.write(fc, 1);
+    gen_com.write(fc, 10);    // FC is received on the eid of the session
 
     decom::util::timer::sleep(std::chrono::milliseconds(100));
 
@@ -164,6 +172,432 @@ protected:
     TEST_END;
   }
 
+
+  // keeps the received messages and the tx indications of all eids
+  class session_sink : public decom::layer
+  {
+  public:
+    session_sink(decom::layer* lower)
+      : layer(lower, "session_sink")
+    { }
+
+    virtual void receive(decom::msg& data, decom::eid const& id, bool)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      rx[id].ref_copy(data);    // share the pages, a deep copy of big messages may exceed the msg pool
+    }
+
+    virtual void indication(status_type code, decom::eid const& id)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (code == tx_done) {
+        ++done[id];
+      }
+    }
+
+    // wait until messages of count eids are received and count tx indications are done
+    bool wait(std::size_t count)
+    {
+      for (int i = 0; i < 500; ++i) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if ((rx.size() >= count) && (done.size() >= count)) {
+            return true;
+          }
+        }
+        decom::util::timer::sleep(std::chrono::milliseconds(10));
+      }
+      return false;
+    }
+
+    std::mutex mutex;
+    std::map<decom::eid, decom::msg> rx;
+    std::map<decom::eid, int> done;
+  };
+
+
+  static decom::msg pattern(std::size_t size, std::uint8_t seed)
+  {
+    decom::msg m;
+    for (std::size_t i = 0U; i < size; ++i) {
+      m.push_back(static_cast<std::uint8_t>(i * 7U + seed));
+    }
+    return m;
+  }
+
+
+  void sessions()
+  {
+    TEST_BEGIN("sessions");
+    DECOM_LOG_NOTICE2("sessions test", "iso15765 test");
+
+    decom::com::loopback loop1;
+    decom::com::loopback loop2;
+    loop1.register_loopback(&loop2);
+    loop2.register_loopback(&loop1);
+
+    decom::prot::iso15765 tp1(&loop1, 1, 0, 4095);
+    decom::prot::iso15765 tp2(&loop2, 1, 4, 4095);   // FC after every 4 CFs
+    session_sink sink1(&tp1);
+    session_sink sink2(&tp2);
+    TEST_CHECK(sink1.open());
+    TEST_CHECK(sink2.open());
+
+    // segmented transmissions to several peers at the same time, in both directions
+    // the number of peers keeps the pages of all transfers below the default pool size,
+    // a CF which can't be appended cancels the reception with rx_overrun
+    const std::uint32_t peers = 4U;
+    for (std::uint32_t i = 1U; i <= peers; ++i) {
+      decom::msg tx1 = pattern(100U + i * 37U, static_cast<std::uint8_t>(i));
+      decom::msg tx2 = pattern(200U + i * 11U, static_cast<std::uint8_t>(i + 100U));
+      TEST_CHECK(sink1.send(tx1, i));
+      TEST_CHECK(sink2.send(tx2, i));
+    }
+    TEST_CHECK(sink1.wait(peers));
+    TEST_CHECK(sink2.wait(peers));
+    for (std::uint32_t i = 1U; i <= peers; ++i) {
+      TEST_CHECK(sink2.rx[i] == pattern(100U + i * 37U, static_cast<std::uint8_t>(i)));
+      TEST_CHECK(sink1.rx[i] == pattern(200U + i * 11U, static_cast<std::uint8_t>(i + 100U)));
+      TEST_CHECK(sink1.done[i] == 1);
+      TEST_CHECK(sink2.done[i] == 1);
+    }
+    TEST_CHECK(tp1.sessions() == peers);
+    TEST_CHECK(tp2.sessions() == peers);
+
+    // session with different eids for request and response
+    TEST_CHECK(tp1.add_session(0x7E0U, 0x7E8U));
+    TEST_CHECK(tp2.add_session(0x7E8U, 0x7E0U));
+    TEST_CHECK(!tp1.add_session(0x7E0U, 0x7E9U));   // tx eid in use
+    decom::msg req = pattern(50U, 0x10U);
+    TEST_CHECK(sink1.send(req, 0x7E0U));
+    decom::msg res = pattern(300U, 0x20U);
+    TEST_CHECK(sink2.send(res, 0x7E8U));
+    TEST_CHECK(sink1.wait(peers + 1U));
+    TEST_CHECK(sink2.wait(peers + 1U));
+    TEST_CHECK(sink2.rx[0x7E0U] == pattern(50U, 0x10U));
+    TEST_CHECK(sink1.rx[0x7E8U] == pattern(300U, 0x20U));
+    TEST_CHECK(sink1.done[0x7E0U] == 1);
+    TEST_CHECK(sink2.done[0x7E8U] == 1);
+
+    sink1.close();
+    sink2.close();
+    TEST_END;
+  }
+
+
+  void fd()
+  {
+    TEST_BEGIN("CAN FD");
+    DECOM_LOG_NOTICE2("CAN FD test", "iso15765 test");
+
+    // SF with SF_DL escape sequence, padded to the next CAN FD frame length
+    decom::com::generic gen_com;
+    decom::prot::iso15765 tp(&gen_com, 0, 0, 10000);
+    decom::dev::generic gen_dev(&tp);
+    TEST_CHECK(!tp.set_frame_length(10));
+    TEST_CHECK(!tp.set_frame_length(72));
+    TEST_CHECK(tp.set_frame_length(64));
+    gen_dev.open("", 10);
+
+    decom::msg tx = pattern(20U, 1U), rx;
+    decom::eid id;
+    bool more;
+    gen_dev.write(tx, 10, false, false);
+    gen_com.read(rx, id, more);
+    TEST_CHECK(rx.size() == 24U);
+    TEST_CHECK(rx[0] == 0x00U);
+    TEST_CHECK(rx[1] == 20U);
+    TEST_CHECK(rx[2] == 1U);
+    TEST_CHECK(rx[21] == (std::uint8_t)(19U * 7U + 1U));   // tx was sent in place
+    TEST_CHECK(rx[22] == 0U);
+    TEST_CHECK(rx[23] == 0U);
+
+    // small SF uses the classic format
+    tx = pattern(3U, 1U);
+    gen_dev.write(tx, 10, false, false);
+    gen_com.read(rx, id, more);
+    TEST_CHECK(rx.size() == 4U);
+    TEST_CHECK(rx[0] == 0x03U);
+
+    // FF with FF_DL escape sequence
+    tx = pattern(5000U, 1U);
+    gen_dev.write(tx, 10, false, false);
+    gen_com.read(rx, id, more);
+    TEST_CHECK(rx.size() == 64U);
+    TEST_CHECK(rx[0] == 0x10U);
+    TEST_CHECK(rx[1] == 0x00U);
+    TEST_CHECK(rx[2] == 0x00U);
+    TEST_CHECK(rx[3] == 0x00U);
+    TEST_CHECK(rx[4] == 0x13U);
+    TEST_CHECK(rx[5] == 0x88U);
+    TEST_CHECK(rx[6] == tx[0]);
+    TEST_CHECK(rx[63] == tx[57]);
+    gen_dev.close();
+    tx.clear();
+    rx.clear();
+
+    // segmented transfers, the peer receives any frame format
+    decom::com::loopback loop1;
+    decom::com::loopback loop2;
+    loop1.register_loopback(&loop2);
+    loop2.register_loopback(&loop1);
+    decom::prot::iso15765 tp1(&loop1, 1, 0, 5000U);
+    decom::prot::iso15765 tp2(&loop2, 1, 16, 5000U);
+    TEST_CHECK(tp1.set_frame_length(64));
+    TEST_CHECK(tp2.set_frame_length(12));
+    session_sink sink1(&tp1);
+    session_sink sink2(&tp2);
+    TEST_CHECK(sink1.open());
+    TEST_CHECK(sink2.open());
+
+    // FF_DL > 4095 needs the escape sequence, the size fits the default msg pool
+    decom::msg tx1 = pattern(4200U, 3U);
+    decom::msg tx2 = pattern(100U, 4U);
+    TEST_CHECK(sink1.send(tx1, 1U));
+    TEST_CHECK(sink2.send(tx2, 2U));
+    TEST_CHECK(sink1.wait(1U));
+    TEST_CHECK(sink2.wait(1U));
+    TEST_CHECK(sink2.rx[1U].size() == 4200U);
+    TEST_CHECK(sink2.rx[1U] == tx1);
+    TEST_CHECK(sink1.rx[2U] == tx2);
+
+    // too big for the receiver
+    sink2.rx.clear();
+    tx1.clear();
+    decom::msg tx3 = pattern(5001U, 5U);
+    TEST_CHECK(!sink1.send(tx3, 3U));
+
+    sink1.close();
+    sink2.close();
+    TEST_END;
+  }
+
+
+  // keeps the sent frames and their more flag
+  struct frame_sink
+  {
+    static void callback(void* arg, decom::msg& data, decom::eid const&, bool more)
+    {
+      frame_sink* f = static_cast<frame_sink*>(arg);
+      std::lock_guard<std::mutex> lock(f->mutex);
+      f->frames.push_back(data);
+      f->more.push_back(more);
+    }
+
+    // wait until count frames are sent
+    bool wait(std::size_t count)
+    {
+      for (int i = 0; i < 500; ++i) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (frames.size() >= count) {
+            return frames.size() == count;
+          }
+        }
+        decom::util::timer::sleep(std::chrono::milliseconds(1));
+      }
+      return false;
+    }
+
+    std::mutex mutex;
+    std::vector<decom::msg> frames;
+    std::vector<bool> more;
+  };
+
+
+  void burst()
+  {
+    TEST_BEGIN("CF burst");
+    DECOM_LOG_NOTICE2("CF burst test", "iso15765 test");
+
+    decom::com::generic gen_com;
+    decom::prot::iso15765 tp(&gen_com, 0, 0, 4095);
+    session_sink sink(&tp);
+    frame_sink frames;
+    gen_com.set_receive_callback(&frames, &frame_sink::callback);
+    TEST_CHECK(sink.open());
+
+    decom::msg fc;
+    fc.push_back(0x30);   // CTS
+    fc.push_back(0x00);   // BS
+    fc.push_back(0x00);   // STmin
+
+    // STmin 0 - the complete message is sent as one burst, FF + 5 CF
+    decom::msg tx = pattern(40U, 1U);
+    TEST_CHECK(sink.send(tx, 10));
+    TEST_CHECK(frames.wait(1U));
+    gen_com.write(fc, 10);
+    TEST_CHECK(frames.wait(6U));
+    TEST_CHECK(frames.more[0] == false);
+    for (std::size_t i = 1U; i < 6U; ++i) {
+      TEST_CHECK(frames.frames[i][0] == 0x20U + i);
+      TEST_CHECK(frames.more[i] == (i < 5U));
+    }
+    TEST_CHECK(frames.frames[5].size() == 7U);
+    TEST_CHECK(frames.frames[5][6] == static_cast<std::uint8_t>(39U * 7U + 1U));
+    decom::util::timer::sleep(std::chrono::milliseconds(10));
+    TEST_CHECK(sink.done[10] == 1);
+
+    // STmin 0, BS 2 - bursts of one block
+    frames.frames.clear();
+    frames.more.clear();
+    fc[1] = 2U;
+    tx = pattern(40U, 1U);
+    TEST_CHECK(sink.send(tx, 10));
+    TEST_CHECK(frames.wait(1U));
+    gen_com.write(fc, 10);
+    TEST_CHECK(frames.wait(3U));
+    TEST_CHECK(frames.more[1] == true);
+    TEST_CHECK(frames.more[2] == false);
+    gen_com.write(fc, 10);
+    TEST_CHECK(frames.wait(5U));
+    TEST_CHECK(frames.more[3] == true);
+    TEST_CHECK(frames.more[4] == false);
+    gen_com.write(fc, 10);
+    TEST_CHECK(frames.wait(6U));
+    TEST_CHECK(frames.more[5] == false);
+    TEST_CHECK(frames.frames[5][0] == 0x25U);
+    decom::util::timer::sleep(std::chrono::milliseconds(10));
+    TEST_CHECK(sink.done[10] == 2);
+
+    // STmin 500 us - single frames, the time isn't interpreted as 245 ms
+    frames.frames.clear();
+    frames.more.clear();
+    fc[1] = 0U;
+    fc[2] = 0xF5U;
+    tx = pattern(40U, 1U);
+    TEST_CHECK(sink.send(tx, 10));
+    TEST_CHECK(frames.wait(1U));
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    gen_com.write(fc, 10);
+    TEST_CHECK(frames.wait(6U));
+    const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+    TEST_CHECK(elapsed >= std::chrono::microseconds(5U * 500U));
+    TEST_CHECK(elapsed < std::chrono::milliseconds(100));
+    for (std::size_t i = 1U; i < 6U; ++i) {
+      TEST_CHECK(frames.more[i] == false);
+    }
+    decom::util::timer::sleep(std::chrono::milliseconds(10));
+    TEST_CHECK(sink.done[10] == 3);
+    sink.close();
+
+    // STmin 0 over loopback, the bursts exceed the loopback ring and are continued after tx_done
+    decom::com::loopback loop1;
+    decom::com::loopback loop2;
+    loop1.register_loopback(&loop2);
+    loop2.register_loopback(&loop1);
+    decom::prot::iso15765 tp1(&loop1, 0, 0, 4095U);
+    decom::prot::iso15765 tp2(&loop2, 0, 0, 4095U);
+    session_sink sink1(&tp1);
+    session_sink sink2(&tp2);
+    TEST_CHECK(sink1.open());
+    TEST_CHECK(sink2.open());
+    decom::msg tx1 = pattern(2500U, 3U);    // 357 CF, the size fits the default msg pool
+    decom::msg tx2 = pattern(500U, 4U);
+    TEST_CHECK(sink1.send(tx1, 1U));
+    TEST_CHECK(sink2.send(tx2, 2U));
+    TEST_CHECK(sink1.wait(1U));
+    TEST_CHECK(sink2.wait(1U));
+    TEST_CHECK(sink2.rx[1U].size() == 2500U);
+    TEST_CHECK(sink2.rx[1U] == tx1);
+    TEST_CHECK(sink1.rx[2U] == tx2);
+    sink1.close();
+    sink2.close();
+
+    TEST_END;
+  }
+
+
+  void remove()
+  {
+    TEST_BEGIN("remove session");
+    DECOM_LOG_NOTICE2("remove session test", "iso15765 test");
+
+    decom::com::generic gen_com;
+    decom::prot::iso15765 tp(&gen_com, 0, 0, 4095);
+    session_sink sink(&tp);
+    frame_sink frames;
+    gen_com.set_receive_callback(&frames, &frame_sink::callback);
+    TEST_CHECK(sink.open());
+
+    decom::msg fc;
+    fc.push_back(0x30);   // CTS
+    fc.push_back(0x00);   // BS
+    fc.push_back(0x00);   // STmin
+
+    // transmission in progress, the FC after the removal is discarded
+    decom::msg tx = pattern(40U, 1U);
+    TEST_CHECK(sink.send(tx, 10));
+    TEST_CHECK(frames.wait(1U));
+    TEST_CHECK(tp.sessions() == 1U);
+    TEST_CHECK(tp.remove_session(10));
+    TEST_CHECK(!tp.remove_session(10));
+    TEST_CHECK(tp.sessions() == 0U);
+    gen_com.write(fc, 10);
+    decom::util::timer::sleep(std::chrono::milliseconds(10));
+    TEST_CHECK(frames.frames.size() == 1U);
+    TEST_CHECK(sink.done[10] == 0);
+
+    // reception in progress, the CF after the removal isn't passed up
+    decom::msg ff = pattern(8U, 2U);
+    ff[0] = 0x10U;
+    ff[1] = 20U;
+    gen_com.write(ff, 20);
+    TEST_CHECK(frames.wait(2U));
+    TEST_CHECK(frames.frames[1][0] == 0x30U);
+    TEST_CHECK(tp.remove_session(20));
+    decom::msg cf = pattern(8U, 3U);
+    cf[0] = 0x21U;
+    gen_com.write(cf, 20);
+    cf[0] = 0x22U;
+    gen_com.write(cf, 20);
+    TEST_CHECK(sink.rx.count(20) == 0U);
+
+    // removal while the CFs are sent by the STmin timer callbacks
+    fc[2] = 1U;
+    for (int i = 0; i < 20; ++i) {
+      tx = pattern(100U, static_cast<std::uint8_t>(i));
+      TEST_CHECK(sink.send(tx, 30));
+      gen_com.write(fc, 30);
+      decom::util::timer::sleep(std::chrono::milliseconds(i % 5));
+      TEST_CHECK(tp.remove_session(30));
+    }
+    decom::util::timer::sleep(std::chrono::milliseconds(10));
+    {
+      std::lock_guard<std::mutex> lock(frames.mutex);
+      frames.frames.clear();
+      frames.more.clear();
+    }
+    decom::util::timer::sleep(std::chrono::milliseconds(10));
+    TEST_CHECK(frames.frames.empty());
+    TEST_CHECK(tp.sessions() == 0U);
+    sink.close();
+
+    // full session table, idle sessions created on first use are replaced, registered ones are kept
+    decom::com::generic gen_com2;
+    decom::prot::iso15765 tp2(&gen_com2, 0, 0, 4095);
+    session_sink sink2(&tp2);
+    TEST_CHECK(sink2.open());
+    TEST_CHECK(tp2.add_session(0x7E0U, 0x7E8U));
+    for (std::uint32_t i = 1U; i < ISO15765_SESSIONS_MAX; ++i) {
+      decom::msg sf = pattern(5U, 4U);
+      TEST_CHECK(sink2.send(sf, 0x1000U + i));
+    }
+    TEST_CHECK(tp2.sessions() == ISO15765_SESSIONS_MAX);
+    TEST_CHECK(!tp2.add_session(0x7E1U, 0x7E9U));
+    for (std::uint32_t i = 0U; i < ISO15765_SESSIONS_MAX; ++i) {
+      decom::msg sf = pattern(5U, 5U);
+      TEST_CHECK(sink2.send(sf, 0x2000U + i));
+    }
+    TEST_CHECK(tp2.sessions() == ISO15765_SESSIONS_MAX);
+    TEST_CHECK(sink2.done[0x2000U + ISO15765_SESSIONS_MAX - 1U] == 1);
+    TEST_CHECK(tp2.remove_session(0x7E8U));
+    TEST_CHECK(tp2.add_session(0x7E1U, 0x7E9U));
+    sink2.close();
+
+    TEST_END;
+  }
+
 };
 
 } // namespace test
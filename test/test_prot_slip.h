@@ -0,0 +1,196 @@
+#ifndef _DECOM_TEST_PROT_SLIP_H_
+#define _DECOM_TEST_PROT_SLIP_H_
+
+#include <vector>
+#include <algorithm>
+
+#include "../src/prot/prot_slip.h"
+#include "../src/com/com_generic.h"
+#include "../src/dev/dev_generic.h"
+#include "test.h"
+
+
+namespace decom {
+namespace test {
+
+class prot_slip : public test
+{
+  // TEST CASES
+public:
+  prot_slip(std::ostream& result_file, format_type format)
+    : test("prot_slip", result_file, format)
+  {
+    encode();
+    decode();
+    roundtrip();
+    batch();
+  }
+
+
+protected:
+
+  // upper layer which records the received batches
+  class batch_sink : public decom::layer
+  {
+  public:
+    batch_sink(decom::layer* lower)
+      : layer(lower, "batch_sink")
+      , calls(0U)
+    { }
+
+    virtual void receive(decom::msg& data, decom::eid const&, bool)
+    {
+      ++calls;
+      packets.push_back(std::vector<std::uint8_t>(data.begin(), data.end()));
+    }
+
+    virtual void receive_batch(decom::msg* data, std::size_t count, decom::eid const&)
+    {
+      ++calls;
+      for (std::size_t i = 0U; i < count; ++i) {
+        packets.push_back(std::vector<std::uint8_t>(data[i].begin(), data[i].end()));
+      }
+    }
+
+    std::size_t calls;
+    std::vector<std::vector<std::uint8_t> > packets;
+  };
+
+
+  void encode()
+  {
+    TEST_BEGIN("encode");
+
+    decom::com::generic com;
+    decom::prot::slip slip(&com);
+    decom::dev::generic dev(&slip);
+    TEST_CHECK(dev.open());
+
+    const std::uint8_t data[] = { 0x01U, 0xC0U, 0x02U, 0xDBU, 0x03U, 0xC0U };
+    TEST_CHECK(dev.write(data, sizeof(data)));
+
+    const std::uint8_t frame[] = { 0xC0U, 0x01U, 0xDBU, 0xDCU, 0x02U, 0xDBU, 0xDDU, 0x03U, 0xDBU, 0xDCU, 0xC0U };
+    decom::msg rx;
+    decom::eid id;
+    bool more;
+    TEST_CHECK(com.read(rx, id, more));
+    TEST_CHECK(rx.size() == sizeof(frame));
+    TEST_CHECK(std::equal(rx.begin(), rx.end(), frame));
+    TEST_END;
+  }
+
+
+  void decode()
+  {
+    TEST_BEGIN("decode");
+
+    decom::com::generic com;
+    decom::prot::slip slip(&com);
+    decom::dev::generic dev(&slip);
+    TEST_CHECK(dev.open());
+
+    std::vector<std::uint8_t> rx;
+    decom::eid id;
+
+    // noise before the first END is ignored, the frame is split in the ESC sequence
+    const std::uint8_t part1[] = { 0x55U, 0xC0U, 0x01U, 0xDBU };
+    const std::uint8_t part2[] = { 0xDCU, 0x02U, 0xC0U };
+    TEST_CHECK(com.write(part1, part1 + sizeof(part1)));
+    TEST_CHECK(!dev.read(rx, id, std::chrono::milliseconds(0)));
+    TEST_CHECK(com.write(part2, part2 + sizeof(part2)));
+    TEST_CHECK(dev.read(rx, id, std::chrono::milliseconds(0)));
+    TEST_CHECK(rx.size() == 3U && rx[0] == 0x01U && rx[1] == 0xC0U && rx[2] == 0x02U);
+
+    // invalid ESC sequence discards the packet
+    const std::uint8_t invalid[] = { 0xC0U, 0x01U, 0xDBU, 0x02U, 0xC0U };
+    TEST_CHECK(com.write(invalid, invalid + sizeof(invalid)));
+    TEST_CHECK(!dev.read(rx, id, std::chrono::milliseconds(0)));
+    TEST_END;
+  }
+
+
+  void roundtrip()
+  {
+    TEST_BEGIN("roundtrip");
+
+    // tx stack
+    decom::com::generic com_tx;
+    decom::prot::slip slip_tx(&com_tx);
+    decom::dev::generic dev_tx(&slip_tx);
+    TEST_CHECK(dev_tx.open());
+    // rx stack
+    decom::com::generic com_rx;
+    decom::prot::slip slip_rx(&com_rx);
+    decom::dev::generic dev_rx(&slip_rx);
+    TEST_CHECK(dev_rx.open());
+
+    // several pages with END/ESC bytes at page boundaries and in runs
+    std::vector<std::uint8_t> data(1000U);
+    for (std::size_t i = 0U; i < data.size(); ++i) {
+      data[i] = static_cast<std::uint8_t>(i * 7U);
+      if (!(i % 37U) || ((i % DECOM_MSG_POOL_PAGE_SIZE) == DECOM_MSG_POOL_PAGE_SIZE - 1U)) {
+        data[i] = (i & 1U) ? 0xC0U : 0xDBU;
+      }
+    }
+    TEST_CHECK(dev_tx.write(data));
+
+    decom::msg frame;
+    decom::eid id;
+    bool more;
+    TEST_CHECK(com_tx.read(frame, id, more));
+    std::vector<std::uint8_t> stream(frame.begin(), frame.end());
+
+    // pass the stream in odd sized pieces
+    for (std::size_t pos = 0U; pos < stream.size(); pos += 61U) {
+      const std::size_t end = pos + 61U < stream.size() ? pos + 61U : stream.size();
+      TEST_CHECK(com_rx.write(stream.begin() + pos, stream.begin() + end));
+    }
+    std::vector<std::uint8_t> rx;
+    TEST_CHECK(dev_rx.read(rx, id, std::chrono::milliseconds(0)));
+    TEST_CHECK(rx == data);
+    TEST_END;
+  }
+
+
+  void batch()
+  {
+    TEST_BEGIN("batch");
+
+    decom::com::generic com;
+    decom::prot::slip slip(&com);
+    batch_sink sink(&slip);
+    slip.set_rx_batch(true);
+    TEST_CHECK(slip.open());
+
+    // 40 packets and the beginning of another one in one msg
+    std::vector<std::uint8_t> stream;
+    for (std::uint8_t i = 0U; i < 40U; ++i) {
+      stream.push_back(0xC0U);
+      stream.push_back(i);
+      if (i & 1U) {
+        stream.push_back(0xDBU);
+        stream.push_back(0xDDU);
+      }
+      stream.push_back(0xC0U);
+    }
+    stream.push_back(0xC0U);
+    stream.push_back(0x55U);
+    TEST_CHECK(com.write(stream));
+    // a full batch and the rest
+    TEST_CHECK(sink.calls == 2U);
+    TEST_CHECK(sink.packets.size() == 40U);
+    TEST_CHECK(sink.packets[3].size() == 2U && sink.packets[3][0] == 3U && sink.packets[3][1] == 0xDBU);
+
+    // the pending packet is completed by the next msg
+    const std::uint8_t end[] = { 0x56U, 0xC0U };
+    TEST_CHECK(com.write(end, end + sizeof(end)));
+    TEST_CHECK(sink.calls == 3U);
+    TEST_CHECK(sink.packets.size() == 41U && sink.packets[40].size() == 2U);
+    TEST_END;
+  }
+};
+
+} // namespace test
+} // namespace decom
+
+#endif // _DECOM_TEST_PROT_SLIP_H_
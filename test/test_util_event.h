@@ -0,0 +1,119 @@
+#ifndef _DECOM_TEST_UTIL_EVENT_H_
+#define _DECOM_TEST_UTIL_EVENT_H_
+
+#include <thread>
+#include <chrono>
+
+#include "../src/util/event.h"
+#include "test.h"
+
+
+namespace decom {
+namespace test {
+
+class util_event : public test
+{
+  // TEST CASES
+public:
+  util_event(std::ostream& result_file, format_type format)
+    : test("util_event", result_file, format)
+  {
+    generic();
+    timeout();
+    wakeup();
+    ping_pong();
+  }
+
+
+protected:
+
+  void generic()
+  {
+    TEST_BEGIN("generic");
+
+    decom::util::event ev;
+    TEST_CHECK(!ev.get());
+    ev.set();
+    TEST_CHECK(ev.get());
+    ev.wait();    // returns immediately
+    TEST_CHECK(ev.wait_for(std::chrono::milliseconds(0)) == std::cv_status::no_timeout);
+    TEST_CHECK(ev.get());   // not reset by wait
+    ev.reset();
+    TEST_CHECK(!ev.get());
+    TEST_END;
+  }
+
+
+  void timeout()
+  {
+    TEST_BEGIN("timeout");
+
+    decom::util::event ev;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    TEST_CHECK(ev.wait_for(std::chrono::milliseconds(20)) == std::cv_status::timeout);
+    TEST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+    TEST_END;
+  }
+
+
+  void wakeup()
+  {
+    TEST_BEGIN("wakeup");
+
+    // several parked waiters are released by one set()
+    decom::util::event ev;
+    int data = 0;
+    bool seen[3] = { false, false, false };
+    std::thread t[3];
+    for (int i = 0; i < 3; ++i) {
+      t[i] = std::thread([&ev, &data, &seen, i] {
+        ev.wait();
+        seen[i] = (data == 42);   // set() publishes the data
+      });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    data = 42;
+    ev.set();
+    for (int i = 0; i < 3; ++i) {
+      t[i].join();
+      TEST_CHECK(seen[i]);
+    }
+    TEST_END;
+  }
+
+
+  void ping_pong()
+  {
+    TEST_BEGIN("ping pong");
+
+    // synchronous request/response between two threads
+    decom::util::event req, rsp;
+    const int count = 10000;
+    int served = 0;
+    std::thread t([&] {
+      for (int i = 0; i < count; ++i) {
+        req.wait();
+        req.reset();
+        ++served;
+        rsp.set();
+      }
+    });
+    int answered = 0;
+    for (int i = 0; i < count; ++i) {
+      rsp.reset();
+      req.set();
+      if (rsp.wait_for(std::chrono::seconds(5)) == std::cv_status::no_timeout) {
+        ++answered;
+      }
+    }
+    t.join();
+    TEST_CHECK(served == count);
+    TEST_CHECK(answered == count);
+    TEST_END;
+  }
+};
+
+} // namespace test
+} // namespace decom
+
+#endif // _DECOM_TEST_UTIL_EVENT_H_
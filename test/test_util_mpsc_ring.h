@@ -0,0 +1,156 @@
+#ifndef _DECOM_TEST_UTIL_MPSC_RING_H_
+#define _DECOM_TEST_UTIL_MPSC_RING_H_
+
+#include <thread>
+#include <vector>
+
+#include "../src/msg.h"
+#include "../src/util/mpsc_ring.h"
+#include "test.h"
+
+
+namespace decom {
+namespace test {
+
+class util_mpsc_ring : public test
+{
+  // TEST CASES
+public:
+  util_mpsc_ring(std::ostream& result_file, format_type format)
+    : test("util_mpsc_ring", result_file, format)
+  {
+    generic();
+    full();
+    handle();
+    producers();
+  }
+
+
+protected:
+
+  struct item
+  {
+    item(unsigned p, unsigned v)
+      : producer(p)
+      , value(v)
+    { }
+    unsigned producer;
+    unsigned value;
+  };
+
+
+  void generic()
+  {
+    TEST_BEGIN("generic");
+
+    decom::util::mpsc_ring<item, 8U> r;
+    TEST_CHECK(r.empty());
+    TEST_CHECK(r.capacity() == 8U);
+    TEST_CHECK(r.drain([](item&) { }) == 0U);
+
+    TEST_CHECK(r.push(0U, 1U));
+    TEST_CHECK(r.push(0U, 2U));
+    TEST_CHECK(r.push(0U, 3U));
+    TEST_CHECK(!r.empty());
+
+    unsigned last = 0U;
+    bool order = true;
+    // batch limit
+    TEST_CHECK(r.drain([&](item& i) { order = order && (i.value == last + 1U); last = i.value; }, 2U) == 2U);
+    TEST_CHECK(r.drain([&](item& i) { order = order && (i.value == last + 1U); last = i.value; }) == 1U);
+    TEST_CHECK(order);
+    TEST_CHECK(last == 3U);
+    TEST_CHECK(r.empty());
+    TEST_END;
+  }
+
+
+  void full()
+  {
+    TEST_BEGIN("full");
+
+    decom::util::mpsc_ring<item, 4U> r;
+    // several rounds
+    for (unsigned round = 0U; round < 3U; ++round) {
+      for (unsigned i = 0U; i < 4U; ++i) {
+        TEST_CHECK(r.push(round, i));
+      }
+      TEST_CHECK(!r.push(round, 4U));
+      unsigned sum = 0U;
+      TEST_CHECK(r.drain([&](item& i) { sum += i.value; }) == 4U);
+      TEST_CHECK(sum == 6U);
+    }
+    TEST_END;
+  }
+
+
+  void handle()
+  {
+    TEST_BEGIN("msg handle");
+
+    struct entry {
+      entry(const decom::msg& m) { data.ref_copy(m); }
+      decom::msg data;
+    };
+
+    {
+      decom::util::mpsc_ring<entry, 4U> r;
+      decom::msg m;
+      m.push_back(0x55U);
+      m.push_back(0xAAU);
+      TEST_CHECK(r.push(m));
+      TEST_CHECK(r.push(m));
+      m.clear();      // the queued handles keep the pages
+      std::size_t size = 0U;
+      TEST_CHECK(r.drain([&](entry& e) { size += e.data.size(); }, 1U) == 1U);
+      TEST_CHECK(size == 2U);
+      // the remaining element is freed by the dtor
+    }
+    TEST_END;
+  }
+
+
+  void producers()
+  {
+    TEST_BEGIN("producers");
+
+    static const unsigned PRODUCERS = 4U;
+    static const unsigned COUNT     = 20000U;
+
+    decom::util::mpsc_ring<item, 64U> r;
+    std::vector<std::thread> t;
+    for (unsigned p = 0U; p < PRODUCERS; ++p) {
+      t.push_back(std::thread([&r, p] {
+        for (unsigned v = 0U; v < COUNT; ++v) {
+          while (!r.push(p, v)) {
+            std::this_thread::yield();
+          }
+        }
+      }));
+    }
+
+    // each producer's elements must arrive in order and complete
+    unsigned next[PRODUCERS] = { 0U };
+    unsigned total = 0U;
+    bool order = true;
+    while (total < PRODUCERS * COUNT) {
+      const std::size_t n = r.drain([&](item& i) { order = order && (next[i.producer]++ == i.value); });
+      if (!n) {
+        std::this_thread::yield();
+      }
+      total += static_cast<unsigned>(n);
+    }
+    for (unsigned p = 0U; p < PRODUCERS; ++p) {
+      t[p].join();
+      TEST_CHECK(next[p] == COUNT);
+    }
+    TEST_CHECK(order);
+    TEST_CHECK(r.empty());
+    TEST_END;
+  }
+};
+
+} // namespace test
+} // namespace decom
+
+#endif // _DECOM_TEST_UTIL_MPSC_RING_H_
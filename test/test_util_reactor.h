@@ -0,0 +1,271 @@
+#ifndef _DECOM_TEST_UTIL_REACTOR_H_
+#define _DECOM_TEST_UTIL_REACTOR_H_
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "../src/util/reactor.h"
+#include "../src/com/com_loopback.h"
+#include "../src/dev/dev_generic.h"
+#include "test.h"
+
+
+namespace decom {
+namespace test {
+
+class util_reactor : public test
+{
+  // TEST CASES
+public:
+  util_reactor(std::ostream& result_file, format_type format)
+    : test("util_reactor", result_file, format)
+  {
+    timer();
+    post();
+    remove();
+    loopback();
+  }
+
+
+protected:
+
+  typedef decom::layer::status_type status_type;
+
+  struct context
+  {
+    std::thread::id thread;   // thread which executed the last callback
+    int             count;    // callback counter
+    decom::msg      rx;       // received data
+    std::uint64_t   token;    // completed tx token
+    status_type     status;   // tx status
+    context() : count(0), token(0U), status(decom::layer::tx_error) { }
+  };
+
+  static void count_callback(void* arg)
+  {
+    context* ctx = static_cast<context*>(arg);
+    ctx->thread = std::this_thread::get_id();
+    ctx->count++;
+  }
+
+  static void receive_callback(void* arg, decom::msg& data, decom::eid const&)
+  {
+    context* ctx = static_cast<context*>(arg);
+    ctx->thread = std::this_thread::get_id();
+    ctx->rx.ref_copy(data);
+    ctx->count++;
+  }
+
+  static void tx_callback(void* arg, std::uint64_t token, status_type status)
+  {
+    context* ctx = static_cast<context*>(arg);
+    ctx->token  = token;
+    ctx->status = status;
+  }
+
+  // handler context of a file descriptor
+  struct fd_context
+  {
+    decom::util::reactor* r;
+    int                   other;      // fd which is removed by the handler, -1 if none
+    std::atomic<int>      count;      // handler calls
+    std::atomic<bool>     entered;    // handler is running
+    std::atomic<bool>     done;       // handler returned
+    fd_context(decom::util::reactor* reactor) : r(reactor), other(-1), count(0), entered(false), done(false) { }
+  };
+
+  // removes the other fd by another thread
+  static void remove_other_handler(void* arg, std::uint32_t)
+  {
+    fd_context* ctx = static_cast<fd_context*>(arg);
+    ctx->count++;
+    std::thread th([ctx]() { ctx->r->remove(ctx->other); });
+    th.join();
+  }
+
+  // takes a while, the fd stays readable
+  static void slow_handler(void* arg, std::uint32_t)
+  {
+    fd_context* ctx = static_cast<fd_context*>(arg);
+    ctx->count++;
+    ctx->entered = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ctx->done = true;
+  }
+
+  // run the reactor until the counter reaches the given value or 1s passed
+  static bool run_until(decom::util::reactor& r, context const& ctx, int count)
+  {
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (ctx.count < count && std::chrono::steady_clock::now() < end) {
+      r.run_once(std::chrono::milliseconds(10));
+    }
+    return ctx.count >= count;
+  }
+
+
+  void timer()
+  {
+    TEST_BEGIN("timer");
+
+    decom::util::reactor r;
+    decom::util::reactor::scope s(r);
+
+    // single shot timer expires in the reactor thread
+    context ctx;
+    decom::util::timer t;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    TEST_CHECK(t.start(std::chrono::milliseconds(5), false, &count_callback, &ctx));
+    TEST_CHECK(t.is_running());
+    TEST_CHECK(ctx.count == 0);       // not before the reactor runs
+    TEST_CHECK(run_until(r, ctx, 1));
+    TEST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(5));
+    TEST_CHECK(ctx.thread == std::this_thread::get_id());
+    TEST_CHECK(!t.is_running());
+
+    // periodic timer
+    ctx.count = 0;
+    TEST_CHECK(t.start(std::chrono::milliseconds(2), true, &count_callback, &ctx));
+    TEST_CHECK(run_until(r, ctx, 3));
+    TEST_CHECK(t.is_running());
+    t.stop();
+    const int count = ctx.count;
+    r.run_once(std::chrono::milliseconds(10));
+    TEST_CHECK(ctx.count == count);   // no expiry after stop
+
+    // stopped timer doesn't expire
+    ctx.count = 0;
+    TEST_CHECK(t.start(std::chrono::milliseconds(2), false, &count_callback, &ctx));
+    t.stop();
+    TEST_CHECK(!run_until(r, ctx, 1));
+    TEST_END;
+  }
+
+
+  void post()
+  {
+    TEST_BEGIN("post");
+
+    decom::util::reactor r;
+    context ctx;
+
+    // post from another thread, executed by the reactor thread
+    std::thread th([&]() { r.post(&count_callback, &ctx); });
+    th.join();
+    TEST_CHECK(ctx.count == 0);
+    TEST_CHECK(run_until(r, ctx, 1));
+    TEST_CHECK(ctx.thread == std::this_thread::get_id());
+    TEST_END;
+  }
+
+
+  void remove()
+  {
+    TEST_BEGIN("remove");
+
+    decom::util::reactor r;
+    const std::uint64_t one = 1U;
+
+    // both fds are readable, whichever handler runs first removes the other one by another thread
+    // the pending event of the removed fd must not be dispatched anymore
+    const int fd1 = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+    const int fd2 = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+    fd_context ctx1(&r), ctx2(&r);
+    ctx1.other = fd2;
+    ctx2.other = fd1;
+    TEST_CHECK(r.add(fd1, EPOLLIN, &remove_other_handler, &ctx1));
+    TEST_CHECK(r.add(fd2, EPOLLIN, &remove_other_handler, &ctx2));
+    TEST_CHECK(::write(fd1, &one, sizeof(one)) == sizeof(one));
+    TEST_CHECK(::write(fd2, &one, sizeof(one)) == sizeof(one));
+    TEST_CHECK(r.run_once(std::chrono::milliseconds(100)) == 2);
+    TEST_CHECK(ctx1.count + ctx2.count == 1);
+    r.remove(ctx1.count ? fd1 : fd2);
+    (void)::close(fd1);
+    (void)::close(fd2);
+
+    // remove() by another thread returns after the running handler returned
+    const int fd3 = ::eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+    fd_context ctx3(&r);
+    TEST_CHECK(r.add(fd3, EPOLLIN, &slow_handler, &ctx3));
+    TEST_CHECK(::write(fd3, &one, sizeof(one)) == sizeof(one));
+    bool done_at_remove = false;
+    std::thread th([&]() {
+      while (!ctx3.entered) {
+        std::this_thread::yield();
+      }
+      r.remove(fd3);
+      done_at_remove = ctx3.done;
+    });
+    for (int i = 0; (i < 100) && !ctx3.done; ++i) {
+      (void)r.run_once(std::chrono::milliseconds(10));
+    }
+    th.join();
+    TEST_CHECK(ctx3.done);
+    TEST_CHECK(done_at_remove);
+
+    // the removed fd is readable, but not dispatched anymore
+    (void)r.run_once(std::chrono::milliseconds(10));
+    TEST_CHECK(ctx3.count == 1);
+    (void)::close(fd3);
+    TEST_END;
+  }
+
+
+  void loopback()
+  {
+    TEST_BEGIN("loopback");
+
+    decom::util::reactor r;
+    decom::util::reactor::scope s(r);
+
+    decom::com::loopback loop1;
+    decom::com::loopback loop2;
+    loop1.register_loopback(&loop2);
+    loop2.register_loopback(&loop1);
+    decom::dev::generic dev1(&loop1);
+    decom::dev::generic dev2(&loop2);
+
+    context ctx1, ctx2;
+    dev1.set_receive_callback(&ctx1, &receive_callback);
+    dev2.set_receive_callback(&ctx2, &receive_callback);
+    TEST_CHECK(dev1.open());
+    TEST_CHECK(dev2.open());
+
+    // request, delivered by the reactor thread
+    decom::msg tx1;
+    for (std::size_t i = 0U; i < 200U; ++i) {
+      tx1.push_back(static_cast<std::uint8_t>(i));
+    }
+    const std::uint64_t token = dev1.write_async(tx1, &tx_callback, &ctx1);
+    TEST_CHECK(token != 0U);
+    TEST_CHECK(ctx2.count == 0);      // not before the reactor runs
+    TEST_CHECK(run_until(r, ctx2, 1));
+    TEST_CHECK(ctx2.thread == std::this_thread::get_id());
+    TEST_CHECK(ctx2.rx == tx1);
+    TEST_CHECK(ctx1.token == token);
+    TEST_CHECK(ctx1.status == decom::layer::tx_done);
+
+    // response
+    decom::msg tx2;
+    tx2.push_back(0x55U);
+    tx2.push_back(0xAAU);
+    TEST_CHECK(dev2.write(tx2, decom::eid_any, false, false));
+    TEST_CHECK(run_until(r, ctx1, 1));
+    TEST_CHECK(ctx1.thread == std::this_thread::get_id());
+    TEST_CHECK(ctx1.rx == tx2);
+    TEST_CHECK(ctx2.count == 1);      // no echo
+
+    dev1.close();
+    dev2.close();
+    TEST_END;
+  }
+};
+
+} // namespace test
+} // namespace decom
+
+#endif // _DECOM_TEST_UTIL_REACTOR_H_
@@ -0,0 +1,180 @@
+#ifndef _DECOM_TEST_UTIL_TIMER_WHEEL_H_
+#define _DECOM_TEST_UTIL_TIMER_WHEEL_H_
+
+#include <vector>
+#include <cstdlib>
+
+#include "../src/util/timer_wheel.h"
+#include "test.h"
+
+
+namespace decom {
+namespace test {
+
+class util_timer_wheel : public test
+{
+  // TEST CASES
+public:
+  util_timer_wheel(std::ostream& result_file, format_type format)
+    : test("util_timer_wheel", result_file, format)
+  {
+    generic();
+    remove();
+    cascade();
+    range();
+    random();
+  }
+
+
+protected:
+
+  typedef decom::util::timer_wheel wheel_type;
+
+  struct entry : public wheel_type::node
+  {
+    std::uint64_t deadline;
+  };
+
+
+  void generic()
+  {
+    TEST_BEGIN("generic");
+
+    wheel_type w(1000U);
+    entry e[3];
+    TEST_CHECK(w.empty());
+    TEST_CHECK(w.next_tick() == std::numeric_limits<std::uint64_t>::max());
+    TEST_CHECK(w.expire(2000U) == nullptr);
+    TEST_CHECK(w.now() == 2001U);
+
+    w.add(e[0], 2010U);
+    w.add(e[1], 2005U);
+    w.add(e[2], 1500U);   // already expired
+    TEST_CHECK(w.size() == 3U);
+    TEST_CHECK(e[0].is_linked());
+    TEST_CHECK(w.next_tick() == 2001U);
+
+    TEST_CHECK(w.expire(2001U) == &e[2]);
+    TEST_CHECK(!e[2].is_linked());
+    TEST_CHECK(w.expire(2001U) == nullptr);
+    TEST_CHECK(w.next_tick() == 2005U);
+    TEST_CHECK(w.expire(2004U) == nullptr);
+    TEST_CHECK(w.expire(2020U) == &e[1]);
+    TEST_CHECK(w.expire(2020U) == &e[0]);
+    TEST_CHECK(w.expire(2020U) == nullptr);
+    TEST_CHECK(w.empty());
+    TEST_END;
+  }
+
+
+  void remove()
+  {
+    TEST_BEGIN("remove");
+
+    wheel_type w;
+    entry e[3];
+    w.add(e[0], 10U);
+    w.add(e[1], 10U);
+    w.add(e[2], 100000U);
+    w.remove(e[1]);
+    w.remove(e[1]);   // not linked
+    w.remove(e[2]);
+    TEST_CHECK(w.size() == 1U);
+    TEST_CHECK(w.next_tick() == 10U);
+
+    // re-add moves the node
+    w.add(e[0], 20U);
+    TEST_CHECK(w.size() == 1U);
+    TEST_CHECK(w.next_tick() == 20U);
+    TEST_CHECK(w.expire(19U) == nullptr);
+    TEST_CHECK(w.expire(20U) == &e[0]);
+    TEST_CHECK(w.empty());
+    TEST_END;
+  }
+
+
+  void cascade()
+  {
+    TEST_BEGIN("cascade");
+
+    wheel_type w(5U);
+    entry e;
+    w.add(e, 5U + 100000U);
+    // the driver only needs to wake up for the cascades, not for every slot
+    std::uint64_t tick = 0U;
+    unsigned wakeups = 0U;
+    wheel_type::node* n = nullptr;
+    while (!n) {
+      tick = w.next_tick();
+      n = w.expire(tick);
+      ++wakeups;
+    }
+    TEST_CHECK(n == &e);
+    TEST_CHECK(tick == 100005U);
+    TEST_CHECK(wakeups <= wheel_type::LEVELS);
+    TEST_END;
+  }
+
+
+  void range()
+  {
+    TEST_BEGIN("range");
+
+    // beyond the wheel range
+    const std::uint64_t far = (static_cast<std::uint64_t>(1U) << (wheel_type::SLOT_BITS * wheel_type::LEVELS)) * 3U + 12345U;
+    wheel_type w;
+    entry e;
+    w.add(e, far);
+    wheel_type::node* n = nullptr;
+    std::uint64_t tick = 0U;
+    unsigned wakeups = 0U;
+    while (!n && wakeups < 100U) {
+      tick = w.next_tick();
+      TEST_CHECK(tick <= far);
+      n = w.expire(tick);
+      ++wakeups;
+    }
+    TEST_CHECK(n == &e);
+    TEST_CHECK(tick == far);
+    TEST_END;
+  }
+
+
+  void random()
+  {
+    TEST_BEGIN("random");
+
+    const std::size_t count = 1000U;
+    std::vector<entry> e(count);
+    wheel_type w(77U);
+    std::srand(42);
+    for (std::size_t i = 0U; i < count; ++i) {
+      e[i].deadline = 77U + static_cast<std::uint64_t>(std::rand()) * static_cast<std::uint64_t>(std::rand() % 64 + 1);
+      w.add(e[i], e[i].deadline);
+    }
+    // remove every 7th
+    for (std::size_t i = 0U; i < count; i += 7U) {
+      w.remove(e[i]);
+    }
+
+    // every node must expire exactly at its deadline, in increasing order
+    std::size_t expired = 0U;
+    std::uint64_t last = 0U;
+    while (!w.empty()) {
+      const std::uint64_t tick = w.next_tick();
+      TEST_CHECK(tick >= last);
+      last = tick;
+      for (wheel_type::node* n = w.expire(tick); n; n = w.expire(tick)) {
+        TEST_CHECK(static_cast<entry*>(n)->deadline == tick);
+        ++expired;
+      }
+    }
+    TEST_CHECK(expired == count - (count + 6U) / 7U);
+    TEST_END;
+  }
+};
+
+} // namespace test
+} // namespace decom
+
+#endif // _DECOM_TEST_UTIL_TIMER_WHEEL_H_